@@ -40,6 +40,9 @@
 
 #define AVAHI_CLIENT_DBUS_API_SUPPORTED ((uint32_t) 0x0201)
 
+/* The first API version that can pass TXT data in wire format */
+#define AVAHI_CLIENT_DBUS_API_TXT_DATA ((uint32_t) 0x0204)
+
 static int init_server(AvahiClient *client, int *ret_error);
 
 int avahi_client_set_errno (AvahiClient *client, int error) {
@@ -56,11 +59,17 @@ int avahi_client_set_dbus_error(AvahiClient *client, DBusError *error) {
 }
 
 static void client_set_state(AvahiClient *client, AvahiClientState state) {
+    int was_connected;
+
     assert(client);
 
     if (client->state == state)
         return;
 
+    /* When connecting, the cached strings were fetched together with
+     * the state and are current */
+    was_connected = client->state != (AvahiClientState) -1 && client->state != AVAHI_CLIENT_CONNECTING;
+
     client->state = state;
 
     switch (client->state) {
@@ -80,6 +89,9 @@ static void client_set_state(AvahiClient *client, AvahiClientState state) {
         case AVAHI_CLIENT_S_COLLISION:
         case AVAHI_CLIENT_S_REGISTERING:
 
+            if (!was_connected && state != AVAHI_CLIENT_FAILURE)
+                break;
+
             /* Clear cached strings */
             avahi_free(client->host_name);
             avahi_free(client->host_name_fqdn);
@@ -90,8 +102,23 @@ static void client_set_state(AvahiClient *client, AvahiClientState state) {
             client->domain_name = NULL;
             break;
 
-        case AVAHI_CLIENT_S_RUNNING:
         case AVAHI_CLIENT_CONNECTING:
+
+            /* We might be talking to another daemon once we are
+             * connected again, so don't keep anything the old one told
+             * us */
+            avahi_free(client->version_string);
+            avahi_free(client->host_name);
+            avahi_free(client->host_name_fqdn);
+            avahi_free(client->domain_name);
+
+            client->version_string = NULL;
+            client->host_name =  NULL;
+            client->host_name_fqdn = NULL;
+            client->domain_name = NULL;
+            break;
+
+        case AVAHI_CLIENT_S_RUNNING:
             break;
 
     }
@@ -252,7 +279,8 @@ static DBusHandlerResult filter_func(DBusConnection *bus, DBusMessage *message,
     else if (dbus_message_is_signal(message, AVAHI_DBUS_INTERFACE_SERVICE_BROWSER, "Failure"))
         return avahi_service_browser_event (client, AVAHI_BROWSER_FAILURE, message);
 
-    else if (dbus_message_is_signal(message, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER, "Found"))
+    else if (dbus_message_is_signal(message, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER, "Found") ||
+             dbus_message_is_signal(message, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER, "FoundTxtData"))
         return avahi_service_resolver_event (client, AVAHI_RESOLVER_FOUND, message);
     else if (dbus_message_is_signal(message, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER, "Failure"))
         return avahi_service_resolver_event (client, AVAHI_RESOLVER_FAILURE, message);
@@ -348,6 +376,12 @@ fail:
     return e;
 }
 
+static int version_supported(uint32_t version) {
+    return
+        (version & 0xFF00) == (AVAHI_CLIENT_DBUS_API_SUPPORTED & 0xFF00) &&
+        (version & 0x00FF) >= (AVAHI_CLIENT_DBUS_API_SUPPORTED & 0x00FF);
+}
+
 static int check_version(AvahiClient *client, int *ret_error) {
     DBusMessage *message = NULL, *reply  = NULL;
     DBusError error;
@@ -400,12 +434,108 @@ static int check_version(AvahiClient *client, int *ret_error) {
 
     /*fprintf(stderr, "API Version 0x%04x\n", version);*/
 
-    if ((version & 0xFF00) != (AVAHI_CLIENT_DBUS_API_SUPPORTED & 0xFF00) ||
-        (version & 0x00FF) < (AVAHI_CLIENT_DBUS_API_SUPPORTED & 0x00FF)) {
+    if (!version_supported(version)) {
+        e = AVAHI_ERR_VERSION_MISMATCH;
+        goto fail;
+    }
+
+    client->api_version = version;
+
+    dbus_message_unref(message);
+    dbus_message_unref(reply);
+
+    return AVAHI_OK;
+
+fail:
+    if (dbus_error_is_set(&error)) {
+        e = avahi_error_dbus_to_number (error.name);
+        dbus_error_free(&error);
+    }
+
+    if (ret_error)
+        *ret_error = e;
+
+    if (message)
+        dbus_message_unref(message);
+    if (reply)
+        dbus_message_unref(reply);
+
+    return e;
+}
+
+static void cache_string(char **cached, const char *s) {
+    assert(cached);
+
+    /* Strings handed out before stay valid */
+    if (!*cached && s)
+        *cached = avahi_strdup(s);
+}
+
+/* Fetches the API version, the state and the cached strings with a
+ * single call. Returns AVAHI_ERR_NOT_SUPPORTED without touching
+ * *ret_error if the server doesn't implement GetServerInfo, so that
+ * the caller can fall back to the individual calls. */
+static int get_server_info(AvahiClient *client, AvahiClientState *ret_state, int *ret_error) {
+    DBusMessage *message = NULL, *reply = NULL;
+    DBusError error;
+    uint32_t version, cookie;
+    int32_t state;
+    char *version_str, *host_name, *host_name_fqdn, *domain_name;
+    int e = AVAHI_ERR_NO_MEMORY;
+
+    assert(client);
+
+    dbus_error_init(&error);
+
+    if (!(message = dbus_message_new_method_call(AVAHI_DBUS_NAME, AVAHI_DBUS_PATH_SERVER, AVAHI_DBUS_INTERFACE_SERVER, "GetServerInfo")))
+        goto fail;
+
+    reply = dbus_connection_send_with_reply_and_block (client->bus, message, -1, &error);
+
+    if (!reply || dbus_error_is_set (&error)) {
+
+        if (dbus_error_is_set(&error) && !strcmp(error.name, DBUS_ERROR_UNKNOWN_METHOD)) {
+            dbus_error_free(&error);
+            client->have_server_info = 0;
+            e = AVAHI_ERR_NOT_SUPPORTED;
+            goto finish;
+        }
+
+        goto fail;
+    }
+
+    if (!dbus_message_get_args(
+            reply, &error,
+            DBUS_TYPE_UINT32, &version,
+            DBUS_TYPE_STRING, &version_str,
+            DBUS_TYPE_STRING, &host_name,
+            DBUS_TYPE_STRING, &host_name_fqdn,
+            DBUS_TYPE_STRING, &domain_name,
+            DBUS_TYPE_INT32, &state,
+            DBUS_TYPE_UINT32, &cookie,
+            DBUS_TYPE_INVALID) ||
+        dbus_error_is_set (&error))
+        goto fail;
+
+    if (!version_supported(version)) {
         e = AVAHI_ERR_VERSION_MISMATCH;
         goto fail;
     }
 
+    client->have_server_info = 1;
+    client->api_version = version;
+
+    cache_string(&client->version_string, version_str);
+    cache_string(&client->host_name, host_name);
+    cache_string(&client->host_name_fqdn, host_name_fqdn);
+    cache_string(&client->domain_name, domain_name);
+
+    client->local_service_cookie = cookie;
+    client->local_service_cookie_valid = 1;
+
+    if (ret_state)
+        *ret_state = (AvahiClientState) state;
+
     dbus_message_unref(message);
     dbus_message_unref(reply);
 
@@ -420,6 +550,7 @@ fail:
     if (ret_error)
         *ret_error = e;
 
+finish:
     if (message)
         dbus_message_unref(message);
     if (reply)
@@ -428,9 +559,31 @@ fail:
     return e;
 }
 
+/* Refills the cache in one round trip, if the server allows it */
+static void update_server_info(AvahiClient *client) {
+    int e = AVAHI_OK;
+
+    assert(client);
+
+    if (!client->have_server_info)
+        return;
+
+    if (get_server_info(client, NULL, &e) < 0 && e != AVAHI_OK)
+        avahi_client_set_errno(client, e);
+}
+
 static int init_server(AvahiClient *client, int *ret_error) {
+    AvahiClientState state;
     int r;
 
+    if ((r = get_server_info(client, &state, ret_error)) >= 0) {
+        client_set_state(client, state);
+        return AVAHI_OK;
+    }
+
+    if (r != AVAHI_ERR_NOT_SUPPORTED)
+        return r;
+
     if ((r = check_version(client, ret_error)) < 0)
         return r;
 
@@ -502,6 +655,8 @@ AvahiClient *avahi_client_new(const AvahiPoll *poll_api, AvahiClientFlags flags,
     client->domain_name = NULL;
     client->version_string = NULL;
     client->local_service_cookie_valid = 0;
+    client->have_server_info = 0;
+    client->api_version = 0;
 
     AVAHI_LLIST_HEAD_INIT(AvahiEntryGroup, client->groups);
     AVAHI_LLIST_HEAD_INIT(AvahiDomainBrowser, client->domain_browsers);
@@ -733,6 +888,9 @@ const char* avahi_client_get_version_string(AvahiClient *client) {
         return NULL;
     }
 
+    if (!client->version_string)
+        update_server_info(client);
+
     if (!client->version_string)
         client->version_string = avahi_client_get_string_reply_and_block(client, "GetVersionString", NULL);
 
@@ -747,6 +905,9 @@ const char* avahi_client_get_domain_name(AvahiClient *client) {
         return NULL;
     }
 
+    if (!client->domain_name)
+        update_server_info(client);
+
     if (!client->domain_name)
         client->domain_name = avahi_client_get_string_reply_and_block(client, "GetDomainName", NULL);
 
@@ -761,6 +922,9 @@ const char* avahi_client_get_host_name(AvahiClient *client) {
         return NULL;
     }
 
+    if (!client->host_name)
+        update_server_info(client);
+
     if (!client->host_name)
         client->host_name = avahi_client_get_string_reply_and_block(client, "GetHostName", NULL);
 
@@ -775,6 +939,9 @@ const char* avahi_client_get_host_name_fqdn (AvahiClient *client) {
         return NULL;
     }
 
+    if (!client->host_name_fqdn)
+        update_server_info(client);
+
     if (!client->host_name_fqdn)
         client->host_name_fqdn = avahi_client_get_string_reply_and_block(client, "GetHostNameFqdn", NULL);
 
@@ -853,6 +1020,9 @@ uint32_t avahi_client_get_local_service_cookie(AvahiClient *client) {
         return AVAHI_SERVICE_COOKIE_INVALID;
     }
 
+    if (!client->local_service_cookie_valid)
+        update_server_info(client);
+
     if (client->local_service_cookie_valid)
         return client->local_service_cookie;
 
@@ -902,6 +1072,13 @@ int avahi_client_is_connected(AvahiClient *client) {
         (client->state == AVAHI_CLIENT_S_RUNNING || client->state == AVAHI_CLIENT_S_REGISTERING || client->state == AVAHI_CLIENT_S_COLLISION);
 }
 
+int avahi_client_has_txt_data(AvahiClient *client) {
+    assert(client);
+
+    return (client->api_version & 0xFF00) == (AVAHI_CLIENT_DBUS_API_TXT_DATA & 0xFF00) &&
+        (client->api_version & 0x00FF) >= (AVAHI_CLIENT_DBUS_API_TXT_DATA & 0x00FF);
+}
+
 int avahi_client_set_host_name(AvahiClient* client, const char *name) {
     DBusMessage *message = NULL, *reply = NULL;
     DBusError error;
@@ -399,6 +399,48 @@ fail:
     return r;
 }
 
+/* Passes the TXT data in wire format as a single byte array, for
+ * servers that support it */
+static int append_txt_data(DBusMessage *message, AvahiStringList *txt) {
+    uint8_t buf[1024], *data = buf;
+    size_t size;
+    int r;
+
+    assert(message);
+
+    if ((size = avahi_string_list_serialize(txt, NULL, 0)) > sizeof(buf))
+        if (!(data = avahi_malloc(size)))
+            return -1;
+
+    size = avahi_string_list_serialize(txt, data, size);
+
+    r = dbus_message_append_args(
+        message,
+        DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &data, (int) size,
+        DBUS_TYPE_INVALID) ? 0 : -1;
+
+    if (data != buf)
+        avahi_free(data);
+
+    return r;
+}
+
+/* The wire format can't carry empty items or items longer than 255
+ * bytes. String lists containing those are passed the old way, so
+ * that the server rejects them no matter which version it is. */
+static int use_txt_data(AvahiClient *client, AvahiStringList *txt) {
+    assert(client);
+
+    if (!avahi_client_has_txt_data(client))
+        return 0;
+
+    for (; txt; txt = txt->next)
+        if (txt->size <= 0 || txt->size > 255)
+            return 0;
+
+    return 1;
+}
+
 int avahi_entry_group_add_service_strlst(
     AvahiEntryGroup *group,
     AvahiIfIndex interface,
@@ -417,12 +459,14 @@ int avahi_entry_group_add_service_strlst(
     AvahiClient *client;
     int32_t i_interface, i_protocol;
     uint32_t u_flags;
+    int txt_data;
 
     assert(group);
     assert(name);
     assert(type);
 
     client = group->client;
+    txt_data = use_txt_data(client, txt);
 
     if (!group->path || !avahi_client_is_connected(group->client))
         return avahi_client_set_errno(group->client, AVAHI_ERR_BAD_STATE);
@@ -435,7 +479,8 @@ int avahi_entry_group_add_service_strlst(
 
     dbus_error_init(&error);
 
-    if (!(message = dbus_message_new_method_call (AVAHI_DBUS_NAME, group->path, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "AddService"))) {
+    if (!(message = dbus_message_new_method_call (AVAHI_DBUS_NAME, group->path, AVAHI_DBUS_INTERFACE_ENTRY_GROUP,
+                                                  txt_data ? "AddServiceTxtData" : "AddService"))) {
         r = avahi_client_set_errno(client, AVAHI_ERR_NO_MEMORY);
         goto fail;
     }
@@ -455,7 +500,7 @@ int avahi_entry_group_add_service_strlst(
             DBUS_TYPE_STRING, &host,
             DBUS_TYPE_UINT16, &port,
             DBUS_TYPE_INVALID) ||
-        append_string_list(message, txt) < 0) {
+        (txt_data ? append_txt_data(message, txt) : append_string_list(message, txt)) < 0) {
         r = avahi_client_set_errno(group->client, AVAHI_ERR_NO_MEMORY);
         goto fail;
     }
@@ -646,12 +691,14 @@ int avahi_entry_group_update_service_txt_strlst(
     AvahiClient *client;
     int32_t i_interface, i_protocol;
     uint32_t u_flags;
+    int txt_data;
 
     assert(group);
     assert(name);
     assert(type);
 
     client = group->client;
+    txt_data = use_txt_data(client, txt);
 
     if (!group->path || !avahi_client_is_connected(group->client))
         return avahi_client_set_errno(group->client, AVAHI_ERR_BAD_STATE);
@@ -661,7 +708,8 @@ int avahi_entry_group_update_service_txt_strlst(
 
     dbus_error_init(&error);
 
-    if (!(message = dbus_message_new_method_call (AVAHI_DBUS_NAME, group->path, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "UpdateServiceTxt"))) {
+    if (!(message = dbus_message_new_method_call (AVAHI_DBUS_NAME, group->path, AVAHI_DBUS_INTERFACE_ENTRY_GROUP,
+                                                  txt_data ? "UpdateServiceTxtData" : "UpdateServiceTxt"))) {
         r = avahi_client_set_errno(client, AVAHI_ERR_NO_MEMORY);
         goto fail;
     }
@@ -679,7 +727,7 @@ int avahi_entry_group_update_service_txt_strlst(
             DBUS_TYPE_STRING, &type,
             DBUS_TYPE_STRING, &domain,
             DBUS_TYPE_INVALID) ||
-        append_string_list(message, txt) < 0) {
+        (txt_data ? append_txt_data(message, txt) : append_string_list(message, txt)) < 0) {
         r = avahi_client_set_errno(group->client, AVAHI_ERR_NO_MEMORY);
         goto fail;
     }
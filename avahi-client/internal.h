@@ -38,6 +38,12 @@ struct AvahiClient {
     uint32_t local_service_cookie;
     int local_service_cookie_valid;
 
+    /* Nonzero if the server can send all of the above with GetServerInfo */
+    int have_server_info;
+
+    /* D-Bus API version of the server */
+    uint32_t api_version;
+
     AvahiClientCallback callback;
     void *userdata;
 
@@ -169,4 +175,6 @@ int avahi_client_simple_method_call(AvahiClient *client, const char *path, const
 
 int avahi_client_is_connected(AvahiClient *client);
 
+int avahi_client_has_txt_data(AvahiClient *client);
+
 #endif
@@ -93,7 +93,8 @@ DBusHandlerResult avahi_service_resolver_event (AvahiClient *client, AvahiResolv
                 dbus_message_iter_next(&iter);
 
             if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
-                dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_ARRAY) {
+                (dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_ARRAY &&
+                 dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_BYTE)) {
                 fprintf(stderr, "Error parsing service resolving message\n");
                 goto fail;
             }
@@ -101,7 +102,22 @@ DBusHandlerResult avahi_service_resolver_event (AvahiClient *client, AvahiResolv
             strlst = NULL;
             dbus_message_iter_recurse(&iter, &sub);
 
-            for (;;) {
+            if (dbus_message_iter_get_element_type(&iter) == DBUS_TYPE_BYTE) {
+                const uint8_t *k = NULL;
+                int n = 0;
+
+                /* FoundTxtData passes the TXT data in wire format,
+                 * parse it right out of the message buffer. The
+                 * callback takes a string list, so this can't be
+                 * deferred. Like below, empty items are skipped. */
+                dbus_message_iter_get_fixed_array(&sub, &k, &n);
+
+                if (k && n > 0 && avahi_string_list_parse(k, (size_t) n, &strlst) < 0) {
+                    fprintf(stderr, "Error parsing service resolving message\n");
+                    goto fail;
+                }
+
+            } else for (;;) {
                 DBusMessageIter sub2;
                 int at;
                 const uint8_t *k;
@@ -244,7 +260,8 @@ AvahiServiceResolver * avahi_service_resolver_new(
         }
 
 
-    if (!(message = dbus_message_new_method_call(AVAHI_DBUS_NAME, AVAHI_DBUS_PATH_SERVER, AVAHI_DBUS_INTERFACE_SERVER, "ServiceResolverNew"))) {
+    if (!(message = dbus_message_new_method_call(AVAHI_DBUS_NAME, AVAHI_DBUS_PATH_SERVER, AVAHI_DBUS_INTERFACE_SERVER,
+                                                 avahi_client_has_txt_data(client) ? "ServiceResolverNewTxtData" : "ServiceResolverNew"))) {
         avahi_client_set_errno(client, AVAHI_ERR_NO_MEMORY);
         goto fail;
     }
@@ -0,0 +1,187 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include <avahi-client/snapshot.h>
+#include <avahi-common/cache-snapshot-format.h>
+#include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/gccmacro.h>
+
+static uint8_t data[4096];
+static size_t data_size = 0;
+static uint32_t n_records = 0;
+
+static void add_record(const char *name, uint16_t type, const void *rdata, size_t rdata_size) {
+    AvahiCacheSnapshotEntry *e;
+    size_t name_size = strlen(name) + 1, l;
+
+    l = AVAHI_CACHE_SNAPSHOT_ENTRY_SIZE(name_size, rdata_size);
+    assert(data_size + l <= sizeof(data));
+
+    e = (AvahiCacheSnapshotEntry*) (data + data_size);
+    memset(e, 0, l);
+    e->interface = 2;
+    e->protocol = AVAHI_PROTO_INET;
+    e->ttl = 120;
+    e->clazz = AVAHI_DNS_CLASS_IN;
+    e->type = type;
+    e->name_size = (uint16_t) name_size;
+    e->rdata_size = (uint16_t) rdata_size;
+    memcpy(e + 1, name, name_size);
+    memcpy((uint8_t*) (e + 1) + name_size, rdata, rdata_size);
+
+    data_size += l;
+    n_records++;
+}
+
+static void write_snapshot(const char *fn) {
+    AvahiCacheSnapshotHeader h;
+    FILE *f;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = AVAHI_CACHE_SNAPSHOT_MAGIC;
+    h.version = AVAHI_CACHE_SNAPSHOT_VERSION;
+    h.n_records = n_records;
+    h.size = data_size;
+    h.timestamp = (int64_t) time(NULL);
+
+    f = fopen(fn, "w");
+    assert(f);
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(data, data_size, 1, f);
+    fclose(f);
+}
+
+static int n_services = 0, n_types = 0, n_resolved = 0;
+
+static void service_callback(
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    AVAHI_GCC_UNUSED void *userdata) {
+
+    printf("service: %i %i '%s' %s %s\n", interface, protocol, name ? name : "n/a", type, domain);
+
+    assert(strcmp(type, "_http._tcp") == 0);
+    assert(strcmp(domain, "local") == 0);
+
+    if (name) {
+        assert(strcmp(name, "Web Server") == 0);
+        n_services++;
+    } else
+        n_types++;
+}
+
+static void resolve_callback(
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    const char *host_name,
+    const AvahiAddress *a,
+    uint16_t port,
+    AvahiStringList *txt,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    AVAHI_GCC_UNUSED void *userdata) {
+
+    char address[AVAHI_ADDRESS_STR_MAX], *t;
+
+    avahi_address_snprint(address, sizeof(address), a);
+    t = avahi_string_list_to_string(txt);
+
+    printf("resolved: %i %i '%s' %s %s %s %s %u %s\n", interface, protocol, name, type, domain, host_name, address, port, t);
+
+    assert(strcmp(host_name, "host.local") == 0);
+    assert(strcmp(address, "192.168.50.1") == 0);
+    assert(port == 80);
+    assert(strcmp(t, "\"path=/\"") == 0);
+
+    avahi_free(t);
+    n_resolved++;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    static const uint8_t services_ptr[] = "\x05_http\x04_tcp\x05local";
+    static const uint8_t http_ptr[] = "\x0aWeb Server\x05_http\x04_tcp\x05local";
+    static const uint8_t srv[] = "\0\0\0\0\0\x50\x04host\x05local";
+    static const uint8_t txt[] = "\x06path=/";
+    static const uint8_t a[] = { 192, 168, 50, 1 };
+    char fn[] = "/tmp/avahi-snapshot-test-XXXXXX";
+    AvahiCacheSnapshot *s;
+    int fd, error;
+
+    add_record("_services._dns-sd._udp.local", AVAHI_DNS_TYPE_PTR, services_ptr, sizeof(services_ptr));
+    add_record("_http._tcp.local", AVAHI_DNS_TYPE_PTR, http_ptr, sizeof(http_ptr));
+    add_record("Web Server._http._tcp.local", AVAHI_DNS_TYPE_SRV, srv, sizeof(srv));
+    add_record("Web Server._http._tcp.local", AVAHI_DNS_TYPE_TXT, txt, sizeof(txt)-1);
+    add_record("host.local", AVAHI_DNS_TYPE_A, a, sizeof(a));
+
+    fd = mkstemp(fn);
+    assert(fd >= 0);
+    close(fd);
+
+    write_snapshot(fn);
+
+    if (!(s = avahi_cache_snapshot_new(fn, &error))) {
+        fprintf(stderr, "Failed to open snapshot: %s\n", avahi_strerror(error));
+        unlink(fn);
+        return 1;
+    }
+
+    avahi_cache_snapshot_foreach_service(s, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, NULL, NULL, service_callback, NULL);
+    avahi_cache_snapshot_foreach_service(s, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "_http._tcp", NULL, service_callback, NULL);
+    assert(n_types == 1);
+    assert(n_services == 1);
+
+    error = avahi_cache_snapshot_resolve_service(s, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "Web Server", "_http._tcp", NULL, AVAHI_PROTO_UNSPEC, resolve_callback, NULL);
+    assert(error == AVAHI_OK);
+    assert(n_resolved == 1);
+
+    error = avahi_cache_snapshot_resolve_service(s, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "Other Server", "_http._tcp", NULL, AVAHI_PROTO_UNSPEC, resolve_callback, NULL);
+    assert(error == AVAHI_ERR_NOT_FOUND);
+
+    /* Interface filter */
+    n_services = 0;
+    avahi_cache_snapshot_foreach_service(s, 3, AVAHI_PROTO_UNSPEC, "_http._tcp", NULL, service_callback, NULL);
+    assert(n_services == 0);
+
+    assert(avahi_cache_snapshot_refresh(s) == AVAHI_OK);
+
+    unlink(fn);
+    assert(avahi_cache_snapshot_refresh(s) == AVAHI_ERR_NO_DAEMON);
+
+    avahi_cache_snapshot_free(s);
+
+    return 0;
+}
@@ -0,0 +1,565 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/error.h>
+#include <avahi-common/domain.h>
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/cache-snapshot-format.h>
+
+#include "snapshot.h"
+
+/* How often we retry if the daemon is writing to the snapshot while
+ * we copy it */
+#define SNAPSHOT_TRIES_MAX 100
+
+struct AvahiCacheSnapshot {
+    char *path;
+
+    int fd;
+    dev_t dev;
+    ino_t ino;
+
+    uint8_t *map;
+    size_t map_size;
+
+    /* Our private copy of the record area */
+    uint8_t *data;
+    size_t size, allocated;
+    uint32_t n_records;
+    time_t timestamp;
+};
+
+typedef void (*EntryCallback)(AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, const char *name, const uint8_t *rdata, uint32_t ttl, void *userdata);
+
+static void close_file(AvahiCacheSnapshot *s) {
+    assert(s);
+
+    if (s->map) {
+        munmap(s->map, s->map_size);
+        s->map = NULL;
+        s->map_size = 0;
+    }
+
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static int map_file(AvahiCacheSnapshot *s) {
+    struct stat st;
+    uint8_t *m;
+
+    assert(s);
+    assert(s->fd >= 0);
+
+    if (fstat(s->fd, &st) < 0)
+        return AVAHI_ERR_FAILURE;
+
+    /* The daemon is still setting the file up */
+    if ((size_t) st.st_size < sizeof(AvahiCacheSnapshotHeader))
+        return AVAHI_ERR_NO_DAEMON;
+
+    if ((size_t) st.st_size == s->map_size)
+        return 0;
+
+    if ((m = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, s->fd, 0)) == MAP_FAILED)
+        return AVAHI_ERR_FAILURE;
+
+    if (s->map)
+        munmap(s->map, s->map_size);
+
+    s->map = m;
+    s->map_size = (size_t) st.st_size;
+
+    return 0;
+}
+
+static int open_file(AvahiCacheSnapshot *s) {
+    struct stat st;
+
+    assert(s);
+    assert(s->fd < 0);
+
+    if ((s->fd = open(s->path, O_RDONLY|O_CLOEXEC)) < 0)
+        return errno == ENOENT ? AVAHI_ERR_NO_DAEMON : AVAHI_ERR_ACCESS_DENIED;
+
+    if (fstat(s->fd, &st) < 0) {
+        close_file(s);
+        return AVAHI_ERR_FAILURE;
+    }
+
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+
+    return 0;
+}
+
+static int take_copy(AvahiCacheSnapshot *s) {
+    unsigned n;
+
+    assert(s);
+
+    for (n = 0; n < SNAPSHOT_TRIES_MAX; n++) {
+        const volatile AvahiCacheSnapshotHeader *h;
+        uint32_t sequence, n_records;
+        uint64_t size;
+        int64_t timestamp;
+        int r;
+
+        if ((r = map_file(s)) < 0)
+            return r;
+
+        h = (const volatile AvahiCacheSnapshotHeader*) s->map;
+
+        if (h->magic != AVAHI_CACHE_SNAPSHOT_MAGIC)
+            return AVAHI_ERR_NO_DAEMON;
+
+        if (h->version != AVAHI_CACHE_SNAPSHOT_VERSION)
+            return AVAHI_ERR_VERSION_MISMATCH;
+
+        sequence = h->sequence;
+        __sync_synchronize();
+
+        if (sequence & 1) {
+            /* The daemon is updating the snapshot right now */
+            sched_yield();
+            continue;
+        }
+
+        size = h->size;
+        n_records = h->n_records;
+        timestamp = h->timestamp;
+
+        /* The file has been grown since we mapped it */
+        if (size > s->map_size - sizeof(AvahiCacheSnapshotHeader))
+            continue;
+
+        if (size > s->allocated) {
+            uint8_t *d;
+
+            if (!(d = avahi_realloc(s->data, (size_t) size)))
+                return AVAHI_ERR_NO_MEMORY;
+
+            s->data = d;
+            s->allocated = (size_t) size;
+        }
+
+        memcpy(s->data, s->map + sizeof(AvahiCacheSnapshotHeader), (size_t) size);
+
+        __sync_synchronize();
+
+        if (h->sequence != sequence)
+            continue;
+
+        s->size = (size_t) size;
+        s->n_records = n_records;
+        s->timestamp = (time_t) timestamp;
+
+        return 0;
+    }
+
+    return AVAHI_ERR_TIMEOUT;
+}
+
+AvahiCacheSnapshot *avahi_cache_snapshot_new(const char *path, int *error) {
+    AvahiCacheSnapshot *s;
+    int r;
+
+    if (!(s = avahi_new0(AvahiCacheSnapshot, 1))) {
+        r = AVAHI_ERR_NO_MEMORY;
+        goto fail;
+    }
+
+    s->fd = -1;
+
+    if (!(s->path = avahi_strdup(path ? path : AVAHI_CACHE_SNAPSHOT))) {
+        r = AVAHI_ERR_NO_MEMORY;
+        goto fail;
+    }
+
+    if ((r = open_file(s)) < 0)
+        goto fail;
+
+    if ((r = take_copy(s)) < 0)
+        goto fail;
+
+    return s;
+
+fail:
+
+    if (error)
+        *error = r;
+
+    if (s)
+        avahi_cache_snapshot_free(s);
+
+    return NULL;
+}
+
+void avahi_cache_snapshot_free(AvahiCacheSnapshot *s) {
+    assert(s);
+
+    close_file(s);
+
+    avahi_free(s->data);
+    avahi_free(s->path);
+    avahi_free(s);
+}
+
+int avahi_cache_snapshot_refresh(AvahiCacheSnapshot *s) {
+    struct stat st;
+    int r;
+
+    assert(s);
+
+    if (stat(s->path, &st) < 0)
+        return AVAHI_ERR_NO_DAEMON;
+
+    /* The daemon has been restarted and created a new file */
+    if (st.st_dev != s->dev || st.st_ino != s->ino) {
+        close_file(s);
+
+        if ((r = open_file(s)) < 0)
+            return r;
+    }
+
+    return take_copy(s);
+}
+
+static void walk(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    uint16_t clazz,
+    uint16_t type,
+    EntryCallback callback,
+    void *userdata) {
+
+    size_t offset = 0;
+    uint32_t i;
+    int64_t age;
+
+    assert(s);
+    assert(callback);
+
+    if ((age = (int64_t) (time(NULL) - s->timestamp)) < 0)
+        age = 0;
+
+    for (i = 0; i < s->n_records; i++) {
+        const AvahiCacheSnapshotEntry *e;
+        const char *n;
+        size_t l;
+
+        if (offset + sizeof(AvahiCacheSnapshotEntry) > s->size)
+            break;
+
+        e = (const AvahiCacheSnapshotEntry*) (s->data + offset);
+        l = AVAHI_CACHE_SNAPSHOT_ENTRY_SIZE(e->name_size, e->rdata_size);
+
+        if (offset + l > s->size || e->name_size < 1)
+            break;
+
+        n = (const char*) (e + 1);
+
+        if (n[e->name_size-1] != 0)
+            break;
+
+        offset += l;
+
+        if ((interface != AVAHI_IF_UNSPEC && e->interface != interface) ||
+            (protocol != AVAHI_PROTO_UNSPEC && e->protocol != protocol) ||
+            (clazz && e->clazz != clazz) ||
+            (type && e->type != type))
+            continue;
+
+        if ((int64_t) e->ttl <= age)
+            continue;
+
+        if (name && !avahi_domain_equal(name, n))
+            continue;
+
+        callback(s, e, n, (const uint8_t*) n + e->name_size, e->ttl - (uint32_t) age, userdata);
+    }
+}
+
+/* Records are serialized without name compression, hence this is much
+ * simpler than the parser in avahi-core */
+static int parse_name(const uint8_t *rdata, size_t size, size_t *offset, char *ret_name, size_t l) {
+    size_t idx;
+    int first_label = 1;
+
+    assert(rdata);
+    assert(offset);
+    assert(ret_name);
+    assert(l > 0);
+
+    for (idx = *offset; idx < size;) {
+        uint8_t n = rdata[idx++];
+
+        if (!n) {
+            *ret_name = 0;
+            *offset = idx;
+            return 0;
+        }
+
+        if (n > 63 || idx + n > size || (size_t) n + 1 > l)
+            return -1;
+
+        if (!first_label) {
+            *(ret_name++) = '.';
+            l--;
+        } else
+            first_label = 0;
+
+        if (!(avahi_escape_label((const char*) rdata + idx, n, &ret_name, &l)))
+            return -1;
+
+        idx += n;
+    }
+
+    return -1;
+}
+
+typedef struct RecordData {
+    AvahiCacheSnapshotRecordCallback callback;
+    void *userdata;
+} RecordData;
+
+static void record_callback(AVAHI_GCC_UNUSED AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, const char *name, const uint8_t *rdata, uint32_t ttl, void *userdata) {
+    RecordData *d = userdata;
+
+    d->callback(e->interface, e->protocol, name, e->clazz, e->type, rdata, e->rdata_size, ttl, (AvahiLookupResultFlags) e->flags, d->userdata);
+}
+
+int avahi_cache_snapshot_foreach_record(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    uint16_t clazz,
+    uint16_t type,
+    AvahiCacheSnapshotRecordCallback callback,
+    void *userdata) {
+
+    RecordData d;
+
+    assert(s);
+    assert(callback);
+
+    if (name && !avahi_is_valid_domain_name(name))
+        return AVAHI_ERR_INVALID_DOMAIN_NAME;
+
+    d.callback = callback;
+    d.userdata = userdata;
+
+    walk(s, interface, protocol, name, clazz, type, record_callback, &d);
+
+    return AVAHI_OK;
+}
+
+typedef struct ServiceData {
+    int types;
+    AvahiCacheSnapshotServiceCallback callback;
+    void *userdata;
+} ServiceData;
+
+static void service_callback(AVAHI_GCC_UNUSED AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, AVAHI_GCC_UNUSED const char *name, const uint8_t *rdata, AVAHI_GCC_UNUSED uint32_t ttl, void *userdata) {
+    ServiceData *d = userdata;
+    char ptr[AVAHI_DOMAIN_NAME_MAX], n[AVAHI_LABEL_MAX], t[AVAHI_DOMAIN_NAME_MAX], domain[AVAHI_DOMAIN_NAME_MAX];
+    size_t offset = 0;
+
+    if (parse_name(rdata, e->rdata_size, &offset, ptr, sizeof(ptr)) < 0)
+        return;
+
+    if (avahi_service_name_split(ptr, d->types ? NULL : n, sizeof(n), t, sizeof(t), domain, sizeof(domain)) < 0)
+        return;
+
+    if (!*t || !*domain)
+        return;
+
+    d->callback(e->interface, e->protocol, d->types ? NULL : n, t, domain, (AvahiLookupResultFlags) e->flags, d->userdata);
+}
+
+int avahi_cache_snapshot_foreach_service(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *type,
+    const char *domain,
+    AvahiCacheSnapshotServiceCallback callback,
+    void *userdata) {
+
+    char n[AVAHI_DOMAIN_NAME_MAX];
+    ServiceData d;
+    int r;
+
+    assert(s);
+    assert(callback);
+
+    if (!domain)
+        domain = "local";
+
+    if (type) {
+        if (!avahi_is_valid_service_type_generic(type))
+            return AVAHI_ERR_INVALID_SERVICE_TYPE;
+
+        if ((r = avahi_service_name_join(n, sizeof(n), NULL, type, domain)) < 0)
+            return r;
+    } else {
+        if ((r = avahi_service_name_join(n, sizeof(n), NULL, "_services._dns-sd._udp", domain)) < 0)
+            return r;
+    }
+
+    d.types = !type;
+    d.callback = callback;
+    d.userdata = userdata;
+
+    walk(s, interface, protocol, n, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, service_callback, &d);
+
+    return AVAHI_OK;
+}
+
+typedef struct ResolveData {
+    int found;
+    AvahiIfIndex interface;
+    AvahiProtocol protocol;
+    AvahiLookupResultFlags flags;
+
+    uint16_t port;
+    char host_name[AVAHI_DOMAIN_NAME_MAX];
+    AvahiStringList *txt;
+    int have_txt;
+    AvahiAddress address;
+} ResolveData;
+
+static void srv_callback(AVAHI_GCC_UNUSED AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, AVAHI_GCC_UNUSED const char *name, const uint8_t *rdata, AVAHI_GCC_UNUSED uint32_t ttl, void *userdata) {
+    ResolveData *d = userdata;
+    size_t offset = 6;
+
+    if (d->found || e->rdata_size < 7)
+        return;
+
+    if (parse_name(rdata, e->rdata_size, &offset, d->host_name, sizeof(d->host_name)) < 0)
+        return;
+
+    d->port = (uint16_t) ((rdata[4] << 8) | rdata[5]);
+    d->interface = e->interface;
+    d->protocol = e->protocol;
+    d->flags = (AvahiLookupResultFlags) e->flags;
+    d->found = 1;
+}
+
+static void txt_callback(AVAHI_GCC_UNUSED AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, AVAHI_GCC_UNUSED const char *name, const uint8_t *rdata, AVAHI_GCC_UNUSED uint32_t ttl, void *userdata) {
+    ResolveData *d = userdata;
+
+    if (d->have_txt)
+        return;
+
+    if (avahi_string_list_parse(rdata, e->rdata_size, &d->txt) >= 0)
+        d->have_txt = 1;
+}
+
+static void address_callback(AVAHI_GCC_UNUSED AvahiCacheSnapshot *s, const AvahiCacheSnapshotEntry *e, AVAHI_GCC_UNUSED const char *name, const uint8_t *rdata, AVAHI_GCC_UNUSED uint32_t ttl, void *userdata) {
+    ResolveData *d = userdata;
+
+    if (d->found > 1)
+        return;
+
+    if (e->type == AVAHI_DNS_TYPE_A && e->rdata_size == sizeof(AvahiIPv4Address)) {
+        d->address.proto = AVAHI_PROTO_INET;
+        memcpy(&d->address.data.ipv4, rdata, sizeof(AvahiIPv4Address));
+    } else if (e->type == AVAHI_DNS_TYPE_AAAA && e->rdata_size == sizeof(AvahiIPv6Address)) {
+        d->address.proto = AVAHI_PROTO_INET6;
+        memcpy(&d->address.data.ipv6, rdata, sizeof(AvahiIPv6Address));
+    } else
+        return;
+
+    d->found = 2;
+}
+
+int avahi_cache_snapshot_resolve_service(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    AvahiProtocol aprotocol,
+    AvahiCacheSnapshotResolveCallback callback,
+    void *userdata) {
+
+    char n[AVAHI_DOMAIN_NAME_MAX];
+    ResolveData d;
+    int r;
+
+    assert(s);
+    assert(name);
+    assert(type);
+    assert(callback);
+
+    if (!domain)
+        domain = "local";
+
+    if ((r = avahi_service_name_join(n, sizeof(n), name, type, domain)) < 0)
+        return r;
+
+    memset(&d, 0, sizeof(d));
+
+    walk(s, interface, protocol, n, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_SRV, srv_callback, &d);
+
+    if (!d.found)
+        return AVAHI_ERR_NOT_FOUND;
+
+    /* Look for the TXT and address records on the interface the SRV
+     * record was found on */
+    walk(s, d.interface, d.protocol, n, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_TXT, txt_callback, &d);
+
+    if (aprotocol != AVAHI_PROTO_INET6)
+        walk(s, d.interface, d.protocol, d.host_name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_A, address_callback, &d);
+    if (aprotocol != AVAHI_PROTO_INET)
+        walk(s, d.interface, d.protocol, d.host_name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_AAAA, address_callback, &d);
+
+    if (d.found < 2) {
+        avahi_string_list_free(d.txt);
+        return AVAHI_ERR_NOT_FOUND;
+    }
+
+    callback(d.interface, d.protocol, name, type, domain, d.host_name, &d.address, d.port, d.txt, d.flags, userdata);
+
+    avahi_string_list_free(d.txt);
+
+    return AVAHI_OK;
+}
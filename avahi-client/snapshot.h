@@ -0,0 +1,138 @@
+#ifndef fooclientsnapshothfoo
+#define fooclientsnapshothfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <avahi-common/cdecl.h>
+#include <avahi-common/address.h>
+#include <avahi-common/strlst.h>
+#include <avahi-common/defs.h>
+
+/** \file avahi-client/snapshot.h Read-only access to the daemon's record cache
+ *
+ * avahi-daemon may be configured to maintain a snapshot of its
+ * per-interface record caches in a shared memory mapped file. The
+ * functions defined here read this snapshot directly, without any
+ * IPC. The results only reflect what happens to be cached, hence
+ * they are roughly equivalent to a browser or resolver that is
+ * stopped as soon as AVAHI_BROWSER_CACHE_EXHAUSTED is received. */
+
+AVAHI_C_DECL_BEGIN
+
+/** A handle to the cache snapshot file \since 0.7 */
+typedef struct AvahiCacheSnapshot AvahiCacheSnapshot;
+
+/** Callback prototype for avahi_cache_snapshot_foreach_record(). ttl
+ * is the number of seconds the record has left to live. \since 0.7 */
+typedef void (*AvahiCacheSnapshotRecordCallback) (
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    uint16_t clazz,
+    uint16_t type,
+    const void *rdata,
+    size_t size,
+    uint32_t ttl,
+    AvahiLookupResultFlags flags,
+    void *userdata);
+
+/** Callback prototype for avahi_cache_snapshot_foreach_service() \since 0.7 */
+typedef void (*AvahiCacheSnapshotServiceCallback) (
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    AvahiLookupResultFlags flags,
+    void *userdata);
+
+/** Callback prototype for avahi_cache_snapshot_resolve_service() \since 0.7 */
+typedef void (*AvahiCacheSnapshotResolveCallback) (
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    const char *host_name,
+    const AvahiAddress *a,
+    uint16_t port,
+    AvahiStringList *txt,
+    AvahiLookupResultFlags flags,
+    void *userdata);
+
+/** Open the cache snapshot. If path is NULL the default location is
+ * used. Returns NULL and sets *error if the daemon doesn't provide a
+ * snapshot. \since 0.7 */
+AvahiCacheSnapshot *avahi_cache_snapshot_new(const char *path, int *error);
+
+/** Close the cache snapshot \since 0.7 */
+void avahi_cache_snapshot_free(AvahiCacheSnapshot *s);
+
+/** Take a new consistent copy of the snapshot. All lookups operate on
+ * the copy taken by the last call to this function or
+ * avahi_cache_snapshot_new(). Returns a negative error code on
+ * failure. \since 0.7 */
+int avahi_cache_snapshot_refresh(AvahiCacheSnapshot *s);
+
+/** Call "callback" for each cached record matching the
+ * arguments. Pass NULL as name and 0 as class and type to match
+ * everything. \since 0.7 */
+int avahi_cache_snapshot_foreach_record(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    uint16_t clazz,
+    uint16_t type,
+    AvahiCacheSnapshotRecordCallback callback,
+    void *userdata);
+
+/** Call "callback" for each cached service of the specified type. If
+ * type is NULL the service types themselves are enumerated, with name
+ * set to NULL. If domain is NULL, ".local" is used. \since 0.7 */
+int avahi_cache_snapshot_foreach_service(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *type,
+    const char *domain,
+    AvahiCacheSnapshotServiceCallback callback,
+    void *userdata);
+
+/** Resolve a service from the cached SRV, TXT and address
+ * records. Returns AVAHI_ERR_NOT_FOUND if the cache doesn't contain
+ * enough information, in which case the callback is not
+ * called. \since 0.7 */
+int avahi_cache_snapshot_resolve_service(
+    AvahiCacheSnapshot *s,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    AvahiProtocol aprotocol,
+    AvahiCacheSnapshotResolveCallback callback,
+    void *userdata);
+
+AVAHI_C_DECL_END
+
+#endif
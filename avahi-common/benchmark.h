@@ -0,0 +1,52 @@
+#ifndef foobenchmarkhfoo
+#define foobenchmarkhfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Timing helper shared by the benchmarks in the test programs. Not
+ * installed. */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <avahi-common/cdecl.h>
+#include <avahi-common/timeval.h>
+
+AVAHI_C_DECL_BEGIN
+
+/* Print how long it took to process n items since *start, in total
+ * and per item, and return the total */
+static inline AvahiUsec avahi_benchmark_report(const struct timeval *start, const char *what, unsigned long n) {
+    AvahiUsec usec;
+
+    usec = avahi_age(start);
+
+    printf("%s: %lu in %llu usec, %.1f nsec each\n",
+           what,
+           n,
+           (unsigned long long) usec,
+           n > 0 ? (double) usec * 1000.0 / (double) n : 0.0);
+
+    return usec;
+}
+
+AVAHI_C_DECL_END
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef foocachesnapshotformathfoo
+#define foocachesnapshotformathfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* On-disk layout of the cache snapshot file avahi-daemon maintains
+ * in its runtime directory. The file is shared between the daemon
+ * (writer) and local clients (readers) on the same machine, hence all
+ * fields are stored in host byte order.
+ *
+ * The writer makes the sequence counter odd before touching the
+ * file and even again when it is done. A reader copies the record
+ * area and accepts the copy only if it read the same even sequence
+ * counter before and after doing so. The file never shrinks while the
+ * daemon is running, so a mapping remains valid for its lifetime. */
+
+#include <inttypes.h>
+
+#include <avahi-common/cdecl.h>
+
+AVAHI_C_DECL_BEGIN
+
+#define AVAHI_CACHE_SNAPSHOT_MAGIC 0x43535641U /* "AVSC" */
+#define AVAHI_CACHE_SNAPSHOT_VERSION 1
+
+/* Records are aligned to this many bytes */
+#define AVAHI_CACHE_SNAPSHOT_ALIGN 4
+
+typedef struct AvahiCacheSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;      /* Odd while an update is in progress */
+    uint32_t n_records;
+    uint64_t size;          /* Bytes of record data following the header */
+    int64_t timestamp;      /* time(NULL) when the snapshot was taken */
+} AvahiCacheSnapshotHeader;
+
+typedef struct AvahiCacheSnapshotEntry {
+    int32_t interface;
+    int32_t protocol;
+    uint32_t ttl;           /* Remaining TTL at the snapshot timestamp */
+    uint32_t flags;         /* AvahiLookupResultFlags */
+    uint16_t clazz;
+    uint16_t type;
+    uint16_t name_size;     /* Length of the name, including the NUL byte */
+    uint16_t rdata_size;
+    /* Followed by the escaped record name and the uncompressed wire
+     * format rdata, padded to AVAHI_CACHE_SNAPSHOT_ALIGN */
+} AvahiCacheSnapshotEntry;
+
+#define AVAHI_CACHE_SNAPSHOT_ENTRY_SIZE(name_size, rdata_size) \
+    ((sizeof(AvahiCacheSnapshotEntry) + (name_size) + (rdata_size) + AVAHI_CACHE_SNAPSHOT_ALIGN - 1) & ~((size_t) AVAHI_CACHE_SNAPSHOT_ALIGN - 1))
+
+AVAHI_C_DECL_END
+
+#endif
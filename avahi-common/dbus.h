@@ -45,8 +45,14 @@ number is increased the API has been extended but is downwards
 compatible. If the release changes compatibility is lost.
 
 Avahi 0.6 implements API version 0x0201;
-Avahi 0.6.1 implements API version 0x0202 */
-#define AVAHI_DBUS_API_VERSION ((uint32_t) 0x0203)
+Avahi 0.6.1 implements API version 0x0202;
+Avahi 0.7 implements API version 0x0204, which adds variants of the
+methods and signals passing TXT data that pass it in DNS wire format
+as a single byte array. Both forms carry the same items, an empty TXT
+record is passed as a single empty string. The client library hands
+out string lists, so it parses the byte array as soon as it arrives;
+invalid items are only passed in the old form. */
+#define AVAHI_DBUS_API_VERSION ((uint32_t) 0x0204)
 
 #define AVAHI_DBUS_ERR_OK "org.freedesktop.Avahi.Success"
 #define AVAHI_DBUS_ERR_FAILURE "org.freedesktop.Avahi.Failure"
@@ -99,17 +99,21 @@ void avahi_simple_poll_wakeup(AvahiSimplePoll *s) {
     assert(s);
 
     write(s->wakeup_pipe[1], &c, sizeof(c));
-    s->wakeup_issued = 1;
+
+    /* Other threads may call this without holding any lock of ours,
+     * see avahi_threaded_poll_post() */
+    __atomic_store_n(&s->wakeup_issued, 1, __ATOMIC_RELEASE);
 }
 
 static void clear_wakeup(AvahiSimplePoll *s) {
     char c[10]; /* Read ten at a time */
 
-    if (!s->wakeup_issued)
+    /* A wakeup whose flag we miss here has written to the pipe
+     * already, so poll() returns right away and we get it the next
+     * time */
+    if (!__atomic_exchange_n(&s->wakeup_issued, 0, __ATOMIC_ACQUIRE))
         return;
 
-    s->wakeup_issued = 0;
-
     for(;;)
         if (read(s->wakeup_pipe[0], &c, sizeof(c)) != sizeof(c))
             break;
@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include "strlst.h"
@@ -31,6 +32,9 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     char *t, *v;
     uint8_t data[1024];
     AvahiStringList *a = NULL, *b, *p;
+    AvahiTxt *x, *y;
+    uint8_t data2[1024];
+    const uint8_t *value;
     size_t size, n;
     int r;
 
@@ -112,9 +116,61 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     avahi_free(t);
     avahi_free(v);
 
-    avahi_string_list_free(a);
     avahi_string_list_free(b);
 
+    /* The same with the compact representation, which has an index
+     * for this many items */
+    size = avahi_string_list_serialize(a, data, sizeof(data));
+
+    x = avahi_txt_new_from_string_list(a);
+    assert(x);
+    assert(avahi_txt_length(x) == 13);
+    assert(avahi_txt_get_data(x, &n) && n == size);
+    assert(memcmp(avahi_txt_get_data(x, &n), data, size) == 0);
+
+    assert(avahi_txt_parse(data, size, &y) == 0);
+    assert(avahi_txt_equal(x, y));
+    avahi_txt_unref(y);
+
+    assert(avahi_txt_find(x, "SEVEN", &value, &n) == 1);
+    assert(n == 3 && memcmp(value, "7 x", 3) == 0);
+    assert(avahi_txt_find(x, "uxknurz2", &value, &n) == 1);
+    assert(n == 14 && memcmp(value, "blafasel\0oerks", 14) == 0);
+    assert(avahi_txt_find(x, "quux", &value, &n) == 1);
+    assert(!value && n == 0);
+    assert(avahi_txt_find(x, "null", NULL, NULL) == 0);
+    assert(avahi_txt_find(x, "sev", NULL, NULL) == 0);
+
+    assert(avahi_txt_to_string_list(x, &b) == 0);
+    assert(avahi_string_list_length(b) == 13);
+    assert(avahi_string_list_serialize(b, data2, sizeof(data2)) == size);
+    assert(memcmp(data, data2, size) == 0);
+    avahi_string_list_free(b);
+
+    y = avahi_txt_ref(x);
+    avahi_txt_unref(x);
+    avahi_txt_unref(y);
+
+    avahi_string_list_free(a);
+
+    /* Without index, the first occurrence of a key wins */
+    a = avahi_string_list_new("foo=1", "", "FOO=2", "bar", NULL);
+    size = avahi_string_list_serialize(a, data, sizeof(data));
+    assert(avahi_txt_parse(data, size, &x) == 0);
+    assert(avahi_txt_length(x) == 3);
+    assert(avahi_txt_find(x, "Foo", &value, &n) == 1);
+    assert(n == 1 && value[0] == '1');
+
+    n = 0;
+    while (avahi_txt_iterate(x, &n, &value, &size))
+        printf("<%.*s>\n", (int) size, value);
+
+    avahi_txt_unref(x);
+    avahi_string_list_free(a);
+
+    /* Truncated data is refused */
+    assert(avahi_txt_parse("\003ab", 3, &x) < 0);
+
     n = avahi_string_list_serialize(NULL, NULL, 0);
     size = avahi_string_list_serialize(NULL, data, sizeof(data));
     assert(size == 1);
@@ -123,5 +179,17 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     assert(avahi_string_list_parse(data, size, &a) == 0);
     assert(!a);
 
+    assert(avahi_txt_parse(data, size, &x) == 0);
+    assert(avahi_txt_length(x) == 0);
+    assert(avahi_txt_get_data(x, &n) && n == 1);
+    assert(avahi_txt_to_string_list(x, &a) == 0);
+    assert(!a);
+    avahi_txt_unref(x);
+
+    x = avahi_txt_new_from_string_list(NULL);
+    assert(x);
+    assert(avahi_txt_get_data(x, &n)[0] == 0 && n == 1);
+    avahi_txt_unref(x);
+
     return 0;
 }
@@ -22,6 +22,7 @@
 #endif
 
 #include <string.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <stdio.h>
@@ -503,3 +504,302 @@ uint32_t avahi_string_list_get_service_cookie(AvahiStringList *l) {
 
     return ret;
 }
+
+/* TXT records with at least this many items get a key index */
+#define AVAHI_TXT_INDEX_MIN 8
+
+/* Wire format TXT data is at most as large as DNS record data */
+#define AVAHI_TXT_SIZE_MAX 0xFFFF
+
+struct AvahiTxt {
+    unsigned ref;
+    unsigned n_items;
+
+    /* Open addressing hash table of the first occurrence of each key,
+     * storing the offset of the length byte of the item plus one, 0
+     * for empty slots. n_index is a power of two, or 0 if there is no
+     * index. */
+    uint16_t *index;
+    unsigned n_index;
+
+    size_t size;
+    uint8_t data[1];
+};
+
+static unsigned txt_key_hash(const uint8_t *key, size_t n) {
+    unsigned hash = 0;
+
+    /* Case insensitive, since DNS-SD keys are */
+    for (; n > 0; n--, key++)
+        hash = 31 * hash + (unsigned) (*key >= 'A' && *key <= 'Z' ? *key - 'A' + 'a' : *key);
+
+    return hash;
+}
+
+static size_t txt_key_length(const uint8_t *text, size_t size) {
+    const uint8_t *e;
+
+    return (e = memchr(text, '=', size)) ? (size_t) (e - text) : size;
+}
+
+static int txt_key_equal(const uint8_t *a, size_t an, const uint8_t *b, size_t bn) {
+    return an == bn && strncasecmp((const char*) a, (const char*) b, an) == 0;
+}
+
+static void txt_index_add(AvahiTxt *t, size_t offset) {
+    const uint8_t *text = t->data + offset + 1;
+    size_t n = txt_key_length(text, t->data[offset]);
+    unsigned i;
+
+    for (i = txt_key_hash(text, n) & (t->n_index - 1);; i = (i + 1) & (t->n_index - 1)) {
+        const uint8_t *other;
+
+        if (!t->index[i]) {
+            t->index[i] = (uint16_t) (offset + 1);
+            return;
+        }
+
+        /* Later occurrences of a key are ignored */
+        other = t->data + t->index[i];
+        if (txt_key_equal(text, n, other, txt_key_length(other, other[-1])))
+            return;
+    }
+}
+
+static AvahiTxt *txt_new(const uint8_t *data, size_t size, unsigned n_items) {
+    AvahiTxt *t;
+    unsigned n_index = 0;
+    size_t offset, index_offset;
+
+    assert(size <= AVAHI_TXT_SIZE_MAX);
+
+    if (n_items >= AVAHI_TXT_INDEX_MIN)
+        for (n_index = 1; n_index < n_items * 2; n_index <<= 1)
+            ;
+
+    /* Everything lives in one memory block, the index after the data */
+    index_offset = (offsetof(AvahiTxt, data) + (size ? size : 1) + sizeof(uint16_t) - 1) & ~(sizeof(uint16_t) - 1);
+
+    if (!(t = avahi_malloc(index_offset + n_index * sizeof(uint16_t))))
+        return NULL;
+
+    t->ref = 1;
+    t->n_items = n_items;
+    t->size = size;
+    t->n_index = n_index;
+    t->index = n_index ? (uint16_t*) ((uint8_t*) t + index_offset) : NULL;
+
+    if (size > 0)
+        memcpy(t->data, data, size);
+    else {
+        /* To comply with section 6.1 of the DNS-SD spec, an empty TXT
+         * record consists of a single empty string */
+        t->data[0] = 0;
+        t->size = 1;
+    }
+
+    if (n_index) {
+        memset(t->index, 0, n_index * sizeof(uint16_t));
+
+        for (offset = 0; offset < size; offset += 1 + t->data[offset])
+            txt_index_add(t, offset);
+    }
+
+    return t;
+}
+
+int avahi_txt_parse(const void *data, size_t size, AvahiTxt **ret) {
+    const uint8_t *c;
+    uint8_t *buf;
+    size_t n = 0;
+    unsigned n_items = 0;
+
+    assert(data || size == 0);
+    assert(ret);
+
+    if (size > AVAHI_TXT_SIZE_MAX)
+        return -1;
+
+    /* Validate and drop empty strings in one go */
+    if (!(buf = avahi_malloc(size ? size : 1)))
+        return -1; /* OOM */
+
+    for (c = data; size > 0;) {
+        size_t k;
+
+        k = *(c++);
+        size--;
+
+        if (k > size) {
+            avahi_free(buf);
+            return -1; /* Overflow */
+        }
+
+        if (k > 0) {
+            buf[n] = (uint8_t) k;
+            memcpy(buf + n + 1, c, k);
+            n += 1 + k;
+            n_items++;
+        }
+
+        c += k;
+        size -= k;
+    }
+
+    *ret = txt_new(buf, n, n_items);
+    avahi_free(buf);
+
+    return *ret ? 0 : -1;
+}
+
+AvahiTxt *avahi_txt_new_from_string_list(AvahiStringList *l) {
+    AvahiTxt *t;
+    uint8_t *buf;
+    size_t size, offset;
+    unsigned n_items = 0;
+
+    size = avahi_string_list_serialize(l, NULL, 0);
+
+    /* Longer string lists get truncated just as when serializing
+     * them into a packet */
+    if (size > AVAHI_TXT_SIZE_MAX)
+        size = AVAHI_TXT_SIZE_MAX;
+
+    if (!(buf = avahi_malloc(size)))
+        return NULL;
+
+    size = avahi_string_list_serialize(l, buf, size);
+
+    for (offset = 0; offset < size && buf[offset]; offset += 1 + buf[offset])
+        n_items++;
+
+    t = txt_new(buf, n_items ? size : 0, n_items);
+    avahi_free(buf);
+
+    return t;
+}
+
+int avahi_txt_to_string_list(const AvahiTxt *t, AvahiStringList **ret) {
+    AvahiStringList *r = NULL;
+    const uint8_t *text;
+    size_t state = 0, size;
+
+    assert(t);
+    assert(ret);
+
+    /* String lists are kept in reverse order */
+    while (avahi_txt_iterate(t, &state, &text, &size))
+        if (!(r = avahi_string_list_add_arbitrary(r, text, size))) {
+            avahi_string_list_free(r);
+            return -1; /* OOM */
+        }
+
+    *ret = r;
+    return 0;
+}
+
+AvahiTxt *avahi_txt_ref(AvahiTxt *t) {
+    assert(t);
+    assert(t->ref >= 1);
+
+    t->ref++;
+    return t;
+}
+
+void avahi_txt_unref(AvahiTxt *t) {
+    assert(t);
+    assert(t->ref >= 1);
+
+    if (--t->ref <= 0)
+        avahi_free(t);
+}
+
+const uint8_t *avahi_txt_get_data(const AvahiTxt *t, size_t *size) {
+    assert(t);
+    assert(size);
+
+    *size = t->size;
+    return t->data;
+}
+
+unsigned avahi_txt_length(const AvahiTxt *t) {
+    assert(t);
+
+    return t->n_items;
+}
+
+int avahi_txt_equal(const AvahiTxt *a, const AvahiTxt *b) {
+    assert(a);
+    assert(b);
+
+    return a == b || (a->size == b->size && memcmp(a->data, b->data, a->size) == 0);
+}
+
+int avahi_txt_iterate(const AvahiTxt *t, size_t *state, const uint8_t **text, size_t *size) {
+    assert(t);
+    assert(state);
+    assert(text);
+    assert(size);
+
+    /* Skips the single empty string of empty TXT records */
+    while (*state < t->size) {
+        size_t k = t->data[*state];
+
+        *text = t->data + *state + 1;
+        *size = k;
+        *state += 1 + k;
+
+        if (k > 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int txt_found(const uint8_t *text, size_t size, size_t n, const uint8_t **value, size_t *value_size) {
+    if (n < size) {
+        /* Skip the '=' */
+        if (value)
+            *value = text + n + 1;
+        if (value_size)
+            *value_size = size - n - 1;
+    } else {
+        if (value)
+            *value = NULL;
+        if (value_size)
+            *value_size = 0;
+    }
+
+    return 1;
+}
+
+int avahi_txt_find(const AvahiTxt *t, const char *key, const uint8_t **value, size_t *size) {
+    size_t n;
+
+    assert(t);
+    assert(key);
+
+    n = strlen(key);
+
+    if (t->n_index) {
+        unsigned i;
+
+        for (i = txt_key_hash((const uint8_t*) key, n) & (t->n_index - 1); t->index[i]; i = (i + 1) & (t->n_index - 1)) {
+            const uint8_t *text = t->data + t->index[i];
+            size_t k = text[-1];
+
+            if (txt_key_equal(text, txt_key_length(text, k), (const uint8_t*) key, n))
+                return txt_found(text, k, n, value, size);
+        }
+
+    } else {
+        const uint8_t *text;
+        size_t state = 0, k;
+
+        while (avahi_txt_iterate(t, &state, &text, &k))
+            if (txt_key_equal(text, txt_key_length(text, k), (const uint8_t*) key, n))
+                return txt_found(text, k, n, value, size);
+    }
+
+    return 0;
+}
@@ -174,6 +174,63 @@ AvahiStringList *avahi_string_list_add_pair_arbitrary(AvahiStringList *l, const
 uint32_t avahi_string_list_get_service_cookie(AvahiStringList *l);
 /** \endcond */
 
+/** @{ \name Compact TXT records */
+
+/** An immutable, reference counted DNS-SD TXT record, kept in DNS
+ * wire format in a single memory block. Copying it is just taking
+ * another reference, and comparing two of them a memcmp(). TXT
+ * records with many items carry an index for fast key lookups.
+ * \since 0.7 */
+typedef struct AvahiTxt AvahiTxt;
+
+/** Create a TXT record object from TXT record data in DNS wire
+ * format. Empty strings are dropped. Returns 0 on success, negative
+ * if the data is invalid or on OOM. \since 0.7 */
+int avahi_txt_parse(const void *data, size_t size, AvahiTxt **ret);
+
+/** Create a TXT record object with the same contents as a string
+ * list, as serialized by avahi_string_list_serialize(). Returns NULL
+ * on OOM. \since 0.7 */
+AvahiTxt *avahi_txt_new_from_string_list(AvahiStringList *l);
+
+/** Convert a TXT record object back into a newly allocated string
+ * list. Returns 0 on success, negative on OOM. \since 0.7 */
+int avahi_txt_to_string_list(const AvahiTxt *t, AvahiStringList **ret);
+
+/** Increase the reference counter of a TXT record object \since 0.7 */
+AvahiTxt *avahi_txt_ref(AvahiTxt *t);
+
+/** Decrease the reference counter of a TXT record object, freeing it
+ * when it drops to zero \since 0.7 */
+void avahi_txt_unref(AvahiTxt *t);
+
+/** Return the TXT record in DNS wire format. An empty TXT record is
+ * returned as a single empty string, like
+ * avahi_string_list_serialize() does. \since 0.7 */
+const uint8_t *avahi_txt_get_data(const AvahiTxt *t, size_t *size);
+
+/** Return the number of items in the TXT record \since 0.7 */
+unsigned avahi_txt_length(const AvahiTxt *t);
+
+/** Compare two TXT record objects \since 0.7 */
+int avahi_txt_equal(const AvahiTxt *a, const AvahiTxt *b);
+
+/** Iterate through the items of a TXT record, in the order they
+ * appear on the wire. *state should be initialized to 0 before the
+ * first call. Returns 1 and fills in *text and *size for every item,
+ * 0 when there are no more items. \since 0.7 */
+int avahi_txt_iterate(const AvahiTxt *t, size_t *state, const uint8_t **text, size_t *size);
+
+/** Look up a DNS-SD TXT key, case insensitively. If the key appears
+ * more than once, the first occurrence wins, as DNS-SD requires. If
+ * the key is found 1 is returned, and *value and *size are filled
+ * with its value, which is not NUL terminated. *value is set to NULL
+ * for keys without a value. Returns 0 if the key is not
+ * found. \since 0.7 */
+int avahi_txt_find(const AvahiTxt *t, const char *key, const uint8_t **value, size_t *size);
+
+/** @} */
+
 AVAHI_C_DECL_END
 
 #endif
@@ -0,0 +1,157 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "thread-watch.h"
+#include "timeval.h"
+#include "benchmark.h"
+#include "watch.h"
+#include "gccmacro.h"
+
+/* Has a number of threads hand work to the event loop thread, once by
+ * taking the event loop lock for every item and once by queuing calls
+ * with avahi_threaded_poll_post(). Pass "busy" as second argument to
+ * keep the event loop thread dispatching a timeout that takes a while
+ * in the meantime. */
+
+#define N_THREADS 4
+#define N_CALLS 100000
+#define BUSY_USEC 50
+
+static AvahiThreadedPoll *threaded_poll = NULL;
+static const AvahiPoll *threaded_poll_api = NULL;
+static unsigned n_calls = N_CALLS;
+
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long counter = 0, expected = 0;
+
+static void call(AVAHI_GCC_UNUSED AvahiThreadedPoll *p, AVAHI_GCC_UNUSED void *userdata) {
+    pthread_mutex_lock(&done_mutex);
+    if (++counter == expected)
+        pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+}
+
+static void busy_callback(AvahiTimeout *t, AVAHI_GCC_UNUSED void *userdata) {
+    struct timeval start, now;
+
+    gettimeofday(&start, NULL);
+
+    do
+        gettimeofday(&now, NULL);
+    while (avahi_timeval_diff(&now, &start) < BUSY_USEC);
+
+    threaded_poll_api->timeout_update(t, &now);
+}
+
+static void* post_thread(AVAHI_GCC_UNUSED void *userdata) {
+    unsigned n;
+
+    for (n = 0; n < n_calls; n++) {
+        int r = avahi_threaded_poll_post(threaded_poll, call, NULL);
+        assert(r == 0);
+    }
+
+    return NULL;
+}
+
+static void* lock_thread(AVAHI_GCC_UNUSED void *userdata) {
+    unsigned n;
+
+    for (n = 0; n < n_calls; n++) {
+        avahi_threaded_poll_lock(threaded_poll);
+        call(threaded_poll, NULL);
+        avahi_threaded_poll_unlock(threaded_poll);
+    }
+
+    return NULL;
+}
+
+static void run(const char *name, void* (*func)(void*)) {
+    pthread_t threads[N_THREADS];
+    struct timeval start;
+    char what[64];
+    unsigned i;
+
+    counter = 0;
+    expected = (unsigned long) n_calls * N_THREADS;
+
+    gettimeofday(&start, NULL);
+
+    for (i = 0; i < N_THREADS; i++)
+        pthread_create(&threads[i], NULL, func, NULL);
+
+    for (i = 0; i < N_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    /* Queued calls may still be outstanding */
+    pthread_mutex_lock(&done_mutex);
+    while (counter != expected)
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+
+    snprintf(what, sizeof(what), "%-4s calls from %u threads", name, N_THREADS);
+    avahi_benchmark_report(&start, what, expected);
+}
+
+int main(int argc, char *argv[]) {
+    AvahiTimeout *busy = NULL;
+
+    if (argc > 1)
+        n_calls = (unsigned) atoi(argv[1]);
+
+    threaded_poll = avahi_threaded_poll_new();
+    assert(threaded_poll);
+    threaded_poll_api = avahi_threaded_poll_get(threaded_poll);
+
+    if (argc > 2 && !strcmp(argv[2], "busy")) {
+        struct timeval tv;
+
+        busy = threaded_poll_api->timeout_new(threaded_poll_api, avahi_elapse_time(&tv, 0, 0), busy_callback, NULL);
+        assert(busy);
+    }
+
+    if (avahi_threaded_poll_start(threaded_poll) < 0) {
+        fprintf(stderr, "Failed to start event loop thread.\n");
+        return 1;
+    }
+
+    run("lock", lock_thread);
+    run("post", post_thread);
+
+    avahi_threaded_poll_stop(threaded_poll);
+
+    if (busy)
+        threaded_poll_api->timeout_free(busy);
+
+    avahi_threaded_poll_free(threaded_poll);
+
+    return 0;
+}
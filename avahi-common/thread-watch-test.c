@@ -0,0 +1,159 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "thread-watch.h"
+#include "gccmacro.h"
+
+/* Has a number of threads post calls to the event loop thread at the
+ * same time, some of which post further calls from the event loop
+ * thread, and checks that every call runs exactly once and that the
+ * calls of each thread run in the order they were posted. */
+
+#define N_THREADS 8
+#define N_CALLS 20000
+
+/* Every REPOST-th call posts another one from within the event loop */
+#define REPOST 10
+
+typedef struct Call {
+    unsigned thread;
+    unsigned index;
+} Call;
+
+static AvahiThreadedPoll *threaded_poll = NULL;
+
+static Call calls[N_THREADS][N_CALLS];
+static Call reposts[N_THREADS][N_CALLS / REPOST];
+
+/* Only touched from the event loop thread */
+static unsigned n_run[N_THREADS][N_CALLS];
+static unsigned n_reposts_run[N_THREADS][N_CALLS / REPOST];
+static unsigned next_index[N_THREADS];
+
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned n_done = 0;
+
+static void done(void) {
+    pthread_mutex_lock(&done_mutex);
+    if (++n_done == N_THREADS * (N_CALLS + N_CALLS / REPOST))
+        pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+}
+
+static void repost_callback(AvahiThreadedPoll *p, void *userdata) {
+    Call *c = userdata;
+
+    assert(p == threaded_poll);
+
+    n_reposts_run[c->thread][c->index / REPOST]++;
+    done();
+}
+
+static void callback(AvahiThreadedPoll *p, void *userdata) {
+    Call *c = userdata;
+
+    assert(p == threaded_poll);
+
+    /* The calls of a thread stay in order */
+    assert(c->index == next_index[c->thread]);
+    next_index[c->thread]++;
+
+    n_run[c->thread][c->index]++;
+
+    if (c->index % REPOST == 0) {
+        Call *r = &reposts[c->thread][c->index / REPOST];
+
+        r->thread = c->thread;
+        r->index = c->index;
+
+        /* Posting from the event loop thread itself must not block */
+        assert(avahi_threaded_poll_post(p, repost_callback, r) == 0);
+    }
+
+    done();
+}
+
+static void* post_thread(void *userdata) {
+    unsigned thread = *(unsigned*) userdata, n;
+
+    for (n = 0; n < N_CALLS; n++) {
+        Call *c = &calls[thread][n];
+
+        c->thread = thread;
+        c->index = n;
+
+        assert(avahi_threaded_poll_post(threaded_poll, callback, c) == 0);
+    }
+
+    return NULL;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    pthread_t threads[N_THREADS];
+    unsigned ids[N_THREADS];
+    unsigned i, n;
+
+    threaded_poll = avahi_threaded_poll_new();
+    assert(threaded_poll);
+
+    assert(avahi_threaded_poll_start(threaded_poll) == 0);
+
+    for (i = 0; i < N_THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&threads[i], NULL, post_thread, &ids[i]) == 0);
+    }
+
+    for (i = 0; i < N_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    pthread_mutex_lock(&done_mutex);
+    while (n_done != N_THREADS * (N_CALLS + N_CALLS / REPOST))
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+
+    assert(avahi_threaded_poll_stop(threaded_poll) >= 0);
+
+    for (i = 0; i < N_THREADS; i++) {
+        assert(next_index[i] == N_CALLS);
+
+        for (n = 0; n < N_CALLS; n++)
+            assert(n_run[i][n] == 1);
+
+        for (n = 0; n < N_CALLS / REPOST; n++)
+            assert(n_reposts_run[i][n] == 1);
+    }
+
+    /* Calls still queued when the event loop is freed are dropped
+     * without running */
+    assert(avahi_threaded_poll_post(threaded_poll, callback, &calls[0][0]) == 0);
+    avahi_threaded_poll_free(threaded_poll);
+
+    printf("%u calls from %u threads run exactly once\n", N_THREADS * (N_CALLS + N_CALLS / REPOST), N_THREADS);
+
+    return 0;
+}
@@ -37,38 +37,95 @@
 #include "simple-watch.h"
 #include "thread-watch.h"
 
+typedef struct AvahiThreadedPollCall AvahiThreadedPollCall;
+
+struct AvahiThreadedPollCall {
+    AvahiThreadedPollCall *next;
+    AvahiThreadedPollCallback callback;
+    void *userdata;
+};
+
 struct AvahiThreadedPoll {
     AvahiSimplePoll *simple_poll;
     pthread_t thread_id;
     pthread_mutex_t mutex;
     int thread_running;
     int retval;
+
+    /* Calls queued by avahi_threaded_poll_post(), most recent first.
+     * Any thread may push to this, only the helper thread takes
+     * entries off it. */
+    AvahiThreadedPollCall *calls;
 };
 
 static int poll_func(struct pollfd *ufds, unsigned int nfds, int timeout, void *userdata) {
-    pthread_mutex_t *mutex = userdata;
+    AvahiThreadedPoll *p = userdata;
     int r;
 
+    /* The wakeup pipe has been emptied already at this point, so if a
+     * call was queued before we'd sleep through it. Calls queued
+     * after this check will write to the pipe again. */
+    if (__atomic_load_n(&p->calls, __ATOMIC_ACQUIRE))
+        timeout = 0;
+
     /* Before entering poll() we unlock the mutex, so that
      * avahi_simple_poll_quit() can succeed from another thread. */
 
-    pthread_mutex_unlock(mutex);
+    pthread_mutex_unlock(&p->mutex);
     r = poll(ufds, nfds, timeout);
-    pthread_mutex_lock(mutex);
+    pthread_mutex_lock(&p->mutex);
 
     return r;
 }
 
+static AvahiThreadedPollCall *take_calls(AvahiThreadedPoll *p) {
+    AvahiThreadedPollCall *c, *next, *ret = NULL;
+
+    c = __atomic_exchange_n(&p->calls, NULL, __ATOMIC_ACQUIRE);
+
+    /* Restore the order the calls were queued in */
+    for (; c; c = next) {
+        next = c->next;
+        c->next = ret;
+        ret = c;
+    }
+
+    return ret;
+}
+
+static void run_calls(AvahiThreadedPoll *p) {
+    AvahiThreadedPollCall *c, *next;
+
+    for (c = take_calls(p); c; c = next) {
+        next = c->next;
+        c->callback(p, c->userdata);
+        avahi_free(c);
+    }
+}
+
 static void* thread(void *userdata){
     AvahiThreadedPoll *p = userdata;
     sigset_t mask;
+    int r;
 
     /* Make sure that signals are delivered to the main thread */
     sigfillset(&mask);
     pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
     pthread_mutex_lock(&p->mutex);
-    p->retval = avahi_simple_poll_loop(p->simple_poll);
+
+    /* Like avahi_simple_poll_loop(), but runs the queued calls after
+     * each iteration */
+    for (;;) {
+
+        if ((r = avahi_simple_poll_iterate(p->simple_poll, -1)) != 0)
+            if (r >= 0 || errno != EINTR)
+                break;
+
+        run_calls(p);
+    }
+
+    p->retval = r;
     pthread_mutex_unlock(&p->mutex);
 
     return NULL;
@@ -85,9 +142,10 @@ AvahiThreadedPoll *avahi_threaded_poll_new(void) {
 
     pthread_mutex_init(&p->mutex, NULL);
 
-    avahi_simple_poll_set_func(p->simple_poll, poll_func, &p->mutex);
+    avahi_simple_poll_set_func(p->simple_poll, poll_func, p);
 
     p->thread_running = 0;
+    p->calls = NULL;
 
     return p;
 
@@ -116,6 +174,12 @@ void avahi_threaded_poll_free(AvahiThreadedPoll *p) {
     if (p->simple_poll)
         avahi_simple_poll_free(p->simple_poll);
 
+    while (p->calls) {
+        AvahiThreadedPollCall *c = p->calls;
+        p->calls = c->next;
+        avahi_free(c);
+    }
+
     pthread_mutex_destroy(&p->mutex);
     avahi_free(p);
 }
@@ -184,3 +248,29 @@ void avahi_threaded_poll_unlock(AvahiThreadedPoll *p) {
 
     pthread_mutex_unlock(&p->mutex);
 }
+
+int avahi_threaded_poll_post(AvahiThreadedPoll *p, AvahiThreadedPollCallback callback, void *userdata) {
+    AvahiThreadedPollCall *c, *head;
+
+    assert(p);
+    assert(callback);
+
+    if (!(c = avahi_new(AvahiThreadedPollCall, 1)))
+        return -1; /* OOM */
+
+    c->callback = callback;
+    c->userdata = userdata;
+
+    head = __atomic_load_n(&p->calls, __ATOMIC_RELAXED);
+
+    do
+        c->next = head;
+    while (!__atomic_compare_exchange_n(&p->calls, &head, c, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* If the queue wasn't empty the helper thread has been woken up
+     * already and will pick this call up, too */
+    if (!head)
+        avahi_simple_poll_wakeup(p->simple_poll);
+
+    return 0;
+}
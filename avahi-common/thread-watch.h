@@ -75,6 +75,20 @@ void avahi_threaded_poll_lock(AvahiThreadedPoll *p);
  * avahi_threaded_poll_lock() \since 0.6.4 */
 void avahi_threaded_poll_unlock(AvahiThreadedPoll *p);
 
+/** A function to be called from the event loop helper thread, see
+ * avahi_threaded_poll_post() \since 0.7 */
+typedef void (*AvahiThreadedPollCallback)(AvahiThreadedPoll *p, void *userdata);
+
+/** Queue a call of callback from the event loop helper thread, with
+ * the same lock held that event loop callbacks are called with. This
+ * may be called from any thread without avahi_threaded_poll_lock(),
+ * and doesn't wait for the event loop, so it is cheaper than taking
+ * the lock if you don't need the result right away. Calls are made in
+ * the order they were queued in. Calls still queued when the event
+ * loop object is freed are dropped. Returns 0 on success, negative on
+ * OOM. \since 0.7 */
+int avahi_threaded_poll_post(AvahiThreadedPoll *p, AvahiThreadedPollCallback callback, void *userdata);
+
 AVAHI_C_DECL_END
 
 #endif
@@ -39,6 +39,7 @@
 #include <avahi-common/error.h>
 #include <avahi-common/domain.h>
 #include <avahi-common/alternative.h>
+#include <avahi-common/llist.h>
 
 #include <avahi-client/client.h>
 #include <avahi-client/publish.h>
@@ -63,6 +64,19 @@ struct type_info {
 struct _DNSServiceRef_t {
     int n_ref;
 
+    /* Set on sdRefs created with kDNSServiceFlagsShareConnection. They
+     * have no thread, poll or client of their own but use those of
+     * the connection, and are freed together with it. */
+    DNSServiceRef connection;
+    AVAHI_LLIST_FIELDS(struct _DNSServiceRef_t, shared);
+
+    /* Set on sdRefs created with DNSServiceCreateConnection() */
+    int is_connection;
+    AVAHI_LLIST_HEAD(struct _DNSServiceRef_t, shared);
+
+    /* The state changes of the client are passed to this */
+    AvahiClientCallback client_callback;
+
     AvahiSimplePoll *simple_poll;
 
     int thread_fd, main_fd;
@@ -358,25 +372,28 @@ static void * thread_func(void *data) {
     return NULL;
 }
 
-static DNSServiceRef sdref_new(void) {
-    int fd[2] = { -1, -1 };
-    DNSServiceRef sdref = NULL;
-    pthread_mutexattr_t mutex_attr;
-
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
-        goto fail;
+static DNSServiceRef sdref_alloc(void) {
+    DNSServiceRef sdref;
 
-    if (!(sdref = avahi_new(struct _DNSServiceRef_t, 1)))
-        goto fail;
+    if (!(sdref = avahi_new0(struct _DNSServiceRef_t, 1)))
+        return NULL;
 
     sdref->n_ref = 1;
-    sdref->thread_fd = fd[0];
-    sdref->main_fd = fd[1];
+    sdref->thread_fd = sdref->main_fd = -1;
+
+    sdref->connection = NULL;
+    sdref->is_connection = 0;
+    AVAHI_LLIST_HEAD_INIT(struct _DNSServiceRef_t, sdref->shared);
+    sdref->client_callback = NULL;
+
+    sdref->simple_poll = NULL;
+    sdref->thread_running = 0;
 
     sdref->client = NULL;
     sdref->service_browser = NULL;
     sdref->service_resolver = NULL;
     sdref->domain_browser = NULL;
+    sdref->record_browser = NULL;
     sdref->entry_group = NULL;
 
     sdref->service_name = sdref->service_name_chosen = sdref->service_domain = sdref->service_host = NULL;
@@ -384,12 +401,44 @@ static DNSServiceRef sdref_new(void) {
 
     type_info_init(&sdref->type_info);
 
+    return sdref;
+}
+
+static DNSServiceRef sdref_new(DNSServiceRef connection) {
+    int fd[2] = { -1, -1 };
+    DNSServiceRef sdref = NULL;
+    pthread_mutexattr_t mutex_attr;
+
+    if (connection) {
+        assert(connection->is_connection);
+
+        if (!(sdref = sdref_alloc()))
+            return NULL;
+
+        ASSERT_SUCCESS(pthread_mutex_lock(&connection->mutex));
+        sdref->connection = connection;
+        AVAHI_LLIST_PREPEND(struct _DNSServiceRef_t, shared, connection->shared, sdref);
+        ASSERT_SUCCESS(pthread_mutex_unlock(&connection->mutex));
+
+        return sdref;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+        goto fail;
+
+    if (!(sdref = sdref_alloc())) {
+        close(fd[0]);
+        close(fd[1]);
+        goto fail;
+    }
+
+    sdref->thread_fd = fd[0];
+    sdref->main_fd = fd[1];
+
     ASSERT_SUCCESS(pthread_mutexattr_init(&mutex_attr));
     pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
     ASSERT_SUCCESS(pthread_mutex_init(&sdref->mutex, &mutex_attr));
 
-    sdref->thread_running = 0;
-
     if (!(sdref->simple_poll = avahi_simple_poll_new()))
         goto fail;
 
@@ -421,25 +470,53 @@ fail:
 static void sdref_free(DNSServiceRef sdref) {
     assert(sdref);
 
-    if (sdref->thread_running) {
-        ASSERT_SUCCESS(write_command(sdref->main_fd, COMMAND_QUIT));
-        avahi_simple_poll_wakeup(sdref->simple_poll);
-        ASSERT_SUCCESS(pthread_join(sdref->thread, NULL));
-    }
+    if (sdref->connection) {
+        DNSServiceRef connection = sdref->connection;
+
+        /* The client stays, so free what we created on it */
+        ASSERT_SUCCESS(pthread_mutex_lock(&connection->mutex));
+
+        if (sdref->service_browser)
+            avahi_service_browser_free(sdref->service_browser);
+        if (sdref->service_resolver)
+            avahi_service_resolver_free(sdref->service_resolver);
+        if (sdref->domain_browser)
+            avahi_domain_browser_free(sdref->domain_browser);
+        if (sdref->record_browser)
+            avahi_record_browser_free(sdref->record_browser);
+        if (sdref->entry_group)
+            avahi_entry_group_free(sdref->entry_group);
+
+        AVAHI_LLIST_REMOVE(struct _DNSServiceRef_t, shared, connection->shared, sdref);
+
+        ASSERT_SUCCESS(pthread_mutex_unlock(&connection->mutex));
+
+    } else {
 
-    if (sdref->client)
-        avahi_client_free(sdref->client);
+        if (sdref->thread_running) {
+            ASSERT_SUCCESS(write_command(sdref->main_fd, COMMAND_QUIT));
+            avahi_simple_poll_wakeup(sdref->simple_poll);
+            ASSERT_SUCCESS(pthread_join(sdref->thread, NULL));
+        }
+
+        /* Severing the connection frees everything that shares it */
+        while (sdref->shared)
+            sdref_free(sdref->shared);
 
-    if (sdref->simple_poll)
-        avahi_simple_poll_free(sdref->simple_poll);
+        if (sdref->client)
+            avahi_client_free(sdref->client);
 
-    if (sdref->thread_fd >= 0)
-        close(sdref->thread_fd);
+        if (sdref->simple_poll)
+            avahi_simple_poll_free(sdref->simple_poll);
 
-    if (sdref->main_fd >= 0)
-        close(sdref->main_fd);
+        if (sdref->thread_fd >= 0)
+            close(sdref->thread_fd);
 
-    ASSERT_SUCCESS(pthread_mutex_destroy(&sdref->mutex));
+        if (sdref->main_fd >= 0)
+            close(sdref->main_fd);
+
+        ASSERT_SUCCESS(pthread_mutex_destroy(&sdref->mutex));
+    }
 
     avahi_free(sdref->service_name);
     avahi_free(sdref->service_name_chosen);
@@ -453,6 +530,52 @@ static void sdref_free(DNSServiceRef sdref) {
     avahi_free(sdref);
 }
 
+static pthread_mutex_t *sdref_mutex(DNSServiceRef sdref) {
+    assert(sdref);
+
+    return sdref->connection ? &sdref->connection->mutex : &sdref->mutex;
+}
+
+/* Returns the client to use for sdref, connecting to the daemon if it
+ * doesn't share a connection */
+static AvahiClient *sdref_client_new(DNSServiceRef sdref, AvahiClientCallback callback, int *error) {
+    assert(sdref);
+    assert(callback);
+    assert(error);
+
+    sdref->client_callback = callback;
+
+    if (sdref->connection) {
+        if (avahi_client_get_state(sdref->connection->client) == AVAHI_CLIENT_FAILURE) {
+            *error = avahi_client_errno(sdref->connection->client);
+            return NULL;
+        }
+
+        return sdref->connection->client;
+    }
+
+    return avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, callback, sdref, error);
+}
+
+/* If kDNSServiceFlagsShareConnection is set, *ret_sdref has to be a
+ * connection created by DNSServiceCreateConnection() for the new
+ * sdRef to share */
+static DNSServiceErrorType get_connection(DNSServiceRef *ret_sdref, DNSServiceFlags flags, DNSServiceRef *connection) {
+    assert(ret_sdref);
+    assert(connection);
+
+    *connection = NULL;
+
+    if (!(flags & kDNSServiceFlagsShareConnection))
+        return kDNSServiceErr_NoError;
+
+    if (!*ret_sdref || (*ret_sdref)->n_ref <= 0 || !(*ret_sdref)->is_connection)
+        return kDNSServiceErr_BadReference;
+
+    *connection = *ret_sdref;
+    return kDNSServiceErr_NoError;
+}
+
 static void sdref_ref(DNSServiceRef sdref) {
     assert(sdref);
     assert(sdref->n_ref >= 1);
@@ -468,6 +591,28 @@ static void sdref_unref(DNSServiceRef sdref) {
         sdref_free(sdref);
 }
 
+static void connection_client_callback(AvahiClient *s, AvahiClientState state, void* userdata) {
+    DNSServiceRef sdref = userdata, i, next;
+
+    assert(s);
+    assert(sdref);
+    assert(sdref->n_ref >= 1);
+
+    /* Pass the state change on to everybody sharing this
+     * connection. The callbacks may deallocate any of them, so keep
+     * the current one alive and look up its successor only after it
+     * has been called. */
+    for (i = sdref->shared; i; i = next) {
+        sdref_ref(i);
+
+        if (i->client_callback)
+            i->client_callback(s, state, i);
+
+        next = i->shared_next;
+        sdref_unref(i);
+    }
+}
+
 int DNSSD_API DNSServiceRefSockFD(DNSServiceRef sdref) {
 
     AVAHI_WARN_LINKAGE;
@@ -475,6 +620,10 @@ int DNSSD_API DNSServiceRefSockFD(DNSServiceRef sdref) {
     if (!sdref || sdref->n_ref <= 0)
         return -1;
 
+    /* Results for shared sdRefs arrive on the connection */
+    if (sdref->connection)
+        return -1;
+
     return sdref->main_fd;
 }
 
@@ -486,6 +635,9 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdref) {
     if (!sdref || sdref->n_ref <= 0)
         return kDNSServiceErr_BadParam;
 
+    if (sdref->connection)
+        return kDNSServiceErr_BadReference;
+
     sdref_ref(sdref);
 
     ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
@@ -527,6 +679,42 @@ void DNSSD_API DNSServiceRefDeallocate(DNSServiceRef sdref) {
         sdref_unref(sdref);
 }
 
+DNSServiceErrorType DNSSD_API DNSServiceCreateConnection(DNSServiceRef *ret_sdref) {
+    DNSServiceErrorType ret = kDNSServiceErr_Unknown;
+    int error;
+    DNSServiceRef sdref = NULL;
+
+    AVAHI_WARN_LINKAGE;
+
+    if (!ret_sdref)
+        return kDNSServiceErr_BadParam;
+    *ret_sdref = NULL;
+
+    if (!(sdref = sdref_new(NULL)))
+        return kDNSServiceErr_Unknown;
+
+    sdref->is_connection = 1;
+
+    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+
+    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, connection_client_callback, sdref, &error))) {
+        ret = map_error(error);
+        goto finish;
+    }
+
+    ret = kDNSServiceErr_NoError;
+    *ret_sdref = sdref;
+
+finish:
+
+    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+
+    if (ret != kDNSServiceErr_NoError)
+        DNSServiceRefDeallocate(sdref);
+
+    return ret;
+}
+
 static void service_browser_callback(
     AvahiServiceBrowser *b,
     AvahiIfIndex interface,
@@ -608,7 +796,7 @@ DNSServiceErrorType DNSSD_API DNSServiceBrowse(
 
     DNSServiceErrorType ret = kDNSServiceErr_Unknown;
     int error;
-    DNSServiceRef sdref = NULL;
+    DNSServiceRef sdref = NULL, connection;
     AvahiIfIndex ifindex;
     struct type_info type_info;
 
@@ -616,8 +804,13 @@ DNSServiceErrorType DNSSD_API DNSServiceBrowse(
 
     if (!ret_sdref || !regtype)
         return kDNSServiceErr_BadParam;
+
+    if ((ret = get_connection(ret_sdref, flags, &connection)) != kDNSServiceErr_NoError)
+        return ret;
     *ret_sdref = NULL;
 
+    flags &= ~kDNSServiceFlagsShareConnection;
+
     if (interface == kDNSServiceInterfaceIndexLocalOnly || flags != 0) {
         AVAHI_WARN_UNSUPPORTED;
         return kDNSServiceErr_Unsupported;
@@ -633,7 +826,7 @@ DNSServiceErrorType DNSSD_API DNSServiceBrowse(
     } else
         regtype = type_info.subtypes ? (char*) type_info.subtypes->text : type_info.type;
 
-    if (!(sdref = sdref_new())) {
+    if (!(sdref = sdref_new(connection))) {
         type_info_free(&type_info);
         return kDNSServiceErr_Unknown;
     }
@@ -641,9 +834,9 @@ DNSServiceErrorType DNSSD_API DNSServiceBrowse(
     sdref->context = context;
     sdref->service_browser_callback = callback;
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
-    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, generic_client_callback, sdref, &error))) {
+    if (!(sdref->client = sdref_client_new(sdref, generic_client_callback, &error))) {
         ret =  map_error(error);
         goto finish;
     }
@@ -660,7 +853,7 @@ DNSServiceErrorType DNSSD_API DNSServiceBrowse(
 
 finish:
 
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     if (ret != kDNSServiceErr_NoError)
         DNSServiceRefDeallocate(sdref);
@@ -734,29 +927,34 @@ DNSServiceErrorType DNSSD_API DNSServiceResolve(
 
     DNSServiceErrorType ret = kDNSServiceErr_Unknown;
     int error;
-    DNSServiceRef sdref = NULL;
+    DNSServiceRef sdref = NULL, connection;
     AvahiIfIndex ifindex;
 
     AVAHI_WARN_LINKAGE;
 
     if (!ret_sdref || !name || !regtype || !domain || !callback)
         return kDNSServiceErr_BadParam;
+
+    if ((ret = get_connection(ret_sdref, flags, &connection)) != kDNSServiceErr_NoError)
+        return ret;
     *ret_sdref = NULL;
 
+    flags &= ~kDNSServiceFlagsShareConnection;
+
     if (interface == kDNSServiceInterfaceIndexLocalOnly || flags != 0) {
         AVAHI_WARN_UNSUPPORTED;
         return kDNSServiceErr_Unsupported;
     }
 
-    if (!(sdref = sdref_new()))
+    if (!(sdref = sdref_new(connection)))
         return kDNSServiceErr_Unknown;
 
     sdref->context = context;
     sdref->service_resolver_callback = callback;
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
-    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, generic_client_callback, sdref, &error))) {
+    if (!(sdref->client = sdref_client_new(sdref, generic_client_callback, &error))) {
         ret =  map_error(error);
         goto finish;
     }
@@ -774,7 +972,7 @@ DNSServiceErrorType DNSSD_API DNSServiceResolve(
 
 finish:
 
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     if (ret != kDNSServiceErr_NoError)
         DNSServiceRefDeallocate(sdref);
@@ -845,30 +1043,35 @@ DNSServiceErrorType DNSSD_API DNSServiceEnumerateDomains(
 
     DNSServiceErrorType ret = kDNSServiceErr_Unknown;
     int error;
-    DNSServiceRef sdref = NULL;
+    DNSServiceRef sdref = NULL, connection;
     AvahiIfIndex ifindex;
 
     AVAHI_WARN_LINKAGE;
 
     if (!ret_sdref || !callback)
         return kDNSServiceErr_BadParam;
+
+    if ((ret = get_connection(ret_sdref, flags, &connection)) != kDNSServiceErr_NoError)
+        return ret;
     *ret_sdref = NULL;
 
+    flags &= ~kDNSServiceFlagsShareConnection;
+
     if (interface == kDNSServiceInterfaceIndexLocalOnly ||
         (flags != kDNSServiceFlagsBrowseDomains &&  flags != kDNSServiceFlagsRegistrationDomains)) {
         AVAHI_WARN_UNSUPPORTED;
         return kDNSServiceErr_Unsupported;
     }
 
-    if (!(sdref = sdref_new()))
+    if (!(sdref = sdref_new(connection)))
         return kDNSServiceErr_Unknown;
 
     sdref->context = context;
     sdref->domain_browser_callback = callback;
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
-    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, generic_client_callback, sdref, &error))) {
+    if (!(sdref->client = sdref_client_new(sdref, generic_client_callback, &error))) {
         ret =  map_error(error);
         goto finish;
     }
@@ -887,7 +1090,7 @@ DNSServiceErrorType DNSSD_API DNSServiceEnumerateDomains(
 
 finish:
 
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     if (ret != kDNSServiceErr_NoError)
         DNSServiceRefDeallocate(sdref);
@@ -1096,7 +1299,7 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister (
 
     DNSServiceErrorType ret = kDNSServiceErr_Unknown;
     int error;
-    DNSServiceRef sdref = NULL;
+    DNSServiceRef sdref = NULL, connection;
     AvahiStringList *txt = NULL;
     struct type_info type_info;
 
@@ -1104,8 +1307,13 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister (
 
     if (!ret_sdref || !regtype)
         return kDNSServiceErr_BadParam;
+
+    if ((ret = get_connection(ret_sdref, flags, &connection)) != kDNSServiceErr_NoError)
+        return ret;
     *ret_sdref = NULL;
 
+    flags &= ~kDNSServiceFlagsShareConnection;
+
     if (!txtRecord) {
         txtLen = 1;
         txtRecord = "";
@@ -1125,7 +1333,7 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister (
         return kDNSServiceErr_Invalid;
     }
 
-    if (!(sdref = sdref_new())) {
+    if (!(sdref = sdref_new(connection))) {
         avahi_string_list_free(txt);
         type_info_free(&type_info);
         return kDNSServiceErr_Unknown;
@@ -1144,9 +1352,9 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister (
 
     /* Some OOM checking would be cool here */
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
-    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, reg_client_callback, sdref, &error))) {
+    if (!(sdref->client = sdref_client_new(sdref, reg_client_callback, &error))) {
         ret =  map_error(error);
         goto finish;
     }
@@ -1199,7 +1407,7 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister (
 
 finish:
 
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     if (ret != kDNSServiceErr_NoError)
         DNSServiceRefDeallocate(sdref);
@@ -1232,7 +1440,7 @@ DNSServiceErrorType DNSSD_API DNSServiceUpdateRecord(
         if (avahi_string_list_parse(rdata, rdlen, &txt) < 0)
             return kDNSServiceErr_Invalid;
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
     if (!avahi_string_list_equal(txt, sdref->service_txt)) {
 
@@ -1264,7 +1472,7 @@ DNSServiceErrorType DNSSD_API DNSServiceUpdateRecord(
     ret = kDNSServiceErr_NoError;
 
 finish:
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     return ret;
 }
@@ -1324,29 +1532,34 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord (
 
     DNSServiceErrorType ret = kDNSServiceErr_Unknown;
     int error;
-    DNSServiceRef sdref = NULL;
+    DNSServiceRef sdref = NULL, connection;
     AvahiIfIndex ifindex;
 
     AVAHI_WARN_LINKAGE;
 
     if (!ret_sdref || !fullname)
         return kDNSServiceErr_BadParam;
+
+    if ((ret = get_connection(ret_sdref, flags, &connection)) != kDNSServiceErr_NoError)
+        return ret;
     *ret_sdref = NULL;
 
+    flags &= ~kDNSServiceFlagsShareConnection;
+
     if (interface == kDNSServiceInterfaceIndexLocalOnly || flags != 0) {
         AVAHI_WARN_UNSUPPORTED;
         return kDNSServiceErr_Unsupported;
     }
 
-    if (!(sdref = sdref_new()))
+    if (!(sdref = sdref_new(connection)))
         return kDNSServiceErr_Unknown;
 
     sdref->context = context;
     sdref->query_resolver_callback = callback;
 
-    ASSERT_SUCCESS(pthread_mutex_lock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_lock(sdref_mutex(sdref)));
 
-    if (!(sdref->client = avahi_client_new(avahi_simple_poll_get(sdref->simple_poll), 0, generic_client_callback, sdref, &error))) {
+    if (!(sdref->client = sdref_client_new(sdref, generic_client_callback, &error))) {
         ret =  map_error(error);
         goto finish;
     }
@@ -1363,7 +1576,7 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord (
 
 finish:
 
-    ASSERT_SUCCESS(pthread_mutex_unlock(&sdref->mutex));
+    ASSERT_SUCCESS(pthread_mutex_unlock(sdref_mutex(sdref)));
 
     if (ret != kDNSServiceErr_NoError)
         DNSServiceRefDeallocate(sdref);
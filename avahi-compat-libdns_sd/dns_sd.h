@@ -151,10 +151,26 @@ enum
      * even for a name in a domain (e.g. foo.apple.com.) that would normally imply unicast DNS.
      */
 
-    kDNSServiceFlagsReturnCNAME         = 0x800
+    kDNSServiceFlagsReturnCNAME         = 0x800,
     /* Flag for returning CNAME records in the DNSServiceQueryRecord call. CNAME records are
      * normally followed without indicating to the client that there was a CNAME record.
      */
+
+    kDNSServiceFlagsShareConnection     = 0x4000
+    /* For efficiency, clients that perform many concurrent operations may want to use a
+     * single connection to the daemon, instead of having a separate connection for each
+     * independent operation. To use this mode, clients first call DNSServiceCreateConnection()
+     * to initialize the main DNSServiceRef. For each subsequent operation that is to share
+     * that same connection, the client copies the main DNSServiceRef, and then passes the
+     * address of that copy, setting the ShareConnection flag to tell the library that this
+     * DNSServiceRef is not a typical uninitialized DNSServiceRef; it's a copy of an existing
+     * DNSServiceRef whose connection information should be reused.
+     *
+     * Results for all operations sharing the connection are delivered by calling
+     * DNSServiceProcessResult() on the main DNSServiceRef; the subordinate DNSServiceRefs
+     * have no socket of their own. Deallocating the main DNSServiceRef terminates all
+     * operations sharing it and invalidates their DNSServiceRefs.
+     */
     };
 
 /*
@@ -1021,8 +1037,9 @@ DNSServiceErrorType DNSSD_API DNSServiceResolve
 
 /* DNSServiceCreateConnection()
  *
- * Create a connection to the daemon allowing efficient registration of
- * multiple individual records.
+ * Create a connection to the daemon which other operations can share by
+ * passing kDNSServiceFlagsShareConnection, see above. Registration of
+ * individual records on the connection is not supported.
  *
  *
  * Parameters:
@@ -59,12 +59,6 @@ DNSServiceErrorType DNSSD_API DNSServiceReconfirmRecord (
     return kDNSServiceErr_Unsupported;
 }
 
-DNSServiceErrorType DNSSD_API DNSServiceCreateConnection(AVAHI_GCC_UNUSED DNSServiceRef *sdRef) {
-    AVAHI_WARN_UNSUPPORTED;
-
-    return kDNSServiceErr_Unsupported;
-}
-
 DNSServiceErrorType DNSSD_API DNSServiceAddRecord(
     AVAHI_GCC_UNUSED DNSServiceRef sdRef,
     AVAHI_GCC_UNUSED DNSRecordRef *RecordRef,
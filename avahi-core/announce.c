@@ -22,9 +22,11 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <avahi-common/timeval.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/gccmacro.h>
 
 #include "announce.h"
 #include "log.h"
@@ -44,9 +46,20 @@ static void remove_announcer(AvahiServer *s, AvahiAnnouncer *a) {
     AVAHI_LLIST_REMOVE(AvahiAnnouncer, by_interface, a->interface->announcers, a);
     AVAHI_LLIST_REMOVE(AvahiAnnouncer, by_entry, a->entry->announcers, a);
 
+    avahi_server_invalidate_answers(s);
+
     avahi_free(a);
 }
 
+/* Whether an entry is registered on an interface depends on the
+ * state, so every change might change the answers to queries */
+static void set_state(AvahiAnnouncer *a, AvahiAnnouncerState state) {
+    assert(a);
+
+    a->state = state;
+    avahi_server_invalidate_answers(a->server);
+}
+
 static void elapse_announce(AvahiTimeEvent *e, void *userdata);
 
 static void set_timeout(AvahiAnnouncer *a, const struct timeval *tv) {
@@ -68,6 +81,86 @@ static void set_timeout(AvahiAnnouncer *a, const struct timeval *tv) {
 
 static void next_state(AvahiAnnouncer *a);
 
+/* Returns nonzero if the probes of this announcer are sent by the
+ * group instead of the announcer's own time event */
+static int is_group_probing(AvahiAnnouncer *a) {
+    assert(a);
+
+    return a->server->config.group_probing && a->entry->group;
+}
+
+static void elapse_group_probe(AvahiTimeEvent *e, void *userdata);
+
+static void schedule_group_probe(AvahiSEntryGroup *g) {
+    struct timeval tv;
+
+    assert(g);
+
+    /* All announcers that join while the group is probing already are
+     * synchronized to the running time event */
+    if (g->probe_time_event)
+        return;
+
+    g->probe_time_event = avahi_time_event_new(g->server->time_event_queue, avahi_elapse_time(&tv, 0, AVAHI_PROBE_JITTER_MSEC), elapse_group_probe, g);
+}
+
+static void elapse_group_probe(AVAHI_GCC_UNUSED AvahiTimeEvent *e, void *userdata) {
+    AvahiSEntryGroup *g = userdata;
+    AvahiEntry *entry;
+    int probing = 0, probed = 0;
+
+    assert(g);
+
+    /* Post the probes of all entries at the same time, so that the
+     * probe scheduler can put them into as few packets as possible */
+
+    for (entry = g->entries; entry; entry = entry->by_group_next) {
+        AvahiAnnouncer *a;
+
+        if (entry->dead)
+            continue;
+
+        for (a = entry->announcers; a; a = a->by_entry_next) {
+
+            if (a->state != AVAHI_PROBING)
+                continue;
+
+            if (a->n_iteration >= 4) {
+                /* Probing done */
+
+                assert(g->n_probing);
+                g->n_probing--;
+
+                if (g->state == AVAHI_ENTRY_GROUP_REGISTERING) {
+                    set_state(a, AVAHI_WAITING);
+                    probed = 1;
+                } else {
+                    set_state(a, AVAHI_ANNOUNCING);
+                    a->n_iteration = 1;
+                    next_state(a);
+                }
+
+            } else {
+                avahi_interface_post_probe(a->interface, a->entry->record, 0);
+                a->n_iteration++;
+                probing = 1;
+            }
+        }
+    }
+
+    if (probing) {
+        struct timeval tv;
+        avahi_time_event_update(g->probe_time_event, avahi_elapse_time(&tv, AVAHI_PROBE_INTERVAL_MSEC, 0));
+    } else {
+        avahi_time_event_free(g->probe_time_event);
+        g->probe_time_event = NULL;
+    }
+
+    /* This might call the group callback, so don't touch g afterwards */
+    if (probed)
+        avahi_s_entry_group_check_probed(g, 1);
+}
+
 void avahi_s_entry_group_check_probed(AvahiSEntryGroup *g, int immediately) {
     AvahiEntry *e;
     assert(g);
@@ -91,7 +184,7 @@ void avahi_s_entry_group_check_probed(AvahiSEntryGroup *g, int immediately) {
             if (a->state != AVAHI_WAITING)
                 continue;
 
-            a->state = AVAHI_ANNOUNCING;
+            set_state(a, AVAHI_ANNOUNCING);
 
             if (immediately) {
                 /* Shortcut */
@@ -128,9 +221,9 @@ static void next_state(AvahiAnnouncer *a) {
             }
 
             if (a->entry->group && a->entry->group->state == AVAHI_ENTRY_GROUP_REGISTERING)
-                a->state = AVAHI_WAITING;
+                set_state(a, AVAHI_WAITING);
             else {
-                a->state = AVAHI_ANNOUNCING;
+                set_state(a, AVAHI_ANNOUNCING);
                 a->n_iteration = 1;
             }
 
@@ -160,7 +253,7 @@ static void next_state(AvahiAnnouncer *a) {
         if (++a->n_iteration >= 4) {
             /* Announcing done */
 
-            a->state = AVAHI_ESTABLISHED;
+            set_state(a, AVAHI_ESTABLISHED);
 
             set_timeout(a, NULL);
         } else {
@@ -203,16 +296,16 @@ static void go_to_initial_state(AvahiAnnouncer *a) {
     e = a->entry;
 
     if ((e->flags & AVAHI_PUBLISH_UNIQUE) && !(e->flags & AVAHI_PUBLISH_NO_PROBE))
-        a->state = AVAHI_PROBING;
+        set_state(a, AVAHI_PROBING);
     else if (!(e->flags & AVAHI_PUBLISH_NO_ANNOUNCE)) {
 
         if (!e->group || e->group->state == AVAHI_ENTRY_GROUP_ESTABLISHED)
-            a->state = AVAHI_ANNOUNCING;
+            set_state(a, AVAHI_ANNOUNCING);
         else
-            a->state = AVAHI_WAITING;
+            set_state(a, AVAHI_WAITING);
 
     } else
-        a->state = AVAHI_ESTABLISHED;
+        set_state(a, AVAHI_ESTABLISHED);
 
     a->n_iteration = 1;
     a->sec_delay = 1;
@@ -220,7 +313,10 @@ static void go_to_initial_state(AvahiAnnouncer *a) {
     if (a->state == AVAHI_PROBING && e->group)
         e->group->n_probing++;
 
-    if (a->state == AVAHI_PROBING)
+    if (a->state == AVAHI_PROBING && is_group_probing(a)) {
+        set_timeout(a, NULL);
+        schedule_group_probe(e->group);
+    } else if (a->state == AVAHI_PROBING)
         set_timeout(a, avahi_elapse_time(&tv, 0, AVAHI_PROBE_JITTER_MSEC));
     else if (a->state == AVAHI_ANNOUNCING)
         set_timeout(a, avahi_elapse_time(&tv, 0, AVAHI_ANNOUNCEMENT_JITTER_MSEC));
@@ -352,66 +448,313 @@ void avahi_entry_return_to_initial_state(AvahiServer *s, AvahiEntry *e, AvahiInt
     go_to_initial_state(a);
 }
 
-static AvahiRecord *make_goodbye_record(AvahiRecord *r) {
-    AvahiRecord *g;
+static int goodbye_compare(const void *a, const void *b) {
+    const AvahiGoodbye *x = a, *y = b;
+    const char *nx, *ny;
+    int r;
 
-    assert(r);
+    if (x->interface != y->interface) {
+        if (x->interface->hardware->index != y->interface->hardware->index)
+            return x->interface->hardware->index < y->interface->hardware->index ? -1 : 1;
+
+        return x->interface->protocol < y->interface->protocol ? -1 : 1;
+    }
 
-    if (!(g = avahi_record_copy(r)))
-        return NULL; /* OOM */
+    /* Keep the records of each name together, this makes the packets
+     * easier to read and helps the name compression */
+    nx = AVAHI_KEY_PRIVATE(x->record->key)->canonical;
+    ny = AVAHI_KEY_PRIVATE(y->record->key)->canonical;
 
-    assert(g->ref == 1);
-    g->ttl = 0;
+    if (nx != ny && (r = strcmp(nx, ny)))
+        return r;
 
-    return g;
+    return avahi_record_lexicographical_compare(x->record, y->record);
 }
 
-static int is_duplicate_entry(AvahiServer *s, AvahiEntry *e) {
-    AvahiEntry *i;
+void avahi_goodbye_sort(AvahiGoodbye *g, unsigned n) {
+    assert(g || n == 0);
+
+    qsort(g, n, sizeof(AvahiGoodbye), goodbye_compare);
+}
+
+/* Returns nonzero if some entry other than e publishes r */
+static int is_still_published(AvahiServer *s, AvahiRecord *r, AvahiEntry *e) {
+    AvahiEntry *k;
 
     assert(s);
-    assert(e);
+    assert(r);
+
+    for (k = avahi_hashmap_lookup(s->entries_by_record, r); k; k = k->by_record_next)
+        if (!k->dead && k != e)
+            return 1;
+
+    return 0;
+}
 
-    for (i = avahi_hashmap_lookup(s->entries_by_key, e->record->key); i; i = i->by_key_next) {
+/* Drops goodbyes that are redundant, or that are for records which
+ * are still published by some other entry. g needs to be sorted,
+ * returns the new number of goodbyes. */
+static unsigned filter_goodbyes(AvahiServer *s, AvahiGoodbye *g, unsigned n) {
+    unsigned i, k = 0;
 
-        if ((i == e) || (i->dead))
+    assert(s);
+
+    for (i = 0; i < n; i++) {
+
+        /* The same record for the same interface twice */
+        if (k > 0 &&
+            g[k-1].interface == g[i].interface &&
+            avahi_record_equal_no_ttl(g[k-1].record, g[i].record)) {
+            g[k-1].flush_cache = g[k-1].flush_cache || g[i].flush_cache;
+            avahi_record_unref(g[i].record);
             continue;
+        }
 
-        if (!avahi_record_equal_no_ttl(i->record, e->record))
+        if (is_still_published(s, g[i].record, g[i].entry)) {
+            avahi_record_unref(g[i].record);
             continue;
+        }
 
-        return 1;
+        g[k++] = g[i];
     }
 
-    return 0;
+    return k;
+}
+
+unsigned avahi_goodbye_pack(AvahiGoodbye *g, unsigned n, size_t mtu, AvahiGoodbyePacketCallback callback, void *userdata) {
+    AvahiDnsPacket *p = NULL;
+    unsigned i, n_records = 0, n_packets = 0;
+
+    assert(g || n == 0);
+    assert(callback);
+
+    for (i = 0; i < n; i++) {
+
+        if (p && avahi_dns_packet_append_goodbye(p, g[i].record, g[i].flush_cache)) {
+            n_records++;
+            continue;
+        }
+
+        /* This one didn't fit anymore, so send what we have */
+        if (p) {
+            avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ANCOUNT, n_records);
+            callback(p, userdata);
+            n_packets++;
+        }
+
+        if (!(p = avahi_dns_packet_new_response(mtu, 1)))
+            return n_packets; /* OOM */
+
+        if (!avahi_dns_packet_append_goodbye(p, g[i].record, g[i].flush_cache)) {
+            size_t size;
+
+            /* The packet is too small for this record, so create one
+             * that fits */
+            avahi_dns_packet_free(p);
+
+            size = avahi_record_get_estimate_size(g[i].record) + AVAHI_DNS_PACKET_HEADER_SIZE;
+
+            if (!(p = avahi_dns_packet_new_response(size + AVAHI_DNS_PACKET_EXTRA_SIZE, 1)))
+                return n_packets; /* OOM */
+
+            if (!avahi_dns_packet_append_goodbye(p, g[i].record, g[i].flush_cache)) {
+                avahi_log_warn("Record too large, cannot send goodbye");
+                avahi_dns_packet_free(p);
+                p = NULL;
+                continue;
+            }
+        }
+
+        n_records = 1;
+    }
+
+    if (p) {
+        avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ANCOUNT, n_records);
+        callback(p, userdata);
+        n_packets++;
+    }
+
+    return n_packets;
+}
+
+static void goodbye_elapse(AvahiTimeEvent *e, void *userdata);
+
+/* Sends as many of the queued goodbye packets of i as the rate limit
+ * allows, and schedules the rest for later */
+static void send_queued_goodbyes(AvahiInterface *i, int force) {
+    struct timeval tv;
+    unsigned j;
+
+    assert(i);
+
+    for (j = 0; j < i->n_goodbye_packets; j++) {
+        if (!force && avahi_interface_ratelimit_check(i, &tv) < 0)
+            break;
+
+        avahi_interface_send_packet_unlimited(i, i->goodbye_packets[j]);
+        avahi_dns_packet_free(i->goodbye_packets[j]);
+    }
+
+    if (j > 0) {
+        memmove(i->goodbye_packets, i->goodbye_packets + j, (i->n_goodbye_packets - j) * sizeof(AvahiDnsPacket*));
+        i->n_goodbye_packets -= j;
+    }
+
+    if (i->n_goodbye_packets == 0) {
+        if (i->goodbye_time_event) {
+            avahi_time_event_free(i->goodbye_time_event);
+            i->goodbye_time_event = NULL;
+        }
+
+        return;
+    }
+
+    if (i->goodbye_time_event)
+        avahi_time_event_update(i->goodbye_time_event, &tv);
+    else
+        i->goodbye_time_event = avahi_time_event_new(i->monitor->server->time_event_queue, &tv, goodbye_elapse, i);
+}
+
+static void goodbye_elapse(AVAHI_GCC_UNUSED AvahiTimeEvent *e, void *userdata) {
+    send_queued_goodbyes(userdata, 0);
+}
+
+static void force_goodbyes(AvahiInterface *i) {
+    assert(i);
+
+    send_queued_goodbyes(i, 1);
+
+    avahi_free(i->goodbye_packets);
+    i->goodbye_packets = NULL;
+    i->n_goodbye_packets = i->n_goodbye_packets_allocated = 0;
+}
+
+static void send_goodbye_packet(AvahiDnsPacket *p, void *userdata) {
+    AvahiInterface *i = userdata;
+
+    if (i->n_goodbye_packets >= i->n_goodbye_packets_allocated) {
+        unsigned n = i->n_goodbye_packets_allocated ? i->n_goodbye_packets_allocated * 2 : 16;
+        AvahiDnsPacket **packets;
+
+        if (!(packets = avahi_realloc(i->goodbye_packets, n * sizeof(AvahiDnsPacket*)))) {
+            avahi_log_error(__FILE__": Out of memory");
+            avahi_dns_packet_free(p);
+            return;
+        }
+
+        i->goodbye_packets = packets;
+        i->n_goodbye_packets_allocated = n;
+    }
+
+    i->goodbye_packets[i->n_goodbye_packets++] = p;
+}
+
+/* Sends the collected goodbyes for interface i, or for all
+ * interfaces if i is NULL */
+static void flush_goodbyes(AvahiServer *s, AvahiInterface *i) {
+    AvahiGoodbye *g;
+    unsigned n, j, k;
+
+    assert(s);
+
+    if (s->n_goodbyes == 0)
+        return;
+
+    /* Move the goodbyes to flush to the front */
+    if (i) {
+        for (j = 0, k = 0; j < s->n_goodbyes; j++)
+            if (s->goodbyes[j].interface == i) {
+                AvahiGoodbye t = s->goodbyes[k];
+                s->goodbyes[k++] = s->goodbyes[j];
+                s->goodbyes[j] = t;
+            }
+
+        n = k;
+    } else
+        n = s->n_goodbyes;
+
+    g = s->goodbyes;
+
+    avahi_goodbye_sort(g, n);
+    k = filter_goodbyes(s, g, n);
+
+    for (j = 0; j < k; ) {
+        AvahiInterface *interface = g[j].interface;
+        unsigned l;
+
+        for (l = j; l < k && g[l].interface == interface; l++)
+            /* Any pending announcement of this record is obsolete now */
+            avahi_response_scheduler_withdraw(interface->response_scheduler, g[l].record);
+
+        avahi_goodbye_pack(g + j, l - j, interface->hardware->mtu, send_goodbye_packet, interface);
+
+        /* Only send what the rate limit allows now, the rest follows
+         * from a time event */
+        send_queued_goodbyes(interface, 0);
+
+        for (; j < l; j++)
+            avahi_record_unref(g[j].record);
+    }
+
+    memmove(s->goodbyes, s->goodbyes + n, (s->n_goodbyes - n) * sizeof(AvahiGoodbye));
+    s->n_goodbyes -= n;
 }
 
 static void send_goodbye_callback(AvahiInterfaceMonitor *m, AvahiInterface *i, void* userdata) {
     AvahiEntry *e = userdata;
-    AvahiRecord *g;
+    AvahiServer *s;
+    AvahiGoodbye *g;
 
     assert(m);
     assert(i);
     assert(e);
     assert(!e->dead);
 
+    s = m->server;
+
+    if (!i->announcing)
+        return;
+
     if (!avahi_interface_match(i, e->interface, e->protocol))
         return;
 
     if (e->flags & AVAHI_PUBLISH_NO_ANNOUNCE)
         return;
 
-    if (!avahi_entry_is_registered(m->server, e, i))
+    if (!avahi_entry_is_registered(s, e, i))
         return;
 
-    if (is_duplicate_entry(m->server, e))
-        return;
+    if (s->n_goodbyes >= s->n_goodbyes_allocated) {
+        unsigned n = s->n_goodbyes_allocated ? s->n_goodbyes_allocated * 2 : 64;
+
+        if (!(g = avahi_realloc(s->goodbyes, n * sizeof(AvahiGoodbye)))) {
+            avahi_log_error(__FILE__": Out of memory");
+            return;
+        }
+
+        s->goodbyes = g;
+        s->n_goodbyes_allocated = n;
+    }
+
+    g = s->goodbyes + s->n_goodbyes++;
+    g->interface = i;
+    g->entry = e;
+    g->record = avahi_record_ref(e->record);
+    g->flush_cache = !!(e->flags & AVAHI_PUBLISH_UNIQUE);
+}
+
+void avahi_goodbye_batch_begin(AvahiServer *s) {
+    assert(s);
+
+    s->goodbye_batch++;
+}
 
-    if (!(g = make_goodbye_record(e->record)))
-        return; /* OOM */
+void avahi_goodbye_batch_end(AvahiServer *s) {
+    assert(s);
+    assert(s->goodbye_batch > 0);
 
-    avahi_interface_post_response(i, g, e->flags & AVAHI_PUBLISH_UNIQUE, NULL, 1);
-    avahi_record_unref(g);
+    if (--s->goodbye_batch == 0)
+        flush_goodbyes(s, NULL);
 }
 
 static void reannounce(AvahiAnnouncer *a) {
@@ -434,21 +777,21 @@ static void reannounce(AvahiAnnouncer *a) {
 
         /* We were probing or waiting after probe, so we restart probing from the beginning here */
 
-        a->state = AVAHI_PROBING;
+        set_state(a, AVAHI_PROBING);
     else if (a->state == AVAHI_WAITING)
 
         /* We were waiting, but were not probing before, so we continue waiting  */
-        a->state = AVAHI_WAITING;
+        set_state(a, AVAHI_WAITING);
 
     else if (e->flags & AVAHI_PUBLISH_NO_ANNOUNCE)
 
         /* No announcer needed */
-        a->state = AVAHI_ESTABLISHED;
+        set_state(a, AVAHI_ESTABLISHED);
 
     else {
 
         /* Ok, let's restart announcing */
-        a->state = AVAHI_ANNOUNCING;
+        set_state(a, AVAHI_ANNOUNCING);
     }
 
     /* Now let's increase the probing counter again */
@@ -458,7 +801,10 @@ static void reannounce(AvahiAnnouncer *a) {
     a->n_iteration = 1;
     a->sec_delay = 1;
 
-    if (a->state == AVAHI_PROBING)
+    if (a->state == AVAHI_PROBING && is_group_probing(a)) {
+        set_timeout(a, NULL);
+        schedule_group_probe(e->group);
+    } else if (a->state == AVAHI_PROBING)
         set_timeout(a, avahi_elapse_time(&tv, 0, AVAHI_PROBE_JITTER_MSEC));
     else if (a->state == AVAHI_ANNOUNCING)
         set_timeout(a, avahi_elapse_time(&tv, 0, AVAHI_ANNOUNCEMENT_JITTER_MSEC));
@@ -499,14 +845,25 @@ void avahi_goodbye_interface(AvahiServer *s, AvahiInterface *i, int send_goodbye
         if (i->announcing) {
             AvahiEntry *e;
 
+            avahi_goodbye_batch_begin(s);
             for (e = s->entries; e; e = e->entries_next)
                 if (!e->dead)
                     send_goodbye_callback(s->monitor, i, e);
+            avahi_goodbye_batch_end(s);
         }
 
-    if (remove)
+    /* The interface might go away before the current batch is
+     * closed, so don't wait for that. */
+    flush_goodbyes(s, i);
+
+    if (remove) {
+        /* No time event will be around to send the rest of the queue
+         * later, so send it right away */
+        force_goodbyes(i);
+
         while (i->announcers)
             remove_announcer(s, i->announcers);
+    }
 }
 
 void avahi_goodbye_entry(AvahiServer *s, AvahiEntry *e, int send_goodbye, int remove) {
@@ -514,9 +871,13 @@ void avahi_goodbye_entry(AvahiServer *s, AvahiEntry *e, int send_goodbye, int re
     assert(e);
 
     if (send_goodbye)
-        if (!e->dead)
+        if (!e->dead) {
             avahi_interface_monitor_walk(s->monitor, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, send_goodbye_callback, e);
 
+            if (!s->goodbye_batch)
+                flush_goodbyes(s, NULL);
+        }
+
     if (remove)
         while (e->announcers)
             remove_announcer(s, e->announcers);
@@ -24,6 +24,7 @@ typedef struct AvahiAnnouncer AvahiAnnouncer;
 
 #include <avahi-common/llist.h>
 #include "iface.h"
+#include "dns.h"
 #include "internal.h"
 #include "timeeventq.h"
 #include "publish.h"
@@ -64,6 +65,33 @@ int avahi_entry_is_probing(AvahiServer *s, AvahiEntry *e, AvahiInterface *i);
 void avahi_goodbye_interface(AvahiServer *s, AvahiInterface *i, int send_goodbye, int rem);
 void avahi_goodbye_entry(AvahiServer *s, AvahiEntry *e, int send_goodbye, int rem);
 
+/* Goodbyes for entries removed between these two calls are sent
+ * together, densely packed. Batches may be nested. */
+void avahi_goodbye_batch_begin(AvahiServer *s);
+void avahi_goodbye_batch_end(AvahiServer *s);
+
+struct AvahiGoodbye {
+    AvahiInterface *interface;
+
+    /* Only compared against, this might be freed before the goodbye
+     * is sent */
+    AvahiEntry *entry;
+
+    AvahiRecord *record;
+    int flush_cache;
+};
+
+/* Sorts goodbyes by interface and name */
+void avahi_goodbye_sort(AvahiGoodbye *g, unsigned n);
+
+typedef void (*AvahiGoodbyePacketCallback)(AvahiDnsPacket *p, void *userdata);
+
+/* Packs the goodbye records of g into as few packets of at most mtu
+ * bytes as possible, in order, and passes each of them to
+ * callback, which takes ownership of the packet. The interface field
+ * is ignored. Returns the number of packets. */
+unsigned avahi_goodbye_pack(AvahiGoodbye *g, unsigned n, size_t mtu, AvahiGoodbyePacketCallback callback, void *userdata);
+
 void avahi_reannounce_entry(AvahiServer *s, AvahiEntry *e);
 
 #endif
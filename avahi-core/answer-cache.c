@@ -0,0 +1,280 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avahi-common/malloc.h>
+
+#include "answer-cache.h"
+#include "hashmap.h"
+#include "log.h"
+#include "rr-util.h"
+
+typedef struct AvahiAnswerSet {
+    AvahiRecord **records;
+    int *flush_cache;
+    unsigned n_records, n_allocated;
+} AvahiAnswerSet;
+
+struct AvahiAnswerCache {
+    AvahiServer *server;
+    AvahiInterface *interface;
+
+    /* AvahiKey -> AvahiAnswerSet of the answers */
+    AvahiHashmap *answers;
+
+    /* AvahiRecord -> AvahiAnswerSet of its auxiliary records */
+    AvahiHashmap *aux_records;
+
+    unsigned n_entries;
+    unsigned serial;
+
+    unsigned hits, misses, flushes;
+};
+
+static void answer_set_free(AvahiAnswerSet *set) {
+    unsigned n;
+
+    assert(set);
+
+    for (n = 0; n < set->n_records; n++)
+        avahi_record_unref(set->records[n]);
+
+    avahi_free(set->records);
+    avahi_free(set->flush_cache);
+    avahi_free(set);
+}
+
+static void collect_callback(AVAHI_GCC_UNUSED AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata) {
+    AvahiAnswerSet **set = userdata;
+
+    assert(r);
+    assert(set);
+
+    /* Bail out on OOM, see below */
+    if (!*set)
+        return;
+
+    if ((*set)->n_records >= (*set)->n_allocated) {
+        unsigned n = (*set)->n_allocated ? (*set)->n_allocated * 2 : 4;
+        AvahiRecord **records;
+        int *flush;
+
+        if (!(records = avahi_realloc((*set)->records, sizeof(AvahiRecord*) * n)))
+            goto fail;
+        (*set)->records = records;
+
+        if (!(flush = avahi_realloc((*set)->flush_cache, sizeof(int) * n)))
+            goto fail;
+        (*set)->flush_cache = flush;
+
+        (*set)->n_allocated = n;
+    }
+
+    (*set)->records[(*set)->n_records] = avahi_record_ref(r);
+    (*set)->flush_cache[(*set)->n_records] = flush_cache;
+    (*set)->n_records++;
+
+    return;
+
+fail:
+    avahi_log_error(__FILE__": Out of memory");
+    answer_set_free(*set);
+    *set = NULL;
+}
+
+static int create_maps(AvahiAnswerCache *c) {
+    assert(c);
+
+    c->answers = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, (AvahiFreeFunc) avahi_key_unref, (AvahiFreeFunc) answer_set_free);
+    c->aux_records = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash, (AvahiEqualFunc) avahi_record_equal_no_ttl, (AvahiFreeFunc) avahi_record_unref, (AvahiFreeFunc) answer_set_free);
+
+    if (!c->answers || !c->aux_records) {
+        if (c->answers)
+            avahi_hashmap_free(c->answers);
+        if (c->aux_records)
+            avahi_hashmap_free(c->aux_records);
+
+        c->answers = c->aux_records = NULL;
+        return -1;
+    }
+
+    c->n_entries = 0;
+    c->serial = c->server->answer_serial;
+    return 0;
+}
+
+static void free_maps(AvahiAnswerCache *c) {
+    assert(c);
+
+    if (c->answers)
+        avahi_hashmap_free(c->answers);
+    if (c->aux_records)
+        avahi_hashmap_free(c->aux_records);
+
+    c->answers = c->aux_records = NULL;
+}
+
+AvahiAnswerCache *avahi_answer_cache_new(AvahiInterface *i) {
+    AvahiAnswerCache *c;
+
+    assert(i);
+
+    if (!(c = avahi_new(AvahiAnswerCache, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    c->server = i->monitor->server;
+    c->interface = i;
+    c->hits = c->misses = c->flushes = 0;
+
+    if (create_maps(c) < 0) {
+        avahi_log_error(__FILE__": Out of memory");
+        avahi_free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void avahi_answer_cache_free(AvahiAnswerCache *c) {
+    assert(c);
+
+    free_maps(c);
+    avahi_free(c);
+}
+
+/* Makes sure the maps are up to date and have room for another
+ * entry. Returns -1 if nothing may be cached right now. */
+static int prepare(AvahiAnswerCache *c) {
+    assert(c);
+
+    if (c->answers && c->serial == c->server->answer_serial && c->n_entries < AVAHI_ANSWER_CACHE_ENTRIES_MAX)
+        return 0;
+
+    if (c->answers && c->n_entries > 0)
+        c->flushes++;
+
+    free_maps(c);
+    return create_maps(c);
+}
+
+static void walk_set(AvahiAnswerCache *c, AvahiAnswerSet *set, AvahiServerRecordCallback callback, void* userdata) {
+    unsigned n;
+
+    assert(c);
+    assert(set);
+    assert(callback);
+
+    for (n = 0; n < set->n_records; n++)
+        callback(c->server, set->records[n], set->flush_cache[n], userdata);
+}
+
+void avahi_answer_cache_walk_answers(AvahiAnswerCache *c, AvahiKey *k, AvahiServerRecordCallback callback, void* userdata) {
+    AvahiAnswerSet *set;
+
+    assert(c);
+    assert(k);
+    assert(callback);
+
+    if (prepare(c) < 0) {
+        avahi_server_find_matching_records(c->server, c->interface, k, callback, userdata);
+        return;
+    }
+
+    if ((set = avahi_hashmap_lookup(c->answers, k))) {
+        c->hits++;
+        walk_set(c, set, callback, userdata);
+        return;
+    }
+
+    c->misses++;
+
+    if ((set = avahi_new0(AvahiAnswerSet, 1)))
+        avahi_server_find_matching_records(c->server, c->interface, k, collect_callback, &set);
+
+    if (!set) {
+        avahi_server_find_matching_records(c->server, c->interface, k, callback, userdata);
+        return;
+    }
+
+    avahi_hashmap_insert(c->answers, avahi_key_ref(k), set);
+    c->n_entries++;
+
+    walk_set(c, set, callback, userdata);
+}
+
+void avahi_answer_cache_walk_aux_records(AvahiAnswerCache *c, AvahiRecord *r, AvahiServerRecordCallback callback, void* userdata) {
+    AvahiAnswerSet *set;
+
+    assert(c);
+    assert(r);
+    assert(callback);
+
+    if (prepare(c) < 0) {
+        avahi_server_find_aux_records(c->server, c->interface, r, callback, userdata);
+        return;
+    }
+
+    if ((set = avahi_hashmap_lookup(c->aux_records, r))) {
+        c->hits++;
+        walk_set(c, set, callback, userdata);
+        return;
+    }
+
+    c->misses++;
+
+    if ((set = avahi_new0(AvahiAnswerSet, 1)))
+        avahi_server_find_aux_records(c->server, c->interface, r, collect_callback, &set);
+
+    if (!set) {
+        avahi_server_find_aux_records(c->server, c->interface, r, callback, userdata);
+        return;
+    }
+
+    avahi_hashmap_insert(c->aux_records, avahi_record_ref(r), set);
+    c->n_entries++;
+
+    walk_set(c, set, callback, userdata);
+}
+
+int avahi_answer_cache_dump(AvahiAnswerCache *c, AvahiDumpCallback callback, void* userdata) {
+    char ln[256];
+    unsigned total;
+
+    assert(c);
+    assert(callback);
+
+    total = c->hits + c->misses;
+
+    snprintf(ln, sizeof(ln), ";;; Answer cache: %u hits, %u misses (%u%% hit rate), %u flushes, %u entries",
+             c->hits, c->misses,
+             total > 0 ? (unsigned) ((100ULL * c->hits) / total) : 0,
+             c->flushes,
+             c->serial == c->server->answer_serial ? c->n_entries : 0);
+
+    callback(ln, userdata);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef fooanswercachehfoo
+#define fooanswercachehfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+typedef struct AvahiAnswerCache AvahiAnswerCache;
+
+#include "core.h"
+#include "rr.h"
+#include "iface.h"
+
+typedef void (*AvahiServerRecordCallback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata);
+
+/* Don't remember answers for more keys or records than this per
+ * interface, everything is forgotten when it is reached */
+#define AVAHI_ANSWER_CACHE_ENTRIES_MAX 1024
+
+/* The per-interface memo of the local records we answer a query for
+ * a key with, and of the auxiliary records that go with each of
+ * them. It is flushed whenever the server's answer_serial changes. */
+
+AvahiAnswerCache *avahi_answer_cache_new(AvahiInterface *i);
+void avahi_answer_cache_free(AvahiAnswerCache *c);
+
+/* Like avahi_server_find_matching_records(), but served from the cache if possible */
+void avahi_answer_cache_walk_answers(AvahiAnswerCache *c, AvahiKey *k, AvahiServerRecordCallback callback, void* userdata);
+
+/* Like avahi_server_find_aux_records(), but served from the cache if possible */
+void avahi_answer_cache_walk_aux_records(AvahiAnswerCache *c, AvahiRecord *r, AvahiServerRecordCallback callback, void* userdata);
+
+int avahi_answer_cache_dump(AvahiAnswerCache *c, AvahiDumpCallback callback, void* userdata);
+
+#endif
@@ -22,6 +22,7 @@
 #endif
 
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -31,6 +32,15 @@
 #include "cache.h"
 #include "log.h"
 #include "rr-util.h"
+#include "querier.h"
+
+/* How long restored entries may stay in the cache without being
+ * confirmed by a response */
+#define AVAHI_CACHE_RESTORE_VERIFY_MSEC 3000
+
+/* How many of the least recently seen entries we look at when
+ * searching for one that nobody is interested in */
+#define AVAHI_CACHE_EVICT_SCAN_MAX 32
 
 static void remove_entry(AvahiCache *c, AvahiCacheEntry *e) {
     AvahiCacheEntry *t;
@@ -49,6 +59,8 @@ static void remove_entry(AvahiCache *c, AvahiCacheEntry *e) {
         avahi_hashmap_remove(c->hashmap, e->record->key);
 
     /* Remove from linked list */
+    if (c->entries_tail == e)
+        c->entries_tail = e->entry_prev;
     AVAHI_LLIST_REMOVE(AvahiCacheEntry, entry, c->entries, e);
 
     if (e->time_event)
@@ -58,6 +70,8 @@ static void remove_entry(AvahiCache *c, AvahiCacheEntry *e) {
 
     avahi_record_unref(e->record);
 
+    c->server->cache_serial++;
+
     avahi_free(e);
 
     assert(c->n_entries >= 1);
@@ -83,7 +97,9 @@ AvahiCache *avahi_cache_new(AvahiServer *server, AvahiInterface *iface) {
     }
 
     AVAHI_LLIST_HEAD_INIT(AvahiCacheEntry, c->entries);
+    c->entries_tail = NULL;
     c->n_entries = 0;
+    c->n_evicted = c->n_rejected = 0;
 
     c->last_rand_timestamp = 0;
 
@@ -179,6 +195,7 @@ static void elapse_func(AvahiTimeEvent *t, void *userdata) {
         case AVAHI_CACHE_POOF_FINAL:
         case AVAHI_CACHE_GOODBYE_FINAL:
         case AVAHI_CACHE_REPLACE_FINAL:
+        case AVAHI_CACHE_RESTORED:
 
             remove_entry(e->cache, e);
 
@@ -263,6 +280,91 @@ static void next_expiry(AvahiCache *c, AvahiCacheEntry *e, unsigned percent) {
     update_time_event(c, e);
 }
 
+/* Mark the entry as the most recently seen one */
+static void touch_entry(AvahiCache *c, AvahiCacheEntry *e) {
+    assert(c);
+    assert(e);
+
+    if (c->entries == e)
+        return;
+
+    if (c->entries_tail == e)
+        c->entries_tail = e->entry_prev;
+
+    AVAHI_LLIST_REMOVE(AvahiCacheEntry, entry, c->entries, e);
+    AVAHI_LLIST_PREPEND(AvahiCacheEntry, entry, c->entries, e);
+}
+
+/* Make room for one entry by dropping the least recently seen entry,
+ * preferring entries that are about to go away anyway or that no
+ * browser is interested in */
+static void evict_entry(AvahiCache *c) {
+    AvahiCacheEntry *e;
+    unsigned n;
+
+    assert(c);
+    assert(c->entries_tail);
+
+    for (e = c->entries_tail, n = 0; e && n < AVAHI_CACHE_EVICT_SCAN_MAX; e = e->entry_prev, n++)
+        if ((e->state != AVAHI_CACHE_VALID && e->state != AVAHI_CACHE_EXPIRY1) ||
+            !avahi_querier_is_subscribed(c->interface, e->record->key))
+            break;
+
+    if (!e || n >= AVAHI_CACHE_EVICT_SCAN_MAX)
+        e = c->entries_tail;
+
+    avahi_querier_cache_incomplete(c->interface, e->record->key);
+    remove_entry(c, e);
+
+    c->n_evicted++;
+    c->server->cache_evicted++;
+}
+
+static AvahiCacheEntry *add_entry(AvahiCache *c, AvahiRecord *r) {
+    AvahiCacheEntry *e, *first;
+
+    assert(c);
+    assert(r);
+
+    if (c->n_entries >= c->server->config.n_cache_entries_max) {
+
+        if (c->n_entries == 0) {
+            c->n_rejected++;
+            c->server->cache_rejected++;
+            return NULL;
+        }
+
+        while (c->n_entries >= c->server->config.n_cache_entries_max)
+            evict_entry(c);
+    }
+
+    if (!(e = avahi_new(AvahiCacheEntry, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    e->cache = c;
+    e->time_event = NULL;
+    e->record = avahi_record_ref(r);
+
+    /* Append to hash table */
+    first = lookup_key(c, r->key);
+    AVAHI_LLIST_PREPEND(AvahiCacheEntry, by_key, first, e);
+    avahi_hashmap_replace(c->hashmap, e->record->key, first);
+
+    /* Append to linked list */
+    if (!c->entries_tail)
+        c->entries_tail = e;
+    AVAHI_LLIST_PREPEND(AvahiCacheEntry, entry, c->entries, e);
+
+    c->n_entries++;
+
+    /* Notify subscribers */
+    avahi_multicast_lookup_engine_notify(c->server->multicast_lookup_engine, c->interface, e->record, AVAHI_BROWSER_NEW);
+
+    return e;
+}
+
 static void expire_in_one_second(AvahiCache *c, AvahiCacheEntry *e, AvahiCacheEntryState state) {
     assert(c);
     assert(e);
@@ -331,6 +433,8 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
             avahi_record_unref(e->record);
             e->record = avahi_record_ref(r);
 
+            touch_entry(c, e);
+
 /*             avahi_log_debug("cache: updating %s", txt);   */
 
         } else {
@@ -338,29 +442,8 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
 
 /*             avahi_log_debug("cache: couldn't find matching cache entry for %s", txt);   */
 
-            if (c->n_entries >= c->server->config.n_cache_entries_max)
+            if (!(e = add_entry(c, r)))
                 return;
-
-            if (!(e = avahi_new(AvahiCacheEntry, 1))) {
-                avahi_log_error(__FILE__": Out of memory");
-                return;
-            }
-
-            e->cache = c;
-            e->time_event = NULL;
-            e->record = avahi_record_ref(r);
-
-            /* Append to hash table */
-            AVAHI_LLIST_PREPEND(AvahiCacheEntry, by_key, first, e);
-            avahi_hashmap_replace(c->hashmap, e->record->key, first);
-
-            /* Append to linked list */
-            AVAHI_LLIST_PREPEND(AvahiCacheEntry, entry, c->entries, e);
-
-            c->n_entries++;
-
-            /* Notify subscribers */
-            avahi_multicast_lookup_engine_notify(c->server->multicast_lookup_engine, c->interface, e->record, AVAHI_BROWSER_NEW);
         }
 
         e->origin = *a;
@@ -368,11 +451,60 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
         next_expiry(c, e, 80);
         e->state = AVAHI_CACHE_VALID;
         e->cache_flush = cache_flush;
+
+        c->server->cache_serial++;
+
+        avahi_querier_answered(c->interface, r->key);
     }
 
 /*     avahi_free(txt);  */
 }
 
+int avahi_cache_restore(AvahiCache *c, AvahiRecord *r) {
+    AvahiCacheEntry *e;
+    AvahiUsec usec;
+
+    assert(c);
+    assert(r && r->ref >= 1);
+    assert(r->ttl > 0);
+
+    /* Never replace what we learned from the network */
+    if (lookup_record(c, r))
+        return 0;
+
+    /* Unconfirmed data doesn't push out anything */
+    if (c->n_entries >= c->server->config.n_cache_entries_max) {
+        c->n_rejected++;
+        c->server->cache_rejected++;
+        return 0;
+    }
+
+    if (!(e = add_entry(c, r)))
+        return -1;
+
+    memset(&e->origin, 0, sizeof(e->origin));
+    e->origin.proto = c->interface->protocol;
+    e->cache_flush = 0;
+    e->state = AVAHI_CACHE_RESTORED;
+    gettimeofday(&e->timestamp, NULL);
+
+    usec = (AvahiUsec) r->ttl * 1000000;
+    if (usec > (AvahiUsec) AVAHI_CACHE_RESTORE_VERIFY_MSEC * 1000)
+        usec = (AvahiUsec) AVAHI_CACHE_RESTORE_VERIFY_MSEC * 1000;
+
+    e->expiry = e->timestamp;
+    avahi_timeval_add(&e->expiry, usec);
+    update_time_event(c, e);
+
+    /* The query scheduler merges these into as few packets as
+     * possible */
+    avahi_interface_post_query(c->interface, r->key, 0, NULL);
+
+    c->server->cache_serial++;
+
+    return 0;
+}
+
 struct dump_data {
     AvahiDumpCallback callback;
     void* userdata;
@@ -400,12 +532,16 @@ static void dump_callback(void* key, void* data, void* userdata) {
 
 int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata) {
     struct dump_data data;
+    char t[128];
 
     assert(c);
     assert(callback);
 
     callback(";;; CACHE DUMP FOLLOWS ;;;", userdata);
 
+    snprintf(t, sizeof(t), ";;; %u entries, %u evicted, %u rejected", c->n_entries, c->n_evicted, c->n_rejected);
+    callback(t, userdata);
+
     data.callback = callback;
     data.userdata = userdata;
 
@@ -414,6 +550,46 @@ int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata)
     return 0;
 }
 
+void avahi_cache_walk_records(AvahiCache *c, AvahiCacheRecordCallback callback, void* userdata) {
+    AvahiCacheEntry *e;
+    struct timeval now;
+
+    assert(c);
+    assert(callback);
+
+    gettimeofday(&now, NULL);
+
+    for (e = c->entries; e; e = e->entry_next) {
+        AvahiLookupResultFlags flags = 0;
+        AvahiUsec age;
+
+        /* Entries in one of the final states are about to go away */
+        if (e->state == AVAHI_CACHE_EXPIRY_FINAL ||
+            e->state == AVAHI_CACHE_POOF_FINAL ||
+            e->state == AVAHI_CACHE_GOODBYE_FINAL ||
+            e->state == AVAHI_CACHE_REPLACE_FINAL)
+            continue;
+
+        /* Restored entries are only guesses until a response confirms
+         * them, which bumps the cache serial */
+        if (e->state == AVAHI_CACHE_RESTORED)
+            continue;
+
+        age = avahi_timeval_diff(&now, &e->timestamp) / 1000000;
+
+        if (age < 0)
+            age = 0;
+
+        if ((AvahiUsec) e->record->ttl <= age)
+            continue;
+
+        if (avahi_server_is_record_local(c->server, c->interface->hardware->index, c->interface->protocol, e->record))
+            flags |= AVAHI_LOOKUP_RESULT_LOCAL;
+
+        callback(c->interface->hardware->index, c->interface->protocol, e->record, e->record->ttl - (uint32_t) age, flags, userdata);
+    }
+}
+
 int avahi_cache_entry_half_ttl(AvahiCache *c, AvahiCacheEntry *e) {
     struct timeval now;
     unsigned age;
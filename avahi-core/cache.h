@@ -37,7 +37,8 @@ typedef enum {
     AVAHI_CACHE_POOF,       /* Passive observation of failure */
     AVAHI_CACHE_POOF_FINAL,
     AVAHI_CACHE_GOODBYE_FINAL,
-    AVAHI_CACHE_REPLACE_FINAL
+    AVAHI_CACHE_REPLACE_FINAL,
+    AVAHI_CACHE_RESTORED    /* Restored from a saved cache, not confirmed yet */
 } AvahiCacheEntryState;
 
 typedef struct AvahiCacheEntry AvahiCacheEntry;
@@ -69,10 +70,16 @@ struct AvahiCache {
 
     AvahiHashmap *hashmap;
 
+    /* Ordered by the time an entry was last seen, most recent first */
     AVAHI_LLIST_HEAD(AvahiCacheEntry, entries);
+    AvahiCacheEntry *entries_tail;
 
     unsigned n_entries;
 
+    /* Entries dropped to make room for new ones, and new entries that
+     * were not admitted because the cache was full */
+    unsigned n_evicted, n_rejected;
+
     int last_rand;
     time_t last_rand_timestamp;
 };
@@ -82,8 +89,15 @@ void avahi_cache_free(AvahiCache *c);
 
 void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const AvahiAddress *a);
 
+/* Add a record from a saved cache and query for it right away. If
+ * nobody confirms it within a few seconds it is removed again. */
+int avahi_cache_restore(AvahiCache *c, AvahiRecord *r);
+
 int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata);
 
+/* Call the callback for each live entry, passing the remaining TTL */
+void avahi_cache_walk_records(AvahiCache *c, AvahiCacheRecordCallback callback, void* userdata);
+
 typedef void* AvahiCacheWalkCallback(AvahiCache *c, AvahiKey *pattern, AvahiCacheEntry *e, void* userdata);
 void* avahi_cache_walk(AvahiCache *c, AvahiKey *pattern, AvahiCacheWalkCallback cb, void* userdata);
 
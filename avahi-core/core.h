@@ -69,6 +69,10 @@ typedef struct AvahiServerConfig {
     unsigned n_cache_entries_max;     /**< Maximum number of cache entries per interface */
     AvahiUsec ratelimit_interval;     /**< If non-zero, rate-limiting interval parameter. */
     unsigned ratelimit_burst;         /**< If ratelimit_interval is non-zero, rate-limiting burst parameter. */
+    unsigned source_ratelimit_rate;   /**< If non-zero, process at most this many incoming packets per second from each source address. \since 0.7 */
+    unsigned source_ratelimit_burst;  /**< If source_ratelimit_rate is non-zero, how many packets a source may send at once. Defaults to source_ratelimit_rate if zero. \since 0.7 */
+    unsigned n_parse_threads;         /**< If non-zero, receive and parse incoming multicast packets in this many worker threads. The server itself still runs in the main loop only. \since 0.7 */
+    int group_probing;                /**< Probe for all unique records of an entry group at the same time, so that they share probe packets. \since 0.7 */
 } AvahiServerConfig;
 
 /** Allocate a new mDNS responder object. */
@@ -145,6 +149,33 @@ typedef void (*AvahiDumpCallback)(const char *text, void* userdata);
 /** Dump the current server status by calling "callback" for each line.  */
 int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata);
 
+/** Callback prototype for avahi_server_walk_caches(). ttl is the
+ * number of seconds the record has left to live in the cache. \since 0.7 */
+typedef void (*AvahiCacheRecordCallback)(AvahiIfIndex interface, AvahiProtocol protocol, AvahiRecord *record, uint32_t ttl, AvahiLookupResultFlags flags, void* userdata);
+
+/** Call "callback" for every record currently stored in the
+ * per-interface mDNS caches. Records restored from a saved cache
+ * are left out until a response confirms them. \since 0.7 */
+int avahi_server_walk_caches(AvahiServer *s, AvahiCacheRecordCallback callback, void* userdata);
+
+/** Return a counter that is incremented each time a record is added
+ * to, refreshed in or removed from one of the mDNS caches. May be used
+ * to skip redundant calls to avahi_server_walk_caches(). \since 0.7 */
+unsigned avahi_server_get_cache_serial(AvahiServer *s);
+
+/** Return how many records were dropped from the mDNS caches to make
+ * room for new ones, and how many were not cached because the cache
+ * was full. \since 0.7 */
+void avahi_server_get_cache_stats(AvahiServer *s, unsigned *ret_evicted, unsigned *ret_rejected);
+
+/** Add a record to the mDNS cache of the specified interface, for
+ * restoring caches saved by a previous instance of the server. The
+ * record's TTL should be set to the time it has left to live. The
+ * record is reported to browsers right away, but it is queried for
+ * at the same time and dropped from the cache again unless it is
+ * confirmed within a few seconds. \since 0.7 */
+int avahi_server_restore_cache_record(AvahiServer *s, AvahiIfIndex interface, AvahiProtocol protocol, AvahiRecord *record);
+
 /** Return the last error code */
 int avahi_server_errno(AvahiServer *s);
 
@@ -35,6 +35,47 @@
 
 #include "dns.h"
 #include "log.h"
+#include "rr-util.h"
+
+/* A domain name in uncompressed wire format, together with the
+ * offsets at which each of its labels (and hence each of its
+ * suffixes) starts */
+typedef struct AvahiWireName {
+    uint8_t *wire;
+    uint16_t size;
+    uint8_t n_labels;
+    uint8_t *label_wire;
+} AvahiWireName;
+
+typedef struct WireNameBuilder {
+    uint8_t wire[AVAHI_DNS_NAME_WIRE_MAX];
+    size_t size;
+    unsigned n_labels;
+    uint8_t label_wire[AVAHI_DNS_LABELS_MAX];
+} WireNameBuilder;
+
+/* Cached on AvahiRecord by avahi_dns_packet_append_record(), so
+ * that published records, which are sent again and again, don't need
+ * to be serialized each time. Allocated as one block. */
+struct AvahiRecordWire {
+    AvahiWireName owner;
+
+    /* The name in PTR, CNAME, NS and SRV records, wire == NULL for
+     * other types */
+    AvahiWireName target;
+
+    /* The fixed part of the SRV rdata, or the complete rdata of
+     * records without a name in it */
+    uint8_t *rdata;
+    uint16_t rdata_size;
+};
+
+static void name_table_reset(AvahiDnsNameTable *t) {
+    assert(t);
+
+    t->n_entries = 0;
+    memset(t->buckets, 0, sizeof(t->buckets));
+}
 
 AvahiDnsPacket* avahi_dns_packet_new(unsigned mtu) {
     AvahiDnsPacket *p;
@@ -56,8 +97,8 @@ AvahiDnsPacket* avahi_dns_packet_new(unsigned mtu) {
     p->size = p->rindex = AVAHI_DNS_PACKET_HEADER_SIZE;
     p->max_size = max_size;
     p->res_size = 0;
-    p->name_table = NULL;
     p->data = NULL;
+    name_table_reset(&p->name_table);
 
     memset(AVAHI_DNS_PACKET_DATA(p), 0, p->size);
     return p;
@@ -125,9 +166,6 @@ AvahiDnsPacket* avahi_dns_packet_new_reply(AvahiDnsPacket* p, unsigned mtu, int
 void avahi_dns_packet_free(AvahiDnsPacket *p) {
     assert(p);
 
-    if (p->name_table)
-        avahi_hashmap_free(p->name_table);
-
     avahi_free(p);
 }
 
@@ -153,70 +191,176 @@ void avahi_dns_packet_inc_field(AvahiDnsPacket *p, unsigned idx) {
 }
 
 
-static void name_table_cleanup(void *key, void *value, void *user_data) {
-    AvahiDnsPacket *p = user_data;
+void avahi_dns_packet_cleanup_name_table(AvahiDnsPacket *p) {
+    AvahiDnsNameTable *t;
+
+    assert(p);
+
+    t = &p->name_table;
+
+    /* Entries are added in the order of their offsets, and each
+     * one is the head of its bucket when it's added, so we can undo
+     * them from the end */
+    while (t->n_entries > 0 && t->offset[t->n_entries-1] >= p->size) {
+        unsigned i = --t->n_entries;
 
-    if ((uint8_t*) value >= AVAHI_DNS_PACKET_DATA(p) + p->size)
-        avahi_hashmap_remove(p->name_table, key);
+        assert(t->buckets[t->hash[i] % AVAHI_DNS_NAME_TABLE_BUCKETS] == i + 1);
+        t->buckets[t->hash[i] % AVAHI_DNS_NAME_TABLE_BUCKETS] = t->next[i];
+    }
 }
 
-void avahi_dns_packet_cleanup_name_table(AvahiDnsPacket *p) {
-    if (p->name_table)
-        avahi_hashmap_foreach(p->name_table, name_table_cleanup, p);
+/* Hash of a name suffix, chained from the hash of the next suffix so
+ * that all suffixes of a name can be hashed in a single pass */
+static uint32_t label_hash(uint32_t h, const uint8_t *label) {
+    unsigned i;
+
+    for (i = 0; i <= label[0]; i++) {
+        h ^= label[i];
+        h *= 0x01000193;
+    }
+
+    return h;
 }
 
-uint8_t* avahi_dns_packet_append_name(AvahiDnsPacket *p, const char *name) {
-    uint8_t *d, *saved_ptr = NULL;
-    size_t saved_size;
+/* Checks whether the (possibly compressed) name at idx in the packet
+ * is the uncompressed name in wire */
+static int name_equal_at(AvahiDnsPacket *p, unsigned idx, const uint8_t *wire) {
+    const uint8_t *d = AVAHI_DNS_PACKET_DATA(p);
+    unsigned i;
 
-    assert(p);
+    for (i = 0; i < AVAHI_DNS_LABELS_MAX; i++) {
+
+        if (idx >= p->size)
+            return 0;
+
+        if ((d[idx] & 0xC0) == 0xC0) {
+            unsigned ptr;
+
+            if (idx + 2 > p->size)
+                return 0;
+
+            ptr = ((unsigned) (d[idx] & ~0xC0)) << 8 | d[idx+1];
+
+            if (ptr >= idx)
+                return 0;
+
+            idx = ptr;
+            continue;
+        }
+
+        if (d[idx] != *wire ||
+            idx + 1 + *wire > p->size ||
+            memcmp(d + idx + 1, wire + 1, *wire) != 0)
+            return 0;
+
+        if (*wire == 0)
+            return 1;
+
+        idx += 1 + *wire;
+        wire += 1 + *wire;
+    }
+
+    return 0;
+}
+
+static int name_table_lookup(AvahiDnsPacket *p, uint32_t hash, const uint8_t *wire) {
+    AvahiDnsNameTable *t = &p->name_table;
+    unsigned i;
+
+    for (i = t->buckets[hash % AVAHI_DNS_NAME_TABLE_BUCKETS]; i > 0; i = t->next[i-1])
+        if (t->hash[i-1] == hash && name_equal_at(p, t->offset[i-1], wire))
+            return t->offset[i-1];
+
+    return -1;
+}
+
+static void name_table_add(AvahiDnsPacket *p, uint32_t hash, unsigned idx) {
+    AvahiDnsNameTable *t = &p->name_table;
+    unsigned b;
+
+    /* Compression pointers have only 14 bits. If the table is full
+     * we simply don't compress the rest of the packet as well. */
+    if (idx >= 0x4000 || t->n_entries >= AVAHI_DNS_NAME_TABLE_MAX)
+        return;
+
+    assert(t->n_entries == 0 || t->offset[t->n_entries-1] < idx);
+
+    b = hash % AVAHI_DNS_NAME_TABLE_BUCKETS;
+
+    t->offset[t->n_entries] = (uint16_t) idx;
+    t->hash[t->n_entries] = hash;
+    t->next[t->n_entries] = t->buckets[b];
+    t->buckets[b] = (uint8_t) ++t->n_entries;
+}
+
+static int wire_name_build(WireNameBuilder *b, const char *name) {
+    assert(b);
     assert(name);
 
-    saved_size = p->size;
-    saved_ptr = avahi_dns_packet_extend(p, 0);
+    b->size = 0;
+    b->n_labels = 0;
 
     while (*name) {
-        uint8_t* prev;
-        const char *pname;
-        char label[64], *u;
+        char label[64];
+        size_t l;
 
-        /* Check whether we can compress this name. */
+        if (b->n_labels >= AVAHI_DNS_LABELS_MAX)
+            return -1;
 
-        if (p->name_table && (prev = avahi_hashmap_lookup(p->name_table, name))) {
-            unsigned idx;
+        if (!avahi_unescape_label(&name, label, sizeof(label)) ||
+            (l = strlen(label)) == 0 ||
+            b->size + 1 + l + 1 > sizeof(b->wire))
+            return -1;
 
-            assert(prev >= AVAHI_DNS_PACKET_DATA(p));
-            idx = (unsigned) (prev - AVAHI_DNS_PACKET_DATA(p));
+        b->label_wire[b->n_labels++] = (uint8_t) b->size;
+        b->wire[b->size++] = (uint8_t) l;
+        memcpy(b->wire + b->size, label, l);
+        b->size += l;
+    }
 
-            assert(idx < p->size);
+    b->wire[b->size++] = 0;
+    return 0;
+}
 
-            if (idx < 0x4000) {
-                uint8_t *t;
-                if (!(t = (uint8_t*) avahi_dns_packet_extend(p, sizeof(uint16_t))))
-                    return NULL;
+/* Appends a name that is already in wire format, compressing it
+ * against the names in the packet */
+static uint8_t* append_labels(AvahiDnsPacket *p, const uint8_t *wire, const uint8_t *label_wire, unsigned n_labels) {
+    uint32_t hash[AVAHI_DNS_LABELS_MAX], h;
+    uint8_t *d, *saved_ptr;
+    size_t saved_size;
+    unsigned i;
 
-		t[0] = (uint8_t) ((0xC000 | idx) >> 8);
-		t[1] = (uint8_t) idx;
-                return saved_ptr;
-            }
-        }
+    assert(p);
+    assert(wire);
+    assert(n_labels <= AVAHI_DNS_LABELS_MAX);
 
-        pname = name;
+    for (i = n_labels, h = 0x811c9dc5; i > 0; i--)
+        hash[i-1] = h = label_hash(h, wire + label_wire[i-1]);
 
-        if (!(avahi_unescape_label(&name, label, sizeof(label))))
-            goto fail;
+    saved_size = p->size;
+    saved_ptr = avahi_dns_packet_extend(p, 0);
 
-        if (!(d = avahi_dns_packet_append_string(p, label)))
-            goto fail;
+    for (i = 0; i < n_labels; i++) {
+        const uint8_t *label = wire + label_wire[i];
+        int idx;
+
+        /* Check whether we can compress this name. */
+
+        if ((idx = name_table_lookup(p, hash[i], label)) >= 0) {
+            uint8_t *t;
 
-        if (!p->name_table)
-            /* This works only for normalized domain names */
-            p->name_table = avahi_hashmap_new(avahi_string_hash, avahi_string_equal, avahi_free, NULL);
+            if (!(t = avahi_dns_packet_extend(p, sizeof(uint16_t))))
+                goto fail;
+
+            t[0] = (uint8_t) ((0xC000 | (unsigned) idx) >> 8);
+            t[1] = (uint8_t) idx;
+            return saved_ptr;
+        }
 
-        if (!(u = avahi_strdup(pname)))
-            avahi_log_error("avahi_strdup() failed.");
-        else
-            avahi_hashmap_insert(p->name_table, u, d);
+        if (!(d = avahi_dns_packet_append_bytes(p, label, (size_t) label[0] + 1)))
+            goto fail;
+
+        name_table_add(p, hash[i], (unsigned) (d - AVAHI_DNS_PACKET_DATA(p)));
     }
 
     if (!(d = avahi_dns_packet_extend(p, 1)))
@@ -233,6 +377,18 @@ fail:
     return NULL;
 }
 
+uint8_t* avahi_dns_packet_append_name(AvahiDnsPacket *p, const char *name) {
+    WireNameBuilder b;
+
+    assert(p);
+    assert(name);
+
+    if (wire_name_build(&b, name) < 0)
+        return NULL;
+
+    return append_labels(p, b.wire, b.label_wire, b.n_labels);
+}
+
 uint8_t* avahi_dns_packet_append_uint16(AvahiDnsPacket *p, uint16_t v) {
     uint8_t *d;
     assert(p);
@@ -337,6 +493,115 @@ int avahi_dns_packet_check_valid_multicast(AvahiDnsPacket *p) {
     return 0;
 }
 
+uint8_t* avahi_dns_packet_append_opt(AvahiDnsPacket *p, uint16_t payload_size) {
+    uint8_t *t;
+    size_t size;
+
+    assert(p);
+
+    size = p->size;
+
+    /* Root name, type, class (the payload size), TTL (extended RCODE,
+     * version and flags, all zero) and empty RDATA */
+    if (!(t = avahi_dns_packet_extend(p, 1)))
+        return NULL;
+
+    *t = 0;
+
+    if (!avahi_dns_packet_append_uint16(p, AVAHI_DNS_TYPE_OPT) ||
+        !avahi_dns_packet_append_uint16(p, payload_size) ||
+        !avahi_dns_packet_append_uint32(p, 0) ||
+        !avahi_dns_packet_append_uint16(p, 0)) {
+        p->size = size;
+        return NULL;
+    }
+
+    assert(p->size - size == AVAHI_DNS_EDNS0_OPT_SIZE);
+
+    return t;
+}
+
+static int skip_name(AvahiDnsPacket *p) {
+    const uint8_t *d = AVAHI_DNS_PACKET_DATA(p);
+    unsigned i;
+
+    for (i = 0; i < AVAHI_DNS_LABELS_MAX; i++) {
+        uint8_t n;
+
+        if (p->rindex + 1 > p->size)
+            return -1;
+
+        n = d[p->rindex];
+
+        if (n == 0) {
+            p->rindex++;
+            return 0;
+        } else if (n <= 63) {
+            if (p->rindex + 1 + n > p->size)
+                return -1;
+
+            p->rindex += 1 + n;
+        } else if ((n & 0xC0) == 0xC0) {
+            if (p->rindex + 2 > p->size)
+                return -1;
+
+            /* A pointer always ends the name */
+            p->rindex += 2;
+            return 0;
+        } else
+            return -1;
+    }
+
+    return -1;
+}
+
+uint16_t avahi_dns_packet_get_edns0_payload_size(AvahiDnsPacket *p) {
+    size_t saved_rindex;
+    unsigned n, n_skip;
+    uint16_t ret = 0;
+
+    assert(p);
+
+    saved_rindex = p->rindex;
+    p->rindex = AVAHI_DNS_PACKET_HEADER_SIZE;
+
+    for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT); n > 0; n--)
+        if (skip_name(p) < 0 || avahi_dns_packet_skip(p, 4) < 0)
+            goto finish;
+
+    n_skip = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT) +
+        avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT);
+
+    for (n = n_skip + avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ARCOUNT); n > 0; n--) {
+        uint16_t type, clazz, rdlength;
+        uint32_t ttl;
+        size_t name_index = p->rindex;
+
+        if (skip_name(p) < 0 ||
+            avahi_dns_packet_consume_uint16(p, &type) < 0 ||
+            avahi_dns_packet_consume_uint16(p, &clazz) < 0 ||
+            avahi_dns_packet_consume_uint32(p, &ttl) < 0 ||
+            avahi_dns_packet_consume_uint16(p, &rdlength) < 0 ||
+            avahi_dns_packet_skip(p, rdlength) < 0)
+            goto finish;
+
+        if (n_skip > 0) {
+            n_skip--;
+            continue;
+        }
+
+        if (type == AVAHI_DNS_TYPE_OPT && AVAHI_DNS_PACKET_DATA(p)[name_index] == 0) {
+            /* Values below 512 are to be treated as 512 */
+            ret = clazz < 512 ? 512 : clazz;
+            break;
+        }
+    }
+
+finish:
+    p->rindex = saved_rindex;
+    return ret;
+}
+
 int avahi_dns_packet_is_query(AvahiDnsPacket *p) {
     assert(p);
 
@@ -568,7 +833,12 @@ static int parse_rdata(AvahiDnsPacket *p, AvahiRecord *r, uint16_t rdlength) {
         case AVAHI_DNS_TYPE_TXT:
 
             if (rdlength > 0) {
-                if (avahi_string_list_parse(avahi_dns_packet_get_rptr(p), rdlength, &r->data.txt.string_list) < 0)
+                AvahiRecordPrivate *rp = AVAHI_RECORD_PRIVATE(r);
+
+                /* Keep the wire format for comparing and sending the
+                 * record, next to the public string list */
+                if (avahi_txt_parse(avahi_dns_packet_get_rptr(p), rdlength, &rp->txt) < 0 ||
+                    (rp->txt && avahi_txt_to_string_list(rp->txt, &r->data.txt.string_list) < 0))
                     return -1;
 
                 if (avahi_dns_packet_skip(p, rdlength) < 0)
@@ -649,6 +919,9 @@ AvahiRecord* avahi_dns_packet_consume_record(AvahiDnsPacket *p, int *ret_cache_f
     if (!avahi_record_is_valid(r))
         goto fail;
 
+    /* Do this right away, this might be a parsing thread */
+    avahi_record_canonicalize(r);
+
     return r;
 
 fail:
@@ -707,6 +980,150 @@ uint8_t* avahi_dns_packet_append_key(AvahiDnsPacket *p, AvahiKey *k, int unicast
     return t;
 }
 
+static size_t wire_name_space(const WireNameBuilder *b) {
+    assert(b);
+
+    return b->size + b->n_labels;
+}
+
+/* Copies the builder into the block at *p, advancing it */
+static void wire_name_copy(AvahiWireName *n, const WireNameBuilder *b, uint8_t **p) {
+    assert(n);
+    assert(b);
+
+    n->size = (uint16_t) b->size;
+    n->n_labels = (uint8_t) b->n_labels;
+
+    n->wire = *p;
+    memcpy(*p, b->wire, b->size);
+    *p += b->size;
+
+    n->label_wire = *p;
+    memcpy(*p, b->label_wire, b->n_labels);
+    *p += b->n_labels;
+}
+
+static const char *record_target(AvahiRecord *r) {
+    assert(r);
+
+    switch (r->key->type) {
+        case AVAHI_DNS_TYPE_PTR:
+        case AVAHI_DNS_TYPE_CNAME:
+        case AVAHI_DNS_TYPE_NS:
+            return r->data.ptr.name;
+
+        case AVAHI_DNS_TYPE_SRV:
+            return r->data.srv.name;
+    }
+
+    return NULL;
+}
+
+static AvahiRecordWire *record_wire_new(AvahiRecord *r) {
+    WireNameBuilder owner, target;
+    const char *target_name;
+    size_t rdata_max, l;
+    AvahiRecordWire *w;
+    uint8_t *d;
+
+    assert(r);
+
+    if (wire_name_build(&owner, r->key->name) < 0)
+        return NULL;
+
+    if ((target_name = record_target(r))) {
+
+        if (wire_name_build(&target, target_name) < 0)
+            return NULL;
+
+        rdata_max = r->key->type == AVAHI_DNS_TYPE_SRV ? 6 : 0;
+
+    } else {
+        target.size = target.n_labels = 0;
+
+        switch (r->key->type) {
+            case AVAHI_DNS_TYPE_TXT:
+                avahi_record_get_txt_data(r, &rdata_max);
+                break;
+
+            case AVAHI_DNS_TYPE_HINFO:
+                rdata_max = 2*256;
+                break;
+
+            case AVAHI_DNS_TYPE_A:
+            case AVAHI_DNS_TYPE_AAAA:
+                rdata_max = 16;
+                break;
+
+            default:
+                rdata_max = r->data.generic.size;
+                break;
+        }
+    }
+
+    if (rdata_max > AVAHI_DNS_RDATA_MAX)
+        return NULL;
+
+    if (!(w = avahi_malloc(sizeof(AvahiRecordWire) +
+                           wire_name_space(&owner) +
+                           wire_name_space(&target) +
+                           rdata_max)))
+        return NULL;
+
+    d = (uint8_t*) (w + 1);
+
+    wire_name_copy(&w->owner, &owner, &d);
+
+    if (target_name)
+        wire_name_copy(&w->target, &target, &d);
+    else
+        memset(&w->target, 0, sizeof(w->target));
+
+    w->rdata = d;
+    w->rdata_size = 0;
+
+    if (r->key->type == AVAHI_DNS_TYPE_SRV) {
+        d[0] = (uint8_t) (r->data.srv.priority >> 8);
+        d[1] = (uint8_t) r->data.srv.priority;
+        d[2] = (uint8_t) (r->data.srv.weight >> 8);
+        d[3] = (uint8_t) r->data.srv.weight;
+        d[4] = (uint8_t) (r->data.srv.port >> 8);
+        d[5] = (uint8_t) r->data.srv.port;
+        w->rdata_size = 6;
+
+    } else if (!target_name && rdata_max > 0) {
+
+        if ((l = avahi_rdata_serialize(r, d, rdata_max)) == (size_t) -1) {
+            avahi_free(w);
+            return NULL;
+        }
+
+        w->rdata_size = (uint16_t) l;
+    }
+
+    return w;
+}
+
+static int append_rdata_wire(AvahiDnsPacket *p, AvahiRecord *r) {
+    const AvahiRecordWire *w;
+
+    assert(p);
+    assert(r);
+
+    w = AVAHI_RECORD_PRIVATE(r)->wire;
+    assert(w);
+
+    if (w->rdata_size > 0)
+        if (!avahi_dns_packet_append_bytes(p, w->rdata, w->rdata_size))
+            return -1;
+
+    if (w->target.wire)
+        if (!append_labels(p, w->target.wire, w->target.label_wire, w->target.n_labels))
+            return -1;
+
+    return 0;
+}
+
 static int append_rdata(AvahiDnsPacket *p, AvahiRecord *r) {
     assert(p);
     assert(r);
@@ -741,15 +1158,14 @@ static int append_rdata(AvahiDnsPacket *p, AvahiRecord *r) {
 
         case AVAHI_DNS_TYPE_TXT: {
 
-            uint8_t *data;
+            const uint8_t *data;
             size_t n;
 
-            n = avahi_string_list_serialize(r->data.txt.string_list, NULL, 0);
+            data = avahi_record_get_txt_data(r, &n);
 
-            if (!(data = avahi_dns_packet_extend(p, n)))
+            if (!avahi_dns_packet_append_bytes(p, data, n))
                 return -1;
 
-            avahi_string_list_serialize(r->data.txt.string_list, data, n);
             break;
         }
 
@@ -781,7 +1197,8 @@ static int append_rdata(AvahiDnsPacket *p, AvahiRecord *r) {
 }
 
 
-uint8_t* avahi_dns_packet_append_record(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush, unsigned max_ttl) {
+static uint8_t* append_record(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush, uint32_t ttl) {
+    AvahiRecordWire *w;
     uint8_t *t, *l, *start;
     size_t size;
 
@@ -790,16 +1207,20 @@ uint8_t* avahi_dns_packet_append_record(AvahiDnsPacket *p, AvahiRecord *r, int c
 
     size = p->size;
 
-    if (!(t = avahi_dns_packet_append_name(p, r->key->name)) ||
+    if (!(w = AVAHI_RECORD_PRIVATE(r)->wire))
+        /* If this fails we just take the slow path */
+        w = AVAHI_RECORD_PRIVATE(r)->wire = record_wire_new(r);
+
+    if (!(t = w ? append_labels(p, w->owner.wire, w->owner.label_wire, w->owner.n_labels) : avahi_dns_packet_append_name(p, r->key->name)) ||
         !avahi_dns_packet_append_uint16(p, r->key->type) ||
         !avahi_dns_packet_append_uint16(p, cache_flush ? (r->key->clazz | AVAHI_DNS_CACHE_FLUSH) : (r->key->clazz &~ AVAHI_DNS_CACHE_FLUSH)) ||
-        !avahi_dns_packet_append_uint32(p, (max_ttl && r->ttl > max_ttl) ? max_ttl : r->ttl) ||
+        !avahi_dns_packet_append_uint32(p, ttl) ||
         !(l = avahi_dns_packet_append_uint16(p, 0)))
         goto fail;
 
     start = avahi_dns_packet_extend(p, 0);
 
-    if (append_rdata(p, r) < 0)
+    if ((w ? append_rdata_wire(p, r) : append_rdata(p, r)) < 0)
         goto fail;
 
     size = avahi_dns_packet_extend(p, 0) - start;
@@ -820,6 +1241,20 @@ fail:
     return NULL;
 }
 
+uint8_t* avahi_dns_packet_append_record(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush, unsigned max_ttl) {
+    assert(p);
+    assert(r);
+
+    return append_record(p, r, cache_flush, (max_ttl && r->ttl > max_ttl) ? max_ttl : r->ttl);
+}
+
+uint8_t* avahi_dns_packet_append_goodbye(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush) {
+    assert(p);
+    assert(r);
+
+    return append_record(p, r, cache_flush, 0);
+}
+
 int avahi_dns_packet_is_empty(AvahiDnsPacket *p) {
     assert(p);
 
@@ -863,12 +1298,10 @@ int avahi_rdata_parse(AvahiRecord *record, const void* rdata, size_t size) {
     p.data = (void*) rdata;
     p.max_size = p.size = size;
     p.rindex = 0;
-    p.name_table = NULL;
+    name_table_reset(&p.name_table);
 
     ret = parse_rdata(&p, record, size);
 
-    assert(!p.name_table);
-
     return ret;
 }
 
@@ -883,13 +1316,10 @@ size_t avahi_rdata_serialize(AvahiRecord *record, void *rdata, size_t max_size)
     p.data = (void*) rdata;
     p.max_size = max_size;
     p.size = p.rindex = 0;
-    p.name_table = NULL;
+    name_table_reset(&p.name_table);
 
     ret = append_rdata(&p, record);
 
-    if (p.name_table)
-         avahi_hashmap_free(p.name_table);
-
     if (ret < 0)
         return (size_t) -1;
 
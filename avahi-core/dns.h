@@ -26,12 +26,34 @@
 #define AVAHI_DNS_PACKET_HEADER_SIZE 12
 #define AVAHI_DNS_PACKET_EXTRA_SIZE 48
 #define AVAHI_DNS_LABELS_MAX 127
+#define AVAHI_DNS_NAME_WIRE_MAX 255
 #define AVAHI_DNS_RDATA_MAX 0xFFFF
 #define AVAHI_DNS_PACKET_SIZE_MAX (AVAHI_DNS_PACKET_HEADER_SIZE + 256 + 2 + 2 + 4 + 2 + AVAHI_DNS_RDATA_MAX)
 
+/* The UDP payload size we advertise in EDNS0 OPT records, and the
+ * most we send to unicast clients that announce EDNS0 support */
+#define AVAHI_DNS_EDNS0_PAYLOAD_MAX 4096
+
+/* Size of an EDNS0 OPT record without any options */
+#define AVAHI_DNS_EDNS0_OPT_SIZE 11
+
+#define AVAHI_DNS_NAME_TABLE_MAX 128
+#define AVAHI_DNS_NAME_TABLE_BUCKETS 64
+
+/* The names appended to a packet so far, for name compression. Only
+ * the offsets of the name suffixes are stored, the names themselves
+ * are compared against the packet data. */
+typedef struct AvahiDnsNameTable {
+    unsigned n_entries;
+    uint8_t buckets[AVAHI_DNS_NAME_TABLE_BUCKETS]; /* index + 1 of the newest entry, 0 if empty */
+    uint8_t next[AVAHI_DNS_NAME_TABLE_MAX];
+    uint16_t offset[AVAHI_DNS_NAME_TABLE_MAX];
+    uint32_t hash[AVAHI_DNS_NAME_TABLE_MAX];
+} AvahiDnsNameTable;
+
 typedef struct AvahiDnsPacket {
     size_t size, rindex, max_size, res_size;
-    AvahiHashmap *name_table; /* for name compression */
+    AvahiDnsNameTable name_table; /* for name compression */
     uint8_t *data;
 } AvahiDnsPacket;
 
@@ -58,8 +80,20 @@ uint8_t *avahi_dns_packet_append_name(AvahiDnsPacket *p, const char *name);
 uint8_t *avahi_dns_packet_append_bytes(AvahiDnsPacket  *p, const void *d, size_t l);
 uint8_t* avahi_dns_packet_append_key(AvahiDnsPacket *p, AvahiKey *k, int unicast_response);
 uint8_t* avahi_dns_packet_append_record(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush, unsigned max_ttl);
+
+/* Appends r with a TTL of 0, without copying it first */
+uint8_t* avahi_dns_packet_append_goodbye(AvahiDnsPacket *p, AvahiRecord *r, int cache_flush);
 uint8_t* avahi_dns_packet_append_string(AvahiDnsPacket *p, const char *s);
 
+/* Append an EDNS0 OPT pseudo record advertising the specified UDP
+ * payload size. The caller needs to increment ARCOUNT. */
+uint8_t* avahi_dns_packet_append_opt(AvahiDnsPacket *p, uint16_t payload_size);
+
+/* Return the UDP payload size advertised in the EDNS0 OPT record in
+ * the additional section of the packet, or 0 if there is none. Doesn't
+ * modify the read index. */
+uint16_t avahi_dns_packet_get_edns0_payload_size(AvahiDnsPacket *p);
+
 int avahi_dns_packet_is_query(AvahiDnsPacket *p);
 int avahi_dns_packet_check_valid(AvahiDnsPacket *p);
 int avahi_dns_packet_check_valid_multicast(AvahiDnsPacket *p);
@@ -94,6 +128,8 @@ size_t avahi_dns_packet_reserved_space(AvahiDnsPacket *p);
 #define AVAHI_DNS_FLAG_TC (1 << 9)
 #define AVAHI_DNS_FLAG_AA (1 << 10)
 
+#define AVAHI_DNS_RCODE_FORMERR 1
+
 #define AVAHI_DNS_FLAGS(qr, opcode, aa, tc, rd, ra, z, ad, cd, rcode) \
         (((uint16_t) !!qr << 15) |  \
          ((uint16_t) (opcode & 15) << 11) | \
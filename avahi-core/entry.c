@@ -69,16 +69,44 @@ static void transport_flags_from_domain(AvahiServer *s, AvahiPublishFlags *flags
         *flags |= AVAHI_PUBLISH_USE_WIDE_AREA;
 }
 
-void avahi_entry_free(AvahiServer*s, AvahiEntry *e) {
+static void link_entry(AvahiServer *s, AvahiEntry *e) {
     AvahiEntry *t;
 
     assert(s);
     assert(e);
 
-    avahi_goodbye_entry(s, e, 1, 1);
+    /* Insert into hash table indexed by name. Shared entries go after
+     * the unique ones, so that looking for entries that might
+     * conflict with a shared record doesn't need to walk all the
+     * other shared ones. */
+    t = avahi_hashmap_lookup(s->entries_by_key, e->record->key);
 
-    /* Remove from linked list */
-    AVAHI_LLIST_REMOVE(AvahiEntry, entries, s->entries, e);
+    if (!t || (e->flags & AVAHI_PUBLISH_UNIQUE) || !(t->flags & AVAHI_PUBLISH_UNIQUE)) {
+        AVAHI_LLIST_PREPEND(AvahiEntry, by_key, t, e);
+        avahi_hashmap_replace(s->entries_by_key, e->record->key, t);
+    } else {
+        while (t->by_key_next && (t->by_key_next->flags & AVAHI_PUBLISH_UNIQUE))
+            t = t->by_key_next;
+
+        e->by_key_prev = t;
+        if ((e->by_key_next = t->by_key_next))
+            e->by_key_next->by_key_prev = e;
+        t->by_key_next = e;
+    }
+
+    /* Insert into hash table indexed by record */
+    t = avahi_hashmap_lookup(s->entries_by_record, e->record);
+    AVAHI_LLIST_PREPEND(AvahiEntry, by_record, t, e);
+    avahi_hashmap_replace(s->entries_by_record, e->record, t);
+
+    avahi_server_invalidate_answers(s);
+}
+
+static void unlink_entry(AvahiServer *s, AvahiEntry *e) {
+    AvahiEntry *t;
+
+    assert(s);
+    assert(e);
 
     /* Remove from hash table indexed by name */
     t = avahi_hashmap_lookup(s->entries_by_key, e->record->key);
@@ -88,6 +116,28 @@ void avahi_entry_free(AvahiServer*s, AvahiEntry *e) {
     else
         avahi_hashmap_remove(s->entries_by_key, e->record->key);
 
+    /* Remove from hash table indexed by record */
+    t = avahi_hashmap_lookup(s->entries_by_record, e->record);
+    AVAHI_LLIST_REMOVE(AvahiEntry, by_record, t, e);
+    if (t)
+        avahi_hashmap_replace(s->entries_by_record, t->record, t);
+    else
+        avahi_hashmap_remove(s->entries_by_record, e->record);
+
+    avahi_server_invalidate_answers(s);
+}
+
+void avahi_entry_free(AvahiServer*s, AvahiEntry *e) {
+    assert(s);
+    assert(e);
+
+    avahi_goodbye_entry(s, e, 1, 1);
+
+    /* Remove from linked list */
+    AVAHI_LLIST_REMOVE(AvahiEntry, entries, s->entries, e);
+
+    unlink_entry(s, e);
+
     /* Remove from associated group */
     if (e->group)
         AVAHI_LLIST_REMOVE(AvahiEntry, by_group, e->group->entries, e);
@@ -106,6 +156,9 @@ void avahi_entry_group_free(AvahiServer *s, AvahiSEntryGroup *g) {
     if (g->register_time_event)
         avahi_time_event_free(g->register_time_event);
 
+    if (g->probe_time_event)
+        avahi_time_event_free(g->probe_time_event);
+
     AVAHI_LLIST_REMOVE(AvahiSEntryGroup, groups, s->groups, g);
     avahi_free(g);
 }
@@ -155,10 +208,13 @@ static int check_record_conflict(AvahiServer *s, AvahiIfIndex interface, AvahiPr
     assert(r);
 
     for (e = avahi_hashmap_lookup(s->entries_by_key, r->key); e; e = e->by_key_next) {
-        if (e->dead)
-            continue;
 
+        /* Only shared entries follow, which can't conflict with a
+         * shared record */
         if (!(flags & AVAHI_PUBLISH_UNIQUE) && !(e->flags & AVAHI_PUBLISH_UNIQUE))
+            break;
+
+        if (e->dead)
             continue;
 
         if ((flags & AVAHI_PUBLISH_ALLOW_MULTIPLE) && (e->flags & AVAHI_PUBLISH_ALLOW_MULTIPLE) )
@@ -231,28 +287,27 @@ static AvahiEntry * server_add_internal(
 
     if (flags & AVAHI_PUBLISH_UPDATE) {
         AvahiRecord *old_record;
-        int is_first = 1;
 
         /* Update and existing record */
 
         /* Find the first matching entry */
-        for (e = avahi_hashmap_lookup(s->entries_by_key, r->key); e; e = e->by_key_next) {
+        for (e = avahi_hashmap_lookup(s->entries_by_key, r->key); e; e = e->by_key_next)
             if (!e->dead && e->group == g && e->interface == interface && e->protocol == protocol)
                 break;
 
-            is_first = 0;
-        }
-
         /* Hmm, nothing found? */
         if (!e) {
             avahi_server_set_errno(s, AVAHI_ERR_NOT_FOUND);
             return NULL;
         }
 
-        /* Update the entry */
+        /* Update the entry, the flags and the record determine where
+         * it is linked */
+        unlink_entry(s, e);
         old_record = e->record;
         e->record = avahi_record_ref(r);
         e->flags = flags;
+        link_entry(s, e);
 
         /* Announce our changes when needed */
         if (!avahi_record_equal_no_ttl(old_record, r) && (!g || g->state != AVAHI_ENTRY_GROUP_UNCOMMITED)) {
@@ -265,14 +320,9 @@ static AvahiEntry * server_add_internal(
             avahi_reannounce_entry(s, e);
         }
 
-        /* If we were the first entry in the list, we need to update the key */
-        if (is_first)
-            avahi_hashmap_replace(s->entries_by_key, e->record->key, e);
-
         avahi_record_unref(old_record);
 
     } else {
-        AvahiEntry *t;
 
         /* Add a new record */
 
@@ -298,10 +348,7 @@ static AvahiEntry * server_add_internal(
 
         AVAHI_LLIST_PREPEND(AvahiEntry, entries, s->entries, e);
 
-        /* Insert into hash table indexed by name */
-        t = avahi_hashmap_lookup(s->entries_by_key, e->record->key);
-        AVAHI_LLIST_PREPEND(AvahiEntry, by_key, t, e);
-        avahi_hashmap_replace(s->entries_by_key, e->record->key, t);
+        link_entry(s, e);
 
         /* Insert into group list */
         if (g)
@@ -345,6 +392,7 @@ const AvahiRecord *avahi_server_iterate(AvahiServer *s, AvahiSEntryGroup *g, voi
 }
 
 int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata) {
+    AvahiSEntryGroup *g;
     AvahiEntry *e;
 
     assert(s);
@@ -368,10 +416,79 @@ int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata
         callback(ln, userdata);
     }
 
+    callback(";;; ENTRY GROUPS ;;;", userdata);
+
+    for (g = s->groups; g; g = g->groups_next) {
+        char ln[256];
+        unsigned n = 0;
+
+        if (g->dead)
+            continue;
+
+        for (e = g->entries; e; e = e->by_group_next)
+            if (!e->dead)
+                n++;
+
+        if (g->state == AVAHI_ENTRY_GROUP_ESTABLISHED)
+            snprintf(ln, sizeof(ln), ";;; %u entries, established after %llu ms", n, (unsigned long long) (g->establish_usec / 1000));
+        else
+            snprintf(ln, sizeof(ln), ";;; %u entries, state=%i", n, g->state);
+
+        callback(ln, userdata);
+    }
+
     avahi_dump_caches(s->monitor, callback, userdata);
 
     if (s->wide_area_lookup_engine)
         avahi_wide_area_cache_dump(s->wide_area_lookup_engine, callback, userdata);
+
+    if (s->source_limiter)
+        avahi_source_limiter_dump(s->source_limiter, callback, userdata);
+
+    return AVAHI_OK;
+}
+
+int avahi_server_walk_caches(AvahiServer *s, AvahiCacheRecordCallback callback, void* userdata) {
+    assert(s);
+    assert(callback);
+
+    avahi_walk_caches(s->monitor, callback, userdata);
+    return AVAHI_OK;
+}
+
+unsigned avahi_server_get_cache_serial(AvahiServer *s) {
+    assert(s);
+
+    return s->cache_serial;
+}
+
+void avahi_server_get_cache_stats(AvahiServer *s, unsigned *ret_evicted, unsigned *ret_rejected) {
+    assert(s);
+
+    if (ret_evicted)
+        *ret_evicted = s->cache_evicted;
+
+    if (ret_rejected)
+        *ret_rejected = s->cache_rejected;
+}
+
+int avahi_server_restore_cache_record(AvahiServer *s, AvahiIfIndex interface, AvahiProtocol protocol, AvahiRecord *r) {
+    AvahiInterface *i;
+
+    assert(s);
+    assert(r);
+
+    AVAHI_CHECK_VALIDITY(s, AVAHI_IF_VALID(interface) && interface != AVAHI_IF_UNSPEC, AVAHI_ERR_INVALID_INTERFACE);
+    AVAHI_CHECK_VALIDITY(s, AVAHI_PROTO_VALID(protocol) && protocol != AVAHI_PROTO_UNSPEC, AVAHI_ERR_INVALID_PROTOCOL);
+    AVAHI_CHECK_VALIDITY(s, avahi_record_is_valid(r), AVAHI_ERR_INVALID_RECORD);
+    AVAHI_CHECK_VALIDITY(s, r->ttl > 0, AVAHI_ERR_INVALID_TTL);
+
+    if (!(i = avahi_interface_monitor_get_interface(s->monitor, interface, protocol)) || !i->announcing)
+        return avahi_server_set_errno(s, AVAHI_ERR_INVALID_INTERFACE);
+
+    if (avahi_cache_restore(i->cache, r) < 0)
+        return avahi_server_set_errno(s, AVAHI_ERR_NO_MEMORY);
+
     return AVAHI_OK;
 }
 
@@ -1029,13 +1146,19 @@ void avahi_s_entry_group_change_state(AvahiSEntryGroup *g, AvahiEntryGroupState
         }
     }
 
-    if (state == AVAHI_ENTRY_GROUP_ESTABLISHED)
+    if (state == AVAHI_ENTRY_GROUP_ESTABLISHED) {
 
         /* If the entry group is now established, remember the time
          * this happened */
 
         gettimeofday(&g->established_at, NULL);
 
+        if (g->establish_usec == 0) {
+            g->establish_usec = avahi_timeval_diff(&g->established_at, &g->commit_time);
+            avahi_log_debug("Entry group established after %llu ms.", (unsigned long long) (g->establish_usec / 1000));
+        }
+    }
+
     g->state = state;
 
     if (g->callback)
@@ -1062,6 +1185,10 @@ AvahiSEntryGroup *avahi_s_entry_group_new(AvahiServer *s, AvahiSEntryGroupCallba
     g->register_time_event = NULL;
     g->register_time.tv_sec = 0;
     g->register_time.tv_usec = 0;
+    g->probe_time_event = NULL;
+    g->commit_time.tv_sec = 0;
+    g->commit_time.tv_usec = 0;
+    g->establish_usec = 0;
     AVAHI_LLIST_HEAD_INIT(AvahiEntry, g->entries);
 
     AVAHI_LLIST_PREPEND(AvahiSEntryGroup, groups, s->groups, g);
@@ -1091,18 +1218,25 @@ void avahi_s_entry_group_free(AvahiSEntryGroup *g) {
     assert(g);
     assert(g->server);
 
+    avahi_goodbye_batch_begin(g->server);
     for (e = g->entries; e; e = e->by_group_next) {
         if (!e->dead) {
             avahi_goodbye_entry(g->server, e, 1, 1);
             e->dead = 1;
         }
     }
+    avahi_goodbye_batch_end(g->server);
 
     if (g->register_time_event) {
         avahi_time_event_free(g->register_time_event);
         g->register_time_event = NULL;
     }
 
+    if (g->probe_time_event) {
+        avahi_time_event_free(g->probe_time_event);
+        g->probe_time_event = NULL;
+    }
+
     g->dead = 1;
 
     g->server->need_group_cleanup = 1;
@@ -1150,6 +1284,9 @@ int avahi_s_entry_group_commit(AvahiSEntryGroup *g) {
 
     g->n_register_try++;
 
+    gettimeofday(&g->commit_time, NULL);
+    g->establish_usec = 0;
+
     avahi_timeval_add(&g->register_time,
                       1000*(g->n_register_try >= AVAHI_RR_RATE_LIMIT_COUNT ?
                             AVAHI_RR_HOLDOFF_MSEC_RATE_LIMIT :
@@ -1177,14 +1314,21 @@ void avahi_s_entry_group_reset(AvahiSEntryGroup *g) {
     AvahiEntry *e;
     assert(g);
 
+    avahi_goodbye_batch_begin(g->server);
     for (e = g->entries; e; e = e->by_group_next) {
         if (!e->dead) {
             avahi_goodbye_entry(g->server, e, 1, 1);
             e->dead = 1;
         }
     }
+    avahi_goodbye_batch_end(g->server);
     g->server->need_entry_cleanup = 1;
 
+    if (g->probe_time_event) {
+        avahi_time_event_free(g->probe_time_event);
+        g->probe_time_event = NULL;
+    }
+
     g->n_probing = 0;
 
     avahi_s_entry_group_change_state(g, AVAHI_ENTRY_GROUP_UNCOMMITED);
@@ -1208,6 +1352,13 @@ AvahiEntryGroupState avahi_s_entry_group_get_state(AvahiSEntryGroup *g) {
     return g->state;
 }
 
+AvahiUsec avahi_s_entry_group_get_establish_time(AvahiSEntryGroup *g) {
+    assert(g);
+    assert(!g->dead);
+
+    return g->establish_usec;
+}
+
 void avahi_s_entry_group_set_data(AvahiSEntryGroup *g, void* userdata) {
     assert(g);
 
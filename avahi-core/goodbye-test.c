@@ -0,0 +1,563 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/defs.h>
+#include <avahi-common/domain.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/timeval.h>
+
+#include "announce.h"
+#include "dns.h"
+#include "rr.h"
+#include "rr-util.h"
+#include "internal.h"
+#include "iface.h"
+#include "publish.h"
+#include "lookup.h"
+#include "socket.h"
+
+#define N_SERVICES 5000
+#define MTU 1500
+
+/* One PTR, SRV and TXT record for every service, and the service type
+ * enumeration PTR */
+#define N_RECORDS (N_SERVICES*3 + 1)
+
+static AvahiGoodbye goodbyes[N_RECORDS];
+static unsigned n_goodbyes = 0;
+
+static unsigned n_seen = 0;
+static unsigned n_packets = 0;
+static size_t largest_record = 0, last_space = 0;
+
+static AvahiRecord *add(AvahiRecord *r, int flush_cache) {
+    assert(r);
+    assert(n_goodbyes < N_RECORDS);
+
+    goodbyes[n_goodbyes].interface = NULL;
+    goodbyes[n_goodbyes].entry = NULL;
+    goodbyes[n_goodbyes].record = r;
+    goodbyes[n_goodbyes].flush_cache = flush_cache;
+    n_goodbyes++;
+
+    return r;
+}
+
+static void packet_callback(AvahiDnsPacket *p, AVAHI_GCC_UNUSED void *userdata) {
+    unsigned n;
+
+    assert(p);
+
+    /* None but the last packet should have had room for another
+     * record, so the one before this one must have been full */
+    if (n_packets > 0)
+        assert(last_space < largest_record);
+
+    n_packets++;
+    last_space = avahi_dns_packet_space(p);
+
+    assert(!avahi_dns_packet_check_valid_multicast(p));
+    assert(avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_FLAGS) & AVAHI_DNS_FLAG_QR);
+
+    n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT);
+    assert(n > 0);
+
+    for (; n > 0; n--) {
+        AvahiRecord *r;
+        int cache_flush = 0;
+
+        r = avahi_dns_packet_consume_record(p, &cache_flush);
+        assert(r);
+        assert(r->ttl == 0);
+
+        /* The records are sent in the order they were passed in */
+        assert(n_seen < n_goodbyes);
+        assert(avahi_record_equal_no_ttl(goodbyes[n_seen].record, r));
+        assert(cache_flush == goodbyes[n_seen].flush_cache);
+        n_seen++;
+
+        avahi_record_unref(r);
+    }
+
+    assert(p->rindex == p->size);
+    avahi_dns_packet_free(p);
+}
+
+static void test_pack(void) {
+    AvahiRecord *r;
+    unsigned i, n;
+    size_t total = 0;
+
+    r = add(avahi_record_new_full("_services._dns-sd._udp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL), 0);
+    r->data.ptr.name = avahi_strdup("_http._tcp.local");
+
+    /* Add them in the order a server would publish them, i.e. by
+     * service, not by name */
+    for (i = 0; i < N_SERVICES; i++) {
+        char name[AVAHI_DOMAIN_NAME_MAX], txt[64];
+
+        snprintf(name, sizeof(name), "Service %u._http._tcp.local", i);
+        snprintf(txt, sizeof(txt), "path=/service/%u", i);
+
+        r = add(avahi_record_new_full("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL), 0);
+        r->data.ptr.name = avahi_strdup(name);
+
+        r = add(avahi_record_new_full(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_SRV, AVAHI_DEFAULT_TTL_HOST_NAME), 1);
+        r->data.srv.priority = 0;
+        r->data.srv.weight = 0;
+        r->data.srv.port = 80;
+        r->data.srv.name = avahi_strdup("host.local");
+
+        r = add(avahi_record_new_full(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_TXT, AVAHI_DEFAULT_TTL), 1);
+        r->data.txt.string_list = avahi_string_list_new(txt, NULL);
+    }
+
+    assert(n_goodbyes == N_RECORDS);
+
+    for (i = 0; i < n_goodbyes; i++) {
+        size_t s = avahi_record_get_estimate_size(goodbyes[i].record);
+
+        total += s;
+        if (s > largest_record)
+            largest_record = s;
+    }
+
+    avahi_goodbye_sort(goodbyes, n_goodbyes);
+    n = avahi_goodbye_pack(goodbyes, n_goodbyes, MTU, packet_callback, NULL);
+
+    assert(n == n_packets);
+    assert(n_seen == n_goodbyes);
+
+    /* Thanks to name compression we need fewer packets than the
+     * uncompressed records would fill */
+    assert(n < total / (MTU - AVAHI_DNS_PACKET_EXTRA_SIZE - AVAHI_DNS_PACKET_HEADER_SIZE));
+
+    printf("%u services, %u records, %u packets (%u records per packet)\n", N_SERVICES, n_goodbyes, n, n_goodbyes / n);
+
+    for (i = 0; i < n_goodbyes; i++)
+        avahi_record_unref(goodbyes[i].record);
+}
+
+/* The rest of the tests run a publishing server and watch its
+ * goodbyes arrive at a second, browsing server on the same host */
+
+#define N_PUBLISHED 100
+
+/* Far shorter than the TTLs, so within that time records only go
+ * away through goodbyes */
+#define TIMEOUT_SEC 15
+
+enum {
+    GOODBYE_WITHDRAW,
+    GOODBYE_INTERFACE,
+    GOODBYE_SHUTDOWN
+};
+
+static AvahiSimplePoll *simple_poll = NULL;
+
+/* How often the PTR, SRV and TXT record of each published service
+ * are currently seen by the browsing server */
+static int seen[N_PUBLISHED][3];
+static int seen_survivor = 0, seen_type = 0;
+
+static unsigned n_established = 0;
+
+/* Goodbye records on the wire, and how many of them withdraw the
+ * service type */
+static int listen_fd = -1;
+static AvahiWatch *listen_watch = NULL;
+static unsigned n_goodbyes_received = 0, n_type_goodbyes_received = 0;
+
+static void listen_callback(AVAHI_GCC_UNUSED AvahiWatch *w, int fd, AVAHI_GCC_UNUSED AvahiWatchEvent event, AVAHI_GCC_UNUSED void *userdata) {
+    AvahiIPv4Address src, dst;
+    AvahiIfIndex iface;
+    uint16_t port;
+    uint8_t ttl;
+    AvahiDnsPacket *p;
+    unsigned n;
+
+    if (!(p = avahi_recv_dns_packet_ipv4(fd, &src, &port, &dst, &iface, &ttl)))
+        return;
+
+    if (avahi_dns_packet_check_valid_multicast(p) < 0 ||
+        !(avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_FLAGS) & AVAHI_DNS_FLAG_QR)) {
+        avahi_dns_packet_free(p);
+        return;
+    }
+
+    for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT); n > 0; n--) {
+        AvahiRecord *r;
+        int cache_flush;
+
+        if (!(r = avahi_dns_packet_consume_record(p, &cache_flush)))
+            break;
+
+        if (r->ttl == 0) {
+            n_goodbyes_received++;
+
+            if (r->key->type == AVAHI_DNS_TYPE_PTR && avahi_domain_equal(r->key->name, "_services._dns-sd._udp.local"))
+                n_type_goodbyes_received++;
+        }
+
+        avahi_record_unref(r);
+    }
+
+    avahi_dns_packet_free(p);
+}
+
+/* Listens for mDNS traffic on the interfaces of s */
+static void start_listening(AvahiServer *s) {
+    const AvahiPoll *api = avahi_simple_poll_get(simple_poll);
+    AvahiInterface *i;
+
+    listen_fd = avahi_open_socket_ipv4(0);
+    assert(listen_fd >= 0);
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next)
+        if (i->protocol == AVAHI_PROTO_INET && i->mcast_joined)
+            assert(avahi_mdns_mcast_join_ipv4(listen_fd, &i->local_mcast_address.data.ipv4, i->hardware->index, 1) == 0);
+
+    listen_watch = api->watch_new(api, listen_fd, AVAHI_WATCH_IN, listen_callback, NULL);
+    assert(listen_watch);
+}
+
+static void stop_listening(void) {
+    const AvahiPoll *api = avahi_simple_poll_get(simple_poll);
+
+    if (listen_fd < 0)
+        return;
+
+    api->watch_free(listen_watch);
+    close(listen_fd);
+}
+
+static void browse_callback(
+    AVAHI_GCC_UNUSED AvahiSServiceBrowser *b,
+    AVAHI_GCC_UNUSED AvahiIfIndex interface,
+    AVAHI_GCC_UNUSED AvahiProtocol protocol,
+    AvahiBrowserEvent event,
+    const char *name,
+    AVAHI_GCC_UNUSED const char *type,
+    AVAHI_GCC_UNUSED const char *domain,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    AVAHI_GCC_UNUSED void* userdata) {
+
+    int d, *counter;
+    unsigned j;
+
+    if (event == AVAHI_BROWSER_NEW)
+        d = 1;
+    else if (event == AVAHI_BROWSER_REMOVE)
+        d = -1;
+    else
+        return;
+
+    if (strcmp(name, "Survivor") == 0)
+        counter = &seen_survivor;
+    else if (sscanf(name, "Goodbye %u", &j) == 1 && j < N_PUBLISHED)
+        counter = &seen[j][0];
+    else
+        return;
+
+    *counter += d;
+    assert(*counter >= 0);
+}
+
+static void record_browse_callback(
+    AVAHI_GCC_UNUSED AvahiSRecordBrowser *b,
+    AVAHI_GCC_UNUSED AvahiIfIndex interface,
+    AVAHI_GCC_UNUSED AvahiProtocol protocol,
+    AvahiBrowserEvent event,
+    AVAHI_GCC_UNUSED AvahiRecord *record,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    void* userdata) {
+
+    int *counter = userdata;
+
+    if (event == AVAHI_BROWSER_NEW)
+        (*counter)++;
+    else if (event == AVAHI_BROWSER_REMOVE)
+        (*counter)--;
+
+    assert(*counter >= 0);
+}
+
+static void type_browse_callback(
+    AVAHI_GCC_UNUSED AvahiSServiceTypeBrowser *b,
+    AVAHI_GCC_UNUSED AvahiIfIndex interface,
+    AVAHI_GCC_UNUSED AvahiProtocol protocol,
+    AvahiBrowserEvent event,
+    AVAHI_GCC_UNUSED const char *type,
+    AVAHI_GCC_UNUSED const char *domain,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    AVAHI_GCC_UNUSED void* userdata) {
+
+    if (event == AVAHI_BROWSER_NEW)
+        seen_type++;
+    else if (event == AVAHI_BROWSER_REMOVE)
+        seen_type--;
+
+    assert(seen_type >= 0);
+}
+
+static void group_callback(AVAHI_GCC_UNUSED AvahiServer *s, AVAHI_GCC_UNUSED AvahiSEntryGroup *g, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void* userdata) {
+    if (state == AVAHI_ENTRY_GROUP_ESTABLISHED)
+        n_established++;
+}
+
+/* Only established entries are withdrawn with goodbyes */
+static int all_seen(void) {
+    unsigned j, k;
+
+    if (n_established < 2)
+        return 0;
+
+    for (j = 0; j < N_PUBLISHED; j++)
+        for (k = 0; k < 3; k++)
+            if (seen[j][k] <= 0)
+                return 0;
+
+    return seen_survivor > 0 && seen_type > 0;
+}
+
+static int none_seen(void) {
+    unsigned j, k;
+
+    for (j = 0; j < N_PUBLISHED; j++)
+        for (k = 0; k < 3; k++)
+            if (seen[j][k] > 0)
+                return 0;
+
+    return 1;
+}
+
+static int survivor_gone(void) {
+    return none_seen() && seen_survivor == 0;
+}
+
+static unsigned n_queued(AvahiServer *s) {
+    AvahiInterface *i;
+    unsigned n = 0;
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next)
+        n += i->n_goodbye_packets;
+
+    return n;
+}
+
+/* Runs the main loop until check() returns non-zero, or returns 0 if
+ * that doesn't happen in time */
+static int wait_for(int (*check)(void), unsigned sec) {
+    struct timeval end, now;
+
+    gettimeofday(&end, NULL);
+    end.tv_sec += sec;
+
+    while (!check()) {
+        gettimeofday(&now, NULL);
+
+        if (avahi_timeval_compare(&now, &end) >= 0)
+            return 0;
+
+        assert(avahi_simple_poll_iterate(simple_poll, 100) == 0);
+    }
+
+    return 1;
+}
+
+static void server_callback(AVAHI_GCC_UNUSED AvahiServer *s, AVAHI_GCC_UNUSED AvahiServerState state, AVAHI_GCC_UNUSED void* userdata) {
+}
+
+static AvahiServer *new_server(void) {
+    AvahiServerConfig config;
+    AvahiServer *s;
+    int error;
+
+    /* Don't publish anything on our own, so that the two servers
+     * don't conflict with each other */
+    avahi_server_config_init(&config);
+    config.use_ipv6 = 0;
+    config.publish_hinfo = 0;
+    config.publish_addresses = 0;
+    config.publish_workstation = 0;
+    config.publish_domain = 0;
+
+    s = avahi_server_new(avahi_simple_poll_get(simple_poll), &config, server_callback, NULL, &error);
+    assert(s);
+
+    avahi_server_config_free(&config);
+
+    return s;
+}
+
+static void add_service(AvahiServer *s, AvahiSEntryGroup *g, const char *name) {
+    int r;
+
+    r = avahi_server_add_service(s, g, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, 80, "path=/", NULL);
+    assert(r == 0);
+}
+
+static int test_goodbye(int how) {
+    AvahiServer *s;
+    AvahiSEntryGroup *g, *survivor;
+    AvahiHwInterface *hw;
+    unsigned j;
+
+    s = new_server();
+
+    n_established = 0;
+
+    g = avahi_s_entry_group_new(s, group_callback, NULL);
+    assert(g);
+
+    for (j = 0; j < N_PUBLISHED; j++) {
+        char name[AVAHI_LABEL_MAX];
+
+        snprintf(name, sizeof(name), "Goodbye %u", j);
+        add_service(s, g, name);
+    }
+
+    assert(avahi_s_entry_group_commit(g) == 0);
+
+    /* Publishes the same service type enumeration record as g, so
+     * that one must not be withdrawn with g */
+    survivor = avahi_s_entry_group_new(s, group_callback, NULL);
+    assert(survivor);
+    add_service(s, survivor, "Survivor");
+    assert(avahi_s_entry_group_commit(survivor) == 0);
+
+    if (!wait_for(all_seen, TIMEOUT_SEC)) {
+        avahi_server_free(s);
+        return -1;
+    }
+
+    if (listen_fd < 0)
+        start_listening(s);
+
+    /* Allow only two packets per 100ms from now on, which is fewer
+     * than the goodbyes need */
+    s->config.ratelimit_interval = 100000;
+    s->config.ratelimit_burst = 1;
+
+    switch (how) {
+        case GOODBYE_WITHDRAW:
+
+            avahi_s_entry_group_free(g);
+
+            /* The rest is waiting for the rate limit */
+            assert(n_queued(s) > 0);
+
+            assert(wait_for(none_seen, TIMEOUT_SEC));
+            assert(n_queued(s) == 0);
+
+            /* The survivor still publishes the service type */
+            assert(n_goodbyes_received > 0);
+            assert(n_type_goodbyes_received == 0);
+            assert(seen_survivor > 0);
+            assert(seen_type > 0);
+
+            avahi_server_free(s);
+            break;
+
+        case GOODBYE_INTERFACE:
+
+            while ((hw = s->monitor->hw_interfaces))
+                avahi_hw_interface_free(hw, 1);
+
+            avahi_server_free(s);
+            break;
+
+        case GOODBYE_SHUTDOWN:
+
+            avahi_server_free(s);
+            break;
+    }
+
+    /* No time events of the server are left to send the rest of the
+     * goodbyes, so they must have been sent right away */
+    assert(wait_for(survivor_gone, TIMEOUT_SEC));
+
+    return 0;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiServer *browser;
+    AvahiSServiceBrowser *b;
+    AvahiSServiceTypeBrowser *tb;
+    AvahiSRecordBrowser *rb;
+    unsigned j;
+
+    test_pack();
+
+    simple_poll = avahi_simple_poll_new();
+    assert(simple_poll);
+
+    browser = new_server();
+
+    b = avahi_s_service_browser_new(browser, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "_http._tcp", NULL, 0, browse_callback, NULL);
+    assert(b);
+
+    tb = avahi_s_service_type_browser_new(browser, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, NULL, 0, type_browse_callback, NULL);
+    assert(tb);
+
+    /* The service browser only sees the PTR records, so look for the
+     * SRV and TXT records, too */
+    for (j = 0; j < N_PUBLISHED; j++) {
+        char name[AVAHI_DOMAIN_NAME_MAX];
+        AvahiKey *k;
+
+        snprintf(name, sizeof(name), "Goodbye %u._http._tcp.local", j);
+
+        k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_SRV);
+        rb = avahi_s_record_browser_new(browser, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, k, AVAHI_LOOKUP_USE_MULTICAST, record_browse_callback, &seen[j][1]);
+        assert(rb);
+        avahi_key_unref(k);
+
+        k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_TXT);
+        rb = avahi_s_record_browser_new(browser, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, k, AVAHI_LOOKUP_USE_MULTICAST, record_browse_callback, &seen[j][2]);
+        assert(rb);
+        avahi_key_unref(k);
+    }
+
+    if (test_goodbye(GOODBYE_WITHDRAW) < 0)
+        printf("No usable network interface, skipping server tests\n");
+    else {
+        assert(test_goodbye(GOODBYE_INTERFACE) == 0);
+        assert(test_goodbye(GOODBYE_SHUTDOWN) == 0);
+        printf("Goodbyes withdrawn, sent on interface removal and on shutdown\n");
+    }
+
+    stop_listening();
+    avahi_server_free(browser);
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
@@ -22,6 +22,8 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 
 #include <avahi-common/domain.h>
 #include <avahi-common/malloc.h>
@@ -45,6 +47,16 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     for (n = 0; n < 1000; n ++)
         avahi_hashmap_insert(m, avahi_strdup_printf("key %u", n), avahi_strdup_printf("value %u", n));
 
+    /* The table has been resized a few times by now */
+    for (n = 0; n < 1000; n ++) {
+        char k[32], v[32];
+
+        snprintf(k, sizeof(k), "key %u", n);
+        snprintf(v, sizeof(v), "value %u", n);
+
+        assert(strcmp(avahi_hashmap_lookup(m, k), v) == 0);
+    }
+
     printf("%s\n", (const char*) avahi_hashmap_lookup(m, "bla"));
 
     avahi_hashmap_replace(m, avahi_strdup("bla"), avahi_strdup("#3"));
@@ -31,13 +31,17 @@
 #include "hashmap.h"
 #include "util.h"
 
+/* The initial number of buckets. The table grows when it holds
+ * more than HASH_MAP_LOAD entries per bucket. */
 #define HASH_MAP_SIZE 123
+#define HASH_MAP_LOAD 2
 
 typedef struct Entry Entry;
 struct Entry {
     AvahiHashmap *hashmap;
     void *key;
     void *value;
+    unsigned hash;
 
     AVAHI_LLIST_FIELDS(Entry, bucket);
     AVAHI_LLIST_FIELDS(Entry, entries);
@@ -48,32 +52,73 @@ struct AvahiHashmap {
     AvahiEqualFunc equal_func;
     AvahiFreeFunc key_free_func, value_free_func;
 
-    Entry *entries[HASH_MAP_SIZE];
+    Entry **entries;
+    unsigned n_buckets, n_entries;
     AVAHI_LLIST_HEAD(Entry, entries_list);
 };
 
 static Entry* entry_get(AvahiHashmap *m, const void *key) {
-    unsigned idx;
+    unsigned hash;
     Entry *e;
 
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
+    hash = m->hash_func(key);
 
-    for (e = m->entries[idx]; e; e = e->bucket_next)
-        if (m->equal_func(key, e->key))
+    for (e = m->entries[hash % m->n_buckets]; e; e = e->bucket_next)
+        if (e->hash == hash && m->equal_func(key, e->key))
             return e;
 
     return NULL;
 }
 
+static void grow(AvahiHashmap *m) {
+    Entry **entries, *e;
+    unsigned n_buckets;
+
+    assert(m);
+
+    n_buckets = m->n_buckets * 2 + 1;
+
+    /* If this fails we simply keep using the old table */
+    if (!(entries = avahi_new0(Entry*, n_buckets)))
+        return;
+
+    for (e = m->entries_list; e; e = e->entries_next)
+        AVAHI_LLIST_PREPEND(Entry, bucket, entries[e->hash % n_buckets], e);
+
+    avahi_free(m->entries);
+    m->entries = entries;
+    m->n_buckets = n_buckets;
+}
+
+static Entry *entry_new(AvahiHashmap *m, void *key, void *value) {
+    Entry *e;
+
+    assert(m);
+
+    if (!(e = avahi_new(Entry, 1)))
+        return NULL;
+
+    e->hashmap = m;
+    e->key = key;
+    e->value = value;
+    e->hash = m->hash_func(key);
+
+    AVAHI_LLIST_PREPEND(Entry, entries, m->entries_list, e);
+    AVAHI_LLIST_PREPEND(Entry, bucket, m->entries[e->hash % m->n_buckets], e);
+
+    if (++m->n_entries > m->n_buckets * HASH_MAP_LOAD)
+        grow(m);
+
+    return e;
+}
+
 static void entry_free(AvahiHashmap *m, Entry *e, int stolen) {
-    unsigned idx;
     assert(m);
     assert(e);
 
-    idx = m->hash_func(e->key) % HASH_MAP_SIZE;
-
-    AVAHI_LLIST_REMOVE(Entry, bucket, m->entries[idx], e);
+    AVAHI_LLIST_REMOVE(Entry, bucket, m->entries[e->hash % m->n_buckets], e);
     AVAHI_LLIST_REMOVE(Entry, entries, m->entries_list, e);
+    m->n_entries--;
 
     if (m->key_free_func)
         m->key_free_func(e->key);
@@ -92,6 +137,13 @@ AvahiHashmap* avahi_hashmap_new(AvahiHashFunc hash_func, AvahiEqualFunc equal_fu
     if (!(m = avahi_new0(AvahiHashmap, 1)))
         return NULL;
 
+    if (!(m->entries = avahi_new0(Entry*, HASH_MAP_SIZE))) {
+        avahi_free(m);
+        return NULL;
+    }
+
+    m->n_buckets = HASH_MAP_SIZE;
+
     m->hash_func = hash_func;
     m->equal_func = equal_func;
     m->key_free_func = key_free_func;
@@ -108,6 +160,7 @@ void avahi_hashmap_free(AvahiHashmap *m) {
     while (m->entries_list)
         entry_free(m, m->entries_list, 0);
 
+    avahi_free(m->entries);
     avahi_free(m);
 }
 
@@ -123,7 +176,6 @@ void* avahi_hashmap_lookup(AvahiHashmap *m, const void *key) {
 }
 
 int avahi_hashmap_insert(AvahiHashmap *m, void *key, void *value) {
-    unsigned idx;
     Entry *e;
 
     assert(m);
@@ -137,24 +189,14 @@ int avahi_hashmap_insert(AvahiHashmap *m, void *key, void *value) {
         return 1;
     }
 
-    if (!(e = avahi_new(Entry, 1)))
+    if (!entry_new(m, key, value))
         return -1;
 
-    e->hashmap = m;
-    e->key = key;
-    e->value = value;
-
-    AVAHI_LLIST_PREPEND(Entry, entries, m->entries_list, e);
-
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
-    AVAHI_LLIST_PREPEND(Entry, bucket, m->entries[idx], e);
-
     return 0;
 }
 
 
 int avahi_hashmap_replace(AvahiHashmap *m, void *key, void *value) {
-    unsigned idx;
     Entry *e;
 
     assert(m);
@@ -171,18 +213,9 @@ int avahi_hashmap_replace(AvahiHashmap *m, void *key, void *value) {
         return 1;
     }
 
-    if (!(e = avahi_new(Entry, 1)))
+    if (!entry_new(m, key, value))
         return -1;
 
-    e->hashmap = m;
-    e->key = key;
-    e->value = value;
-
-    AVAHI_LLIST_PREPEND(Entry, entries, m->entries_list, e);
-
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
-    AVAHI_LLIST_PREPEND(Entry, bucket, m->entries[idx], e);
-
     return 0;
 }
 
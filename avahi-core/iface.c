@@ -280,10 +280,14 @@ void avahi_interface_free(AvahiInterface *i, int send_goodbye) {
     avahi_goodbye_interface(i->monitor->server, i, send_goodbye, 1);
     avahi_response_scheduler_force(i->response_scheduler);
     assert(!i->announcers);
+    assert(!i->goodbye_time_event);
 
     if (i->mcast_joined)
         interface_mdns_mcast_join(i, 0);
 
+    if (i->announcing && i->monitor->server->parse_pipeline)
+        avahi_parse_pipeline_set_interface(i->monitor->server->parse_pipeline, i->hardware->index, i->protocol, 0);
+
     /* Remove queriers */
     avahi_querier_free_all(i);
     avahi_hashmap_free(i->queriers_by_key);
@@ -297,6 +301,7 @@ void avahi_interface_free(AvahiInterface *i, int send_goodbye) {
     avahi_response_scheduler_free(i->response_scheduler);
     avahi_query_scheduler_free(i->query_scheduler);
     avahi_probe_scheduler_free(i->probe_scheduler);
+    avahi_answer_cache_free(i->answer_cache);
     avahi_cache_free(i->cache);
 
     AVAHI_LLIST_REMOVE(AvahiInterface, interface, i->monitor->interfaces, i);
@@ -345,12 +350,17 @@ AvahiInterface* avahi_interface_new(AvahiInterfaceMonitor *m, AvahiHwInterface *
     AVAHI_LLIST_HEAD_INIT(AvahiQuerier, i->queriers);
     i->queriers_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL);
 
+    i->goodbye_packets = NULL;
+    i->n_goodbye_packets = i->n_goodbye_packets_allocated = 0;
+    i->goodbye_time_event = NULL;
+
     i->cache = avahi_cache_new(m->server, i);
     i->response_scheduler = avahi_response_scheduler_new(i);
     i->query_scheduler = avahi_query_scheduler_new(i);
     i->probe_scheduler = avahi_probe_scheduler_new(i);
+    i->answer_cache = avahi_answer_cache_new(i);
 
-    if (!i->cache || !i->response_scheduler || !i->query_scheduler || !i->probe_scheduler)
+    if (!i->cache || !i->response_scheduler || !i->query_scheduler || !i->probe_scheduler || !i->answer_cache)
         goto fail; /* OOM */
 
     AVAHI_LLIST_PREPEND(AvahiInterface, by_hardware, hw->interfaces, i);
@@ -369,6 +379,8 @@ fail:
             avahi_query_scheduler_free(i->query_scheduler);
         if (i->probe_scheduler)
             avahi_probe_scheduler_free(i->probe_scheduler);
+        if (i->answer_cache)
+            avahi_answer_cache_free(i->answer_cache);
     }
 
     return NULL;
@@ -445,6 +457,10 @@ void avahi_interface_check_relevant(AvahiInterface *i) {
             avahi_log_info("New relevant interface %s.%s for mDNS.", i->hardware->name, avahi_proto_to_string(i->protocol));
 
             i->announcing = 1;
+
+            if (m->server->parse_pipeline)
+                avahi_parse_pipeline_set_interface(m->server->parse_pipeline, i->hardware->index, i->protocol, 1);
+
             avahi_announce_interface(m->server, i);
             avahi_multicast_lookup_engine_new_interface(m->server->multicast_lookup_engine, i);
         }
@@ -464,6 +480,9 @@ void avahi_interface_check_relevant(AvahiInterface *i) {
 
         i->announcing = 0;
 
+        if (m->server->parse_pipeline)
+            avahi_parse_pipeline_set_interface(m->server->parse_pipeline, i->hardware->index, i->protocol, 0);
+
     } else
         interface_mdns_mcast_rejoin(i);
 }
@@ -565,31 +584,52 @@ AvahiInterfaceAddress* avahi_interface_monitor_get_address(AvahiInterfaceMonitor
     return NULL;
 }
 
-void avahi_interface_send_packet_unicast(AvahiInterface *i, AvahiDnsPacket *p, const AvahiAddress *a, uint16_t port) {
+int avahi_interface_ratelimit_check(AvahiInterface *i, struct timeval *ret_tv) {
+    struct timeval now, end;
+
     assert(i);
-    assert(p);
 
-    if (!i->announcing)
-        return;
+    if (i->monitor->server->config.ratelimit_interval <= 0)
+        return 0;
 
-    assert(!a || a->proto == i->protocol);
+    gettimeofday(&now, NULL);
 
-    if (i->monitor->server->config.ratelimit_interval > 0) {
-        struct timeval now, end;
+    end = i->hardware->ratelimit_begin;
+    avahi_timeval_add(&end, i->monitor->server->config.ratelimit_interval);
 
-        gettimeofday(&now, NULL);
+    if (i->hardware->ratelimit_begin.tv_sec <= 0 ||
+        avahi_timeval_compare(&end, &now) < 0) {
 
-        end = i->hardware->ratelimit_begin;
-        avahi_timeval_add(&end, i->monitor->server->config.ratelimit_interval);
+        i->hardware->ratelimit_begin = now;
+        i->hardware->ratelimit_counter = 0;
+    }
 
-        if (i->hardware->ratelimit_begin.tv_sec <= 0 ||
-            avahi_timeval_compare(&end, &now) < 0) {
+    if (i->hardware->ratelimit_counter > i->monitor->server->config.ratelimit_burst) {
 
-            i->hardware->ratelimit_begin = now;
-            i->hardware->ratelimit_counter = 0;
+        /* The window is over only once we are past its end */
+        if (ret_tv) {
+            *ret_tv = end;
+            avahi_timeval_add(ret_tv, 1);
         }
 
-        if (i->hardware->ratelimit_counter > i->monitor->server->config.ratelimit_burst)
+        return -1;
+    }
+
+    return 0;
+}
+
+static void send_packet(AvahiInterface *i, AvahiDnsPacket *p, const AvahiAddress *a, uint16_t port, int limited) {
+    assert(i);
+    assert(p);
+
+    if (!i->announcing)
+        return;
+
+    assert(!a || a->proto == i->protocol);
+
+    if (i->monitor->server->config.ratelimit_interval > 0) {
+
+        if (avahi_interface_ratelimit_check(i, NULL) < 0 && limited)
             return;
 
         i->hardware->ratelimit_counter++;
@@ -601,6 +641,10 @@ void avahi_interface_send_packet_unicast(AvahiInterface *i, AvahiDnsPacket *p, c
         avahi_send_dns_packet_ipv6(i->monitor->server->fd_ipv6, i->hardware->index, p, i->mcast_joined ? &i->local_mcast_address.data.ipv6 : NULL, a ? &a->data.ipv6 : NULL, port);
 }
 
+void avahi_interface_send_packet_unicast(AvahiInterface *i, AvahiDnsPacket *p, const AvahiAddress *a, uint16_t port) {
+    send_packet(i, p, a, port, 1);
+}
+
 void avahi_interface_send_packet(AvahiInterface *i, AvahiDnsPacket *p) {
     assert(i);
     assert(p);
@@ -608,6 +652,10 @@ void avahi_interface_send_packet(AvahiInterface *i, AvahiDnsPacket *p) {
     avahi_interface_send_packet_unicast(i, p, NULL, 0);
 }
 
+void avahi_interface_send_packet_unlimited(AvahiInterface *i, AvahiDnsPacket *p) {
+    send_packet(i, p, NULL, 0, 0);
+}
+
 int avahi_interface_post_query(AvahiInterface *i, AvahiKey *key, int immediately, unsigned *ret_id) {
     assert(i);
     assert(key);
@@ -654,12 +702,24 @@ int avahi_dump_caches(AvahiInterfaceMonitor *m, AvahiDumpCallback callback, void
             callback(ln, userdata);
             if (avahi_cache_dump(i->cache, callback, userdata) < 0)
                 return -1;
+            if (avahi_answer_cache_dump(i->answer_cache, callback, userdata) < 0)
+                return -1;
         }
     }
 
     return 0;
 }
 
+void avahi_walk_caches(AvahiInterfaceMonitor *m, AvahiCacheRecordCallback callback, void* userdata) {
+    AvahiInterface *i;
+    assert(m);
+    assert(callback);
+
+    for (i = m->interfaces; i; i = i->interface_next)
+        if (avahi_interface_is_relevant(i))
+            avahi_cache_walk_records(i->cache, callback, userdata);
+}
+
 static int avahi_interface_is_relevant_internal(AvahiInterface *i) {
     AvahiInterfaceAddress *a;
 
@@ -31,6 +31,7 @@ typedef struct AvahiHwInterface AvahiHwInterface;
 #include "internal.h"
 #include "cache.h"
 #include "response-sched.h"
+#include "answer-cache.h"
 #include "query-sched.h"
 #include "probe-sched.h"
 #include "dns.h"
@@ -109,12 +110,18 @@ struct AvahiInterface {
     AvahiQueryScheduler *query_scheduler;
     AvahiResponseScheduler * response_scheduler;
     AvahiProbeScheduler *probe_scheduler;
+    AvahiAnswerCache *answer_cache;
 
     AVAHI_LLIST_HEAD(AvahiInterfaceAddress, addresses);
     AVAHI_LLIST_HEAD(AvahiAnnouncer, announcers);
 
     AvahiHashmap *queriers_by_key;
     AVAHI_LLIST_HEAD(AvahiQuerier, queriers);
+
+    /* Goodbye packets waiting for the rate limit */
+    AvahiDnsPacket **goodbye_packets;
+    unsigned n_goodbye_packets, n_goodbye_packets_allocated;
+    AvahiTimeEvent *goodbye_time_event;
 };
 
 struct AvahiInterfaceAddress {
@@ -142,6 +149,7 @@ void avahi_interface_monitor_sync(AvahiInterfaceMonitor *m);
 typedef void (*AvahiInterfaceMonitorWalkCallback)(AvahiInterfaceMonitor *m, AvahiInterface *i, void* userdata);
 void avahi_interface_monitor_walk(AvahiInterfaceMonitor *m, AvahiIfIndex idx, AvahiProtocol protocol, AvahiInterfaceMonitorWalkCallback callback, void* userdata);
 int avahi_dump_caches(AvahiInterfaceMonitor *m, AvahiDumpCallback callback, void* userdata);
+void avahi_walk_caches(AvahiInterfaceMonitor *m, AvahiCacheRecordCallback callback, void* userdata);
 
 void avahi_interface_monitor_update_rrs(AvahiInterfaceMonitor *m, int remove_rrs);
 int avahi_address_is_local(AvahiInterfaceMonitor *m, const AvahiAddress *a);
@@ -169,6 +177,14 @@ int avahi_interface_is_relevant(AvahiInterface *i);
 void avahi_interface_send_packet(AvahiInterface *i, AvahiDnsPacket *p);
 void avahi_interface_send_packet_unicast(AvahiInterface *i, AvahiDnsPacket *p, const AvahiAddress *a, uint16_t port);
 
+/* Sends a packet even if the rate limit has been hit */
+void avahi_interface_send_packet_unlimited(AvahiInterface *i, AvahiDnsPacket *p);
+
+/* Returns 0 if the rate limit allows sending a packet on the
+ * interface right now. Otherwise returns -1 and, if ret_tv is not
+ * NULL, stores the time when it will allow it again there. */
+int avahi_interface_ratelimit_check(AvahiInterface *i, struct timeval *ret_tv);
+
 int avahi_interface_post_query(AvahiInterface *i, AvahiKey *k, int immediately, unsigned *ret_id);
 int avahi_interface_withraw_query(AvahiInterface *i, unsigned id);
 int avahi_interface_post_response(AvahiInterface *i, AvahiRecord *record, int flush_cache, const AvahiAddress *querier, int immediately);
@@ -0,0 +1,237 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/domain.h>
+
+#include "intern.h"
+#include "log.h"
+
+#define N_BUCKETS_MIN 256
+
+typedef struct Atom Atom;
+
+struct Atom {
+    Atom *next;
+    Atom *canonical; /* ourselves if we are lower case already */
+    unsigned ref;
+    unsigned hash;
+    char name[1];
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static Atom **buckets = NULL;
+static unsigned n_buckets = 0, n_atoms = 0;
+
+#define ATOM(n) ((Atom*) ((n) - offsetof(Atom, name)))
+
+static char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? (char) (c - 'A' + 'a') : c;
+}
+
+/* Normalized names always escape the same way, so comparing the
+ * escaped strings case insensitively is the same as comparing the
+ * labels, and we can hash them without unescaping */
+static unsigned hash_name(const char *n, int *ret_lower) {
+    unsigned hash = 0x811c9dc5;
+    int lower = 1;
+
+    for (; *n; n++) {
+        char c = fold(*n);
+
+        if (c != *n)
+            lower = 0;
+
+        hash ^= (unsigned char) c;
+        hash *= 0x01000193;
+    }
+
+    *ret_lower = lower;
+    return hash;
+}
+
+static int grow(void) {
+    Atom **b;
+    unsigned n, i;
+
+    n = n_buckets ? n_buckets * 2 : N_BUCKETS_MIN;
+
+    if (!(b = avahi_new0(Atom*, n)))
+        return -1;
+
+    for (i = 0; i < n_buckets; i++) {
+        Atom *a, *next;
+
+        for (a = buckets[i]; a; a = next) {
+            next = a->next;
+            a->next = b[a->hash % n];
+            b[a->hash % n] = a;
+        }
+    }
+
+    avahi_free(buckets);
+    buckets = b;
+    n_buckets = n;
+
+    return 0;
+}
+
+static Atom *intern(const char *n) {
+    unsigned hash;
+    int lower;
+    size_t l;
+    Atom *a;
+
+    hash = hash_name(n, &lower);
+
+    if (n_buckets > 0)
+        for (a = buckets[hash % n_buckets]; a; a = a->next)
+            if (a->hash == hash && strcmp(a->name, n) == 0) {
+                a->ref++;
+                return a;
+            }
+
+    if (n_atoms >= n_buckets && grow() < 0)
+        return NULL;
+
+    l = strlen(n);
+
+    if (!(a = avahi_malloc(offsetof(Atom, name) + l + 1)))
+        return NULL;
+
+    memcpy(a->name, n, l + 1);
+    a->hash = hash;
+    a->ref = 1;
+
+    if (lower)
+        a->canonical = a;
+    else {
+        char *p;
+
+        for (p = a->name; *p; p++)
+            *p = fold(*p);
+
+        a->canonical = intern(a->name);
+        memcpy(a->name, n, l + 1);
+
+        if (!a->canonical) {
+            avahi_free(a);
+            return NULL;
+        }
+    }
+
+    a->next = buckets[hash % n_buckets];
+    buckets[hash % n_buckets] = a;
+    n_atoms++;
+
+    return a;
+}
+
+static void release(Atom *a) {
+    Atom **p;
+
+    assert(a->ref >= 1);
+
+    if (--a->ref > 0)
+        return;
+
+    for (p = &buckets[a->hash % n_buckets]; *p != a; p = &(*p)->next)
+        assert(*p);
+
+    *p = a->next;
+    n_atoms--;
+
+    if (a->canonical != a)
+        release(a->canonical);
+
+    avahi_free(a);
+
+    if (n_atoms == 0) {
+        avahi_free(buckets);
+        buckets = NULL;
+        n_buckets = 0;
+    }
+}
+
+const char *avahi_intern_name(const char *n) {
+    Atom *a;
+
+    assert(n);
+
+    pthread_mutex_lock(&mutex);
+    a = intern(n);
+    pthread_mutex_unlock(&mutex);
+
+    if (!a) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    return a->name;
+}
+
+const char *avahi_intern_ref(const char *n) {
+    assert(n);
+
+    pthread_mutex_lock(&mutex);
+    assert(ATOM(n)->ref >= 1);
+    ATOM(n)->ref++;
+    pthread_mutex_unlock(&mutex);
+
+    return n;
+}
+
+void avahi_intern_unref(const char *n) {
+    assert(n);
+
+    pthread_mutex_lock(&mutex);
+    release(ATOM(n));
+    pthread_mutex_unlock(&mutex);
+}
+
+unsigned avahi_intern_hash(const char *n) {
+    assert(n);
+
+    return ATOM(n)->hash;
+}
+
+const char *avahi_intern_canonical(const char *n) {
+    assert(n);
+
+    return ATOM(n)->canonical->name;
+}
+
+unsigned avahi_intern_n_names(void) {
+    unsigned n;
+
+    pthread_mutex_lock(&mutex);
+    n = n_atoms;
+    pthread_mutex_unlock(&mutex);
+
+    return n;
+}
@@ -0,0 +1,50 @@
+#ifndef foointernhfoo
+#define foointernhfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* A process wide table of domain names. Every distinct normalized
+ * name is stored only once, together with a case insensitive hash
+ * and a pointer to its lower case spelling, which is interned as
+ * well. Two names are equal in the sense of avahi_domain_equal() iff
+ * their canonical pointers are the same. The table is protected by a
+ * mutex, the strings returned are immutable. */
+
+/* Returns an interned copy of the normalized name n, with a new
+ * reference. NULL on OOM. */
+const char *avahi_intern_name(const char *n);
+
+/* Adds a reference to an interned name */
+const char *avahi_intern_ref(const char *n);
+
+/* Drops a reference to an interned name */
+void avahi_intern_unref(const char *n);
+
+/* Returns the case insensitive hash of an interned name */
+unsigned avahi_intern_hash(const char *n);
+
+/* Returns the interned lower case spelling of an interned name,
+ * without adding a reference. It stays valid as long as n does. */
+const char *avahi_intern_canonical(const char *n);
+
+/* Returns the number of names in the table */
+unsigned avahi_intern_n_names(void);
+
+#endif
@@ -23,6 +23,9 @@
 /** A locally registered DNS resource record */
 typedef struct AvahiEntry AvahiEntry;
 
+/** A goodbye that has been collected but not sent yet */
+typedef struct AvahiGoodbye AvahiGoodbye;
+
 #include <avahi-common/llist.h>
 #include <avahi-common/watch.h>
 #include <avahi-common/timeval.h>
@@ -39,6 +42,7 @@ typedef struct AvahiEntry AvahiEntry;
 #include "wide-area.h"
 #include "multicast-lookup.h"
 #include "dns-srv-rr.h"
+#include "pipeline.h"
 
 #define AVAHI_LEGACY_UNICAST_REFLECT_SLOTS_MAX 100
 
@@ -74,6 +78,7 @@ struct AvahiEntry {
 
     AVAHI_LLIST_FIELDS(AvahiEntry, entries);
     AVAHI_LLIST_FIELDS(AvahiEntry, by_key);
+    AVAHI_LLIST_FIELDS(AvahiEntry, by_record);
     AVAHI_LLIST_FIELDS(AvahiEntry, by_group);
 
     AVAHI_LLIST_HEAD(AvahiAnnouncer, announcers);
@@ -93,7 +98,15 @@ struct AvahiSEntryGroup {
     struct timeval register_time;
     AvahiTimeEvent *register_time_event;
 
-    struct timeval established_at;
+    /* Drives the probing of all entries of this group if
+     * group_probing is enabled */
+    AvahiTimeEvent *probe_time_event;
+
+    struct timeval commit_time, established_at;
+
+    /* How long it took from the last commit until the group was
+     * established */
+    AvahiUsec establish_usec;
 
     AVAHI_LLIST_FIELDS(AvahiSEntryGroup, groups);
     AVAHI_LLIST_HEAD(AvahiEntry, entries);
@@ -106,8 +119,13 @@ struct AvahiServer {
     AvahiServerConfig config;
 
     AVAHI_LLIST_HEAD(AvahiEntry, entries);
+    /* In the lists of entries with the same key the unique entries
+     * come first */
     AvahiHashmap *entries_by_key;
 
+    /* Entries with equal records, regardless of the TTL */
+    AvahiHashmap *entries_by_record;
+
     AVAHI_LLIST_HEAD(AvahiSEntryGroup, groups);
 
     AVAHI_LLIST_HEAD(AvahiSRecordBrowser, record_browsers);
@@ -125,6 +143,12 @@ struct AvahiServer {
     /* Used for scheduling RR cleanup */
     AvahiTimeEvent *cleanup_time_event;
 
+    /* Goodbyes are collected while goodbye_batch > 0 and sent
+     * together when the outermost batch ends */
+    unsigned goodbye_batch;
+    AvahiGoodbye *goodbyes;
+    unsigned n_goodbyes, n_goodbyes_allocated;
+
     AvahiTimeEventQueue *time_event_queue;
 
     char *host_name, *host_name_fqdn, *domain_name;
@@ -136,6 +160,13 @@ struct AvahiServer {
     AvahiWatch *watch_ipv4, *watch_ipv6,
         *watch_legacy_unicast_ipv4, *watch_legacy_unicast_ipv6;
 
+    /* If non-NULL, the multicast sockets are read by worker threads
+     * instead of watch_ipv4 and watch_ipv6 */
+    AvahiParsePipeline *parse_pipeline;
+
+    /* Per source address limit for incoming multicast packets, NULL if disabled */
+    AvahiSourceLimiter *source_limiter;
+
     AvahiServerState state;
     AvahiServerCallback callback;
     void* userdata;
@@ -159,6 +190,16 @@ struct AvahiServer {
 
     AvahiMulticastLookupEngine *multicast_lookup_engine;
     AvahiWideAreaLookupEngine *wide_area_lookup_engine;
+
+    /* Incremented on every cache modification */
+    unsigned cache_serial;
+
+    /* Totals of the per-interface cache counters */
+    unsigned cache_evicted, cache_rejected;
+
+    /* Incremented whenever an entry or its announcement state
+     * changes, which flushes the answer caches of the interfaces */
+    unsigned answer_serial;
 };
 
 void avahi_entry_free(AvahiServer*s, AvahiEntry *e);
@@ -176,6 +217,16 @@ int avahi_entry_is_commited(AvahiEntry *e);
 
 void avahi_server_enumerate_aux_records(AvahiServer *s, AvahiInterface *i, AvahiRecord *r, void (*callback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata), void* userdata);
 
+/* Like avahi_server_prepare_matching_responses() and
+ * avahi_server_enumerate_aux_records(), but these walk the entries
+ * instead of consulting the answer cache of the interface */
+void avahi_server_find_matching_records(AvahiServer *s, AvahiInterface *i, AvahiKey *k, void (*callback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata), void* userdata);
+void avahi_server_find_aux_records(AvahiServer *s, AvahiInterface *i, AvahiRecord *r, void (*callback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata), void* userdata);
+
+/* Call this whenever the answers avahi_server_find_matching_records()
+ * and avahi_server_find_aux_records() return might change */
+void avahi_server_invalidate_answers(AvahiServer *s);
+
 void avahi_host_rr_entry_group_callback(AvahiServer *s, AvahiSEntryGroup *g, AvahiEntryGroupState state, void *userdata);
 
 void avahi_server_decrease_host_rr_pending(AvahiServer *s);
@@ -0,0 +1,39 @@
+#ifndef foologthreadhfoo
+#define foologthreadhfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include "log.h"
+
+/* Redirects the log messages issued by a single thread. Worker
+ * threads use this to hand their messages to the main loop, since
+ * the log function set with avahi_set_log_function() is only ever
+ * called from there. */
+typedef struct AvahiLogThreadHook {
+    void (*function)(AvahiLogLevel level, const char *txt, void *userdata);
+    void *userdata;
+} AvahiLogThreadHook;
+
+/* Sends all messages the calling thread logs to hook instead of the
+ * log function, until this is called again with NULL. hook has to
+ * stay valid for that long. */
+void avahi_log_set_thread_hook(const AvahiLogThreadHook *hook);
+
+#endif
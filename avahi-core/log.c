@@ -23,21 +23,47 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "log.h"
+#include "log-thread.h"
 
 static AvahiLogFunction log_function = NULL;
 
+static pthread_once_t hook_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t hook_key;
+static int hook_key_valid = 0;
+
+static void hook_key_init(void) {
+    hook_key_valid = pthread_key_create(&hook_key, NULL) == 0;
+}
+
+static const AvahiLogThreadHook *get_thread_hook(void) {
+    pthread_once(&hook_key_once, hook_key_init);
+
+    return hook_key_valid ? pthread_getspecific(hook_key) : NULL;
+}
+
+void avahi_log_set_thread_hook(const AvahiLogThreadHook *hook) {
+    pthread_once(&hook_key_once, hook_key_init);
+
+    if (hook_key_valid)
+        pthread_setspecific(hook_key, hook);
+}
+
 void avahi_set_log_function(AvahiLogFunction function) {
     log_function = function;
 }
 
 void avahi_log_ap(AvahiLogLevel level, const char*format, va_list ap) {
     char txt[256];
+    const AvahiLogThreadHook *hook;
 
     vsnprintf(txt, sizeof(txt), format, ap);
 
-    if (log_function)
+    if ((hook = get_thread_hook()))
+        hook->function(level, txt, hook->userdata);
+    else if (log_function)
         log_function(level, txt);
     else
         fprintf(stderr, "%s\n", txt);
@@ -230,6 +230,13 @@ AvahiSServiceResolver *avahi_s_service_resolver_new(
 /** Free an AvahiSServiceResolver object */
 void avahi_s_service_resolver_free(AvahiSServiceResolver *r);
 
+/** Return the TXT data of the resolved service in DNS wire format,
+ * i.e. the same items as the string list passed to the callback,
+ * without copying them. Returns NULL if no TXT record has been
+ * resolved. Only valid while an AVAHI_RESOLVER_FOUND event is being
+ * dispatched. \since 0.7 */
+const uint8_t *avahi_s_service_resolver_get_txt_data(AvahiSServiceResolver *r, size_t *size);
+
 AVAHI_C_DECL_END
 
 #endif
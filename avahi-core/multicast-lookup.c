@@ -50,8 +50,13 @@ struct AvahiMulticastLookup {
 
     AvahiTimeEvent *all_for_now_event;
 
+    /* Nonzero while the lookup can be found in lookups_by_key and
+     * lookups_by_cname_key */
+    int indexed;
+
     AVAHI_LLIST_FIELDS(AvahiMulticastLookup, lookups);
     AVAHI_LLIST_FIELDS(AvahiMulticastLookup, by_key);
+    AVAHI_LLIST_FIELDS(AvahiMulticastLookup, by_cname_key);
 };
 
 struct AvahiMulticastLookupEngine {
@@ -61,9 +66,70 @@ struct AvahiMulticastLookupEngine {
     AVAHI_LLIST_HEAD(AvahiMulticastLookup, lookups);
     AvahiHashmap *lookups_by_key;
 
+    /* Lookups by the CNAME key of their key, so that incoming CNAME
+     * records are dispatched without scanning all lookups */
+    AvahiHashmap *lookups_by_cname_key;
+
+    /* Nesting depth of avahi_multicast_lookup_engine_notify(). Freed
+     * lookups are only taken out of the index while this is zero, so
+     * that the lists being walked stay intact. */
+    unsigned n_dispatching;
+
     int cleanup_dead;
 };
 
+static void lookup_index(AvahiMulticastLookup *l) {
+    AvahiMulticastLookupEngine *e;
+    AvahiMulticastLookup *t;
+
+    assert(l);
+    assert(!l->indexed);
+
+    e = l->engine;
+
+    t = avahi_hashmap_lookup(e->lookups_by_key, l->key);
+    AVAHI_LLIST_PREPEND(AvahiMulticastLookup, by_key, t, l);
+    avahi_hashmap_replace(e->lookups_by_key, avahi_key_ref(l->key), t);
+
+    if (l->cname_key) {
+        t = avahi_hashmap_lookup(e->lookups_by_cname_key, l->cname_key);
+        AVAHI_LLIST_PREPEND(AvahiMulticastLookup, by_cname_key, t, l);
+        avahi_hashmap_replace(e->lookups_by_cname_key, avahi_key_ref(l->cname_key), t);
+    }
+
+    l->indexed = 1;
+}
+
+static void lookup_unindex(AvahiMulticastLookup *l) {
+    AvahiMulticastLookupEngine *e;
+    AvahiMulticastLookup *t;
+
+    assert(l);
+
+    if (!l->indexed)
+        return;
+
+    e = l->engine;
+
+    t = avahi_hashmap_lookup(e->lookups_by_key, l->key);
+    AVAHI_LLIST_REMOVE(AvahiMulticastLookup, by_key, t, l);
+    if (t)
+        avahi_hashmap_replace(e->lookups_by_key, avahi_key_ref(l->key), t);
+    else
+        avahi_hashmap_remove(e->lookups_by_key, l->key);
+
+    if (l->cname_key) {
+        t = avahi_hashmap_lookup(e->lookups_by_cname_key, l->cname_key);
+        AVAHI_LLIST_REMOVE(AvahiMulticastLookup, by_cname_key, t, l);
+        if (t)
+            avahi_hashmap_replace(e->lookups_by_cname_key, avahi_key_ref(l->cname_key), t);
+        else
+            avahi_hashmap_remove(e->lookups_by_cname_key, l->cname_key);
+    }
+
+    l->indexed = 0;
+}
+
 static void all_for_now_callback(AvahiTimeEvent *e, void* userdata) {
     AvahiMulticastLookup *l = userdata;
 
@@ -84,7 +150,7 @@ AvahiMulticastLookup *avahi_multicast_lookup_new(
     AvahiMulticastLookupCallback callback,
     void *userdata) {
 
-    AvahiMulticastLookup *l, *t;
+    AvahiMulticastLookup *l;
     struct timeval tv;
 
     assert(e);
@@ -104,10 +170,9 @@ AvahiMulticastLookup *avahi_multicast_lookup_new(
     l->protocol = protocol;
     l->all_for_now_event = NULL;
     l->queriers_added = 0;
+    l->indexed = 0;
 
-    t = avahi_hashmap_lookup(e->lookups_by_key, l->key);
-    AVAHI_LLIST_PREPEND(AvahiMulticastLookup, by_key, t, l);
-    avahi_hashmap_replace(e->lookups_by_key, avahi_key_ref(l->key), t);
+    lookup_index(l);
 
     AVAHI_LLIST_PREPEND(AvahiMulticastLookup, lookups, e->lookups, l);
 
@@ -117,7 +182,10 @@ AvahiMulticastLookup *avahi_multicast_lookup_new(
     /* Add a second */
     avahi_timeval_add(&tv, 1000000);
 
-    /* Issue the ALL_FOR_NOW event one second after the querier was initially created */
+    /* Issue the ALL_FOR_NOW event one second after the querier was
+     * initially created. If the queriers have been around for longer
+     * than that, the cache is complete for this key and the event
+     * fires right after the cache scan. */
     l->all_for_now_event = avahi_time_event_new(e->server->time_event_queue, &tv, all_for_now_callback, l);
 
     return l;
@@ -140,17 +208,10 @@ static void lookup_stop(AvahiMulticastLookup *l) {
 }
 
 static void lookup_destroy(AvahiMulticastLookup *l) {
-    AvahiMulticastLookup *t;
     assert(l);
 
     lookup_stop(l);
-
-    t = avahi_hashmap_lookup(l->engine->lookups_by_key, l->key);
-    AVAHI_LLIST_REMOVE(AvahiMulticastLookup, by_key, t, l);
-    if (t)
-        avahi_hashmap_replace(l->engine->lookups_by_key, avahi_key_ref(l->key), t);
-    else
-        avahi_hashmap_remove(l->engine->lookups_by_key, l->key);
+    lookup_unindex(l);
 
     AVAHI_LLIST_REMOVE(AvahiMulticastLookup, lookups, l->engine->lookups, l);
 
@@ -172,6 +233,11 @@ void avahi_multicast_lookup_free(AvahiMulticastLookup *l) {
     l->dead = 1;
     l->engine->cleanup_dead = 1;
     lookup_stop(l);
+
+    /* Stop cache events from reaching it right away, instead of
+     * skipping it on every event until the next cleanup */
+    if (!l->engine->n_dispatching)
+        lookup_unindex(l);
 }
 
 void avahi_multicast_lookup_engine_cleanup(AvahiMulticastLookupEngine *e) {
@@ -294,6 +360,8 @@ void avahi_multicast_lookup_engine_notify(AvahiMulticastLookupEngine *e, AvahiIn
     assert(record);
     assert(i);
 
+    e->n_dispatching++;
+
     for (l = avahi_hashmap_lookup(e->lookups_by_key, record->key); l; l = l->by_key_next) {
         if (l->dead || !l->callback)
             continue;
@@ -302,24 +370,18 @@ void avahi_multicast_lookup_engine_notify(AvahiMulticastLookupEngine *e, AvahiIn
             l->callback(e, i->hardware->index, i->protocol, event, AVAHI_LOOKUP_RESULT_MULTICAST, record, l->userdata);
     }
 
-
     if (record->key->clazz == AVAHI_DNS_CLASS_IN && record->key->type == AVAHI_DNS_TYPE_CNAME) {
-        /* It's a CNAME record, so we have to scan the all lookups to see if one matches */
-
-        for (l = e->lookups; l; l = l->lookups_next) {
-            AvahiKey *key;
+        /* It's a CNAME record, so pass it to the lookups for the name it is an alias for */
 
+        for (l = avahi_hashmap_lookup(e->lookups_by_cname_key, record->key); l; l = l->by_cname_key_next) {
             if (l->dead || !l->callback)
                 continue;
 
-            if ((key = avahi_key_new_cname(l->key))) {
-                if (avahi_key_equal(record->key, key))
-                    l->callback(e, i->hardware->index, i->protocol, event, AVAHI_LOOKUP_RESULT_MULTICAST, record, l->userdata);
-
-                avahi_key_unref(key);
-            }
+            l->callback(e, i->hardware->index, i->protocol, event, AVAHI_LOOKUP_RESULT_MULTICAST, record, l->userdata);
         }
     }
+
+    e->n_dispatching--;
 }
 
 AvahiMulticastLookupEngine *avahi_multicast_lookup_engine_new(AvahiServer *s) {
@@ -330,9 +392,11 @@ AvahiMulticastLookupEngine *avahi_multicast_lookup_engine_new(AvahiServer *s) {
     e = avahi_new(AvahiMulticastLookupEngine, 1);
     e->server = s;
     e->cleanup_dead = 0;
+    e->n_dispatching = 0;
 
     /* Initialize lookup list */
     e->lookups_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, (AvahiFreeFunc) avahi_key_unref, NULL);
+    e->lookups_by_cname_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, (AvahiFreeFunc) avahi_key_unref, NULL);
     AVAHI_LLIST_HEAD_INIT(AvahiWideAreaLookup, e->lookups);
 
     return e;
@@ -345,6 +409,7 @@ void avahi_multicast_lookup_engine_free(AvahiMulticastLookupEngine *e) {
         lookup_destroy(e->lookups);
 
     avahi_hashmap_free(e->lookups_by_key);
+    avahi_hashmap_free(e->lookups_by_cname_key);
     avahi_free(e);
 }
 
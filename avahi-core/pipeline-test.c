@@ -0,0 +1,233 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/timeval.h>
+
+#include "pipeline.h"
+#include "socket.h"
+#include "log.h"
+#include "log-thread.h"
+
+#define N_THREADS 4
+#define N_BATCHES 20
+#define BATCH_SIZE 50
+
+static AvahiSimplePoll *simple_poll = NULL;
+static pthread_t main_thread;
+static AvahiIfIndex loopback;
+
+static unsigned n_sent = 0, n_dispatched = 0;
+
+static void log_function(AvahiLogLevel level, const char *txt) {
+    /* Nothing may be logged from the workers directly */
+    assert(pthread_equal(pthread_self(), main_thread));
+    fprintf(stderr, "%i: %s\n", (int) level, txt);
+}
+
+static void callback(AvahiParsePipeline *pl, AvahiParsedPacket *pp, AVAHI_GCC_UNUSED void *userdata) {
+    char name[64];
+
+    assert(pl);
+    assert(pthread_equal(pthread_self(), main_thread));
+
+    /* Packets are dispatched in the order they were sent, the
+     * dropped ones don't show up at all */
+    assert(avahi_dns_packet_get_field(pp->packet, AVAHI_DNS_FIELD_ID) == n_dispatched);
+    assert(pp->iface == loopback);
+    assert(pp->valid);
+    assert(!pp->truncated);
+    assert(pp->n_keys == (n_dispatched % 7 == 0 ? 100 : 1));
+
+    snprintf(name, sizeof(name), "q%u.local", n_dispatched);
+    assert(strcmp(pp->keys[0]->name, name) == 0);
+
+    n_dispatched++;
+}
+
+static void send_packet(int fd, uint16_t port, uint16_t id, int query) {
+    AvahiDnsPacket *p;
+    struct sockaddr_in sa;
+    char name[64];
+    unsigned n, n_keys;
+
+    if (query) {
+        p = avahi_dns_packet_new_query(1500);
+
+        /* Some packets take much longer to parse than others, so
+         * that the workers finish out of order */
+        n_keys = id % 7 == 0 ? 100 : 1;
+
+        for (n = 0; n < n_keys; n++) {
+            AvahiKey *k;
+
+            snprintf(name, sizeof(name), "q%u.local", n == 0 ? id : id + 1000 * n);
+            k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_A);
+            assert(avahi_dns_packet_append_key(p, k, 0));
+            avahi_key_unref(k);
+        }
+
+        avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_QDCOUNT, (uint16_t) n_keys);
+    } else
+        /* Responses must come from the mDNS port, these are dropped
+         * before parsing */
+        p = avahi_dns_packet_new_response(1500, 1);
+
+    avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ID, id);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(sendto(fd, AVAHI_DNS_PACKET_DATA(p), p->size, 0, (struct sockaddr*) &sa, sizeof(sa)) == (ssize_t) p->size);
+
+    avahi_dns_packet_free(p);
+}
+
+/* Runs the main loop until n packets have been dispatched */
+static void wait_for(unsigned n) {
+    struct timeval start;
+
+    gettimeofday(&start, NULL);
+
+    while (n_dispatched < n) {
+        assert(avahi_age(&start) < 10*1000000);
+        assert(avahi_simple_poll_iterate(simple_poll, 100) >= 0);
+    }
+
+    /* Nothing else is on its way */
+    assert(avahi_simple_poll_iterate(simple_poll, 100) >= 0);
+    assert(n_dispatched == n);
+}
+
+static void hook_function(AVAHI_GCC_UNUSED AvahiLogLevel level, const char *txt, void *userdata) {
+    assert(strcmp(txt, "from a worker") == 0);
+    (*(unsigned*) userdata)++;
+}
+
+static void *log_thread(void *userdata) {
+    AvahiLogThreadHook hook;
+
+    hook.function = hook_function;
+    hook.userdata = userdata;
+
+    avahi_log_set_thread_hook(&hook);
+    avahi_log_warn("from a worker");
+    avahi_log_set_thread_hook(NULL);
+
+    return NULL;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiParsePipeline *pl;
+    struct sockaddr_in sa;
+    socklen_t l = sizeof(sa);
+    int fd, sender;
+    unsigned batch, n, n_hooked = 0;
+    uint16_t port;
+    pthread_t t;
+
+    main_thread = pthread_self();
+    avahi_set_log_function(log_function);
+
+    /* Messages logged by a thread with a hook go to the hook only */
+    assert(pthread_create(&t, NULL, log_thread, &n_hooked) == 0);
+    assert(pthread_join(t, NULL) == 0);
+    assert(n_hooked == 1);
+
+    if (!(loopback = (AvahiIfIndex) if_nametoindex("lo"))) {
+        printf("No loopback interface, skipping the pipeline test.\n");
+        return 0;
+    }
+
+    /* A unicast socket receives with the same interface and
+     * destination information as the multicast ones */
+    fd = avahi_open_unicast_socket_ipv4();
+    assert(fd >= 0);
+    assert(getsockname(fd, (struct sockaddr*) &sa, &l) == 0);
+    port = ntohs(sa.sin_port);
+
+    sender = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(sender >= 0);
+
+    simple_poll = avahi_simple_poll_new();
+    assert(simple_poll);
+
+    pl = avahi_parse_pipeline_new(avahi_simple_poll_get(simple_poll), fd, -1, NULL, N_THREADS, callback, NULL);
+    assert(pl);
+
+    /* Nothing is accepted before the interface is enabled */
+    send_packet(sender, port, 0xffff, 1);
+    wait_for(0);
+
+    avahi_parse_pipeline_set_interface(pl, loopback, AVAHI_PROTO_INET, 1);
+
+    /* Send in batches that fit into the socket buffer, with a
+     * response to be dropped after every third query */
+    for (batch = 0; batch < N_BATCHES; batch++) {
+        for (n = 0; n < BATCH_SIZE; n++) {
+            send_packet(sender, port, (uint16_t) n_sent++, 1);
+
+            if (n % 3 == 0)
+                send_packet(sender, port, 0xffff, 0);
+        }
+
+        wait_for(n_sent);
+    }
+
+    /* Disabling the interface drops its packets again, and enabling
+     * it restores them */
+    avahi_parse_pipeline_set_interface(pl, loopback, AVAHI_PROTO_INET, 0);
+    send_packet(sender, port, 0xffff, 1);
+    wait_for(n_sent);
+
+    avahi_parse_pipeline_set_interface(pl, loopback, AVAHI_PROTO_INET, 1);
+    send_packet(sender, port, (uint16_t) n_sent++, 1);
+    wait_for(n_sent);
+
+    /* Packets still on their way are dropped */
+    for (n = 0; n < BATCH_SIZE; n++)
+        send_packet(sender, port, 0xffff, 1);
+
+    avahi_parse_pipeline_free(pl);
+    avahi_simple_poll_free(simple_poll);
+
+    close(sender);
+    close(fd);
+
+    return 0;
+}
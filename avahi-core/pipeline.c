@@ -0,0 +1,683 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/time.h>
+#include <poll.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+
+#include "pipeline.h"
+#include "socket.h"
+#include "fdutil.h"
+#include "addr-util.h"
+#include "log.h"
+#include "log-thread.h"
+
+/* The smallest question is the root name, type and class, the
+ * smallest record adds TTL and RDATA length */
+#define MIN_QUESTION_SIZE 5
+#define MIN_RECORD_SIZE 11
+
+typedef struct LogMessage LogMessage;
+
+/* A message a worker logged, to be passed on by the main loop */
+struct LogMessage {
+    LogMessage *next;
+    AvahiLogLevel level;
+    char txt[1];
+};
+
+typedef struct PipelineInterface {
+    AvahiIfIndex iface;
+    AvahiProtocol protocol;
+} PipelineInterface;
+
+struct AvahiParsePipeline {
+    const AvahiPoll *poll_api;
+    int fd_ipv4, fd_ipv6;
+
+    AvahiSourceLimiter *limiter;
+
+    pthread_t *threads;
+    unsigned n_threads;
+
+    /* Only one worker at a time waits for and receives a packet, the
+     * others are parsing or waiting for their turn */
+    pthread_mutex_t recv_mutex;
+
+    /* Every received packet gets a ticket, in the order the packets
+     * were received. A worker queues its packet (or drops it) only
+     * when it is its ticket's turn, so that the main loop sees the
+     * packets in the order they arrived no matter which worker
+     * finished parsing first. next_ticket is protected by
+     * recv_mutex, queue_ticket by queue_mutex. */
+    unsigned next_ticket, queue_ticket;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_cond;
+
+    /* The interfaces the main loop accepts packets on. If adding one
+     * failed, all interfaces are accepted. */
+    pthread_mutex_t interfaces_mutex;
+    PipelineInterface *interfaces;
+    unsigned n_interfaces, n_interfaces_allocated;
+    int interfaces_incomplete;
+
+    /* A single byte is written to this to make all workers quit */
+    int quit_pipe[2];
+
+    /* The workers write to this when they queue a packet for an idle
+     * main loop */
+    int wakeup_pipe[2];
+    AvahiWatch *watch;
+
+    /* Lock-free LIFO of parsed packets. The workers push packets,
+     * the main loop takes all of them at once. */
+    AvahiParsedPacket *queue;
+    unsigned n_queued;
+
+    /* Lock-free LIFO of messages the workers logged, passed on to
+     * the real log function by the main loop */
+    LogMessage *log_queue;
+
+    unsigned n_dropped, n_dropped_logged;
+
+    AvahiParsePipelineCallback callback;
+    void *userdata;
+};
+
+AvahiParsedPacket *avahi_parsed_packet_new(
+    AvahiDnsPacket *p,
+    const AvahiAddress *src_address,
+    uint16_t port,
+    const AvahiAddress *dst_address,
+    AvahiIfIndex iface,
+    uint8_t ttl) {
+
+    AvahiParsedPacket *pp;
+    unsigned n_keys, n_records, n;
+    size_t l;
+
+    assert(p);
+    assert(src_address);
+    assert(dst_address);
+
+    if (!(pp = avahi_new0(AvahiParsedPacket, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        avahi_dns_packet_free(p);
+        return NULL;
+    }
+
+    pp->packet = p;
+    pp->src_address = *src_address;
+    pp->dst_address = *dst_address;
+    pp->port = port;
+    pp->iface = iface;
+    pp->ttl = ttl;
+
+    if (avahi_dns_packet_check_valid_multicast(p) < 0)
+        return pp;
+
+    pp->valid = 1;
+
+    n_keys = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT);
+    n_records =
+        avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT) +
+        avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT);
+
+    /* For queries EDNS0 might add an OPT record to the additional
+     * section, but nobody looks at it there */
+    if (!avahi_dns_packet_is_query(p))
+        n_records += avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ARCOUNT);
+
+    /* Don't allocate more than the packet could possibly contain */
+    l = p->size - AVAHI_DNS_PACKET_HEADER_SIZE;
+
+    if (n_keys > l / MIN_QUESTION_SIZE) {
+        n_keys = l / MIN_QUESTION_SIZE;
+        n_records = 0;
+        pp->truncated = 1;
+    }
+
+    if (n_records > l / MIN_RECORD_SIZE) {
+        n_records = l / MIN_RECORD_SIZE;
+        pp->truncated = 1;
+    }
+
+    if (n_keys > 0)
+        if (!(pp->keys = avahi_new(AvahiKey*, n_keys)) ||
+            !(pp->unicast_response = avahi_new0(int, n_keys)))
+            goto oom;
+
+    if (n_records > 0)
+        if (!(pp->records = avahi_new(AvahiRecord*, n_records)) ||
+            !(pp->cache_flush = avahi_new0(int, n_records)))
+            goto oom;
+
+    for (n = 0; n < n_keys; n++) {
+        if (!(pp->keys[n] = avahi_dns_packet_consume_key(p, &pp->unicast_response[n]))) {
+            pp->truncated = 1;
+            return pp;
+        }
+
+        pp->n_keys++;
+    }
+
+    for (n = 0; n < n_records; n++) {
+        if (!(pp->records[n] = avahi_dns_packet_consume_record(p, &pp->cache_flush[n]))) {
+            pp->truncated = 1;
+            return pp;
+        }
+
+        pp->n_records++;
+    }
+
+    return pp;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+    avahi_parsed_packet_free(pp);
+    return NULL;
+}
+
+void avahi_parsed_packet_free(AvahiParsedPacket *pp) {
+    unsigned n;
+
+    assert(pp);
+
+    for (n = 0; n < pp->n_keys; n++)
+        avahi_key_unref(pp->keys[n]);
+
+    for (n = 0; n < pp->n_records; n++)
+        avahi_record_unref(pp->records[n]);
+
+    avahi_free(pp->keys);
+    avahi_free(pp->unicast_response);
+    avahi_free(pp->records);
+    avahi_free(pp->cache_flush);
+
+    avahi_dns_packet_free(pp->packet);
+    avahi_free(pp);
+}
+
+/* Waits until one of the sockets has a packet and receives it.
+ * Returns -1 when the worker should quit. */
+static int receive(
+    AvahiParsePipeline *pl,
+    AvahiDnsPacket **ret_packet,
+    AvahiAddress *src_address,
+    uint16_t *port,
+    AvahiAddress *dst_address,
+    AvahiIfIndex *iface,
+    uint8_t *ttl,
+    unsigned *ticket) {
+
+    struct pollfd pollfd[3];
+    unsigned n;
+    int r = 0;
+
+    *ret_packet = NULL;
+
+    memset(pollfd, 0, sizeof(pollfd));
+    pollfd[0].fd = pl->quit_pipe[0];
+    pollfd[1].fd = pl->fd_ipv4;
+    pollfd[2].fd = pl->fd_ipv6;
+
+    for (n = 0; n < 3; n++)
+        pollfd[n].events = POLLIN;
+
+    pthread_mutex_lock(&pl->recv_mutex);
+
+    /* Negative fds are ignored by poll() */
+    if (poll(pollfd, 3, -1) < 0) {
+        if (errno != EINTR)
+            avahi_log_warn("poll(): %s", strerror(errno));
+
+    } else if (pollfd[0].revents)
+        r = -1;
+
+    else if (pollfd[1].revents) {
+        dst_address->proto = src_address->proto = AVAHI_PROTO_INET;
+        *ret_packet = avahi_recv_dns_packet_ipv4(pl->fd_ipv4, &src_address->data.ipv4, port, &dst_address->data.ipv4, iface, ttl);
+
+    } else if (pollfd[2].revents) {
+        dst_address->proto = src_address->proto = AVAHI_PROTO_INET6;
+        *ret_packet = avahi_recv_dns_packet_ipv6(pl->fd_ipv6, &src_address->data.ipv6, port, &dst_address->data.ipv6, iface, ttl);
+    }
+
+    if (*ret_packet)
+        *ticket = pl->next_ticket++;
+
+    pthread_mutex_unlock(&pl->recv_mutex);
+
+    return r;
+}
+
+static void wakeup(AvahiParsePipeline *pl) {
+    char c = 'x';
+
+    if (write(pl->wakeup_pipe[1], &c, sizeof(c)) < 0) {
+        /* The pipe is full, so the main loop will wake up anyway.
+         * Don't log anything, that would end up here again. */
+    }
+}
+
+static void push(AvahiParsePipeline *pl, AvahiParsedPacket *pp) {
+    AvahiParsedPacket *head;
+
+    head = __atomic_load_n(&pl->queue, __ATOMIC_RELAXED);
+
+    do
+        pp->next = head;
+    while (!__atomic_compare_exchange_n(&pl->queue, &head, pp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* If the queue wasn't empty, the main loop has been woken up
+     * already and will pick this packet up, too */
+    if (!head)
+        wakeup(pl);
+}
+
+/* Queues everything the workers log for the main loop, the log
+ * function set by the application needn't be thread safe */
+static void log_hook(AvahiLogLevel level, const char *txt, void *userdata) {
+    AvahiParsePipeline *pl = userdata;
+    LogMessage *m, *head;
+    size_t l;
+
+    l = strlen(txt);
+
+    /* Nobody to tell if this fails */
+    if (!(m = avahi_malloc(offsetof(LogMessage, txt) + l + 1)))
+        return;
+
+    m->level = level;
+    memcpy(m->txt, txt, l + 1);
+
+    head = __atomic_load_n(&pl->log_queue, __ATOMIC_RELAXED);
+
+    do
+        m->next = head;
+    while (!__atomic_compare_exchange_n(&pl->log_queue, &head, m, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (!head)
+        wakeup(pl);
+}
+
+static int interface_accepted(AvahiParsePipeline *pl, AvahiIfIndex iface, AvahiProtocol protocol) {
+    unsigned n;
+    int r;
+
+    pthread_mutex_lock(&pl->interfaces_mutex);
+
+    r = pl->interfaces_incomplete;
+
+    for (n = 0; !r && n < pl->n_interfaces; n++)
+        if (pl->interfaces[n].iface == iface && pl->interfaces[n].protocol == protocol)
+            r = 1;
+
+    pthread_mutex_unlock(&pl->interfaces_mutex);
+
+    return r;
+}
+
+/* The checks of dispatch_packet() in server.c that are cheap and
+ * don't need any server state, so that the workers don't parse what
+ * the main loop would drop anyway. It still does all of them. */
+static int accept_packet(
+    AvahiParsePipeline *pl,
+    AvahiDnsPacket *p,
+    const AvahiAddress *src_address,
+    uint16_t port,
+    AvahiIfIndex iface) {
+
+    if (port <= 0 || avahi_address_is_ipv4_in_ipv6(src_address))
+        return 0;
+
+    /* Only queries may come from another port (legacy unicast) */
+    if (port != AVAHI_MDNS_PORT &&
+        p->size >= AVAHI_DNS_PACKET_HEADER_SIZE &&
+        !avahi_dns_packet_is_query(p))
+        return 0;
+
+    /* Packets without interface are looked up by their address in
+     * the main loop */
+    if (iface != AVAHI_IF_UNSPEC &&
+        !interface_accepted(pl, iface, src_address->proto))
+        return 0;
+
+    if (pl->limiter) {
+        struct timeval now;
+
+        gettimeofday(&now, NULL);
+
+        if (!avahi_source_limiter_check(pl->limiter, src_address, &now))
+            return 0;
+    }
+
+    return 1;
+}
+
+static void* thread(void *userdata) {
+    AvahiParsePipeline *pl = userdata;
+    AvahiLogThreadHook hook;
+    sigset_t mask;
+
+    /* Make sure that signals are delivered to the main thread */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    hook.function = log_hook;
+    hook.userdata = pl;
+    avahi_log_set_thread_hook(&hook);
+
+    for (;;) {
+        AvahiDnsPacket *p;
+        AvahiParsedPacket *pp = NULL;
+        AvahiAddress src, dst;
+        uint16_t port;
+        AvahiIfIndex iface;
+        uint8_t ttl;
+        unsigned ticket;
+
+        if (receive(pl, &p, &src, &port, &dst, &iface, &ttl, &ticket) < 0)
+            break;
+
+        if (!p)
+            continue;
+
+        if (!accept_packet(pl, p, &src, port, iface))
+            avahi_dns_packet_free(p);
+
+        /* Drop the packet right away if the main loop couldn't
+         * handle it anytime soon anyway */
+        else if (__atomic_add_fetch(&pl->n_queued, 1, __ATOMIC_RELAXED) > AVAHI_PARSE_PIPELINE_QUEUE_MAX) {
+            __atomic_sub_fetch(&pl->n_queued, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&pl->n_dropped, 1, __ATOMIC_RELAXED);
+            avahi_dns_packet_free(p);
+
+        /* The keys and records created here aren't shared with
+         * anybody, so their reference counts are only touched by
+         * this thread until push() hands them over to the main loop,
+         * and only by the main loop afterwards. */
+        } else if (!(pp = avahi_parsed_packet_new(p, &src, port, &dst, iface, ttl)))
+            __atomic_sub_fetch(&pl->n_queued, 1, __ATOMIC_RELAXED);
+
+        /* Wait for our turn even if the packet was dropped, the
+         * workers with later tickets are waiting for us */
+        pthread_mutex_lock(&pl->queue_mutex);
+
+        while (pl->queue_ticket != ticket)
+            pthread_cond_wait(&pl->queue_cond, &pl->queue_mutex);
+
+        if (pp)
+            push(pl, pp);
+
+        pl->queue_ticket++;
+        pthread_cond_broadcast(&pl->queue_cond);
+        pthread_mutex_unlock(&pl->queue_mutex);
+    }
+
+    avahi_log_set_thread_hook(NULL);
+
+    return NULL;
+}
+
+static AvahiParsedPacket *take_queue(AvahiParsePipeline *pl) {
+    AvahiParsedPacket *pp, *next, *ret = NULL;
+
+    pp = __atomic_exchange_n(&pl->queue, NULL, __ATOMIC_ACQUIRE);
+
+    /* Restore the order the packets were queued in */
+    for (; pp; pp = next) {
+        next = pp->next;
+        pp->next = ret;
+        ret = pp;
+    }
+
+    return ret;
+}
+
+static void flush_log(AvahiParsePipeline *pl) {
+    LogMessage *m, *next, *l = NULL;
+
+    m = __atomic_exchange_n(&pl->log_queue, NULL, __ATOMIC_ACQUIRE);
+
+    for (; m; m = next) {
+        next = m->next;
+        m->next = l;
+        l = m;
+    }
+
+    for (m = l; m; m = next) {
+        next = m->next;
+        avahi_log(m->level, "%s", m->txt);
+        avahi_free(m);
+    }
+}
+
+static void wakeup_event(AvahiWatch *w, int fd, AvahiWatchEvent events, void *userdata) {
+    AvahiParsePipeline *pl = userdata;
+    AvahiParsedPacket *pp, *next;
+    unsigned n = 0, n_dropped;
+    char buf[64];
+
+    assert(w);
+    assert(fd == pl->wakeup_pipe[0]);
+    assert(events & AVAHI_WATCH_IN);
+
+    /* Empty the pipe before taking the queue, so that we don't miss a
+     * wakeup for packets queued after that */
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    flush_log(pl);
+
+    pp = take_queue(pl);
+
+    for (next = pp; next; next = next->next)
+        n++;
+
+    __atomic_sub_fetch(&pl->n_queued, n, __ATOMIC_RELAXED);
+
+    for (; pp; pp = next) {
+        next = pp->next;
+        pl->callback(pl, pp, pl->userdata);
+        avahi_parsed_packet_free(pp);
+    }
+
+    n_dropped = __atomic_load_n(&pl->n_dropped, __ATOMIC_RELAXED);
+
+    if (n_dropped != pl->n_dropped_logged) {
+        avahi_log_warn("Dropped %u incoming packets, main loop too busy.", n_dropped - pl->n_dropped_logged);
+        pl->n_dropped_logged = n_dropped;
+    }
+}
+
+AvahiParsePipeline *avahi_parse_pipeline_new(
+    const AvahiPoll *poll_api,
+    int fd_ipv4,
+    int fd_ipv6,
+    AvahiSourceLimiter *limiter,
+    unsigned n_threads,
+    AvahiParsePipelineCallback callback,
+    void *userdata) {
+
+    AvahiParsePipeline *pl;
+    int r;
+
+    assert(poll_api);
+    assert(fd_ipv4 >= 0 || fd_ipv6 >= 0);
+    assert(n_threads > 0);
+    assert(callback);
+
+    if (!(pl = avahi_new0(AvahiParsePipeline, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    pl->poll_api = poll_api;
+    pl->fd_ipv4 = fd_ipv4;
+    pl->fd_ipv6 = fd_ipv6;
+    pl->limiter = limiter;
+    pl->callback = callback;
+    pl->userdata = userdata;
+    pl->quit_pipe[0] = pl->quit_pipe[1] = -1;
+    pl->wakeup_pipe[0] = pl->wakeup_pipe[1] = -1;
+
+    pthread_mutex_init(&pl->recv_mutex, NULL);
+    pthread_mutex_init(&pl->queue_mutex, NULL);
+    pthread_cond_init(&pl->queue_cond, NULL);
+    pthread_mutex_init(&pl->interfaces_mutex, NULL);
+
+    if (pipe(pl->quit_pipe) < 0 ||
+        pipe(pl->wakeup_pipe) < 0) {
+        avahi_log_error("pipe() failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    if (avahi_set_cloexec(pl->quit_pipe[0]) < 0 ||
+        avahi_set_cloexec(pl->quit_pipe[1]) < 0 ||
+        avahi_set_cloexec(pl->wakeup_pipe[0]) < 0 ||
+        avahi_set_cloexec(pl->wakeup_pipe[1]) < 0 ||
+        avahi_set_nonblock(pl->wakeup_pipe[0]) < 0 ||
+        avahi_set_nonblock(pl->wakeup_pipe[1]) < 0) {
+        avahi_log_error("fcntl() failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    if (!(pl->watch = poll_api->watch_new(poll_api, pl->wakeup_pipe[0], AVAHI_WATCH_IN, wakeup_event, pl))) {
+        avahi_log_error(__FILE__": Failed to create watch");
+        goto fail;
+    }
+
+    if (!(pl->threads = avahi_new(pthread_t, n_threads))) {
+        avahi_log_error(__FILE__": Out of memory");
+        goto fail;
+    }
+
+    for (; pl->n_threads < n_threads; pl->n_threads++)
+        if ((r = pthread_create(&pl->threads[pl->n_threads], NULL, thread, pl)) != 0) {
+            avahi_log_error("Failed to create parser thread: %s", strerror(r));
+            goto fail;
+        }
+
+    return pl;
+
+fail:
+    avahi_parse_pipeline_free(pl);
+    return NULL;
+}
+
+void avahi_parse_pipeline_free(AvahiParsePipeline *pl) {
+    AvahiParsedPacket *pp, *next;
+    unsigned n;
+
+    assert(pl);
+
+    if (pl->n_threads > 0) {
+        char c = 'x';
+
+        /* Nobody reads this, so it wakes up all workers for good */
+        if (write(pl->quit_pipe[1], &c, sizeof(c)) < 0)
+            avahi_log_warn("write(): %s", strerror(errno));
+
+        for (n = 0; n < pl->n_threads; n++)
+            pthread_join(pl->threads[n], NULL);
+    }
+
+    if (pl->watch)
+        pl->poll_api->watch_free(pl->watch);
+
+    flush_log(pl);
+
+    for (pp = take_queue(pl); pp; pp = next) {
+        next = pp->next;
+        avahi_parsed_packet_free(pp);
+    }
+
+    for (n = 0; n < 2; n++) {
+        if (pl->quit_pipe[n] >= 0)
+            close(pl->quit_pipe[n]);
+        if (pl->wakeup_pipe[n] >= 0)
+            close(pl->wakeup_pipe[n]);
+    }
+
+    pthread_mutex_destroy(&pl->recv_mutex);
+    pthread_mutex_destroy(&pl->queue_mutex);
+    pthread_cond_destroy(&pl->queue_cond);
+    pthread_mutex_destroy(&pl->interfaces_mutex);
+
+    avahi_free(pl->interfaces);
+    avahi_free(pl->threads);
+    avahi_free(pl);
+}
+
+void avahi_parse_pipeline_set_interface(AvahiParsePipeline *pl, AvahiIfIndex iface, AvahiProtocol protocol, int enable) {
+    unsigned n;
+
+    assert(pl);
+    assert(iface != AVAHI_IF_UNSPEC);
+
+    pthread_mutex_lock(&pl->interfaces_mutex);
+
+    for (n = 0; n < pl->n_interfaces; n++)
+        if (pl->interfaces[n].iface == iface && pl->interfaces[n].protocol == protocol)
+            break;
+
+    if (!enable) {
+
+        if (n < pl->n_interfaces)
+            pl->interfaces[n] = pl->interfaces[--pl->n_interfaces];
+
+    } else if (n >= pl->n_interfaces) {
+
+        if (pl->n_interfaces >= pl->n_interfaces_allocated) {
+            PipelineInterface *i;
+            unsigned k;
+
+            k = pl->n_interfaces_allocated ? pl->n_interfaces_allocated * 2 : 8;
+
+            if (!(i = avahi_realloc(pl->interfaces, sizeof(PipelineInterface) * k))) {
+                avahi_log_error(__FILE__": Out of memory, parsing packets from all interfaces");
+                pl->interfaces_incomplete = 1;
+                goto finish;
+            }
+
+            pl->interfaces = i;
+            pl->n_interfaces_allocated = k;
+        }
+
+        pl->interfaces[pl->n_interfaces].iface = iface;
+        pl->interfaces[pl->n_interfaces].protocol = protocol;
+        pl->n_interfaces++;
+    }
+
+finish:
+    pthread_mutex_unlock(&pl->interfaces_mutex);
+}
@@ -0,0 +1,118 @@
+#ifndef foopipelinehfoo
+#define foopipelinehfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <avahi-common/address.h>
+#include <avahi-common/watch.h>
+
+#include "dns.h"
+#include "rr.h"
+#include "source-limit.h"
+
+/* Don't let the worker threads queue more than this many packets for
+ * the main loop */
+#define AVAHI_PARSE_PIPELINE_QUEUE_MAX 1024
+
+typedef struct AvahiParsedPacket AvahiParsedPacket;
+
+/* A received multicast packet with all its keys and records parsed
+ * already. This is created by whoever received the packet and not
+ * modified anymore afterwards, so that it can be handed from a worker
+ * thread to the main loop. */
+struct AvahiParsedPacket {
+    AvahiParsedPacket *next;
+
+    /* The packet itself, for generating legacy unicast responses and
+     * for reflecting */
+    AvahiDnsPacket *packet;
+
+    AvahiAddress src_address, dst_address;
+    uint16_t port;
+    AvahiIfIndex iface;
+    uint8_t ttl;
+
+    /* Nonzero if avahi_dns_packet_check_valid_multicast() succeeded,
+     * nothing below is filled in otherwise */
+    int valid;
+
+    /* The question section */
+    AvahiKey **keys;
+    int *unicast_response;
+    unsigned n_keys;
+
+    /* The answer, authority and additional sections, in this
+     * order. The additional section is only parsed for responses. */
+    AvahiRecord **records;
+    int *cache_flush;
+    unsigned n_records;
+
+    /* Parsing stops at the first invalid key or record, the sections
+     * are complete only if this isn't set */
+    int truncated;
+};
+
+/* Parses p and takes possession of it. Returns NULL on OOM, in which
+ * case p is freed, too. */
+AvahiParsedPacket *avahi_parsed_packet_new(
+    AvahiDnsPacket *p,
+    const AvahiAddress *src_address,
+    uint16_t port,
+    const AvahiAddress *dst_address,
+    AvahiIfIndex iface,
+    uint8_t ttl);
+
+void avahi_parsed_packet_free(AvahiParsedPacket *pp);
+
+typedef struct AvahiParsePipeline AvahiParsePipeline;
+
+/* Called from the main loop for each packet the worker threads
+ * parsed. The callback doesn't take possession of the packet. */
+typedef void (*AvahiParsePipelineCallback)(AvahiParsePipeline *pl, AvahiParsedPacket *pp, void *userdata);
+
+/* Starts n_threads worker threads that receive and parse packets
+ * from the multicast sockets fd_ipv4 and fd_ipv6 (either may be
+ * negative). Packets that limiter (if non-NULL) rejects, that come
+ * in on an interface not enabled with
+ * avahi_parse_pipeline_set_interface() or that fail the other cheap
+ * checks of the main loop are dropped before parsing. The results
+ * are passed to callback from the main loop behind poll_api, in the
+ * order the packets were received. Whatever the workers log is
+ * logged from the main loop, too. */
+AvahiParsePipeline *avahi_parse_pipeline_new(
+    const AvahiPoll *poll_api,
+    int fd_ipv4,
+    int fd_ipv6,
+    AvahiSourceLimiter *limiter,
+    unsigned n_threads,
+    AvahiParsePipelineCallback callback,
+    void *userdata);
+
+/* Stops the worker threads and drops all packets not dispatched yet */
+void avahi_parse_pipeline_free(AvahiParsePipeline *pl);
+
+/* Makes the workers accept (or drop) packets received on the
+ * interface iface for protocol. Packets whose interface isn't known
+ * are always accepted. Call this from the main loop only. */
+void avahi_parse_pipeline_set_interface(AvahiParsePipeline *pl, AvahiIfIndex iface, AvahiProtocol protocol, int enable);
+
+#endif
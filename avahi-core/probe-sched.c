@@ -201,7 +201,7 @@ static int packet_add_probe_query(AvahiProbeScheduler *s, AvahiDnsPacket *p, Ava
             continue;
 
         /* Does the record match the probe? */
-        if (k->clazz != pj->record->key->clazz || !avahi_domain_equal(k->name, pj->record->key->name))
+        if (k->clazz != pj->record->key->clazz || AVAHI_KEY_PRIVATE(k)->canonical != AVAHI_KEY_PRIVATE(pj->record->key)->canonical)
             continue;
 
         /* This job wouldn't fit in */
@@ -0,0 +1,118 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <avahi-common/error.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/benchmark.h>
+#include <avahi-common/gccmacro.h>
+
+#include <avahi-core/core.h>
+#include <avahi-core/publish.h>
+
+/* Registers lots of services of the same type in one entry group,
+ * which used to take time quadratic in the number of services since
+ * all of them share the PTR key of the type */
+
+#define N_SERVICES 10000
+#define N_STEPS 10
+
+int main(int argc, char *argv[]) {
+    AvahiSimplePoll *simple_poll;
+    AvahiServer *server;
+    AvahiServerConfig config;
+    AvahiSEntryGroup *group;
+    struct timeval start, step;
+    unsigned n, n_services = N_SERVICES, n_step;
+    int error;
+
+    if (argc > 1)
+        n_services = (unsigned) atoi(argv[1]);
+
+    n_step = n_services / N_STEPS ? n_services / N_STEPS : 1;
+
+    simple_poll = avahi_simple_poll_new();
+    assert(simple_poll);
+
+    avahi_server_config_init(&config);
+    config.publish_domain = config.publish_workstation = config.publish_hinfo = config.publish_addresses = 0;
+
+    if (!(server = avahi_server_new(avahi_simple_poll_get(simple_poll), &config, NULL, NULL, &error))) {
+        fprintf(stderr, "Failed to create server: %s\n", avahi_strerror(error));
+        return 1;
+    }
+
+    avahi_server_config_free(&config);
+
+    group = avahi_s_entry_group_new(server, NULL, NULL);
+    assert(group);
+
+    gettimeofday(&start, NULL);
+    step = start;
+
+    for (n = 0; n < n_services; n++) {
+        char name[64];
+        int ret;
+
+        snprintf(name, sizeof(name), "Service %u", n);
+
+        ret = avahi_server_add_service(server, group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, 80, "path=/", NULL);
+        assert(ret == AVAHI_OK);
+
+        if ((n + 1) % n_step == 0) {
+            char what[64];
+
+            /* The time per service must not grow with the number of
+             * services already registered */
+            snprintf(what, sizeof(what), "services %6u to %6u registered", n + 2 - n_step, n + 1);
+            avahi_benchmark_report(&step, what, n_step);
+            gettimeofday(&step, NULL);
+        }
+    }
+
+    /* Adding the same service again has to be refused quickly, too */
+    gettimeofday(&step, NULL);
+    for (n = 0; n < n_services; n++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "Service %u", n);
+
+        if (avahi_server_add_service(server, NULL, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, 81, "path=/", NULL) != AVAHI_ERR_COLLISION) {
+            fprintf(stderr, "Conflicting service has not been refused.\n");
+            return 1;
+        }
+    }
+
+    avahi_benchmark_report(&step, "conflicting services refused", n_services);
+    avahi_benchmark_report(&start, "services registered and refused in total", 2 * n_services);
+
+    avahi_s_entry_group_free(group);
+    avahi_server_free(server);
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
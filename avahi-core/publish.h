@@ -67,6 +67,12 @@ int avahi_s_entry_group_is_empty(AvahiSEntryGroup *g);
 /** Return the current state of the specified entry group */
 AvahiEntryGroupState avahi_s_entry_group_get_state(AvahiSEntryGroup *g);
 
+/** Return how long it took from the last call to
+ * avahi_s_entry_group_commit() until the group reached
+ * AVAHI_ENTRY_GROUP_ESTABLISHED, in usec. Returns 0 if the group
+ * has not been established since the last commit. \since 0.7 */
+AvahiUsec avahi_s_entry_group_get_establish_time(AvahiSEntryGroup *g);
+
 /** Change the opaque user data pointer attached to an entry group object */
 void avahi_s_entry_group_set_data(AvahiSEntryGroup *g, void* userdata);
 
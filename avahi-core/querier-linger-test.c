@@ -0,0 +1,281 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/defs.h>
+#include <avahi-common/domain.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/timeval.h>
+
+#include "core.h"
+#include "publish.h"
+#include "lookup.h"
+#include "internal.h"
+
+/* Has one server publish services and another one browse for them,
+ * and checks when the browser gets its ALL_FOR_NOW event: right away
+ * if an earlier browser for the same key got an answer that is still
+ * cached, otherwise a second after browsing started. */
+
+#define TIMEOUT_SEC 10
+
+/* Enough for the first service and its type, but not for the fillers */
+#define N_CACHE_ENTRIES 8
+#define N_FILLERS 10
+
+/* Anything quicker than this did not wait for the one second delay */
+#define QUICK_USEC (500000)
+
+static AvahiSimplePoll *simple_poll = NULL;
+
+static int n_established = 0;
+static int n_new = 0;
+static int all_for_now = 0;
+
+static void server_callback(AVAHI_GCC_UNUSED AvahiServer *s, AVAHI_GCC_UNUSED AvahiServerState state, AVAHI_GCC_UNUSED void* userdata) {
+}
+
+static void group_callback(AVAHI_GCC_UNUSED AvahiServer *s, AVAHI_GCC_UNUSED AvahiSEntryGroup *g, AvahiEntryGroupState state, AVAHI_GCC_UNUSED void *userdata) {
+    if (state == AVAHI_ENTRY_GROUP_ESTABLISHED)
+        n_established++;
+}
+
+static void browse_callback(
+    AVAHI_GCC_UNUSED AvahiSRecordBrowser *b,
+    AVAHI_GCC_UNUSED AvahiIfIndex interface,
+    AVAHI_GCC_UNUSED AvahiProtocol protocol,
+    AvahiBrowserEvent event,
+    AVAHI_GCC_UNUSED AvahiRecord *record,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    AVAHI_GCC_UNUSED void* userdata) {
+
+    switch (event) {
+        case AVAHI_BROWSER_NEW:
+            n_new++;
+            break;
+
+        case AVAHI_BROWSER_ALL_FOR_NOW:
+            all_for_now = 1;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static int established(void) {
+    return n_established > 0;
+}
+
+static int got_all_for_now(void) {
+    return all_for_now;
+}
+
+/* Runs the main loop until check() returns non-zero, or returns 0 if
+ * that doesn't happen in time */
+static int wait_for(int (*check)(void), unsigned sec) {
+    struct timeval end, now;
+
+    gettimeofday(&end, NULL);
+    end.tv_sec += sec;
+
+    while (!check()) {
+        gettimeofday(&now, NULL);
+
+        if (avahi_timeval_compare(&now, &end) >= 0)
+            return 0;
+
+        assert(avahi_simple_poll_iterate(simple_poll, 100) == 0);
+    }
+
+    return 1;
+}
+
+/* Runs the main loop for the specified time */
+static void run(AvahiUsec usec) {
+    struct timeval start;
+
+    gettimeofday(&start, NULL);
+
+    while (avahi_age(&start) < usec)
+        assert(avahi_simple_poll_iterate(simple_poll, 100) == 0);
+}
+
+static unsigned n_evicted(AvahiServer *s) {
+    AvahiInterface *i;
+    unsigned n = 0;
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next)
+        n += i->cache->n_evicted;
+
+    return n;
+}
+
+/* Creates a server, with the default cache size if n_cache_entries_max is 0 */
+static AvahiServer *new_server(unsigned n_cache_entries_max) {
+    AvahiServerConfig config;
+    AvahiServer *s;
+    int error;
+
+    /* Don't publish anything on our own, so that the two servers
+     * don't conflict with each other */
+    avahi_server_config_init(&config);
+    config.use_ipv6 = 0;
+    config.publish_hinfo = 0;
+    config.publish_addresses = 0;
+    config.publish_workstation = 0;
+    config.publish_domain = 0;
+
+    if (n_cache_entries_max > 0)
+        config.n_cache_entries_max = n_cache_entries_max;
+
+    s = avahi_server_new(avahi_simple_poll_get(simple_poll), &config, server_callback, NULL, &error);
+    assert(s);
+
+    avahi_server_config_free(&config);
+
+    return s;
+}
+
+static void publish(AvahiServer *s, const char *type, unsigned n) {
+    AvahiSEntryGroup *g;
+    unsigned j;
+
+    g = avahi_s_entry_group_new(s, group_callback, NULL);
+    assert(g);
+
+    for (j = 0; j < n; j++) {
+        char name[AVAHI_LABEL_MAX];
+
+        snprintf(name, sizeof(name), "Linger %u", j);
+        assert(avahi_server_add_service(s, g, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, type, NULL, NULL, 80, "path=/", NULL) == 0);
+    }
+
+    n_established = 0;
+    assert(avahi_s_entry_group_commit(g) == 0);
+}
+
+/* Browses for the PTR records of the service type, and returns how
+ * long it took until ALL_FOR_NOW, or -1 if it never came. The number
+ * of services found is returned in *ret_n. */
+static AvahiUsec browse(AvahiServer *s, const char *type, AvahiUsec linger, int *ret_n) {
+    AvahiSRecordBrowser *b;
+    AvahiKey *k;
+    struct timeval start;
+    AvahiUsec t;
+    char name[AVAHI_DOMAIN_NAME_MAX];
+
+    snprintf(name, sizeof(name), "%s.local", type);
+
+    k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR);
+    assert(k);
+
+    n_new = 0;
+    all_for_now = 0;
+    gettimeofday(&start, NULL);
+
+    b = avahi_s_record_browser_new(s, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, k, AVAHI_LOOKUP_USE_MULTICAST, browse_callback, NULL);
+    assert(b);
+    avahi_key_unref(k);
+
+    t = wait_for(got_all_for_now, TIMEOUT_SEC) ? avahi_age(&start) : -1;
+
+    /* Give the answers to our queries time to come in */
+    run(linger);
+
+    *ret_n = n_new;
+    avahi_s_record_browser_free(b);
+
+    return t;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiServer *publisher, *browser;
+    AvahiUsec t;
+    int n;
+
+    simple_poll = avahi_simple_poll_new();
+    assert(simple_poll);
+
+    publisher = new_server(0);
+    browser = new_server(N_CACHE_ENTRIES);
+
+    /* Wait for the browser to come up too */
+    run(1000000);
+
+    publish(publisher, "_http._tcp", 1);
+
+    assert(wait_for(established, TIMEOUT_SEC));
+
+    /* The first browser has to wait the full second, a later one
+     * can rely on the cache and gets ALL_FOR_NOW right away */
+    t = browse(browser, "_http._tcp", 1000000, &n);
+
+    if (n == 0) {
+        printf("No usable network interface, skipping querier tests\n");
+        goto finish;
+    }
+
+    assert(t >= QUICK_USEC);
+    assert(n == 1);
+
+    t = browse(browser, "_http._tcp", 0, &n);
+    assert(t >= 0 && t < QUICK_USEC);
+    assert(n == 1);
+
+    /* Nobody answers queries for this type, so no browser may rely
+     * on the cache being complete, no matter how long the querier
+     * has been around */
+    t = browse(browser, "_nobody._tcp", 1000000, &n);
+    assert(t >= QUICK_USEC);
+    assert(n == 0);
+
+    t = browse(browser, "_nobody._tcp", 0, &n);
+    assert(t >= QUICK_USEC);
+    assert(n == 0);
+
+    /* Make the browser evict the service from its cache, after which
+     * it is not complete anymore */
+    publish(publisher, "_filler._tcp", N_FILLERS);
+    assert(wait_for(established, TIMEOUT_SEC));
+    run(1000000);
+
+    assert(n_evicted(browser) > 0);
+
+    t = browse(browser, "_http._tcp", 1000000, &n);
+    assert(t >= QUICK_USEC);
+    assert(n == 1);
+
+    printf("Answered queries linger, unanswered and incomplete ones don't\n");
+
+finish:
+    avahi_server_free(browser);
+    avahi_server_free(publisher);
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
@@ -31,12 +31,29 @@
 #include "querier.h"
 #include "log.h"
 
+/* How long a querier whose query has been answered is kept around
+ * after the last lookup went away. A new lookup for the same key
+ * within that time may rely on the cache being complete and gets its
+ * ALL_FOR_NOW event right away, instead of one second later. The
+ * querier is dropped earlier if the cache needs to refresh or evict
+ * one of its entries for the key, since the cache might then go out
+ * of date. */
+#define AVAHI_QUERIER_LINGER_MSEC (60*1000)
+
+/* Other responders may take up to a second to answer our query, so
+ * even after an answer came in the cache is only considered complete
+ * for the key once the querier is that old */
+#define AVAHI_QUERIER_ANSWERED_USEC (1000000)
+
 struct AvahiQuerier {
     AvahiInterface *interface;
 
     AvahiKey *key;
     int n_used;
 
+    /* An answer to our query has been received and cached */
+    int answered;
+
     unsigned sec_delay;
 
     AvahiTimeEvent *time_event;
@@ -105,7 +122,17 @@ void avahi_querier_add(AvahiInterface *i, AvahiKey *key, struct timeval *ret_cti
     if ((q = avahi_hashmap_lookup(i->queriers_by_key, key))) {
 
         /* Someone is already browsing for records of this RR key */
-        q->n_used++;
+        if (q->n_used++ <= 0) {
+            /* Nobody was using this querier anymore, so we stopped
+             * sending queries from it. Start again. */
+            avahi_time_event_update(q->time_event, avahi_elapse_time(&tv, q->sec_delay*1000, 0));
+
+            /* Without an answer the cache might not be complete for
+             * this key, so the new lookup has to wait the full
+             * second before ALL_FOR_NOW */
+            if (!q->answered)
+                gettimeofday(&q->creation_time, NULL);
+        }
 
         /* Return the creation time. This is used for generating the
          * ALL_FOR_NOW event one second after the querier was
@@ -122,6 +149,7 @@ void avahi_querier_add(AvahiInterface *i, AvahiKey *key, struct timeval *ret_cti
     q->key = avahi_key_ref(key);
     q->interface = i;
     q->n_used = 1;
+    q->answered = 0;
     q->sec_delay = 1;
     q->post_id_valid = 0;
     gettimeofday(&q->creation_time, NULL);
@@ -152,10 +180,26 @@ void avahi_querier_remove(AvahiInterface *i, AvahiKey *key) {
         return;
 
     if ((--q->n_used) <= 0) {
+        struct timeval tv;
 
         /* Nobody references us anymore. */
 
-        if (q->post_id_valid && avahi_interface_withraw_query(i, q->post_id)) {
+        if (q->answered && avahi_age(&q->creation_time) >= AVAHI_QUERIER_ANSWERED_USEC) {
+
+            /* Our query has been answered, and the cache is complete
+             * for this key now. Stop querying, but stay around for a
+             * while so that the next lookup for this key can make
+             * use of that. We are freed when our time event
+             * elapses. */
+
+            if (q->post_id_valid) {
+                avahi_interface_withraw_query(i, q->post_id);
+                q->post_id_valid = 0;
+            }
+
+            avahi_time_event_update(q->time_event, avahi_elapse_time(&tv, AVAHI_QUERIER_LINGER_MSEC, 0));
+
+        } else if (q->post_id_valid && avahi_interface_withraw_query(i, q->post_id)) {
 
             /* We succeeded in withdrawing our query from the queue,
              * so let's drop dead. */
@@ -266,3 +310,46 @@ void avahi_querier_free_all(AvahiInterface *i) {
     while (i->queriers)
         avahi_querier_free(i->queriers);
 }
+
+void avahi_querier_cache_incomplete(AvahiInterface *i, AvahiKey *key) {
+    AvahiQuerier *q;
+
+    assert(i);
+    assert(key);
+
+    /* Called by the cache maintainer when it drops an entry that
+     * might still be valid */
+
+    if (!(q = avahi_hashmap_lookup(i->queriers_by_key, key)))
+        return;
+
+    if (q->n_used <= 0)
+        avahi_querier_free(q);
+    else
+        /* The lookups still using us have seen the entry go away, but
+         * later ones could not rely on the cache anymore */
+        q->answered = 0;
+}
+
+void avahi_querier_answered(AvahiInterface *i, AvahiKey *key) {
+    AvahiQuerier *q;
+
+    assert(i);
+    assert(key);
+
+    /* Called by the cache maintainer when it stored a record for the
+     * key. Records coming in while nobody uses the querier are not
+     * answers to its query. */
+
+    if ((q = avahi_hashmap_lookup(i->queriers_by_key, key)) && q->n_used > 0)
+        q->answered = 1;
+}
+
+int avahi_querier_is_subscribed(AvahiInterface *i, AvahiKey *key) {
+    AvahiQuerier *q;
+
+    assert(i);
+    assert(key);
+
+    return (q = avahi_hashmap_lookup(i->queriers_by_key, key)) && q->n_used > 0;
+}
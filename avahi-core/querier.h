@@ -45,4 +45,17 @@ void avahi_querier_free_all(AvahiInterface *i);
 /** Return 1 if there is a querier for the specified key on the specified interface */
 int avahi_querier_shall_refresh_cache(AvahiInterface *i, AvahiKey *key);
 
+/** Tell the querier for the specified key that the cache dropped an
+ * entry for it that might still be valid, so that new lookups don't
+ * rely on the cache being complete for the key anymore */
+void avahi_querier_cache_incomplete(AvahiInterface *i, AvahiKey *key);
+
+/** Tell the querier for the specified key that an answer to its
+ * query has been stored in the cache, so that it may linger once its
+ * lookups are gone */
+void avahi_querier_answered(AvahiInterface *i, AvahiKey *key);
+
+/** Return 1 if a browser is currently subscribed to the key on this interface */
+int avahi_querier_is_subscribed(AvahiInterface *i, AvahiKey *key);
+
 #endif
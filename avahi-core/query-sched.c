@@ -197,6 +197,11 @@ static void* known_answer_walk_callback(AvahiCache *c, AvahiKey *pattern, AvahiC
     if (avahi_cache_entry_half_ttl(c, e))
         return NULL;
 
+    /* Restored entries are waiting for exactly the responses that
+     * we'd suppress by listing them */
+    if (e->state == AVAHI_CACHE_RESTORED)
+        return NULL;
+
     if (!(ka = avahi_new0(AvahiKnownAnswer, 1))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL;
@@ -31,6 +31,7 @@
 #include <avahi-common/error.h>
 
 #include "browse.h"
+#include "rr-util.h"
 #include "log.h"
 
 #define TIMEOUT_MSEC 5000
@@ -141,6 +142,18 @@ static void finish(AvahiSServiceResolver *r, AvahiResolverEvent event) {
     }
 }
 
+const uint8_t *avahi_s_service_resolver_get_txt_data(AvahiSServiceResolver *r, size_t *size) {
+    assert(r);
+    assert(size);
+
+    if (!r->txt_record) {
+        *size = 0;
+        return NULL;
+    }
+
+    return avahi_record_get_txt_data(r->txt_record, size);
+}
+
 static void time_event_callback(AvahiTimeEvent *e, void *userdata) {
     AvahiSServiceResolver *r = userdata;
 
@@ -502,6 +502,23 @@ void avahi_response_scheduler_suppress(AvahiResponseScheduler *s, AvahiRecord *r
     job_set_elapse_time(s, rj, AVAHI_RESPONSE_SUPPRESS_MSEC, 0);
 }
 
+void avahi_response_scheduler_withdraw(AvahiResponseScheduler *s, AvahiRecord *record) {
+    AvahiResponseJob *rj;
+
+    assert(s);
+    assert(record);
+
+    /* A goodbye for this record has been sent bypassing us, so
+     * neither send the record again nor suppress it being announced
+     * again later on */
+
+    if ((rj = find_scheduled_job(s, record)))
+        job_free(s, rj);
+
+    if ((rj = find_history_job(s, record)))
+        job_free(s, rj);
+}
+
 void avahi_response_scheduler_force(AvahiResponseScheduler *s) {
     assert(s);
 
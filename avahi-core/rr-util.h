@@ -24,6 +24,36 @@
 
 AVAHI_C_DECL_BEGIN
 
+/** The private part of an AvahiKey. avahi_key_new() always allocates
+ * keys as part of one of these. */
+typedef struct AvahiKeyPrivate {
+    AvahiKey key;
+    unsigned hash;         /**< Case insensitive hash of the key */
+    const char *canonical; /**< Interned lower case spelling of the name, equal names have the same pointer */
+} AvahiKeyPrivate;
+
+#define AVAHI_KEY_PRIVATE(k) ((AvahiKeyPrivate*) (k))
+
+/** Cached wire format of a record, see dns.c */
+typedef struct AvahiRecordWire AvahiRecordWire;
+
+/** Canonical wire format of the data of a record, see rr.c */
+typedef struct AvahiRecordCanonical AvahiRecordCanonical;
+
+/** The private part of an AvahiRecord. avahi_record_new() and
+ * avahi_record_copy() always allocate records as part of one of
+ * these. */
+typedef struct AvahiRecordPrivate {
+    AvahiRecord record;
+    AvahiRecordWire *wire; /**< Uncompressed wire format of this record, filled in when it is first appended to a packet */
+    AvahiRecordCanonical *canonical; /**< Lower case wire format of the record data and its hash, filled in when the record is first compared */
+    AvahiTxt *txt;      /**< The data of a TXT record in wire format, created from data.txt.string_list when first needed */
+    unsigned hash;      /**< Cached result of avahi_record_hash() */
+    int hash_valid;     /**< Whether hash has been calculated yet */
+} AvahiRecordPrivate;
+
+#define AVAHI_RECORD_PRIVATE(r) ((AvahiRecordPrivate*) (r))
+
 /** Creaze new AvahiKey object based on an existing key but replaceing the type by CNAME */
 AvahiKey *avahi_key_new_cname(AvahiKey *key);
 
@@ -51,9 +81,20 @@ size_t avahi_record_get_estimate_size(AvahiRecord *r);
  * zero if equal. */
 int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b);
 
+/** Calculate the canonical wire format of the record data which is
+ * used for comparing and hashing records. This is done implicitly
+ * when needed, but may be called early to move the work elsewhere,
+ * e.g. to the thread that parses a packet. The record may not be
+ * modified anymore afterwards. */
+void avahi_record_canonicalize(AvahiRecord *r);
+
 /** Return 1 if the specified record is an mDNS goodbye record. i.e. TTL is zero. */
 int avahi_record_is_goodbye(AvahiRecord *r);
 
+/** Return the data of a TXT record in DNS wire format. Records
+ * without data yield a single empty string. */
+const uint8_t *avahi_record_get_txt_data(const AvahiRecord *r, size_t *size);
+
 /** Make a deep copy of an AvahiRecord object */
 AvahiRecord *avahi_record_copy(AvahiRecord *r);
 
@@ -39,25 +39,51 @@
 #include "domain-util.h"
 #include "rr-util.h"
 #include "addr-util.h"
+#include "intern.h"
+
+/* The record data in uncompressed wire format with all domain names
+ * in lower case, followed by size bytes of data. Two records are equal
+ * iff their keys and these are, which makes comparing them a memcmp()
+ * and lets us order records as RFC 6762 Section 8.2 requires. */
+struct AvahiRecordCanonical {
+    uint64_t hash;
+    uint16_t size;
+};
+
+#define CANONICAL_DATA(c) ((uint8_t*) ((c) + 1))
+
+/* Marks records whose canonical form couldn't be calculated, so that
+ * we don't try again and end up hashing them differently later */
+static AvahiRecordCanonical canonical_failed;
 
 AvahiKey *avahi_key_new(const char *name, uint16_t class, uint16_t type) {
+    char t[AVAHI_DOMAIN_NAME_MAX];
+    AvahiKeyPrivate *p;
     AvahiKey *k;
     assert(name);
 
-    if (!(k = avahi_new(AvahiKey, 1))) {
+    if (!avahi_normalize_name(name, t, sizeof(t))) {
+        avahi_log_error("avahi_normalize_name() failed.");
+        return NULL;
+    }
+
+    if (!(p = avahi_new(AvahiKeyPrivate, 1))) {
         avahi_log_error("avahi_new() failed.");
         return NULL;
     }
 
-    if (!(k->name = avahi_normalize_name_strdup(name))) {
-        avahi_log_error("avahi_normalize_name() failed.");
-        avahi_free(k);
+    k = &p->key;
+
+    if (!(k->name = (char*) avahi_intern_name(t))) {
+        avahi_free(p);
         return NULL;
     }
 
     k->ref = 1;
     k->clazz = class;
     k->type = type;
+    p->hash = avahi_intern_hash(k->name) + type + class;
+    p->canonical = avahi_intern_canonical(k->name);
 
     return k;
 }
@@ -88,25 +114,31 @@ void avahi_key_unref(AvahiKey *k) {
     assert(k->ref >= 1);
 
     if ((--k->ref) <= 0) {
-        avahi_free(k->name);
+        avahi_intern_unref(k->name);
         avahi_free(k);
     }
 }
 
 AvahiRecord *avahi_record_new(AvahiKey *k, uint32_t ttl) {
+    AvahiRecordPrivate *p;
     AvahiRecord *r;
 
     assert(k);
 
-    if (!(r = avahi_new(AvahiRecord, 1))) {
+    if (!(p = avahi_new(AvahiRecordPrivate, 1))) {
         avahi_log_error("avahi_new() failed.");
         return NULL;
     }
 
+    r = &p->record;
     r->ref = 1;
     r->key = avahi_key_ref(k);
 
     memset(&r->data, 0, sizeof(r->data));
+    p->wire = NULL;
+    p->canonical = NULL;
+    p->txt = NULL;
+    p->hash_valid = 0;
 
     r->ttl = ttl != (uint32_t) -1 ? ttl : AVAHI_DEFAULT_TTL;
 
@@ -167,6 +199,9 @@ void avahi_record_unref(AvahiRecord *r) {
 
             case AVAHI_DNS_TYPE_TXT:
                 avahi_string_list_free(r->data.txt.string_list);
+
+                if (AVAHI_RECORD_PRIVATE(r)->txt)
+                    avahi_txt_unref(AVAHI_RECORD_PRIVATE(r)->txt);
                 break;
 
             case AVAHI_DNS_TYPE_A:
@@ -177,6 +212,12 @@ void avahi_record_unref(AvahiRecord *r) {
                 avahi_free(r->data.generic.data);
         }
 
+        /* A single allocation, see dns.c */
+        avahi_free(AVAHI_RECORD_PRIVATE(r)->wire);
+
+        if (AVAHI_RECORD_PRIVATE(r)->canonical != &canonical_failed)
+            avahi_free(AVAHI_RECORD_PRIVATE(r)->canonical);
+
         avahi_key_unref(r->key);
         avahi_free(r);
     }
@@ -245,6 +286,40 @@ char *avahi_key_to_string(const AvahiKey *k) {
     return avahi_strdup_printf("%s\t%s\t%s", k->name, c, t);
 }
 
+static AvahiTxt *get_txt(const AvahiRecord *r) {
+    AvahiRecordPrivate *p;
+
+    assert(r);
+    assert(r->key->type == AVAHI_DNS_TYPE_TXT);
+
+    p = AVAHI_RECORD_PRIVATE(r);
+
+    /* Like the other caches of immutable record data this may be
+     * filled in on const records */
+    if (!p->txt && r->data.txt.string_list)
+        if (!(p->txt = avahi_txt_new_from_string_list(r->data.txt.string_list)))
+            avahi_log_error(__FILE__": Out of memory, treating TXT record as empty");
+
+    return p->txt;
+}
+
+const uint8_t *avahi_record_get_txt_data(const AvahiRecord *r, size_t *size) {
+    /* To comply with section 6.1 of the DNS-SD spec, an empty TXT
+     * record consists of a single empty string */
+    static const uint8_t empty = 0;
+    const AvahiTxt *t;
+
+    assert(r);
+    assert(r->key->type == AVAHI_DNS_TYPE_TXT);
+    assert(size);
+
+    if ((t = get_txt(r)))
+        return avahi_txt_get_data(t, size);
+
+    *size = 1;
+    return &empty;
+}
+
 char *avahi_record_to_string(const AvahiRecord *r) {
     char *p, *s;
     char buf[1024], *t = NULL, *d = NULL;
@@ -327,7 +402,7 @@ int avahi_key_equal(const AvahiKey *a, const AvahiKey *b) {
     if (a == b)
         return 1;
 
-    return avahi_domain_equal(a->name, b->name) &&
+    return AVAHI_KEY_PRIVATE(a)->canonical == AVAHI_KEY_PRIVATE(b)->canonical &&
         a->type == b->type &&
         a->clazz == b->clazz;
 }
@@ -341,7 +416,7 @@ int avahi_key_pattern_match(const AvahiKey *pattern, const AvahiKey *k) {
     if (pattern == k)
         return 1;
 
-    return avahi_domain_equal(pattern->name, k->name) &&
+    return AVAHI_KEY_PRIVATE(pattern)->canonical == AVAHI_KEY_PRIVATE(k)->canonical &&
         (pattern->type == k->type || pattern->type == AVAHI_DNS_TYPE_ANY) &&
         (pattern->clazz == k->clazz || pattern->clazz == AVAHI_DNS_CLASS_ANY);
 }
@@ -357,10 +432,7 @@ int avahi_key_is_pattern(const AvahiKey *k) {
 unsigned avahi_key_hash(const AvahiKey *k) {
     assert(k);
 
-    return
-        avahi_domain_hash(k->name) +
-        k->type +
-        k->clazz;
+    return AVAHI_KEY_PRIVATE(k)->hash;
 }
 
 static int rdata_equal(const AvahiRecord *a, const AvahiRecord *b) {
@@ -386,8 +458,15 @@ static int rdata_equal(const AvahiRecord *a, const AvahiRecord *b) {
                 !strcmp(a->data.hinfo.cpu, b->data.hinfo.cpu) &&
                 !strcmp(a->data.hinfo.os, b->data.hinfo.os);
 
-        case AVAHI_DNS_TYPE_TXT:
-            return avahi_string_list_equal(a->data.txt.string_list, b->data.txt.string_list);
+        case AVAHI_DNS_TYPE_TXT: {
+            const uint8_t *da, *db;
+            size_t asize, bsize;
+
+            da = avahi_record_get_txt_data(a, &asize);
+            db = avahi_record_get_txt_data(b, &bsize);
+
+            return asize == bsize && memcmp(da, db, asize) == 0;
+        }
 
         case AVAHI_DNS_TYPE_A:
             return memcmp(&a->data.a.address, &b->data.a.address, sizeof(AvahiIPv4Address)) == 0;
@@ -402,30 +481,229 @@ static int rdata_equal(const AvahiRecord *a, const AvahiRecord *b) {
 
 }
 
+static unsigned data_hash(unsigned hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+
+    for (; size > 0; size--, p++)
+        hash = 31 * hash + *p;
+
+    return hash;
+}
+
+/* Needs to be kept in sync with rdata_equal() */
+static unsigned rdata_hash(const AvahiRecord *r) {
+    const uint8_t *data;
+    size_t size;
+    unsigned hash;
+
+    assert(r);
+
+    switch (r->key->type) {
+        case AVAHI_DNS_TYPE_SRV:
+            hash = r->data.srv.priority;
+            hash = 31 * hash + r->data.srv.weight;
+            hash = 31 * hash + r->data.srv.port;
+            return 31 * hash + avahi_domain_hash(r->data.srv.name);
+
+        case AVAHI_DNS_TYPE_PTR:
+        case AVAHI_DNS_TYPE_CNAME:
+        case AVAHI_DNS_TYPE_NS:
+            return avahi_domain_hash(r->data.ptr.name);
+
+        case AVAHI_DNS_TYPE_HINFO:
+            return 31 * avahi_string_hash(r->data.hinfo.cpu) + avahi_string_hash(r->data.hinfo.os);
+
+        case AVAHI_DNS_TYPE_TXT:
+            data = avahi_record_get_txt_data(r, &size);
+            return data_hash(0, data, size);
+
+        case AVAHI_DNS_TYPE_A:
+            return data_hash(0, &r->data.a.address, sizeof(AvahiIPv4Address));
+
+        case AVAHI_DNS_TYPE_AAAA:
+            return data_hash(0, &r->data.aaaa.address, sizeof(AvahiIPv6Address));
+
+        default:
+            return data_hash(0, r->data.generic.data, r->data.generic.size);
+    }
+}
+
+static size_t canonical_size_max(const AvahiRecord *r) {
+    assert(r);
+
+    switch (r->key->type) {
+        case AVAHI_DNS_TYPE_PTR:
+        case AVAHI_DNS_TYPE_CNAME:
+        case AVAHI_DNS_TYPE_NS:
+            return strlen(r->data.ptr.name) + 2;
+
+        case AVAHI_DNS_TYPE_SRV:
+            return 6 + strlen(r->data.srv.name) + 2;
+
+        case AVAHI_DNS_TYPE_HINFO:
+            return strlen(r->data.hinfo.cpu) + 1 + strlen(r->data.hinfo.os) + 1;
+
+        case AVAHI_DNS_TYPE_TXT: {
+            size_t size;
+
+            avahi_record_get_txt_data(r, &size);
+            return size;
+        }
+
+        case AVAHI_DNS_TYPE_A:
+            return sizeof(AvahiIPv4Address);
+
+        case AVAHI_DNS_TYPE_AAAA:
+            return sizeof(AvahiIPv6Address);
+
+        default:
+            return r->data.generic.size;
+    }
+}
+
+static AvahiRecordCanonical *canonical_new(AvahiRecord *r) {
+    AvahiRecordCanonical *c;
+    size_t max, size, offset, i;
+    uint8_t *d;
+    uint64_t hash;
+
+    assert(r);
+
+    max = canonical_size_max(r);
+
+    if (max > 0xFFFF)
+        return NULL;
+
+    if (!(c = avahi_malloc(sizeof(AvahiRecordCanonical) + max + 1)))
+        return NULL;
+
+    d = CANONICAL_DATA(c);
+
+    if (max == 0)
+        size = 0;
+    else if ((size = avahi_rdata_serialize(r, d, max)) == (size_t) -1) {
+        avahi_free(c);
+        return NULL;
+    }
+
+    /* Domain names compare case insensitively. Label length bytes
+     * are never larger than 63 and hence not touched by this. */
+    switch (r->key->type) {
+        case AVAHI_DNS_TYPE_PTR:
+        case AVAHI_DNS_TYPE_CNAME:
+        case AVAHI_DNS_TYPE_NS:
+            offset = 0;
+            break;
+
+        case AVAHI_DNS_TYPE_SRV:
+            offset = 6;
+            break;
+
+        default:
+            offset = size;
+    }
+
+    for (i = offset; i < size; i++)
+        if (d[i] >= 'A' && d[i] <= 'Z')
+            d[i] = (uint8_t) (d[i] - 'A' + 'a');
+
+    /* FNV-1a */
+    hash = 14695981039346656037ULL;
+    for (i = 0; i < size; i++) {
+        hash ^= d[i];
+        hash *= 1099511628211ULL;
+    }
+
+    c->hash = hash;
+    c->size = (uint16_t) size;
+
+    return c;
+}
+
+void avahi_record_canonicalize(AvahiRecord *r) {
+    AvahiRecordPrivate *p;
+
+    assert(r);
+
+    p = AVAHI_RECORD_PRIVATE(r);
+
+    if (p->canonical)
+        return;
+
+    if (!(p->canonical = canonical_new(r))) {
+        avahi_log_debug(__FILE__": Failed to calculate canonical record data, falling back to slow comparisons.");
+        p->canonical = &canonical_failed;
+    }
+}
+
+static const AvahiRecordCanonical *get_canonical(const AvahiRecord *r) {
+    assert(r);
+
+    /* The canonical form is a cache of the immutable record data, so
+     * it is fine to fill it in on const records */
+    avahi_record_canonicalize((AvahiRecord*) r);
+
+    return AVAHI_RECORD_PRIVATE(r)->canonical != &canonical_failed ? AVAHI_RECORD_PRIVATE(r)->canonical : NULL;
+}
+
+unsigned avahi_record_hash(const AvahiRecord *r) {
+    AvahiRecordPrivate *p;
+
+    assert(r);
+
+    /* Equal records must hash the same, whether their canonical form
+     * could be calculated or not, so don't use its hash here. The
+     * record data is immutable, so the result may be cached even on
+     * const records. */
+    p = AVAHI_RECORD_PRIVATE(r);
+
+    if (!p->hash_valid) {
+        p->hash = 31 * avahi_key_hash(r->key) + rdata_hash(r);
+        p->hash_valid = 1;
+    }
+
+    return p->hash;
+}
+
 int avahi_record_equal_no_ttl(const AvahiRecord *a, const AvahiRecord *b) {
+    const AvahiRecordCanonical *ca, *cb;
+
     assert(a);
     assert(b);
 
     if (a == b)
         return 1;
 
+    if (!avahi_key_equal(a->key, b->key))
+        return 0;
+
+    if (!(ca = get_canonical(a)) || !(cb = get_canonical(b)))
+        return rdata_equal(a, b);
+
     return
-        avahi_key_equal(a->key, b->key) &&
-        rdata_equal(a, b);
+        ca->hash == cb->hash &&
+        ca->size == cb->size &&
+        memcmp(CANONICAL_DATA(ca), CANONICAL_DATA(cb), ca->size) == 0;
 }
 
 
 AvahiRecord *avahi_record_copy(AvahiRecord *r) {
+    AvahiRecordPrivate *p;
     AvahiRecord *copy;
 
-    if (!(copy = avahi_new(AvahiRecord, 1))) {
+    if (!(p = avahi_new(AvahiRecordPrivate, 1))) {
         avahi_log_error("avahi_new() failed.");
         return NULL;
     }
 
+    copy = &p->record;
     copy->ref = 1;
     copy->key = avahi_key_ref(r->key);
     copy->ttl = r->ttl;
+    p->wire = NULL;
+    p->canonical = NULL;
+    p->txt = NULL;
+    p->hash_valid = 0;
 
     switch (r->key->type) {
         case AVAHI_DNS_TYPE_PTR:
@@ -454,7 +732,12 @@ AvahiRecord *avahi_record_copy(AvahiRecord *r) {
             break;
 
         case AVAHI_DNS_TYPE_TXT:
-            copy->data.txt.string_list = avahi_string_list_copy(r->data.txt.string_list);
+            if (r->data.txt.string_list && !(copy->data.txt.string_list = avahi_string_list_copy(r->data.txt.string_list)))
+                goto fail;
+
+            /* The wire format is immutable, so it can be shared */
+            if (AVAHI_RECORD_PRIVATE(r)->txt)
+                p->txt = avahi_txt_ref(AVAHI_RECORD_PRIVATE(r)->txt);
             break;
 
         case AVAHI_DNS_TYPE_A:
@@ -512,9 +795,13 @@ size_t avahi_record_get_estimate_size(AvahiRecord *r) {
             n += strlen(r->data.hinfo.os) + 1 + strlen(r->data.hinfo.cpu) + 1;
             break;
 
-        case AVAHI_DNS_TYPE_TXT:
-            n += avahi_string_list_serialize(r->data.txt.string_list, NULL, 0);
+        case AVAHI_DNS_TYPE_TXT: {
+            size_t size;
+
+            avahi_record_get_txt_data(r, &size);
+            n += size;
             break;
+        }
 
         case AVAHI_DNS_TYPE_A:
             n += sizeof(AvahiIPv4Address);
@@ -552,7 +839,22 @@ static int uint16_cmp(uint16_t a, uint16_t b) {
     return a == b ? 0 : (a < b ? -1 : 1);
 }
 
+/* RFC 6762 Section 8.2: if one is a prefix of the other, the longer
+ * one is later */
+static int canonical_cmp(const AvahiRecordCanonical *a, const AvahiRecordCanonical *b) {
+    int r;
+
+    assert(a);
+    assert(b);
+
+    if ((r = memcmp(CANONICAL_DATA(a), CANONICAL_DATA(b), a->size < b->size ? a->size : b->size)))
+        return r;
+
+    return a->size == b->size ? 0 : (a->size < b->size ? -1 : 1);
+}
+
 int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b) {
+    const AvahiRecordCanonical *ca, *cb;
     int r;
 /*      char *t1, *t2; */
 
@@ -572,6 +874,9 @@ int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b) {
         (r = uint16_cmp(a->key->type, b->key->type)))
         return r;
 
+    if ((ca = get_canonical(a)) && (cb = get_canonical(b)))
+        return canonical_cmp(ca, cb);
+
     switch (a->key->type) {
 
         case AVAHI_DNS_TYPE_PTR:
@@ -600,36 +905,13 @@ int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b) {
 
         case AVAHI_DNS_TYPE_TXT: {
 
-            uint8_t *ma = NULL, *mb = NULL;
+            const uint8_t *ma, *mb;
             size_t asize, bsize;
 
-            asize = avahi_string_list_serialize(a->data.txt.string_list, NULL, 0);
-            bsize = avahi_string_list_serialize(b->data.txt.string_list, NULL, 0);
-
-            if (asize > 0 && !(ma = avahi_new(uint8_t, asize)))
-                goto fail;
-
-            if (bsize > 0 && !(mb = avahi_new(uint8_t, bsize))) {
-                avahi_free(ma);
-                goto fail;
-            }
-
-            avahi_string_list_serialize(a->data.txt.string_list, ma, asize);
-            avahi_string_list_serialize(b->data.txt.string_list, mb, bsize);
-
-            if (asize && bsize)
-                r = lexicographical_memcmp(ma, asize, mb, bsize);
-            else if (asize && !bsize)
-                r = 1;
-            else if (!asize && bsize)
-                r = -1;
-            else
-                r = 0;
+            ma = avahi_record_get_txt_data(a, &asize);
+            mb = avahi_record_get_txt_data(b, &bsize);
 
-            avahi_free(ma);
-            avahi_free(mb);
-
-            return r;
+            return lexicographical_memcmp(ma, asize, mb, bsize);
         }
 
         case AVAHI_DNS_TYPE_A:
@@ -642,11 +924,6 @@ int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b) {
             return lexicographical_memcmp(a->data.generic.data, a->data.generic.size,
                                           b->data.generic.data, b->data.generic.size);
     }
-
-
-fail:
-    avahi_log_error(__FILE__": Out of memory");
-    return -1; /* or whatever ... */
 }
 
 int avahi_record_is_goodbye(AvahiRecord *r) {
@@ -54,7 +54,7 @@ enum {
     changes should be imposed after creation */
 typedef struct AvahiKey {
     int ref;           /**< Reference counter */
-    char *name;        /**< Record name */
+    char *name;        /**< Record name, interned and shared with all other keys of the same name. Don't modify. */
     uint16_t clazz;    /**< Record class, one of the AVAHI_DNS_CLASS_xxx constants */
     uint16_t type;     /**< Record type, one of the AVAHI_DNS_TYPE_xxx constants */
 } AvahiKey;
@@ -124,6 +124,11 @@ int avahi_key_equal(const AvahiKey *a, const AvahiKey *b);
 /** Return a numeric hash value for a key for usage in hash tables. */
 unsigned avahi_key_hash(const AvahiKey *k);
 
+/** Return a numeric hash value for a record for usage in hash
+ * tables. The TTL is ignored, i.e. records that are equal according
+ * to avahi_record_equal_no_ttl() have the same hash. \since 0.7 */
+unsigned avahi_record_hash(const AvahiRecord *r);
+
 /** Create a new record object. Record data should be filled in right after creation. The reference counter is set to 1. */
 AvahiRecord *avahi_record_new(AvahiKey *k, uint32_t ttl);
 
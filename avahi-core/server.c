@@ -48,10 +48,11 @@
 #include "addr-util.h"
 #include "domain-util.h"
 #include "rr-util.h"
+#include "answer-cache.h"
 
 #define AVAHI_DEFAULT_CACHE_ENTRIES_MAX 4096
 
-static void enum_aux_records(AvahiServer *s, AvahiInterface *i, const char *name, uint16_t type, void (*callback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata), void* userdata) {
+static void enum_aux_records(AvahiServer *s, AvahiInterface *i, const char *name, uint16_t type, AvahiServerRecordCallback callback, void* userdata) {
     assert(s);
     assert(i);
     assert(name);
@@ -82,7 +83,7 @@ static void enum_aux_records(AvahiServer *s, AvahiInterface *i, const char *name
     }
 }
 
-void avahi_server_enumerate_aux_records(AvahiServer *s, AvahiInterface *i, AvahiRecord *r, void (*callback)(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata), void* userdata) {
+void avahi_server_find_aux_records(AvahiServer *s, AvahiInterface *i, AvahiRecord *r, AvahiServerRecordCallback callback, void* userdata) {
     assert(s);
     assert(i);
     assert(r);
@@ -102,6 +103,15 @@ void avahi_server_enumerate_aux_records(AvahiServer *s, AvahiInterface *i, Avahi
     }
 }
 
+void avahi_server_enumerate_aux_records(AvahiServer *s, AvahiInterface *i, AvahiRecord *r, AvahiServerRecordCallback callback, void* userdata) {
+    assert(s);
+    assert(i);
+    assert(r);
+    assert(callback);
+
+    avahi_answer_cache_walk_aux_records(i->answer_cache, r, callback, userdata);
+}
+
 void avahi_server_prepare_response(AvahiServer *s, AvahiInterface *i, AvahiEntry *e, int unicast_response, int auxiliary) {
     assert(s);
     assert(i);
@@ -110,12 +120,13 @@ void avahi_server_prepare_response(AvahiServer *s, AvahiInterface *i, AvahiEntry
     avahi_record_list_push(s->record_list, e->record, e->flags & AVAHI_PUBLISH_UNIQUE, unicast_response, auxiliary);
 }
 
-void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i, AvahiKey *k, int unicast_response) {
+void avahi_server_find_matching_records(AvahiServer *s, AvahiInterface *i, AvahiKey *k, AvahiServerRecordCallback callback, void* userdata) {
     assert(s);
     assert(i);
     assert(k);
+    assert(callback);
 
-    /* Push all records that match the specified key to the record list */
+    /* Call the specified callback for all records that match the specified key */
 
     if (avahi_key_is_pattern(k)) {
         AvahiEntry *e;
@@ -124,7 +135,7 @@ void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i,
 
         for (e = s->entries; e; e = e->entries_next)
             if (!e->dead && avahi_key_pattern_match(k, e->record->key) && avahi_entry_is_registered(s, e, i))
-                avahi_server_prepare_response(s, i, e, unicast_response, 0);
+                callback(s, e->record, e->flags & AVAHI_PUBLISH_UNIQUE, userdata);
 
     } else {
         AvahiEntry *e;
@@ -133,7 +144,7 @@ void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i,
 
         for (e = avahi_hashmap_lookup(s->entries_by_key, k); e; e = e->by_key_next)
             if (!e->dead && avahi_entry_is_registered(s, e, i))
-                avahi_server_prepare_response(s, i, e, unicast_response, 0);
+                callback(s, e->record, e->flags & AVAHI_PUBLISH_UNIQUE, userdata);
     }
 
     /* Look for CNAME records */
@@ -146,11 +157,36 @@ void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i,
         if (!(cname_key = avahi_key_new(k->name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_CNAME)))
             return;
 
-        avahi_server_prepare_matching_responses(s, i, cname_key, unicast_response);
+        avahi_server_find_matching_records(s, i, cname_key, callback, userdata);
         avahi_key_unref(cname_key);
     }
 }
 
+void avahi_server_invalidate_answers(AvahiServer *s) {
+    assert(s);
+
+    s->answer_serial++;
+}
+
+static void prepare_response_callback(AvahiServer *s, AvahiRecord *r, int flush_cache, void* userdata) {
+    int *unicast_response = userdata;
+
+    assert(s);
+    assert(r);
+    assert(unicast_response);
+
+    avahi_record_list_push(s->record_list, r, flush_cache, *unicast_response, 0);
+}
+
+void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i, AvahiKey *k, int unicast_response) {
+    assert(s);
+    assert(i);
+    assert(k);
+
+    /* Push all records that match the specified key to the record list */
+    avahi_answer_cache_walk_answers(i->answer_cache, k, prepare_response_callback, &unicast_response);
+}
+
 static void withdraw_entry(AvahiServer *s, AvahiEntry *e) {
     assert(s);
     assert(e);
@@ -239,86 +275,94 @@ static void incoming_probe(AvahiServer *s, AvahiRecord *record, AvahiInterface *
 }
 
 static int handle_conflict(AvahiServer *s, AvahiInterface *i, AvahiRecord *record, int unique) {
-    int valid = 1, ours = 0, conflict = 0, withdraw_immediately = 0;
+    int valid = 1, conflict = 0, withdraw_immediately = 0;
     AvahiEntry *e, *n, *conflicting_entry = NULL;
 
     assert(s);
     assert(i);
     assert(record);
 
-    /* Check whether an incoming record conflicts with one of our own */
+    /* Check whether an incoming record is identical to one of our own */
 
-    for (e = avahi_hashmap_lookup(s->entries_by_key, record->key); e; e = n) {
-        n = e->by_key_next;
+    for (e = avahi_hashmap_lookup(s->entries_by_record, record); e; e = e->by_record_next) {
 
         if (e->dead)
             continue;
 
         /* Check if the incoming is a goodbye record */
         if (avahi_record_is_goodbye(record)) {
+            char *t;
 
-            if (avahi_record_equal_no_ttl(e->record, record)) {
-                char *t;
+            /* Refresh */
+            t = avahi_record_to_string(record);
+            avahi_log_debug("Received goodbye record for one of our records [%s]. Refreshing.", t);
+            avahi_server_prepare_matching_responses(s, i, e->record->key, 0);
 
-                /* Refresh */
-                t = avahi_record_to_string(record);
-                avahi_log_debug("Received goodbye record for one of our records [%s]. Refreshing.", t);
-                avahi_server_prepare_matching_responses(s, i, e->record->key, 0);
-
-                valid = 0;
-                avahi_free(t);
-                break;
-            }
-
-            /* If the goodybe packet doesn't match one of our own RRs, we simply ignore it. */
-            continue;
+            avahi_free(t);
+            return 0;
         }
 
         if (!(e->flags & AVAHI_PUBLISH_UNIQUE) && !unique)
             continue;
 
-        /* Either our entry or the other is intended to be unique, so let's check */
+        /* Either our entry or the other is intended to be unique, and
+         * we have an identical record, so this is no conflict */
 
-        if (avahi_record_equal_no_ttl(e->record, record)) {
-            ours = 1; /* We have an identical record, so this is no conflict */
+        /* Check wheter there is a TTL conflict */
+        if (record->ttl <= e->record->ttl/2 &&
+            avahi_entry_is_registered(s, e, i)) {
+            char *t;
+            /* Refresh */
+            t = avahi_record_to_string(record);
 
-            /* Check wheter there is a TTL conflict */
-            if (record->ttl <= e->record->ttl/2 &&
-                avahi_entry_is_registered(s, e, i)) {
-                char *t;
-                /* Refresh */
-                t = avahi_record_to_string(record);
+            avahi_log_debug("Received record with bad TTL [%s]. Refreshing.", t);
+            avahi_server_prepare_matching_responses(s, i, e->record->key, 0);
+            valid = 0;
 
-                avahi_log_debug("Received record with bad TTL [%s]. Refreshing.", t);
-                avahi_server_prepare_matching_responses(s, i, e->record->key, 0);
-                valid = 0;
+            avahi_free(t);
+        }
 
-                avahi_free(t);
-            }
+        /* There's no need to check the other entries of this RRset */
+        return valid;
+    }
+
+    /* If the goodybe packet doesn't match one of our own RRs, we simply ignore it. */
+    if (avahi_record_is_goodbye(record))
+        return 1;
+
+    /* Check whether an incoming record conflicts with one of our own */
+
+    for (e = avahi_hashmap_lookup(s->entries_by_key, record->key); e; e = n) {
+        n = e->by_key_next;
 
-            /* There's no need to check the other entries of this RRset */
+        /* Only shared entries follow */
+        if (!(e->flags & AVAHI_PUBLISH_UNIQUE) && !unique)
             break;
 
-        } else {
+        if (e->dead)
+            continue;
 
-            if (avahi_entry_is_registered(s, e, i)) {
+        /* Either our entry or the other is intended to be unique, and
+         * since identical records have been dealt with above already,
+         * this is a conflict */
 
-                /* A conflict => we have to return to probe mode */
-                conflict = 1;
-                conflicting_entry = e;
+        if (avahi_entry_is_registered(s, e, i)) {
 
-            } else if (avahi_entry_is_probing(s, e, i)) {
+            /* A conflict => we have to return to probe mode */
+            conflict = 1;
+            conflicting_entry = e;
 
-                /* We are currently registering a matching record, but
-                 * someone else already claimed it, so let's
-                 * withdraw */
-                conflict = 1;
-                withdraw_immediately = 1;
-            }
+        } else if (avahi_entry_is_probing(s, e, i)) {
+
+            /* We are currently registering a matching record, but
+             * someone else already claimed it, so let's
+             * withdraw */
+            conflict = 1;
+            withdraw_immediately = 1;
         }
     }
 
-    if (!ours && conflict) {
+    if (conflict) {
         char *t;
 
         valid = 0;
@@ -369,10 +413,20 @@ void avahi_server_generate_response(AvahiServer *s, AvahiInterface *i, AvahiDnsP
     if (legacy_unicast) {
         AvahiDnsPacket *reply;
         AvahiRecord *r;
+        uint16_t payload_size;
+        size_t size = 512; /* unicast DNS maximum packet size is 512 */
 
-        if (!(reply = avahi_dns_packet_new_reply(p, 512 + AVAHI_DNS_PACKET_EXTRA_SIZE /* unicast DNS maximum packet size is 512 */ , 1, 1)))
+        /* Clients supporting EDNS0 tell us how much they can take */
+        if ((payload_size = avahi_dns_packet_get_edns0_payload_size(p)) > 0)
+            size = payload_size < AVAHI_DNS_EDNS0_PAYLOAD_MAX ? payload_size : AVAHI_DNS_EDNS0_PAYLOAD_MAX;
+
+        if (!(reply = avahi_dns_packet_new_reply(p, size + AVAHI_DNS_PACKET_EXTRA_SIZE, 1, 1)))
             return; /* OOM */
 
+        /* Keep room for our own OPT record */
+        if (payload_size > 0)
+            reply->max_size -= AVAHI_DNS_EDNS0_OPT_SIZE;
+
         while ((r = avahi_record_list_next(s->record_list, NULL, NULL, NULL))) {
 
             append_aux_records_to_list(s, i, r, 0);
@@ -388,6 +442,13 @@ void avahi_server_generate_response(AvahiServer *s, AvahiInterface *i, AvahiDnsP
             avahi_record_unref(r);
         }
 
+        if (payload_size > 0) {
+            reply->max_size += AVAHI_DNS_EDNS0_OPT_SIZE;
+
+            if (avahi_dns_packet_append_opt(reply, AVAHI_DNS_EDNS0_PAYLOAD_MAX))
+                avahi_dns_packet_inc_field(reply, AVAHI_DNS_FIELD_ARCOUNT);
+        }
+
         if (avahi_dns_packet_get_field(reply, AVAHI_DNS_FIELD_ANCOUNT) != 0)
             avahi_interface_send_packet_unicast(i, reply, a, port);
 
@@ -520,6 +581,10 @@ static void* reflect_cache_walk_callback(AvahiCache *c, AvahiKey *pattern, Avahi
     assert(e);
     assert(s);
 
+    /* Don't reflect entries that haven't been confirmed yet */
+    if (e->state == AVAHI_CACHE_RESTORED)
+        return NULL;
+
     /* Don't reflect cache entry with ipv6 link-local addresses. */
     r = e->record;
     if ((r->key->type == AVAHI_DNS_TYPE_AAAA) &&
@@ -568,86 +633,92 @@ static void reflect_probe(AvahiServer *s, AvahiInterface *i, AvahiRecord *r) {
             avahi_interface_post_probe(j, r, 1);
 }
 
-static void handle_query_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterface *i, const AvahiAddress *a, uint16_t port, int legacy_unicast, int from_local_iface) {
-    size_t n;
+static void handle_query_packet(AvahiServer *s, AvahiParsedPacket *pp, AvahiInterface *i, int legacy_unicast, int from_local_iface) {
+    AvahiDnsPacket *p;
+    const AvahiAddress *a;
+    unsigned n, n_answers, n_probes;
     int is_probe;
 
     assert(s);
-    assert(p);
+    assert(pp);
     assert(i);
-    assert(a);
 
     assert(avahi_record_list_is_empty(s->record_list));
 
-    is_probe = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT) > 0;
+    p = pp->packet;
+    a = &pp->src_address;
+
+    n_answers = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT);
+    n_probes = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT);
+    is_probe = n_probes > 0;
 
     /* Handle the questions */
-    for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT); n > 0; n --) {
+    for (n = 0; n < avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT); n++) {
         AvahiKey *key;
-        int unicast_response = 0;
+        int unicast_response;
 
-        if (!(key = avahi_dns_packet_consume_key(p, &unicast_response))) {
+        if (n >= pp->n_keys) {
             avahi_log_debug(__FILE__": Packet too short or invalid while reading question key. (Maybe a UTF-8 problem?)");
             goto fail;
         }
 
+        key = pp->keys[n];
+        unicast_response = pp->unicast_response[n];
+
         if (!legacy_unicast && !from_local_iface) {
             reflect_query(s, i, key);
             if (!unicast_response)
               avahi_cache_start_poof(i->cache, key, a);
         }
 
-        if (avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT) == 0 &&
+        if (n_answers == 0 &&
             !(avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_FLAGS) & AVAHI_DNS_FLAG_TC))
             /* Allow our own queries to be suppressed by incoming
              * queries only when they do not include known answers */
             avahi_query_scheduler_incoming(i->query_scheduler, key);
 
         avahi_server_prepare_matching_responses(s, i, key, unicast_response);
-        avahi_key_unref(key);
     }
 
     if (!legacy_unicast) {
 
         /* Known Answer Suppression */
-        for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT); n > 0; n --) {
+        for (n = 0; n < n_answers; n++) {
             AvahiRecord *record;
-            int unique = 0;
 
-            if (!(record = avahi_dns_packet_consume_record(p, &unique))) {
+            if (n >= pp->n_records) {
                 avahi_log_debug(__FILE__": Packet too short or invalid while reading known answer record. (Maybe a UTF-8 problem?)");
                 goto fail;
             }
 
+            record = pp->records[n];
+
             avahi_response_scheduler_suppress(i->response_scheduler, record, a);
             avahi_record_list_drop(s->record_list, record);
             avahi_cache_stop_poof(i->cache, record, a);
-
-            avahi_record_unref(record);
         }
 
         /* Probe record */
-        for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT); n > 0; n --) {
+        for (n = n_answers; n < n_answers + n_probes; n++) {
             AvahiRecord *record;
-            int unique = 0;
 
-            if (!(record = avahi_dns_packet_consume_record(p, &unique))) {
+            if (n >= pp->n_records) {
                 avahi_log_debug(__FILE__": Packet too short or invalid while reading probe record. (Maybe a UTF-8 problem?)");
                 goto fail;
             }
 
+            record = pp->records[n];
+
             if (!avahi_key_is_pattern(record->key)) {
                 if (!from_local_iface)
                     reflect_probe(s, i, record);
                 incoming_probe(s, record, i);
             }
-
-            avahi_record_unref(record);
         }
     }
 
     if (!avahi_record_list_is_empty(s->record_list))
-        avahi_server_generate_response(s, i, p, a, port, legacy_unicast, is_probe);
+        avahi_server_generate_response(s, i, p, a, pp->port, legacy_unicast, is_probe);
 
     return;
 
@@ -655,37 +726,32 @@ fail:
     avahi_record_list_flush(s->record_list);
 }
 
-static void handle_response_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterface *i, const AvahiAddress *a, int from_local_iface) {
+static void handle_response_packet(AvahiServer *s, AvahiParsedPacket *pp, AvahiInterface *i, int from_local_iface) {
     unsigned n;
 
     assert(s);
-    assert(p);
+    assert(pp);
     assert(i);
-    assert(a);
 
-    for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT) +
-             avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ARCOUNT); n > 0; n--) {
-        AvahiRecord *record;
-        int cache_flush = 0;
+    for (n = 0; n < pp->n_records; n++) {
+        AvahiRecord *record = pp->records[n];
+        int cache_flush = pp->cache_flush[n];
 
-        if (!(record = avahi_dns_packet_consume_record(p, &cache_flush))) {
-            avahi_log_debug(__FILE__": Packet too short or invalid while reading response record. (Maybe a UTF-8 problem?)");
-            break;
-        }
-
-        if (!avahi_key_is_pattern(record->key)) {
+        if (!avahi_key_is_pattern(record->key) &&
+            record->key->type != AVAHI_DNS_TYPE_OPT) {
 
             if (handle_conflict(s, i, record, cache_flush)) {
                 if (!from_local_iface && !avahi_record_is_link_local_address(record))
                     reflect_response(s, i, record, cache_flush);
-                avahi_cache_update(i->cache, record, cache_flush, a);
+                avahi_cache_update(i->cache, record, cache_flush, &pp->src_address);
                 avahi_response_scheduler_incoming(i->response_scheduler, record, cache_flush);
             }
         }
-
-        avahi_record_unref(record);
     }
 
+    if (pp->truncated)
+        avahi_log_debug(__FILE__": Packet too short or invalid while reading response record. (Maybe a UTF-8 problem?)");
+
     /* If the incoming response contained a conflicting record, some
        records have been scheduled for sending. We need to flush them
        here. */
@@ -888,17 +954,30 @@ static int originates_from_local_iface(AvahiServer *s, AvahiIfIndex iface, const
     return avahi_interface_has_address(s->monitor, iface, a);
 }
 
-static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddress *src_address, uint16_t port, const AvahiAddress *dst_address, AvahiIfIndex iface, int ttl) {
+static void dispatch_packet(AvahiServer *s, AvahiParsedPacket *pp) {
     AvahiInterface *i;
+    AvahiDnsPacket *p;
+    const AvahiAddress *src_address, *dst_address;
+    AvahiIfIndex iface;
+    uint16_t port;
     int from_local_iface = 0;
 
     assert(s);
-    assert(p);
-    assert(src_address);
-    assert(dst_address);
-    assert(iface > 0);
+    assert(pp);
+
+    p = pp->packet;
+    src_address = &pp->src_address;
+    dst_address = &pp->dst_address;
+    port = pp->port;
+
     assert(src_address->proto == dst_address->proto);
 
+    if ((iface = pp->iface) == AVAHI_IF_UNSPEC &&
+        (iface = avahi_find_interface_for_address(s->monitor, dst_address)) == AVAHI_IF_UNSPEC) {
+        avahi_log_error("Incoming packet received on address that isn't local.");
+        return;
+    }
+
     if (!(i = avahi_interface_monitor_get_interface(s->monitor, iface, src_address->proto)) ||
         !i->announcing) {
         avahi_log_debug("Received packet from invalid interface.");
@@ -923,7 +1002,7 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
     if (s->config.enable_reflector)
         from_local_iface = originates_from_local_iface(s, iface, src_address, port);
 
-    if (avahi_dns_packet_check_valid_multicast(p) < 0) {
+    if (!pp->valid) {
         avahi_log_debug("Received invalid packet.");
         return;
     }
@@ -931,9 +1010,9 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
     if (avahi_dns_packet_is_query(p)) {
         int legacy_unicast = 0;
 
-        /* For queries EDNS0 might allow ARCOUNT != 0. We ignore the
-         * AR section completely here, so far. Until the day we add
-         * EDNS0 support. */
+        /* For queries EDNS0 might allow ARCOUNT != 0. The only thing
+         * we look at in the AR section is the OPT record of legacy
+         * unicast queries, when we generate the response. */
 
         if (port != AVAHI_MDNS_PORT) {
             /* Legacy Unicast */
@@ -950,7 +1029,7 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
         if (legacy_unicast)
             reflect_legacy_unicast_query_packet(s, p, i, src_address, port);
 
-        handle_query_packet(s, p, i, src_address, port, legacy_unicast, from_local_iface);
+        handle_query_packet(s, pp, i, legacy_unicast, from_local_iface);
 
     } else {
         char t[AVAHI_ADDRESS_STR_MAX];
@@ -960,8 +1039,8 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
             return;
         }
 
-        if (ttl != 255 && s->config.check_response_ttl) {
-            avahi_log_debug("Received response from host %s with invalid TTL %u on interface '%s.%i'.", avahi_address_snprint(t, sizeof(t), src_address), ttl, i->hardware->name, i->protocol);
+        if (pp->ttl != 255 && s->config.check_response_ttl) {
+            avahi_log_debug("Received response from host %s with invalid TTL %u on interface '%s.%i'.", avahi_address_snprint(t, sizeof(t), src_address), pp->ttl, i->hardware->name, i->protocol);
             return;
         }
 
@@ -980,7 +1059,7 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
             return;
         }
 
-        handle_response_packet(s, p, i, src_address, from_local_iface);
+        handle_response_packet(s, pp, i, from_local_iface);
     }
 }
 
@@ -1019,6 +1098,7 @@ static void mcast_socket_event(AvahiWatch *w, int fd, AvahiWatchEvent events, vo
     AvahiServer *s = userdata;
     AvahiAddress dest, src;
     AvahiDnsPacket *p = NULL;
+    AvahiParsedPacket *pp;
     AvahiIfIndex iface;
     uint16_t port;
     uint8_t ttl;
@@ -1036,21 +1116,40 @@ static void mcast_socket_event(AvahiWatch *w, int fd, AvahiWatchEvent events, vo
         p = avahi_recv_dns_packet_ipv6(s->fd_ipv6, &src.data.ipv6, &port, &dest.data.ipv6, &iface, &ttl);
     }
 
-    if (p) {
-        if (iface == AVAHI_IF_UNSPEC)
-            iface = avahi_find_interface_for_address(s->monitor, &dest);
+    if (!p)
+        return;
 
-        if (iface != AVAHI_IF_UNSPEC)
-            dispatch_packet(s, p, &src, port, &dest, iface, ttl);
-        else
-            avahi_log_error("Incoming packet received on address that isn't local.");
+    if (s->source_limiter) {
+        struct timeval now;
 
-        avahi_dns_packet_free(p);
+        gettimeofday(&now, NULL);
+
+        /* Don't even bother parsing packets from sources that flood us */
+        if (!avahi_source_limiter_check(s->source_limiter, &src, &now)) {
+            avahi_dns_packet_free(p);
+            return;
+        }
+    }
+
+    if ((pp = avahi_parsed_packet_new(p, &src, port, &dest, iface, ttl))) {
+        dispatch_packet(s, pp);
+        avahi_parsed_packet_free(pp);
 
         avahi_cleanup_dead_entries(s);
     }
 }
 
+static void parse_pipeline_callback(AvahiParsePipeline *pl, AvahiParsedPacket *pp, void *userdata) {
+    AvahiServer *s = userdata;
+
+    assert(pl);
+    assert(pp);
+    assert(s);
+
+    dispatch_packet(s, pp);
+    avahi_cleanup_dead_entries(s);
+}
+
 static void legacy_unicast_socket_event(AvahiWatch *w, int fd, AvahiWatchEvent events, void *userdata) {
     AvahiServer *s = userdata;
     AvahiDnsPacket *p = NULL;
@@ -1344,10 +1443,27 @@ static int setup_sockets(AvahiServer *s) {
         s->watch_legacy_unicast_ipv4 =
         s->watch_legacy_unicast_ipv6 = NULL;
 
-    if (s->fd_ipv4 >= 0)
-        s->watch_ipv4 = s->poll_api->watch_new(s->poll_api, s->fd_ipv4, AVAHI_WATCH_IN, mcast_socket_event, s);
-    if (s->fd_ipv6 >= 0)
-        s->watch_ipv6 = s->poll_api->watch_new(s->poll_api, s->fd_ipv6, AVAHI_WATCH_IN, mcast_socket_event, s);
+    s->parse_pipeline = NULL;
+    s->source_limiter = NULL;
+
+    if (s->config.source_ratelimit_rate > 0 &&
+        !(s->source_limiter = avahi_source_limiter_new(
+              s->config.source_ratelimit_rate,
+              s->config.source_ratelimit_burst > 0 ? s->config.source_ratelimit_burst : s->config.source_ratelimit_rate)))
+        avahi_log_warn("Failed to set up per source rate limiting.");
+
+    /* Legacy unicast traffic is rare enough to stay in the main loop
+     * even if the multicast sockets are handled by worker threads */
+    if (s->config.n_parse_threads > 0 &&
+        !(s->parse_pipeline = avahi_parse_pipeline_new(s->poll_api, s->fd_ipv4, s->fd_ipv6, s->source_limiter, s->config.n_parse_threads, parse_pipeline_callback, s)))
+        avahi_log_warn("Failed to start packet parser threads, parsing in the main loop.");
+
+    if (!s->parse_pipeline) {
+        if (s->fd_ipv4 >= 0)
+            s->watch_ipv4 = s->poll_api->watch_new(s->poll_api, s->fd_ipv4, AVAHI_WATCH_IN, mcast_socket_event, s);
+        if (s->fd_ipv6 >= 0)
+            s->watch_ipv6 = s->poll_api->watch_new(s->poll_api, s->fd_ipv6, AVAHI_WATCH_IN, mcast_socket_event, s);
+    }
 
     if (s->fd_legacy_unicast_ipv4 >= 0)
         s->watch_legacy_unicast_ipv4 = s->poll_api->watch_new(s->poll_api, s->fd_legacy_unicast_ipv4, AVAHI_WATCH_IN, legacy_unicast_socket_event, s);
@@ -1396,6 +1512,9 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
     s->need_group_cleanup = 0;
     s->need_browser_cleanup = 0;
     s->cleanup_time_event = NULL;
+    s->goodbye_batch = 0;
+    s->goodbyes = NULL;
+    s->n_goodbyes = s->n_goodbyes_allocated = 0;
     s->hinfo_entry_group = NULL;
     s->browse_domain_entry_group = NULL;
     s->error = AVAHI_OK;
@@ -1407,6 +1526,7 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
     s->time_event_queue = avahi_time_event_queue_new(poll_api);
 
     s->entries_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL);
+    s->entries_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL);
     AVAHI_LLIST_HEAD_INIT(AvahiEntry, s->entries);
     AVAHI_LLIST_HEAD_INIT(AvahiGroup, s->groups);
 
@@ -1423,6 +1543,10 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
     s->legacy_unicast_reflect_slots = NULL;
     s->legacy_unicast_reflect_id = 0;
 
+    s->cache_serial = 0;
+    s->answer_serial = 0;
+    s->cache_evicted = s->cache_rejected = 0;
+
     s->record_list = avahi_record_list_new();
 
     /* Get host name */
@@ -1456,6 +1580,16 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
 void avahi_server_free(AvahiServer* s) {
     assert(s);
 
+    /* Stop the parser threads, packets they queued are dropped */
+
+    if (s->parse_pipeline) {
+        avahi_parse_pipeline_free(s->parse_pipeline);
+        s->parse_pipeline = NULL;
+    }
+
+    if (s->source_limiter)
+        avahi_source_limiter_free(s->source_limiter);
+
     /* Remove all browsers */
 
     while (s->dns_server_browsers)
@@ -1477,8 +1611,10 @@ void avahi_server_free(AvahiServer* s) {
 
     /* Remove all locally rgeistered stuff */
 
+    avahi_goodbye_batch_begin(s);
     while(s->entries)
         avahi_entry_free(s, s->entries);
+    avahi_goodbye_batch_end(s);
 
     avahi_interface_monitor_free(s->monitor);
 
@@ -1488,6 +1624,7 @@ void avahi_server_free(AvahiServer* s) {
     free_slots(s);
 
     avahi_hashmap_free(s->entries_by_key);
+    avahi_hashmap_free(s->entries_by_record);
     avahi_record_list_free(s->record_list);
     avahi_hashmap_free(s->record_browser_hashmap);
 
@@ -1498,6 +1635,9 @@ void avahi_server_free(AvahiServer* s) {
     if (s->cleanup_time_event)
         avahi_time_event_free(s->cleanup_time_event);
 
+    assert(s->n_goodbyes == 0);
+    avahi_free(s->goodbyes);
+
     avahi_time_event_queue_free(s->time_event_queue);
 
     /* Free watches */
@@ -1601,6 +1741,10 @@ AvahiServerConfig* avahi_server_config_init(AvahiServerConfig *c) {
     c->n_cache_entries_max = AVAHI_DEFAULT_CACHE_ENTRIES_MAX;
     c->ratelimit_interval = 0;
     c->ratelimit_burst = 0;
+    c->source_ratelimit_rate = 0;
+    c->source_ratelimit_burst = 0;
+    c->n_parse_threads = 0;
+    c->group_probing = 0;
 
     return c;
 }
@@ -1760,12 +1904,11 @@ int avahi_server_is_record_local(AvahiServer *s, AvahiIfIndex interface, AvahiPr
     assert(s);
     assert(record);
 
-    for (e = avahi_hashmap_lookup(s->entries_by_key, record->key); e; e = e->by_key_next)
+    for (e = avahi_hashmap_lookup(s->entries_by_record, record); e; e = e->by_record_next)
 
         if ((e->interface == interface || e->interface <= 0 || interface <= 0) &&
             (e->protocol == protocol || e->protocol == AVAHI_PROTO_UNSPEC || protocol == AVAHI_PROTO_UNSPEC) &&
-            (!e->group || e->group->state == AVAHI_ENTRY_GROUP_ESTABLISHED || e->group->state == AVAHI_ENTRY_GROUP_REGISTERING) &&
-            avahi_record_equal_no_ttl(record, e->record))
+            (!e->group || e->group->state == AVAHI_ENTRY_GROUP_ESTABLISHED || e->group->state == AVAHI_ENTRY_GROUP_REGISTERING))
             return 1;
 
     return 0;
@@ -0,0 +1,103 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/timeval.h>
+
+#include "source-limit.h"
+
+#define RATE 10
+#define BURST 5
+
+static void dump_callback(const char *text, AVAHI_GCC_UNUSED void* userdata) {
+    printf("%s\n", text);
+}
+
+static unsigned count_allowed(AvahiSourceLimiter *l, const AvahiAddress *a, const struct timeval *now, unsigned n) {
+    unsigned allowed = 0;
+
+    for (; n > 0; n--)
+        if (avahi_source_limiter_check(l, a, now))
+            allowed++;
+
+    return allowed;
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiSourceLimiter *l;
+    AvahiAddress flooder, quiet, other;
+    struct timeval now;
+    unsigned n;
+
+    avahi_address_parse("192.168.50.1", AVAHI_PROTO_INET, &flooder);
+    avahi_address_parse("192.168.50.2", AVAHI_PROTO_INET, &quiet);
+
+    l = avahi_source_limiter_new(RATE, BURST);
+    assert(l);
+
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    /* A burst is allowed, everything after it dropped */
+    assert(count_allowed(l, &flooder, &now, 100) == BURST);
+    assert(avahi_source_limiter_get_n_dropped(l, &flooder) == 100 - BURST);
+
+    /* Other sources are not affected */
+    assert(count_allowed(l, &quiet, &now, BURST) == BURST);
+    assert(avahi_source_limiter_get_n_dropped(l, &quiet) == 0);
+
+    /* Tokens come back at RATE per second... */
+    avahi_timeval_add(&now, 2*1000000/RATE);
+    assert(count_allowed(l, &flooder, &now, 100) == 2);
+
+    /* ... but never more than BURST of them */
+    avahi_timeval_add(&now, 10*1000000);
+    assert(count_allowed(l, &flooder, &now, 100) == BURST);
+
+    /* Sending at exactly the rate is never limited */
+    for (n = 0; n < 10*RATE; n++) {
+        avahi_timeval_add(&now, 1000000/RATE);
+        assert(avahi_source_limiter_check(l, &quiet, &now));
+    }
+
+    avahi_source_limiter_dump(l, dump_callback, NULL);
+
+    /* More sources than the table can track still get their burst */
+    avahi_address_parse("fe80::1", AVAHI_PROTO_INET6, &other);
+
+    for (n = 0; n < 4*AVAHI_SOURCE_LIMITER_SLOTS; n++) {
+        other.data.ipv6.address[14] = (uint8_t) (n >> 8);
+        other.data.ipv6.address[15] = (uint8_t) n;
+
+        assert(count_allowed(l, &other, &now, BURST) == BURST);
+    }
+
+    assert(count_allowed(l, &quiet, &now, 1) == 1);
+
+    avahi_source_limiter_free(l);
+
+    return 0;
+}
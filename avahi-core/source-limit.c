@@ -0,0 +1,221 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+
+#include "source-limit.h"
+#include "log.h"
+
+/* Sources are hashed to a set of this many slots, a new source
+ * replaces the one in its set that has been quiet the longest */
+#define SET_SIZE 4
+
+typedef struct Slot {
+    AvahiAddress address;
+    int used;
+
+    /* The token bucket, implemented as a "theoretical arrival time":
+     * the bucket is full if this is not in the future, and every
+     * packet moves it one interval further */
+    AvahiUsec tat;
+
+    unsigned n_dropped;
+} Slot;
+
+struct AvahiSourceLimiter {
+    pthread_mutex_t mutex;
+
+    AvahiUsec interval;   /* usec per token */
+    AvahiUsec tolerance;  /* How far tat may be ahead of now */
+
+    unsigned seed;
+
+    Slot slots[AVAHI_SOURCE_LIMITER_SLOTS];
+};
+
+static AvahiUsec usec(const struct timeval *tv) {
+    return (AvahiUsec) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static unsigned address_hash(const AvahiSourceLimiter *l, const AvahiAddress *a) {
+    const uint8_t *p = a->data.data;
+    size_t n = a->proto == AVAHI_PROTO_INET ? sizeof(AvahiIPv4Address) : sizeof(AvahiIPv6Address);
+    unsigned hash = 2166136261U ^ l->seed;
+
+    for (; n > 0; n--, p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static Slot *find_set(AvahiSourceLimiter *l, const AvahiAddress *a) {
+    return l->slots + (address_hash(l, a) % (AVAHI_SOURCE_LIMITER_SLOTS / SET_SIZE)) * SET_SIZE;
+}
+
+static Slot *lookup(AvahiSourceLimiter *l, const AvahiAddress *a) {
+    Slot *set;
+    unsigned n;
+
+    set = find_set(l, a);
+
+    for (n = 0; n < SET_SIZE; n++)
+        if (set[n].used && avahi_address_cmp(&set[n].address, a) == 0)
+            return set + n;
+
+    return NULL;
+}
+
+AvahiSourceLimiter *avahi_source_limiter_new(unsigned rate, unsigned burst) {
+    AvahiSourceLimiter *l;
+    struct timeval tv;
+
+    assert(rate > 0);
+    assert(burst > 0);
+
+    if (!(l = avahi_new0(AvahiSourceLimiter, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    pthread_mutex_init(&l->mutex, NULL);
+
+    l->interval = (AvahiUsec) 1000000 / rate;
+    if (l->interval <= 0)
+        l->interval = 1;
+
+    l->tolerance = l->interval * (burst - 1);
+
+    /* Make it harder to pick addresses that collide with someone
+     * else's */
+    gettimeofday(&tv, NULL);
+    l->seed = (unsigned) usec(&tv);
+
+    return l;
+}
+
+void avahi_source_limiter_free(AvahiSourceLimiter *l) {
+    assert(l);
+
+    pthread_mutex_destroy(&l->mutex);
+    avahi_free(l);
+}
+
+int avahi_source_limiter_check(AvahiSourceLimiter *l, const AvahiAddress *a, const struct timeval *now) {
+    AvahiUsec t;
+    Slot *slot;
+    int r = 1;
+
+    assert(l);
+    assert(a);
+    assert(now);
+
+    t = usec(now);
+
+    pthread_mutex_lock(&l->mutex);
+
+    if (!(slot = lookup(l, a))) {
+        Slot *set = find_set(l, a);
+        unsigned n;
+
+        /* Take a free slot, or forget about the source whose bucket
+         * has been refilling the longest */
+        slot = set;
+        for (n = 0; n < SET_SIZE; n++) {
+            if (!set[n].used) {
+                slot = set + n;
+                break;
+            }
+
+            if (set[n].tat < slot->tat)
+                slot = set + n;
+        }
+
+        slot->address = *a;
+        slot->used = 1;
+        slot->tat = t;
+        slot->n_dropped = 0;
+    }
+
+    if (slot->tat < t)
+        slot->tat = t;
+
+    if (slot->tat - t > l->tolerance) {
+        r = 0;
+
+        if (slot->n_dropped++ == 0) {
+            char s[AVAHI_ADDRESS_STR_MAX];
+            avahi_log_info("Packet rate of %s exceeds the limit, dropping packets.", avahi_address_snprint(s, sizeof(s), a));
+        }
+    } else
+        slot->tat += l->interval;
+
+    pthread_mutex_unlock(&l->mutex);
+
+    return r;
+}
+
+unsigned avahi_source_limiter_get_n_dropped(AvahiSourceLimiter *l, const AvahiAddress *a) {
+    Slot *slot;
+    unsigned n;
+
+    assert(l);
+    assert(a);
+
+    pthread_mutex_lock(&l->mutex);
+    n = (slot = lookup(l, a)) ? slot->n_dropped : 0;
+    pthread_mutex_unlock(&l->mutex);
+
+    return n;
+}
+
+void avahi_source_limiter_dump(AvahiSourceLimiter *l, AvahiDumpCallback callback, void* userdata) {
+    unsigned n;
+
+    assert(l);
+    assert(callback);
+
+    callback(";;; RATE LIMITED SOURCES ;;;", userdata);
+
+    pthread_mutex_lock(&l->mutex);
+
+    for (n = 0; n < AVAHI_SOURCE_LIMITER_SLOTS; n++) {
+        Slot *slot = l->slots + n;
+        char s[AVAHI_ADDRESS_STR_MAX], ln[256];
+
+        if (!slot->used || !slot->n_dropped)
+            continue;
+
+        snprintf(ln, sizeof(ln), ";;; %s: %u packets dropped", avahi_address_snprint(s, sizeof(s), &slot->address), slot->n_dropped);
+        callback(ln, userdata);
+    }
+
+    pthread_mutex_unlock(&l->mutex);
+}
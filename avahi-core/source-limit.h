@@ -0,0 +1,52 @@
+#ifndef foosourcelimithfoo
+#define foosourcelimithfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/time.h>
+
+#include <avahi-common/address.h>
+
+#include "core.h"
+
+/* Number of sources we track at the same time. When more than that
+ * are sending, the ones that were quiet the longest are forgotten. */
+#define AVAHI_SOURCE_LIMITER_SLOTS 1024
+
+typedef struct AvahiSourceLimiter AvahiSourceLimiter;
+
+/* Allows rate packets per second from each source address, with
+ * bursts of up to burst packets. The limiter may be used from
+ * multiple threads at the same time. */
+AvahiSourceLimiter *avahi_source_limiter_new(unsigned rate, unsigned burst);
+void avahi_source_limiter_free(AvahiSourceLimiter *l);
+
+/* Returns nonzero if a packet from a that arrived at now may be
+ * processed, 0 if it should be dropped */
+int avahi_source_limiter_check(AvahiSourceLimiter *l, const AvahiAddress *a, const struct timeval *now);
+
+/* Returns the number of packets dropped from a since it was last
+ * forgotten */
+unsigned avahi_source_limiter_get_n_dropped(AvahiSourceLimiter *l, const AvahiAddress *a);
+
+/* Lists all sources we dropped packets from */
+void avahi_source_limiter_dump(AvahiSourceLimiter *l, AvahiDumpCallback callback, void* userdata);
+
+#endif
@@ -244,6 +244,10 @@ AvahiWideAreaLookup *avahi_wide_area_lookup_new(
 
     avahi_dns_packet_set_field(l->packet, AVAHI_DNS_FIELD_QDCOUNT, 1);
 
+    /* Ask for large responses, so that we don't get truncated ones */
+    if (avahi_dns_packet_append_opt(l->packet, AVAHI_DNS_EDNS0_PAYLOAD_MAX))
+        avahi_dns_packet_set_field(l->packet, AVAHI_DNS_FIELD_ARCOUNT, 1);
+
     if (send_to_dns_server(l, l->packet) < 0) {
         avahi_log_error(__FILE__": Failed to send packet.");
         avahi_dns_packet_free(l->packet);
@@ -496,6 +500,22 @@ static void handle_packet(AvahiWideAreaLookupEngine *e, AvahiDnsPacket *p) {
     if (!(l = find_lookup(e, avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ID))) || l->dead)
         goto finish;
 
+    /* Servers that don't know EDNS0 may refuse our OPT record, in
+     * which case we try again without it */
+    if ((avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_FLAGS) & 15) == AVAHI_DNS_RCODE_FORMERR &&
+        avahi_dns_packet_get_field(l->packet, AVAHI_DNS_FIELD_ARCOUNT) > 0) {
+
+        l->packet->size -= AVAHI_DNS_EDNS0_OPT_SIZE;
+        avahi_dns_packet_set_field(l->packet, AVAHI_DNS_FIELD_ARCOUNT, 0);
+
+        if (send_to_dns_server(l, l->packet) < 0)
+            avahi_log_error(__FILE__": Failed to send packet.");
+
+        /* Don't free the lookup */
+        l = NULL;
+        goto finish;
+    }
+
     /* Check whether this a packet indicating a failure */
     if ((r = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_FLAGS) & 15) != 0 ||
         avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT) == 0) {
@@ -536,7 +556,9 @@ static void handle_packet(AvahiWideAreaLookupEngine *e, AvahiDnsPacket *p) {
             goto finish;
         }
 
-        add_to_cache(e, rr);
+        if (rr->key->type != AVAHI_DNS_TYPE_OPT)
+            add_to_cache(e, rr);
+
         avahi_record_unref(rr);
     }
 
@@ -0,0 +1,141 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/cache-snapshot-format.h>
+#include <avahi-core/log.h>
+
+#include "cache-buffer.h"
+
+/* Initial size of the buffer, doubled as needed */
+#define CACHE_BUFFER_SIZE_MIN 4096
+
+typedef struct WalkInfo {
+    CacheBuffer *buffer;
+    int skip_local;
+    int failed;
+} WalkInfo;
+
+static uint8_t rdata[0xFFFF];
+
+int cache_buffer_reserve(CacheBuffer *b, size_t l) {
+    size_t n;
+    uint8_t *d;
+
+    assert(b);
+
+    if (b->size + l <= b->allocated)
+        return 0;
+
+    n = b->allocated ? b->allocated : CACHE_BUFFER_SIZE_MIN;
+    while (n < b->size + l)
+        n *= 2;
+
+    if (!(d = avahi_realloc(b->data, n)))
+        return -1;
+
+    b->data = d;
+    b->allocated = n;
+    return 0;
+}
+
+static void record_callback(AvahiIfIndex interface, AvahiProtocol protocol, AvahiRecord *r, uint32_t ttl, AvahiLookupResultFlags flags, void* userdata) {
+    WalkInfo *i = userdata;
+    CacheBuffer *b;
+    AvahiCacheSnapshotEntry *e;
+    size_t name_size, rdata_size, l;
+    uint8_t *p;
+
+    assert(r);
+    assert(i);
+
+    b = i->buffer;
+
+    if (i->failed || (i->skip_local && (flags & AVAHI_LOOKUP_RESULT_LOCAL)))
+        return;
+
+    name_size = strlen(r->key->name) + 1;
+
+    if ((rdata_size = avahi_rdata_serialize(r, rdata, sizeof(rdata))) == (size_t) -1 ||
+        name_size > 0xFFFF)
+        return;
+
+    l = AVAHI_CACHE_SNAPSHOT_ENTRY_SIZE(name_size, rdata_size);
+
+    if (cache_buffer_reserve(b, l) < 0) {
+        i->failed = 1;
+        return;
+    }
+
+    p = b->data + b->size;
+    memset(p, 0, l);
+
+    e = (AvahiCacheSnapshotEntry*) p;
+    e->interface = interface;
+    e->protocol = protocol;
+    e->ttl = ttl;
+    e->flags = flags;
+    e->clazz = r->key->clazz;
+    e->type = r->key->type;
+    e->name_size = (uint16_t) name_size;
+    e->rdata_size = (uint16_t) rdata_size;
+
+    p += sizeof(AvahiCacheSnapshotEntry);
+    memcpy(p, r->key->name, name_size);
+    memcpy(p + name_size, rdata, rdata_size);
+
+    b->size += l;
+    b->n_records++;
+}
+
+int cache_buffer_append_caches(CacheBuffer *b, AvahiServer *s, int skip_local) {
+    WalkInfo i;
+
+    assert(b);
+    assert(s);
+
+    i.buffer = b;
+    i.skip_local = skip_local;
+    i.failed = 0;
+
+    avahi_server_walk_caches(s, record_callback, &i);
+
+    if (i.failed) {
+        avahi_log_error(__FILE__": Out of memory");
+        return -1;
+    }
+
+    return 0;
+}
+
+void cache_buffer_free(CacheBuffer *b) {
+    assert(b);
+
+    avahi_free(b->data);
+    b->data = NULL;
+    b->size = b->allocated = 0;
+    b->n_records = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef foocachebufferhfoo
+#define foocachebufferhfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <avahi-core/core.h>
+
+/* Collects cache records in the format of the cache snapshot. Shared
+ * by the cache snapshot and the cache state file. */
+typedef struct CacheBuffer {
+    uint8_t *data;
+    size_t size, allocated;
+    uint32_t n_records;
+} CacheBuffer;
+
+/* Makes room for l more bytes after the used ones */
+int cache_buffer_reserve(CacheBuffer *b, size_t l);
+
+/* Appends all records in the caches of the server. Records we
+ * published ourselves are skipped if skip_local is set. Returns
+ * negative on OOM. */
+int cache_buffer_append_caches(CacheBuffer *b, AvahiServer *s, int skip_local);
+
+void cache_buffer_free(CacheBuffer *b);
+
+#endif
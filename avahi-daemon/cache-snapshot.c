@@ -0,0 +1,274 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/cache-snapshot-format.h>
+#include <avahi-core/log.h>
+
+#ifdef ENABLE_CHROOT
+#include "chroot.h"
+#endif
+
+#include "main.h"
+#include "cache-buffer.h"
+#include "cache-snapshot.h"
+
+/* How often we check whether the caches changed */
+#define SNAPSHOT_INTERVAL_MSEC 1000
+
+/* Initial size of the file, grown in multiples of this if needed */
+#define SNAPSHOT_SIZE_STEP (64*1024)
+
+static const AvahiPoll *poll_api = NULL;
+static AvahiTimeout *timeout = NULL;
+static int fd = -1;
+static uint8_t *map = NULL;
+static size_t map_size = 0;
+
+static AvahiServer *last_server = NULL;
+static unsigned last_serial = 0;
+
+/* Reused between snapshots so that we don't have to grow it again
+ * every time */
+static CacheBuffer buffer = { NULL, 0, 0, 0 };
+
+static int grow_file(size_t size) {
+    size_t n;
+    int r;
+    uint8_t *m;
+
+    assert(fd >= 0);
+
+    n = ((size + SNAPSHOT_SIZE_STEP - 1) / SNAPSHOT_SIZE_STEP) * SNAPSHOT_SIZE_STEP;
+
+    if (n <= map_size)
+        return 0;
+
+    /* Allocate the blocks instead of just extending the file size,
+     * so that we don't get SIGBUS when writing to a full tmpfs */
+    if ((r = posix_fallocate(fd, 0, (off_t) n)) != 0) {
+        avahi_log_warn("Failed to grow cache snapshot file: %s", strerror(r));
+        return -1;
+    }
+
+    if ((m = mmap(NULL, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        avahi_log_warn("mmap() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (map)
+        munmap(map, map_size);
+
+    map = m;
+    map_size = n;
+
+    return 0;
+}
+
+static int write_snapshot(const CacheBuffer *b) {
+    AvahiCacheSnapshotHeader *h;
+
+    assert(b);
+    assert(map);
+
+    /* Grow before taking the lock, readers with a smaller mapping
+     * are not affected by this */
+    if (grow_file(sizeof(AvahiCacheSnapshotHeader) + b->size) < 0)
+        return -1;
+
+    h = (AvahiCacheSnapshotHeader*) map;
+
+    h->sequence++;
+    assert(h->sequence & 1);
+    __sync_synchronize();
+
+    if (b->size > 0)
+        memcpy(map + sizeof(AvahiCacheSnapshotHeader), b->data, b->size);
+
+    h->n_records = b->n_records;
+    h->size = b->size;
+    h->timestamp = (int64_t) time(NULL);
+
+    __sync_synchronize();
+    h->sequence++;
+
+    return 0;
+}
+
+void cache_snapshot_update(void) {
+    unsigned serial = 0;
+
+    if (!map)
+        return;
+
+    if (avahi_server == last_server &&
+        (!avahi_server || avahi_server_get_cache_serial(avahi_server) == last_serial))
+        return;
+
+    buffer.size = 0;
+    buffer.n_records = 0;
+
+    if (avahi_server) {
+        if (cache_buffer_append_caches(&buffer, avahi_server, 0) < 0)
+            return;
+
+        serial = avahi_server_get_cache_serial(avahi_server);
+    }
+
+    /* Only remember what has been written, so that a failed write is
+     * retried on the next tick */
+    if (write_snapshot(&buffer) < 0)
+        return;
+
+    last_serial = serial;
+    last_server = avahi_server;
+}
+
+static void timeout_callback(AvahiTimeout *t, AVAHI_GCC_UNUSED void *userdata) {
+    struct timeval tv;
+
+    assert(t == timeout);
+
+    cache_snapshot_update();
+
+    avahi_elapse_time(&tv, SNAPSHOT_INTERVAL_MSEC, 0);
+    poll_api->timeout_update(t, &tv);
+}
+
+int cache_snapshot_setup(const AvahiPoll *api) {
+    AvahiCacheSnapshotHeader *h;
+    struct timeval tv;
+    char tmp[] = AVAHI_CACHE_SNAPSHOT".XXXXXX";
+    int tmp_created = 0;
+
+    assert(api);
+    assert(fd < 0);
+
+    poll_api = api;
+
+    /* Set up the new file next to the old one and move it into place
+     * only when it is complete. Clients that still have the old file
+     * mapped keep seeing it unchanged instead of a truncated one. */
+    if ((fd = mkstemp(tmp)) < 0) {
+        avahi_log_warn("Failed to create cache snapshot file "AVAHI_CACHE_SNAPSHOT": %s", strerror(errno));
+        goto fail;
+    }
+
+    tmp_created = 1;
+
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        avahi_log_warn("fcntl() failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    /* Don't depend on the umask, the file is supposed to be world
+     * readable */
+    fchmod(fd, 0644);
+
+    if (grow_file(SNAPSHOT_SIZE_STEP) < 0)
+        goto fail;
+
+    h = (AvahiCacheSnapshotHeader*) map;
+    memset(h, 0, sizeof(AvahiCacheSnapshotHeader));
+    h->version = AVAHI_CACHE_SNAPSHOT_VERSION;
+    h->timestamp = (int64_t) time(NULL);
+
+    /* Readers check the magic first, hence set it last */
+    __sync_synchronize();
+    h->magic = AVAHI_CACHE_SNAPSHOT_MAGIC;
+
+    if (rename(tmp, AVAHI_CACHE_SNAPSHOT) < 0) {
+        avahi_log_warn("Failed to create cache snapshot file "AVAHI_CACHE_SNAPSHOT": %s", strerror(errno));
+        goto fail;
+    }
+
+    tmp_created = 0;
+    last_server = NULL;
+
+    avahi_elapse_time(&tv, SNAPSHOT_INTERVAL_MSEC, 0);
+    if (!(timeout = poll_api->timeout_new(poll_api, &tv, timeout_callback, NULL))) {
+        avahi_log_error(__FILE__": Failed to create timeout");
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (tmp_created) {
+        unlink(tmp);
+
+        /* Don't remove a snapshot file we never replaced */
+        if (map) {
+            munmap(map, map_size);
+            map = NULL;
+            map_size = 0;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    cache_snapshot_shutdown();
+    return -1;
+}
+
+void cache_snapshot_shutdown(void) {
+
+    if (timeout) {
+        poll_api->timeout_free(timeout);
+        timeout = NULL;
+    }
+
+    if (map) {
+        munmap(map, map_size);
+        map = NULL;
+        map_size = 0;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+
+#ifdef ENABLE_CHROOT
+        avahi_chroot_helper_unlink(AVAHI_CACHE_SNAPSHOT);
+#else
+        unlink(AVAHI_CACHE_SNAPSHOT);
+#endif
+    }
+
+    cache_buffer_free(&buffer);
+
+    last_server = NULL;
+}
@@ -0,0 +1,292 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/domain.h>
+#include <avahi-common/cache-snapshot-format.h>
+#include <avahi-core/log.h>
+
+#include "main.h"
+#include "cache-buffer.h"
+#include "cache-state.h"
+
+/* The state file uses the same format as the cache snapshot, but it
+ * is private to the daemon, written less often and survives
+ * restarts. */
+
+/* How often we save the caches if they changed */
+#define STATE_INTERVAL_MSEC 30000
+
+/* Don't read state files bigger than this */
+#define STATE_SIZE_MAX (16*1024*1024)
+
+static const AvahiPoll *poll_api = NULL;
+static AvahiTimeout *timeout = NULL;
+static int fd = -1;
+
+/* The state read on startup, until it's fed into the caches */
+static uint8_t *saved = NULL;
+static size_t saved_size = 0;
+
+static AvahiServer *last_server = NULL;
+static unsigned last_serial = 0;
+
+static void save(int force) {
+    CacheBuffer b;
+    AvahiCacheSnapshotHeader *h;
+    ssize_t n;
+
+    if (fd < 0 || !avahi_server)
+        return;
+
+    /* Don't overwrite the old state before we restored it */
+    if (saved)
+        return;
+
+    if (!force &&
+        avahi_server == last_server &&
+        avahi_server_get_cache_serial(avahi_server) == last_serial)
+        return;
+
+    memset(&b, 0, sizeof(b));
+
+    if (cache_buffer_reserve(&b, sizeof(AvahiCacheSnapshotHeader)) < 0) {
+        avahi_log_error(__FILE__": Out of memory");
+        return;
+    }
+
+    b.size = sizeof(AvahiCacheSnapshotHeader);
+
+    /* Our own records are registered again by whoever owns them */
+    if (cache_buffer_append_caches(&b, avahi_server, 1) < 0)
+        goto finish;
+
+    h = (AvahiCacheSnapshotHeader*) b.data;
+    memset(h, 0, sizeof(AvahiCacheSnapshotHeader));
+    h->magic = AVAHI_CACHE_SNAPSHOT_MAGIC;
+    h->version = AVAHI_CACHE_SNAPSHOT_VERSION;
+    h->n_records = b.n_records;
+    h->size = b.size - sizeof(AvahiCacheSnapshotHeader);
+    h->timestamp = (int64_t) time(NULL);
+
+    /* A partially written file is detected by its size not matching
+     * the header when we read it back */
+    if (ftruncate(fd, 0) < 0 ||
+        (n = pwrite(fd, b.data, b.size, 0)) < 0) {
+        avahi_log_warn("Failed to save cache state: %s", strerror(errno));
+        goto finish;
+    }
+
+    if ((size_t) n != b.size) {
+        avahi_log_warn("Failed to save cache state: short write");
+        goto finish;
+    }
+
+    last_server = avahi_server;
+    last_serial = avahi_server_get_cache_serial(avahi_server);
+
+finish:
+    cache_buffer_free(&b);
+}
+
+static void timeout_callback(AvahiTimeout *t, AVAHI_GCC_UNUSED void *userdata) {
+    struct timeval tv;
+
+    assert(t == timeout);
+
+    save(0);
+
+    avahi_elapse_time(&tv, STATE_INTERVAL_MSEC, 0);
+    poll_api->timeout_update(t, &tv);
+}
+
+static int load(void) {
+    struct stat st;
+    const AvahiCacheSnapshotHeader *h;
+    ssize_t n;
+
+    assert(fd >= 0);
+
+    if (fstat(fd, &st) < 0) {
+        avahi_log_warn("stat() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (st.st_size == 0)
+        return 0;
+
+    if (st.st_size < (off_t) sizeof(AvahiCacheSnapshotHeader) || st.st_size > STATE_SIZE_MAX)
+        goto invalid;
+
+    if (!(saved = avahi_new(uint8_t, st.st_size))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return -1;
+    }
+
+    if ((n = pread(fd, saved, (size_t) st.st_size, 0)) != st.st_size)
+        goto invalid;
+
+    h = (const AvahiCacheSnapshotHeader*) saved;
+
+    if (h->magic != AVAHI_CACHE_SNAPSHOT_MAGIC ||
+        h->version != AVAHI_CACHE_SNAPSHOT_VERSION ||
+        h->size != (uint64_t) st.st_size - sizeof(AvahiCacheSnapshotHeader))
+        goto invalid;
+
+    saved_size = (size_t) st.st_size;
+    return 0;
+
+invalid:
+    avahi_log_warn("Ignoring invalid cache state file "AVAHI_CACHE_STATE".");
+
+    avahi_free(saved);
+    saved = NULL;
+    saved_size = 0;
+
+    return -1;
+}
+
+void cache_state_restore(void) {
+    const AvahiCacheSnapshotHeader *h;
+    const uint8_t *p, *end;
+    time_t now;
+    int64_t age;
+    unsigned n_restored = 0;
+
+    if (!saved)
+        return;
+
+    if (!avahi_server)
+        goto finish;
+
+    h = (const AvahiCacheSnapshotHeader*) saved;
+    p = saved + sizeof(AvahiCacheSnapshotHeader);
+    end = saved + saved_size;
+
+    now = time(NULL);
+    if ((age = (int64_t) now - h->timestamp) < 0)
+        age = 0;
+
+    while ((size_t) (end - p) >= sizeof(AvahiCacheSnapshotEntry)) {
+        const AvahiCacheSnapshotEntry *e = (const AvahiCacheSnapshotEntry*) p;
+        const char *name;
+        size_t l;
+        AvahiKey *k;
+        AvahiRecord *r;
+
+        l = AVAHI_CACHE_SNAPSHOT_ENTRY_SIZE(e->name_size, e->rdata_size);
+        if (e->name_size < 1 || l > (size_t) (end - p))
+            break;
+
+        p += l;
+
+        name = (const char*) (e + 1);
+
+        if (name[e->name_size-1] != 0 ||
+            (int64_t) e->ttl <= age ||
+            !avahi_is_valid_domain_name(name))
+            continue;
+
+        if (!(k = avahi_key_new(name, e->clazz, e->type)))
+            continue;
+
+        r = avahi_record_new(k, e->ttl - (uint32_t) age);
+        avahi_key_unref(k);
+
+        if (!r)
+            continue;
+
+        if (avahi_rdata_parse(r, (const uint8_t*) name + e->name_size, e->rdata_size) >= 0 &&
+            avahi_server_restore_cache_record(avahi_server, e->interface, e->protocol, r) >= 0)
+            n_restored++;
+
+        avahi_record_unref(r);
+    }
+
+    avahi_log_info("Restored %u cache entries, verifying.", n_restored);
+
+finish:
+    avahi_free(saved);
+    saved = NULL;
+    saved_size = 0;
+}
+
+int cache_state_setup(const AvahiPoll *api) {
+    struct timeval tv;
+
+    assert(api);
+    assert(fd < 0);
+
+    poll_api = api;
+
+    if ((fd = open(AVAHI_CACHE_STATE, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0600)) < 0) {
+        avahi_log_warn("Failed to open cache state file "AVAHI_CACHE_STATE": %s", strerror(errno));
+        goto fail;
+    }
+
+    load();
+
+    last_server = NULL;
+
+    avahi_elapse_time(&tv, STATE_INTERVAL_MSEC, 0);
+    if (!(timeout = poll_api->timeout_new(poll_api, &tv, timeout_callback, NULL))) {
+        avahi_log_error(__FILE__": Failed to create timeout");
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    cache_state_shutdown();
+    return -1;
+}
+
+void cache_state_shutdown(void) {
+
+    save(1);
+
+    if (timeout) {
+        poll_api->timeout_free(timeout);
+        timeout = NULL;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+
+    avahi_free(saved);
+    saved = NULL;
+    saved_size = 0;
+
+    last_server = NULL;
+}
@@ -56,6 +56,7 @@ enum {
 #endif
     AVAHI_CHROOT_UNLINK_PID,
     AVAHI_CHROOT_UNLINK_SOCKET,
+    AVAHI_CHROOT_UNLINK_CACHE_SNAPSHOT,
     AVAHI_CHROOT_MAX
 };
 
@@ -74,6 +75,7 @@ static const char* const get_file_name_table[AVAHI_CHROOT_MAX] = {
     AVAHI_DBUS_INTROSPECTION_DIR"/org.freedesktop.Avahi.ServiceTypeBrowser.xml",
     AVAHI_DBUS_INTROSPECTION_DIR"/org.freedesktop.Avahi.RecordBrowser.xml",
 #endif
+    NULL,
     NULL,
     NULL
 };
@@ -94,7 +96,8 @@ static const char *const unlink_file_name_table[AVAHI_CHROOT_MAX] = {
     NULL,
 #endif
     AVAHI_DAEMON_RUNTIME_DIR"/pid",
-    AVAHI_SOCKET
+    AVAHI_SOCKET,
+    AVAHI_CACHE_SNAPSHOT
 };
 
 static int helper_fd = -1;
@@ -261,6 +264,7 @@ static int helper_main(int fd) {
             }
 
             case AVAHI_CHROOT_UNLINK_SOCKET:
+            case AVAHI_CHROOT_UNLINK_CACHE_SNAPSHOT:
             case AVAHI_CHROOT_UNLINK_PID: {
                 uint8_t c = AVAHI_CHROOT_SUCCESS;
 
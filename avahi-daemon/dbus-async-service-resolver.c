@@ -71,7 +71,8 @@ void avahi_dbus_async_service_resolver_callback(
     assert(r);
     assert(i);
 
-    reply = dbus_message_new_signal(i->path, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER, avahi_dbus_map_resolve_signal_name(event));
+    reply = dbus_message_new_signal(i->path, AVAHI_DBUS_INTERFACE_SERVICE_RESOLVER,
+                                    event == AVAHI_RESOLVER_FOUND && i->txt_data ? "FoundTxtData" : avahi_dbus_map_resolve_signal_name(event));
 
     if (!reply) {
         avahi_log_error("Failed allocate message");
@@ -119,7 +120,20 @@ void avahi_dbus_async_service_resolver_callback(
             DBUS_TYPE_UINT16, &port,
             DBUS_TYPE_INVALID);
 
-        avahi_dbus_append_string_list(reply, txt);
+        if (i->txt_data) {
+            const uint8_t *data;
+            size_t size;
+
+            /* Pass the record's wire format on as it is instead of
+             * serializing txt again */
+            data = avahi_s_service_resolver_get_txt_data(r, &size);
+
+            if (avahi_dbus_append_txt_data(reply, data, size) < 0) {
+                dbus_message_unref(reply);
+                return;
+            }
+        } else
+            avahi_dbus_append_string_list(reply, txt);
 
         dbus_message_append_args(
             reply,
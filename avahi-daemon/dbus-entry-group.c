@@ -163,12 +163,14 @@ DBusHandlerResult avahi_dbus_msg_entry_group_impl(DBusConnection *c, DBusMessage
         state = avahi_s_entry_group_get_state(i->entry_group);
         return avahi_dbus_respond_int32(c, m, (int32_t) state);
 
-    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "AddService")) {
+    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "AddService") ||
+               dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "AddServiceTxtData")) {
         int32_t interface, protocol;
         uint32_t flags;
         char *type, *name, *domain, *host;
         uint16_t port;
         AvahiStringList *strlst = NULL;
+        int txt_data = dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "AddServiceTxtData");
 
         if (!dbus_message_get_args(
                 m, &error,
@@ -182,8 +184,8 @@ DBusHandlerResult avahi_dbus_msg_entry_group_impl(DBusConnection *c, DBusMessage
                 DBUS_TYPE_UINT16, &port,
                 DBUS_TYPE_INVALID) ||
             !type || !name ||
-            avahi_dbus_read_strlst(m, 8, &strlst) < 0) {
-            avahi_log_warn("Error parsing EntryGroup::AddService message");
+            (txt_data ? avahi_dbus_read_txt_data(m, 8, &strlst) : avahi_dbus_read_strlst(m, 8, &strlst)) < 0) {
+            avahi_log_warn("Error parsing EntryGroup::%s message", dbus_message_get_member(m));
             goto fail;
         }
 
@@ -244,11 +246,13 @@ DBusHandlerResult avahi_dbus_msg_entry_group_impl(DBusConnection *c, DBusMessage
 
         return avahi_dbus_respond_ok(c, m);
 
-    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "UpdateServiceTxt")) {
+    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "UpdateServiceTxt") ||
+               dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "UpdateServiceTxtData")) {
         int32_t interface, protocol;
         uint32_t flags;
         char *type, *name, *domain;
         AvahiStringList *strlst;
+        int txt_data = dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_ENTRY_GROUP, "UpdateServiceTxtData");
 
         if (!dbus_message_get_args(
                 m, &error,
@@ -260,8 +264,8 @@ DBusHandlerResult avahi_dbus_msg_entry_group_impl(DBusConnection *c, DBusMessage
                 DBUS_TYPE_STRING, &domain,
                 DBUS_TYPE_INVALID) ||
             !type || !name ||
-            avahi_dbus_read_strlst(m, 6, &strlst)) {
-            avahi_log_warn("Error parsing EntryGroup::UpdateServiceTxt message");
+            (txt_data ? avahi_dbus_read_txt_data(m, 6, &strlst) : avahi_dbus_read_strlst(m, 6, &strlst)) < 0) {
+            avahi_log_warn("Error parsing EntryGroup::%s message", dbus_message_get_member(m));
             goto fail;
         }
 
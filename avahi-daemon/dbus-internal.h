@@ -133,6 +133,9 @@ struct AsyncServiceResolverInfo {
     AvahiSServiceResolver *service_resolver;
     char *path;
 
+    /* Send FoundTxtData instead of Found */
+    int txt_data;
+
     AVAHI_LLIST_FIELDS(AsyncServiceResolverInfo, async_service_resolvers);
 };
 
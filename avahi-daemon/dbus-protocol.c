@@ -340,6 +340,47 @@ static DBusHandlerResult msg_server_impl(DBusConnection *c, DBusMessage *m, AVAH
 
         return avahi_dbus_respond_uint32(c, m, avahi_server_get_local_service_cookie(avahi_server));
 
+    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "GetServerInfo")) {
+        DBusMessage *reply;
+        const char *version, *host_name, *host_name_fqdn, *domain_name;
+        uint32_t api_version, cookie;
+        int32_t state;
+
+        if (!(dbus_message_get_args(m, &error, DBUS_TYPE_INVALID))) {
+            avahi_log_warn("Error parsing Server::GetServerInfo message");
+            goto fail;
+        }
+
+        /* Everything a client asks for when connecting, in one reply */
+        api_version = AVAHI_DBUS_API_VERSION;
+        version = PACKAGE_STRING;
+        host_name = avahi_server_get_host_name(avahi_server);
+        host_name_fqdn = avahi_server_get_host_name_fqdn(avahi_server);
+        domain_name = avahi_server_get_domain_name(avahi_server);
+        state = (int32_t) avahi_server_get_state(avahi_server);
+        cookie = avahi_server_get_local_service_cookie(avahi_server);
+
+        if (!(reply = dbus_message_new_method_return(m))) {
+            avahi_log_error("Failed allocate message");
+            return DBUS_HANDLER_RESULT_NEED_MEMORY;
+        }
+
+        dbus_message_append_args(
+            reply,
+            DBUS_TYPE_UINT32, &api_version,
+            DBUS_TYPE_STRING, &version,
+            DBUS_TYPE_STRING, &host_name,
+            DBUS_TYPE_STRING, &host_name_fqdn,
+            DBUS_TYPE_STRING, &domain_name,
+            DBUS_TYPE_INT32, &state,
+            DBUS_TYPE_UINT32, &cookie,
+            DBUS_TYPE_INVALID);
+
+        dbus_connection_send(c, reply, NULL);
+        dbus_message_unref(reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+
     } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "GetNetworkInterfaceNameByIndex")) {
         int32_t idx;
         char name[IF_NAMESIZE];
@@ -761,7 +802,8 @@ static DBusHandlerResult msg_server_impl(DBusConnection *c, DBusMessage *m, AVAH
 
         return DBUS_HANDLER_RESULT_HANDLED;
 
-    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "ServiceResolverNew")) {
+    } else if (dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "ServiceResolverNew") ||
+               dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "ServiceResolverNewTxtData")) {
         Client *client;
         int32_t interface, protocol, aprotocol;
         uint32_t flags;
@@ -786,7 +828,7 @@ static DBusHandlerResult msg_server_impl(DBusConnection *c, DBusMessage *m, AVAH
                 DBUS_TYPE_INT32, &aprotocol,
                 DBUS_TYPE_UINT32, &flags,
                 DBUS_TYPE_INVALID) || !type) {
-            avahi_log_warn("Error parsing Server::ServiceResolverNew message");
+            avahi_log_warn("Error parsing Server::%s message", dbus_message_get_member(m));
             goto fail;
         }
 
@@ -810,6 +852,7 @@ static DBusHandlerResult msg_server_impl(DBusConnection *c, DBusMessage *m, AVAH
         i->id = ++client->current_id;
         i->client = client;
         i->path = NULL;
+        i->txt_data = dbus_message_is_method_call(m, AVAHI_DBUS_INTERFACE_SERVER, "ServiceResolverNewTxtData");
         AVAHI_LLIST_PREPEND(AsyncServiceResolverInfo, async_service_resolvers, client->async_service_resolvers, i);
         client->n_objects++;
 
@@ -315,6 +315,25 @@ void avahi_dbus_append_string_list(DBusMessage *reply, AvahiStringList *txt) {
     dbus_message_iter_close_container(&iter, &sub);
 }
 
+/* Appends TXT data in DNS wire format as one byte array, which is
+ * much cheaper to marshal and demarshal than an array per item. data
+ * may be NULL for no TXT data at all. */
+int avahi_dbus_append_txt_data(DBusMessage *reply, const uint8_t *data, size_t size) {
+    static const uint8_t empty = 0;
+
+    assert(reply);
+
+    if (!data) {
+        data = &empty;
+        size = 0;
+    }
+
+    return dbus_message_append_args(
+        reply,
+        DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &data, (int) size,
+        DBUS_TYPE_INVALID) ? 0 : -1;
+}
+
 int avahi_dbus_read_rdata(DBusMessage *m, int idx, void **rdata, uint32_t *size) {
     DBusMessageIter iter, sub;
     int n, j;
@@ -405,6 +424,56 @@ fail:
     return -1;
 }
 
+int avahi_dbus_read_txt_data(DBusMessage *m, int idx, AvahiStringList **l) {
+    void *data;
+    uint32_t size;
+    const uint8_t *c;
+    AvahiStringList *strlst = NULL;
+
+    assert(m);
+    assert(l);
+
+    /* The data is parsed right out of the message buffer */
+    if (avahi_dbus_read_rdata(m, idx, &data, &size) < 0)
+        goto fail;
+
+    c = data;
+
+    /* A single empty string is the empty TXT record */
+    if (size == 1 && c[0] == 0)
+        size = 0;
+
+    /* Unlike avahi_string_list_parse() this keeps empty items, so that
+     * they are rejected just like when passed by avahi_dbus_read_strlst() */
+    while (size > 0) {
+        AvahiStringList *n;
+        size_t k;
+
+        k = *(c++);
+        size--;
+
+        if (k > size)
+            goto fail;
+
+        if (!(n = avahi_string_list_add_arbitrary(strlst, c, k)))
+            goto fail;
+
+        strlst = n;
+        c += k;
+        size -= (uint32_t) k;
+    }
+
+    *l = strlst;
+    return 0;
+
+fail:
+    avahi_log_warn("Error parsing TXT data");
+
+    avahi_string_list_free(strlst);
+    *l = NULL;
+    return -1;
+}
+
 int avahi_dbus_is_our_own_service(Client *c, AvahiIfIndex interface, AvahiProtocol protocol, const char *name, const char *type, const char *domain) {
     AvahiSEntryGroup *g;
 
@@ -37,6 +37,7 @@
 #endif
 #include <stdio.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <time.h>
 #include <stdlib.h>
 #include <sys/time.h>
@@ -63,6 +64,8 @@
 #include <avahi-common/error.h>
 #include <avahi-common/alternative.h>
 #include <avahi-common/domain.h>
+#include <avahi-common/strlst.h>
+#include <avahi-common/timeval.h>
 
 #include <avahi-core/core.h>
 #include <avahi-core/publish.h>
@@ -78,6 +81,8 @@
 #include "setproctitle.h"
 #include "main.h"
 #include "simple-protocol.h"
+#include "cache-snapshot.h"
+#include "cache-state.h"
 #include "static-services.h"
 #include "static-hosts.h"
 #include "ini-file-parser.h"
@@ -120,6 +125,9 @@ typedef struct {
     int use_chroot;
 #endif
     int modify_proc_title;
+    int enable_cache_snapshot;
+    int enable_cache_state;
+    int enable_service_cache;
 
     int disable_user_service_publishing;
     int publish_resolv_conf;
@@ -726,6 +734,26 @@ static int load_config_file(DaemonConfig *c) {
 
                     c->server_config.ratelimit_burst = k;
 
+                } else if (strcasecmp(p->key, "source-ratelimit-rate") == 0) {
+                    unsigned k;
+
+                    if (parse_unsigned(p->value, &k) < 0) {
+                        avahi_log_error("Invalid source-ratelimit-rate setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.source_ratelimit_rate = k;
+
+                } else if (strcasecmp(p->key, "source-ratelimit-burst") == 0) {
+                    unsigned k;
+
+                    if (parse_unsigned(p->value, &k) < 0) {
+                        avahi_log_error("Invalid source-ratelimit-burst setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.source_ratelimit_burst = k;
+
                 } else if (strcasecmp(p->key, "cache-entries-max") == 0) {
                     unsigned k;
 
@@ -735,6 +763,21 @@ static int load_config_file(DaemonConfig *c) {
                     }
 
                     c->server_config.n_cache_entries_max = k;
+                } else if (strcasecmp(p->key, "parse-threads") == 0) {
+                    unsigned k;
+
+                    if (parse_unsigned(p->value, &k) < 0 || k > 64) {
+                        avahi_log_error("Invalid parse-threads setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.n_parse_threads = k;
+                } else if (strcasecmp(p->key, "enable-cache-snapshot") == 0) {
+                    c->enable_cache_snapshot = is_yes(p->value);
+                } else if (strcasecmp(p->key, "enable-persistent-cache") == 0) {
+                    c->enable_cache_state = is_yes(p->value);
+                } else if (strcasecmp(p->key, "enable-service-cache") == 0) {
+                    c->enable_service_cache = is_yes(p->value);
 #ifdef HAVE_DBUS
                 } else if (strcasecmp(p->key, "clients-max") == 0) {
                     unsigned k;
@@ -798,6 +841,8 @@ static int load_config_file(DaemonConfig *c) {
                     c->server_config.publish_a_on_ipv6 = is_yes(p->value);
                 else if (strcasecmp(p->key, "publish-aaaa-on-ipv4") == 0)
                     c->server_config.publish_aaaa_on_ipv4 = is_yes(p->value);
+                else if (strcasecmp(p->key, "group-probing") == 0)
+                    c->server_config.group_probing = is_yes(p->value);
                 else {
                     avahi_log_error("Invalid configuration key \"%s\" in group \"%s\"\n", p->key, g->name);
                     goto finish;
@@ -911,23 +956,25 @@ static void dump(const char *text, AVAHI_GCC_UNUSED void* userdata) {
 #ifdef HAVE_INOTIFY
 
 static int inotify_fd = -1;
+static int inotify_services_wd = -1, inotify_config_wd = -1;
 
 static void add_inotify_watches(void) {
     int c = 0;
-    /* We ignore the return values, because one or more of these files
-     * might not exist and we're OK with that. In addition we never
-     * want to remove these watches, hence we keep their ids? */
+    /* We ignore failures, because one or more of these files might
+     * not exist and we're OK with that. We keep the ids however, to
+     * tell which directory an event refers to. Adding a watch again
+     * returns the same id. */
 
 #ifdef ENABLE_CHROOT
     c = config.use_chroot;
 #endif
 
-    inotify_add_watch(inotify_fd, c ? "/services" : AVAHI_SERVICE_DIR, IN_CLOSE_WRITE|IN_DELETE|IN_DELETE_SELF|IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF
+    inotify_services_wd = inotify_add_watch(inotify_fd, c ? "/services" : AVAHI_SERVICE_DIR, IN_CLOSE_WRITE|IN_DELETE|IN_DELETE_SELF|IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF
 #ifdef IN_ONLYDIR
                       |IN_ONLYDIR
 #endif
     );
-    inotify_add_watch(inotify_fd, c ? "/" : AVAHI_CONFIG_DIR, IN_CLOSE_WRITE|IN_DELETE|IN_DELETE_SELF|IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF
+    inotify_config_wd = inotify_add_watch(inotify_fd, c ? "/" : AVAHI_CONFIG_DIR, IN_CLOSE_WRITE|IN_DELETE|IN_DELETE_SELF|IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF
 #ifdef IN_ONLYDIR
                       |IN_ONLYDIR
 #endif
@@ -983,8 +1030,136 @@ static void add_kqueue_watch(const char *dir) {
 
 #endif
 
+#if defined(HAVE_INOTIFY) || defined(HAVE_KQUEUE)
+
+/* File changes come in bursts, e.g. when a package or a configuration
+ * management tool installs lots of service files at once. Hence we
+ * wait until things settle down before reloading, but not forever, and
+ * then only reload what actually changed. */
+
+#define RELOAD_SETTLE_MSEC 500
+#define RELOAD_DELAY_MAX_MSEC 5000
+
+enum {
+    RELOAD_SERVICES = 1, /* Rescan the whole services directory */
+    RELOAD_HOSTS = 2
+};
+
+static unsigned reload_pending = 0;
+static AvahiStringList *reload_service_files = NULL;
+static int reload_scheduled = 0;
+static struct timeval reload_deadline;
+static AvahiTimeout *reload_timeout = NULL;
+
+static void reload_files(void);
+
+static void reload_timeout_callback(AVAHI_GCC_UNUSED AvahiTimeout *t, AVAHI_GCC_UNUSED void *userdata) {
+    reload_files();
+}
+
+static void cancel_reload(void) {
+    reload_pending = 0;
+    avahi_string_list_free(reload_service_files);
+    reload_service_files = NULL;
+    reload_scheduled = 0;
+
+    if (reload_timeout)
+        avahi_simple_poll_get(simple_poll_api)->timeout_update(reload_timeout, NULL);
+}
+
+/* Queues a reload of what, and of the single service file name if
+ * non-NULL */
+static void schedule_reload(unsigned what, const char *service_file) {
+    const AvahiPoll *poll_api;
+    struct timeval tv;
+
+    reload_pending |= what;
+
+    if (reload_pending & RELOAD_SERVICES) {
+        avahi_string_list_free(reload_service_files);
+        reload_service_files = NULL;
+
+    } else if (service_file) {
+        AvahiStringList *l;
+
+        for (l = reload_service_files; l; l = l->next)
+            if (strcmp((char*) l->text, service_file) == 0)
+                break;
+
+        if (!l)
+            reload_service_files = avahi_string_list_add(reload_service_files, service_file);
+    }
+
+    poll_api = avahi_simple_poll_get(simple_poll_api);
+
+    if (!reload_scheduled) {
+        avahi_elapse_time(&reload_deadline, RELOAD_DELAY_MAX_MSEC, 0);
+        reload_scheduled = 1;
+    }
+
+    avahi_elapse_time(&tv, RELOAD_SETTLE_MSEC, 0);
+
+    if (avahi_timeval_compare(&tv, &reload_deadline) > 0)
+        tv = reload_deadline;
+
+    if (reload_timeout)
+        poll_api->timeout_update(reload_timeout, &tv);
+    else if (!(reload_timeout = poll_api->timeout_new(poll_api, &tv, reload_timeout_callback, NULL))) {
+        avahi_log_error("Failed to create reload timeout, reloading right away.");
+        reload_files();
+    }
+}
+
+static void reload_files(void) {
+    unsigned what = reload_pending;
+    AvahiStringList *files = reload_service_files, *l;
+    int c = 0;
+
+    reload_pending = 0;
+    reload_service_files = NULL;
+    reload_scheduled = 0;
+
+#ifdef ENABLE_CHROOT
+    c = config.use_chroot;
+#endif
+
+    avahi_log_info("Files changed, reloading.");
+
+#ifdef HAVE_INOTIFY
+    /* Refresh in case the config dirs have been removed */
+    add_inotify_watches();
+#endif
+
+#ifdef HAVE_KQUEUE
+    add_kqueue_watches();
+#endif
+
+    if (what & RELOAD_SERVICES)
+        static_service_load(c);
+    else
+        for (l = files; l; l = l->next)
+            static_service_load_file(c, (char*) l->text);
+
+    if ((what & RELOAD_SERVICES) || files)
+        static_service_add_to_server();
+
+    if (what & RELOAD_HOSTS) {
+        static_hosts_load(c);
+        static_hosts_add_to_server();
+    }
+
+    avahi_string_list_free(files);
+}
+
+#endif
+
 static void reload_config(void) {
 
+#if defined(HAVE_INOTIFY) || defined(HAVE_KQUEUE)
+    /* We're going to reload everything anyway */
+    cancel_reload();
+#endif
+
 #ifdef HAVE_INOTIFY
     /* Refresh in case the config dirs have been removed */
     add_inotify_watches();
@@ -1018,8 +1193,19 @@ static void reload_config(void) {
 
 #ifdef HAVE_INOTIFY
 
+static int is_service_file_name(const char *name) {
+    size_t l;
+
+    assert(name);
+
+    l = strlen(name);
+    return l > 8 && strcmp(name + l - 8, ".service") == 0;
+}
+
 static void inotify_callback(AvahiWatch *watch, int fd, AVAHI_GCC_UNUSED AvahiWatchEvent event, AVAHI_GCC_UNUSED void *userdata) {
-    char* buffer;
+    char *buffer, *p;
+    const struct inotify_event *e;
+    ssize_t r;
     int n = 0;
 
     assert(fd == inotify_fd);
@@ -1027,18 +1213,41 @@ static void inotify_callback(AvahiWatch *watch, int fd, AVAHI_GCC_UNUSED AvahiWa
 
     ioctl(inotify_fd, FIONREAD, &n);
     if (n <= 0)
-        n = 128;
+        n = sizeof(struct inotify_event) + NAME_MAX + 1;
 
     buffer = avahi_malloc(n);
-    if (read(inotify_fd, buffer, n) < 0 ) {
+    if ((r = read(inotify_fd, buffer, n)) < 0 ) {
         avahi_free(buffer);
         avahi_log_error("Failed to read inotify event: %s", avahi_strerror(errno));
         return;
     }
-    avahi_free(buffer);
 
-    avahi_log_info("Files changed, reloading.");
-    reload_config();
+    for (p = buffer; p + sizeof(struct inotify_event) <= buffer + r; p += sizeof(struct inotify_event) + e->len) {
+        e = (struct inotify_event*) p;
+
+        if (e->mask & IN_Q_OVERFLOW)
+            /* We lost track, so reload everything */
+            schedule_reload(RELOAD_SERVICES|RELOAD_HOSTS, NULL);
+
+        else if (e->wd == inotify_services_wd) {
+
+            if (e->len <= 0 || (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED)))
+                schedule_reload(RELOAD_SERVICES, NULL);
+            else if (is_service_file_name(e->name))
+                schedule_reload(0, e->name);
+
+        } else if (e->wd == inotify_config_wd) {
+
+            if (e->len <= 0 || (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED)))
+                schedule_reload(RELOAD_SERVICES|RELOAD_HOSTS, NULL);
+            else if (strcmp(e->name, "hosts") == 0)
+                schedule_reload(RELOAD_HOSTS, NULL);
+            else if (strcmp(e->name, "services") == 0)
+                schedule_reload(RELOAD_SERVICES, NULL);
+        }
+    }
+
+    avahi_free(buffer);
 }
 
 #endif
@@ -1055,13 +1264,11 @@ static void kqueue_callback(AvahiWatch *watch, int fd, AVAHI_GCC_UNUSED AvahiWat
 
     res = kevent(kq, NULL, 0, &ev, 1, &nullts);
 
-    if (res > 0) {
-        /* Sleep for a half-second to avoid potential races
-         * during install/uninstall. */
-        usleep(500000);
-        avahi_log_info("Files changed, reloading.");
-        reload_config();
-    } else {
+    if (res > 0)
+        /* kqueue doesn't tell us which file changed, but waiting for
+         * things to settle avoids races during install/uninstall */
+        schedule_reload(RELOAD_SERVICES|RELOAD_HOSTS, NULL);
+    else {
         avahi_log_error("Failed to read kqueue event: %s", avahi_strerror(errno));
     }
 }
@@ -1163,6 +1370,15 @@ static int run_server(DaemonConfig *c) {
     if (simple_protocol_setup(poll_api) < 0)
         goto finish;
 
+    if (c->enable_cache_snapshot)
+        cache_snapshot_setup(poll_api);
+
+    if (c->enable_cache_state)
+        cache_state_setup(poll_api);
+
+    if (c->enable_service_cache)
+        static_service_cache_setup();
+
 #ifdef HAVE_DBUS
     if (c->enable_dbus) {
         if (dbus_protocol_setup(poll_api,
@@ -1244,6 +1460,8 @@ static int run_server(DaemonConfig *c) {
         goto finish;
     }
 
+    cache_state_restore();
+
     update_wide_area_servers();
     update_browse_domains();
 
@@ -1270,6 +1488,11 @@ static int run_server(DaemonConfig *c) {
 
 finish:
 
+    /* Save the caches before we unregister our own records, so that
+     * we can still tell which records are ours */
+    cache_state_shutdown();
+    static_service_cache_shutdown();
+
     static_service_remove_from_server();
     static_service_free_all();
 
@@ -1278,6 +1501,7 @@ finish:
 
     remove_dns_server_entry_groups();
 
+    cache_snapshot_shutdown();
     simple_protocol_shutdown();
 
 #ifdef HAVE_DBUS
@@ -1285,6 +1509,15 @@ finish:
         dbus_protocol_shutdown();
 #endif
 
+#if defined(HAVE_INOTIFY) || defined(HAVE_KQUEUE)
+    cancel_reload();
+
+    if (reload_timeout) {
+        poll_api->timeout_free(reload_timeout);
+        reload_timeout = NULL;
+    }
+#endif
+
     if (avahi_server) {
         avahi_server_free(avahi_server);
         avahi_server = NULL;
@@ -1520,6 +1753,9 @@ int main(int argc, char *argv[]) {
     config.use_chroot = 1;
 #endif
     config.modify_proc_title = 1;
+    config.enable_cache_snapshot = 1;
+    config.enable_cache_state = 1;
+    config.enable_service_cache = 0;
 
     config.disable_user_service_publishing = 0;
     config.publish_dns_servers = NULL;
@@ -28,16 +28,24 @@
 #include <avahi-common/llist.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
+#include <avahi-common/domain.h>
 #include <avahi-core/log.h>
 #include <avahi-core/publish.h>
+#include <avahi-core/hashmap.h>
 
 #include "main.h"
 #include "static-hosts.h"
 
+/* Static hosts are published in shared entry groups of at most this
+ * many hosts, so that large hosts files don't need one entry group per
+ * line */
+#define STATIC_HOSTS_PER_GROUP 64
+
 typedef struct StaticHost StaticHost;
+typedef struct StaticHostGroup StaticHostGroup;
 
 struct StaticHost {
-    AvahiSEntryGroup *group;
+    StaticHostGroup *group;
     int iteration;
 
     char *host;
@@ -46,32 +54,175 @@ struct StaticHost {
     AVAHI_LLIST_FIELDS(StaticHost, hosts);
 };
 
-static AVAHI_LLIST_HEAD(StaticHost, hosts) = NULL;
+struct StaticHostGroup {
+    AvahiSEntryGroup *entry_group;
+
+    /* Set if hosts have been removed, in which case the remaining ones
+     * need to be published again */
+    int dirty;
+
+    unsigned n_hosts;
+    AVAHI_LLIST_HEAD(StaticHost, hosts);
+
+    AVAHI_LLIST_FIELDS(StaticHostGroup, groups);
+};
+
+static AVAHI_LLIST_HEAD(StaticHostGroup, groups) = NULL;
+
+/* The group new hosts are added to, if it hasn't been published yet */
+static StaticHostGroup *filling_group = NULL;
+
+/* All hosts, indexed by name and address */
+static AvahiHashmap *hosts_by_key = NULL;
+
 static int current_iteration = 0;
 
-static void add_static_host_to_server(StaticHost *h);
-static void remove_static_host_from_server(StaticHost *h);
+static void add_static_host_group_to_server(StaticHostGroup *g);
+
+static unsigned static_host_hash(const void *data) {
+    const StaticHost *h = data;
+    const uint8_t *p;
+    unsigned hash, n;
+
+    assert(h);
+
+    hash = avahi_string_hash(h->host);
+
+    if (h->address.proto == AVAHI_PROTO_INET) {
+        p = (const uint8_t*) &h->address.data.ipv4;
+        n = sizeof(h->address.data.ipv4);
+    } else {
+        p = h->address.data.ipv6.address;
+        n = sizeof(h->address.data.ipv6.address);
+    }
+
+    for (; n > 0; n--, p++)
+        hash = 31 * hash + *p;
+
+    return hash;
+}
+
+static int static_host_equal(const void *a, const void *b) {
+    const StaticHost *x = a, *y = b;
+
+    return strcmp(x->host, y->host) == 0 && avahi_address_cmp(&x->address, &y->address) == 0;
+}
+
+static StaticHostGroup *static_host_group_new(void) {
+    StaticHostGroup *g;
+
+    if (!(g = avahi_new(StaticHostGroup, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    g->entry_group = NULL;
+    g->dirty = 0;
+    g->n_hosts = 0;
+
+    AVAHI_LLIST_HEAD_INIT(StaticHost, g->hosts);
+    AVAHI_LLIST_PREPEND(StaticHostGroup, groups, groups, g);
+
+    return g;
+}
+
+static void static_host_group_free(StaticHostGroup *g) {
+    assert(g);
+    assert(!g->hosts);
+
+    if (g == filling_group)
+        filling_group = NULL;
+
+    AVAHI_LLIST_REMOVE(StaticHostGroup, groups, groups, g);
+
+    if (g->entry_group)
+        avahi_s_entry_group_free(g->entry_group);
+
+    avahi_free(g);
+}
+
+static void static_host_group_add(StaticHostGroup *g, StaticHost *h) {
+    assert(g);
+    assert(h);
+    assert(!h->group);
+
+    h->group = g;
+    g->n_hosts++;
+    AVAHI_LLIST_PREPEND(StaticHost, hosts, g->hosts, h);
+}
+
+static void static_host_group_remove(StaticHost *h) {
+    StaticHostGroup *g;
+
+    assert(h);
+    assert(h->group);
+
+    g = h->group;
+
+    AVAHI_LLIST_REMOVE(StaticHost, hosts, g->hosts, h);
+    g->n_hosts--;
+    g->dirty = 1;
+    h->group = NULL;
+}
 
 static void entry_group_callback(AvahiServer *s, AVAHI_GCC_UNUSED AvahiSEntryGroup *eg, AvahiEntryGroupState state, void* userdata) {
-    StaticHost *h;
+    StaticHostGroup *g;
 
     assert(s);
     assert(eg);
 
-    h = userdata;
+    g = userdata;
+
+    if (!g->hosts)
+        return;
 
     switch (state) {
 
         case AVAHI_ENTRY_GROUP_COLLISION:
-            avahi_log_error("Host name conflict for \"%s\", not established.", h->host);
+
+            if (g->n_hosts > 1) {
+                StaticHost *h;
+
+                /* We don't know which host collided, so publish every
+                 * one of them on its own, to let the others succeed */
+                avahi_log_warn("Host name conflict in a group of %u static host names, publishing them separately.", g->n_hosts);
+
+                avahi_s_entry_group_reset(g->entry_group);
+
+                while (g->hosts->hosts_next) {
+                    StaticHostGroup *n;
+
+                    h = g->hosts->hosts_next;
+
+                    if (!(n = static_host_group_new()))
+                        break;
+
+                    static_host_group_remove(h);
+                    static_host_group_add(n, h);
+
+                    add_static_host_group_to_server(n);
+                }
+
+                g->dirty = 1;
+                add_static_host_group_to_server(g);
+
+            } else
+                avahi_log_error("Host name conflict for \"%s\", not established.", g->hosts->host);
+
             break;
 
         case AVAHI_ENTRY_GROUP_ESTABLISHED:
-            avahi_log_notice ("Static host name \"%s\" successfully established.", h->host);
+            if (g->n_hosts > 1)
+                avahi_log_notice ("%u static host names successfully established.", g->n_hosts);
+            else
+                avahi_log_notice ("Static host name \"%s\" successfully established.", g->hosts->host);
             break;
 
         case AVAHI_ENTRY_GROUP_FAILURE:
-            avahi_log_notice ("Failed to establish static host name \"%s\": %s.", h->host, avahi_strerror (avahi_server_errno (s)));
+            if (g->n_hosts > 1)
+                avahi_log_notice ("Failed to establish %u static host names: %s.", g->n_hosts, avahi_strerror (avahi_server_errno (s)));
+            else
+                avahi_log_notice ("Failed to establish static host name \"%s\": %s.", g->hosts->host, avahi_strerror (avahi_server_errno (s)));
             break;
 
         case AVAHI_ENTRY_GROUP_UNCOMMITED:
@@ -80,97 +231,141 @@ static void entry_group_callback(AvahiServer *s, AVAHI_GCC_UNUSED AvahiSEntryGro
     }
 }
 
-static StaticHost *static_host_new(void) {
-    StaticHost *s;
+static StaticHost *static_host_new(char *host, const AvahiAddress *a) {
+    StaticHost *h;
+
+    assert(host);
+    assert(a);
+
+    if (!hosts_by_key)
+        if (!(hosts_by_key = avahi_hashmap_new(static_host_hash, static_host_equal, NULL, NULL)))
+            goto oom;
 
-    s = avahi_new(StaticHost, 1);
+    /* New hosts never join a group that has been published already,
+     * since that would mean publishing its hosts again */
+    if (!filling_group || filling_group->n_hosts >= STATIC_HOSTS_PER_GROUP)
+        if (!(filling_group = static_host_group_new()))
+            return NULL;
 
-    s->group = NULL;
-    s->host = NULL;
-    s->iteration = current_iteration;
+    if (!(h = avahi_new(StaticHost, 1)))
+        goto oom;
 
-    AVAHI_LLIST_PREPEND(StaticHost, hosts, hosts, s);
+    h->group = NULL;
+    h->host = host;
+    h->address = *a;
+    h->iteration = current_iteration;
 
-    return s;
+    if (avahi_hashmap_insert(hosts_by_key, h, h) < 0) {
+        avahi_free(h);
+        goto oom;
+    }
+
+    static_host_group_add(filling_group, h);
+
+    return h;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+    return NULL;
 }
 
-static void static_host_free(StaticHost *s) {
-    assert(s);
+static void static_host_free(StaticHost *h) {
+    StaticHostGroup *g;
 
-    AVAHI_LLIST_REMOVE(StaticHost, hosts, hosts, s);
+    assert(h);
 
-    if (s->group)
-        avahi_s_entry_group_free (s->group);
+    g = h->group;
 
-    avahi_free(s->host);
+    avahi_hashmap_remove(hosts_by_key, h);
+    static_host_group_remove(h);
 
-    avahi_free(s);
+    if (!g->hosts)
+        static_host_group_free(g);
+
+    avahi_free(h->host);
+    avahi_free(h);
 }
 
 static StaticHost *static_host_find(const char *host, const AvahiAddress *a) {
-    StaticHost *h;
+    StaticHost k;
 
     assert(host);
     assert(a);
 
-    for (h = hosts; h; h = h->hosts_next)
-        if (!strcmp(h->host, host) && !avahi_address_cmp(a, &h->address))
-            return h;
+    if (!hosts_by_key)
+        return NULL;
 
-    return NULL;
+    k.host = (char*) host;
+    k.address = *a;
+
+    return avahi_hashmap_lookup(hosts_by_key, &k);
 }
 
-static void add_static_host_to_server(StaticHost *h)
-{
+static void add_static_host_group_to_server(StaticHostGroup *g) {
+    const AvahiServerConfig *config;
+    StaticHost *h;
 
-    if (!h->group)
-        if (!(h->group = avahi_s_entry_group_new (avahi_server, entry_group_callback, h))) {
+    assert(g);
+
+    if (!g->hosts)
+        return;
+
+    if (!g->entry_group)
+        if (!(g->entry_group = avahi_s_entry_group_new (avahi_server, entry_group_callback, g))) {
             avahi_log_error("avahi_s_entry_group_new() failed: %s", avahi_strerror(avahi_server_errno(avahi_server)));
             return;
         }
 
-    if (avahi_s_entry_group_is_empty(h->group)) {
+    if (g->dirty) {
+        avahi_s_entry_group_reset(g->entry_group);
+        g->dirty = 0;
+    }
+
+    if (!avahi_s_entry_group_is_empty(g->entry_group))
+        /* Already published */
+        return;
+
+    /* No more hosts for this one */
+    if (g == filling_group)
+        filling_group = NULL;
+
+    config = avahi_server_get_config(avahi_server);
+
+    for (h = g->hosts; h; h = h->hosts_next) {
         AvahiProtocol p;
         int err;
-        const AvahiServerConfig *config;
-        config = avahi_server_get_config(avahi_server);
 
         p = (h->address.proto == AVAHI_PROTO_INET && config->publish_a_on_ipv6) ||
             (h->address.proto == AVAHI_PROTO_INET6 && config->publish_aaaa_on_ipv4) ? AVAHI_PROTO_UNSPEC : h->address.proto;
 
-        if ((err = avahi_server_add_address(avahi_server, h->group, AVAHI_IF_UNSPEC, p, 0, h->host, &h->address)) < 0) {
+        if ((err = avahi_server_add_address(avahi_server, g->entry_group, AVAHI_IF_UNSPEC, p, 0, h->host, &h->address)) < 0)
             avahi_log_error ("Static host name %s: avahi_server_add_address failure: %s", h->host, avahi_strerror(err));
-            return;
-        }
-
-        avahi_s_entry_group_commit (h->group);
     }
-}
 
-static void remove_static_host_from_server(StaticHost *h)
-{
-    if (h->group)
-        avahi_s_entry_group_reset (h->group);
+    if (!avahi_s_entry_group_is_empty(g->entry_group))
+        avahi_s_entry_group_commit (g->entry_group);
 }
 
 void static_hosts_add_to_server(void) {
-    StaticHost *h;
+    StaticHostGroup *g;
 
-    for (h = hosts; h; h = h->hosts_next)
-        add_static_host_to_server(h);
+    for (g = groups; g; g = g->groups_next)
+        add_static_host_group_to_server(g);
 }
 
 void static_hosts_remove_from_server(void) {
-    StaticHost *h;
+    StaticHostGroup *g;
 
-    for (h = hosts; h; h = h->hosts_next)
-        remove_static_host_from_server(h);
+    for (g = groups; g; g = g->groups_next)
+        if (g->entry_group)
+            avahi_s_entry_group_reset(g->entry_group);
 }
 
 void static_hosts_load(int in_chroot) {
     FILE *f;
     unsigned int line = 0;
     StaticHost *h, *next;
+    StaticHostGroup *g, *next_group;
     const char *filename = in_chroot ? "/hosts" : AVAHI_CONFIG_DIR "/hosts";
 
     if (!(f = fopen(filename, "r"))) {
@@ -183,7 +378,7 @@ void static_hosts_load(int in_chroot) {
 
     while (!feof(f)) {
         unsigned int len;
-        char ln[256], *s;
+        char ln[AVAHI_DOMAIN_NAME_MAX + 64], *s;
         char *host, *ip;
         AvahiAddress a;
 
@@ -192,6 +387,20 @@ void static_hosts_load(int in_chroot) {
 
         line++;
 
+        if (!strchr(ln, '\n') && !feof(f)) {
+            int c;
+
+            /* Skip the rest of the line, it can't be valid anyway
+             * unless it's a comment */
+            while ((c = fgetc(f)) != EOF && c != '\n')
+                ;
+
+            if (ln[strspn(ln, " \t")] != '#') {
+                avahi_log_error("%s:%d: Line too long, ignoring.", filename, line);
+                continue;
+            }
+        }
+
         /* Find the start of the line, ignore whitespace */
         s = ln + strspn(ln, " \t");
         /* Set the end of the string to NULL */
@@ -247,9 +456,10 @@ void static_hosts_load(int in_chroot) {
         if ((h = static_host_find(host, &a)))
             avahi_free(host);
         else {
-            h = static_host_new();
-            h->host = host;
-            h->address = a;
+            if (!(h = static_host_new(host, &a))) {
+                avahi_free(host);
+                continue;
+            }
 
             avahi_log_info("Loading new static hostname %s.", h->host);
         }
@@ -257,12 +467,17 @@ void static_hosts_load(int in_chroot) {
         h->iteration = current_iteration;
     }
 
-    for (h = hosts; h; h = next) {
-        next = h->hosts_next;
+    for (g = groups; g; g = next_group) {
+        next_group = g->groups_next;
+
+        /* This might free g */
+        for (h = g->hosts; h; h = next) {
+            next = h->hosts_next;
 
-        if (h->iteration != current_iteration) {
-            avahi_log_info("Static hostname %s vanished, removing.", h->host);
-            static_host_free(h);
+            if (h->iteration != current_iteration) {
+                avahi_log_info("Static hostname %s vanished, removing.", h->host);
+                static_host_free(h);
+            }
         }
     }
 
@@ -273,6 +488,20 @@ fail:
 
 void static_hosts_free_all (void)
 {
-    while(hosts)
-        static_host_free(hosts);
+    while (groups) {
+        StaticHostGroup *g = groups;
+        unsigned n = g->n_hosts;
+
+        if (n == 0)
+            static_host_group_free(g);
+        else
+            /* The last host takes the group with it */
+            for (; n > 0; n--)
+                static_host_free(g->hosts);
+    }
+
+    if (hosts_by_key) {
+        avahi_hashmap_free(hosts_by_key);
+        hosts_by_key = NULL;
+    }
 }
@@ -45,8 +45,10 @@
 #include <avahi-common/domain.h>
 #include <avahi-core/log.h>
 #include <avahi-core/publish.h>
+#include <avahi-core/hashmap.h>
 
 #include "main.h"
+#include "cache-buffer.h"
 #include "static-services.h"
 
 typedef struct StaticService StaticService;
@@ -71,6 +73,8 @@ struct StaticService {
 struct StaticServiceGroup {
     char *filename;
     time_t mtime;
+    off_t size;
+    ino_t inode;
 
     char *name, *chosen_name;
     int replace_wildcards;
@@ -82,6 +86,14 @@ struct StaticServiceGroup {
 
 static AVAHI_LLIST_HEAD(StaticServiceGroup, groups) = NULL;
 
+/* The parsed service files, as read from AVAHI_SERVICE_CACHE on
+ * startup, indexed by file name, and whether it needs to be written
+ * again */
+static int cache_fd = -1;
+static uint8_t *cache_data = NULL;
+static AvahiHashmap *cache_files = NULL;
+static int cache_dirty = 0;
+
 static char *replacestr(const char *pattern, const char *a, const char *b) {
     char *r = NULL, *e, *n;
 
@@ -139,6 +151,8 @@ static StaticServiceGroup *static_service_group_new(char *filename) {
     g = avahi_new(StaticServiceGroup, 1);
     g->filename = avahi_strdup(filename);
     g->mtime = 0;
+    g->size = 0;
+    g->inode = 0;
     g->name = g->chosen_name = NULL;
     g->replace_wildcards = 0;
     g->entry_group = NULL;
@@ -167,6 +181,8 @@ static void static_service_free(StaticService *s) {
 static void static_service_group_free(StaticServiceGroup *g) {
     assert(g);
 
+    cache_dirty = 1;
+
     if (g->entry_group)
         avahi_s_entry_group_free(g->entry_group);
 
@@ -760,6 +776,461 @@ static void XMLCALL xml_cdata(void *data, const XML_Char *s, int len) {
     }
 }
 
+/* The service cache is a private file in the runtime directory which
+ * holds all service groups we loaded in a binary form, so that we
+ * don't need to parse the XML files again on the next start if they
+ * didn't change. It's written in native byte order and thrown away if
+ * anything about it looks wrong. */
+
+#define SERVICE_CACHE_MAGIC 0x43535641U /* "AVSC" */
+#define SERVICE_CACHE_VERSION 1
+
+/* Don't read cache files bigger than this */
+#define SERVICE_CACHE_SIZE_MAX (64*1024*1024)
+
+/* Marks a NULL string */
+#define SERVICE_CACHE_NULL 0xFFFF
+
+typedef struct ServiceCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; /* of everything after the header */
+} ServiceCacheHeader;
+
+/* Followed by the NUL terminated file name and the data */
+typedef struct ServiceCacheFile {
+    int64_t mtime;
+    int64_t size;
+    uint64_t inode;
+    uint32_t data_size;
+    uint16_t filename_size;
+    uint16_t reserved;
+} ServiceCacheFile;
+
+/* Remembers the first error, so that the serializers below needn't
+ * check every single call */
+typedef struct ServiceCacheWriter {
+    CacheBuffer buffer;
+    int failed;
+} ServiceCacheWriter;
+
+static uint8_t *service_cache_put(ServiceCacheWriter *b, const void *p, size_t l) {
+    uint8_t *d;
+
+    assert(b);
+
+    if (b->failed)
+        return NULL;
+
+    if (cache_buffer_reserve(&b->buffer, l) < 0) {
+        avahi_log_error(__FILE__": Out of memory");
+        b->failed = 1;
+        return NULL;
+    }
+
+    d = b->buffer.data + b->buffer.size;
+
+    if (p)
+        memcpy(d, p, l);
+
+    b->buffer.size += l;
+    return d;
+}
+
+static void service_cache_put_uint16(ServiceCacheWriter *b, uint16_t v) {
+    service_cache_put(b, &v, sizeof(v));
+}
+
+static void service_cache_put_uint32(ServiceCacheWriter *b, uint32_t v) {
+    service_cache_put(b, &v, sizeof(v));
+}
+
+static void service_cache_put_data(ServiceCacheWriter *b, const void *p, size_t l) {
+
+    if (l >= SERVICE_CACHE_NULL) {
+        b->failed = 1;
+        return;
+    }
+
+    service_cache_put_uint16(b, (uint16_t) l);
+    service_cache_put(b, p, l);
+}
+
+static void service_cache_put_string(ServiceCacheWriter *b, const char *s) {
+
+    if (!s)
+        service_cache_put_uint16(b, SERVICE_CACHE_NULL);
+    else
+        service_cache_put_data(b, s, strlen(s));
+}
+
+static void service_cache_put_string_list(ServiceCacheWriter *b, AvahiStringList *l) {
+    service_cache_put_uint32(b, avahi_string_list_length(l));
+
+    for (; l; l = l->next)
+        service_cache_put_data(b, l->text, l->size);
+}
+
+static void cache_serialize_group(ServiceCacheWriter *b, StaticServiceGroup *g) {
+    StaticService *s;
+    uint32_t n = 0;
+
+    service_cache_put_string(b, g->name);
+    service_cache_put_uint32(b, (uint32_t) g->replace_wildcards);
+
+    for (s = g->services; s; s = s->services_next)
+        n++;
+
+    service_cache_put_uint32(b, n);
+
+    if (!g->services)
+        return;
+
+    /* Loading prepends the services, so store them backwards */
+    for (s = g->services; s->services_next; s = s->services_next)
+        ;
+
+    for (; s; s = s->services_prev) {
+        service_cache_put_string(b, s->type);
+        service_cache_put_string(b, s->domain_name);
+        service_cache_put_string(b, s->host_name);
+        service_cache_put_uint16(b, s->port);
+        service_cache_put_uint32(b, (uint32_t) s->protocol);
+        service_cache_put_string_list(b, s->subtypes);
+        service_cache_put_string_list(b, s->txt_records);
+    }
+}
+
+static void cache_save(void) {
+    ServiceCacheWriter b;
+    ServiceCacheHeader *h;
+    StaticServiceGroup *g;
+    ssize_t n;
+
+    memset(&b, 0, sizeof(b));
+
+    if (cache_fd < 0 || !cache_dirty)
+        goto finish;
+
+    service_cache_put(&b, NULL, sizeof(ServiceCacheHeader));
+
+    for (g = groups; g && !b.failed; g = g->groups_next) {
+        ServiceCacheFile f;
+        size_t offset, l;
+
+        /* Not loaded successfully */
+        if (!g->name)
+            continue;
+
+        l = strlen(g->filename) + 1;
+        if (l > 0xFFFF)
+            continue;
+
+        memset(&f, 0, sizeof(f));
+        f.mtime = (int64_t) g->mtime;
+        f.size = (int64_t) g->size;
+        f.inode = (uint64_t) g->inode;
+        f.filename_size = (uint16_t) l;
+
+        offset = b.buffer.size;
+        service_cache_put(&b, &f, sizeof(f));
+        service_cache_put(&b, g->filename, l);
+        cache_serialize_group(&b, g);
+
+        if (!b.failed) {
+            f.data_size = (uint32_t) (b.buffer.size - offset - sizeof(f) - l);
+            memcpy(b.buffer.data + offset, &f, sizeof(f));
+        }
+    }
+
+    if (b.failed)
+        goto finish;
+
+    h = (ServiceCacheHeader*) b.buffer.data;
+    memset(h, 0, sizeof(ServiceCacheHeader));
+    h->magic = SERVICE_CACHE_MAGIC;
+    h->version = SERVICE_CACHE_VERSION;
+    h->size = b.buffer.size - sizeof(ServiceCacheHeader);
+
+    if (ftruncate(cache_fd, 0) < 0 ||
+        (n = pwrite(cache_fd, b.buffer.data, b.buffer.size, 0)) < 0) {
+        avahi_log_warn("Failed to save service cache: %s", strerror(errno));
+        goto finish;
+    }
+
+    if ((size_t) n != b.buffer.size) {
+        avahi_log_warn("Failed to save service cache: short write");
+        goto finish;
+    }
+
+    cache_dirty = 0;
+
+finish:
+    cache_buffer_free(&b.buffer);
+
+    /* What we read on startup is stale now */
+    if (cache_files) {
+        avahi_hashmap_free(cache_files);
+        cache_files = NULL;
+    }
+
+    avahi_free(cache_data);
+    cache_data = NULL;
+}
+
+typedef struct ServiceCacheReader {
+    const uint8_t *p, *end;
+    int failed;
+} ServiceCacheReader;
+
+static const uint8_t *service_cache_get(ServiceCacheReader *r, size_t l) {
+    const uint8_t *p;
+
+    if (r->failed || (size_t) (r->end - r->p) < l) {
+        r->failed = 1;
+        return NULL;
+    }
+
+    p = r->p;
+    r->p += l;
+    return p;
+}
+
+static uint16_t service_cache_get_uint16(ServiceCacheReader *r) {
+    const uint8_t *p;
+    uint16_t v;
+
+    if (!(p = service_cache_get(r, sizeof(v))))
+        return 0;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t service_cache_get_uint32(ServiceCacheReader *r) {
+    const uint8_t *p;
+    uint32_t v;
+
+    if (!(p = service_cache_get(r, sizeof(v))))
+        return 0;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static char *service_cache_get_string(ServiceCacheReader *r) {
+    const uint8_t *p;
+    uint16_t l;
+    char *s;
+
+    if ((l = service_cache_get_uint16(r)) == SERVICE_CACHE_NULL || r->failed)
+        return NULL;
+
+    if (!(p = service_cache_get(r, l)) || memchr(p, 0, l))
+        goto fail;
+
+    if (!(s = avahi_strndup((const char*) p, l)))
+        goto fail;
+
+    return s;
+
+fail:
+    r->failed = 1;
+    return NULL;
+}
+
+static AvahiStringList *service_cache_get_string_list(ServiceCacheReader *r) {
+    AvahiStringList *l = NULL;
+    uint32_t n;
+
+    for (n = service_cache_get_uint32(r); n > 0 && !r->failed; n--) {
+        const uint8_t *p;
+        uint16_t k;
+
+        k = service_cache_get_uint16(r);
+
+        if (!(p = service_cache_get(r, k)))
+            break;
+
+        if (!(l = avahi_string_list_add_arbitrary(l, p, k))) {
+            r->failed = 1;
+            break;
+        }
+    }
+
+    if (r->failed) {
+        avahi_string_list_free(l);
+        return NULL;
+    }
+
+    return avahi_string_list_reverse(l);
+}
+
+/* Fills in g from the cache if it has it in the state the file has
+ * now. Returns 0 on success. */
+static int cache_restore_group(StaticServiceGroup *g) {
+    const uint8_t *p;
+    ServiceCacheFile f;
+    ServiceCacheReader r;
+    uint32_t n;
+
+    assert(g);
+    assert(!g->services);
+
+    if (!cache_files || !(p = avahi_hashmap_lookup(cache_files, g->filename)))
+        return -1;
+
+    memcpy(&f, p, sizeof(f));
+
+    if (f.mtime != (int64_t) g->mtime ||
+        f.size != (int64_t) g->size ||
+        f.inode != (uint64_t) g->inode)
+        return -1;
+
+    r.p = p + sizeof(f) + f.filename_size;
+    r.end = r.p + f.data_size;
+    r.failed = 0;
+
+    g->name = service_cache_get_string(&r);
+    g->replace_wildcards = (int) service_cache_get_uint32(&r);
+
+    for (n = service_cache_get_uint32(&r); n > 0 && !r.failed; n--) {
+        StaticService *s;
+
+        s = static_service_new(g);
+        s->type = service_cache_get_string(&r);
+        s->domain_name = service_cache_get_string(&r);
+        s->host_name = service_cache_get_string(&r);
+        s->port = service_cache_get_uint16(&r);
+        s->protocol = (int) service_cache_get_uint32(&r);
+        s->subtypes = service_cache_get_string_list(&r);
+        s->txt_records = service_cache_get_string_list(&r);
+
+        if (!s->type)
+            r.failed = 1;
+    }
+
+    if (r.failed || !g->name || r.p != r.end) {
+        avahi_log_warn("Invalid service cache entry for %s, ignoring.", g->filename);
+
+        while (g->services)
+            static_service_free(g->services);
+
+        avahi_free(g->name);
+        g->name = NULL;
+        g->replace_wildcards = 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void cache_load(void) {
+    struct stat st;
+    const ServiceCacheHeader *h;
+    const uint8_t *p, *end;
+
+    assert(cache_fd >= 0);
+
+    if (fstat(cache_fd, &st) < 0) {
+        avahi_log_warn("stat() failed: %s", strerror(errno));
+        return;
+    }
+
+    if (st.st_size == 0)
+        return;
+
+    if (st.st_size < (off_t) sizeof(ServiceCacheHeader) || st.st_size > SERVICE_CACHE_SIZE_MAX)
+        goto invalid;
+
+    if (!(cache_data = avahi_new(uint8_t, st.st_size)) ||
+        !(cache_files = avahi_hashmap_new(avahi_string_hash, avahi_string_equal, NULL, NULL))) {
+        avahi_log_error(__FILE__": Out of memory");
+        goto fail;
+    }
+
+    if (pread(cache_fd, cache_data, (size_t) st.st_size, 0) != st.st_size)
+        goto invalid;
+
+    h = (const ServiceCacheHeader*) cache_data;
+
+    if (h->magic != SERVICE_CACHE_MAGIC ||
+        h->version != SERVICE_CACHE_VERSION ||
+        h->size != (uint64_t) st.st_size - sizeof(ServiceCacheHeader))
+        goto invalid;
+
+    p = cache_data + sizeof(ServiceCacheHeader);
+    end = cache_data + st.st_size;
+
+    while (p < end) {
+        ServiceCacheFile f;
+        const char *filename;
+
+        if ((size_t) (end - p) < sizeof(f))
+            goto invalid;
+
+        /* The entries aren't necessarily aligned */
+        memcpy(&f, p, sizeof(f));
+
+        if (f.filename_size < 1 ||
+            (size_t) (end - p) - sizeof(f) < (size_t) f.filename_size + f.data_size)
+            goto invalid;
+
+        filename = (const char*) p + sizeof(f);
+
+        if (filename[f.filename_size-1] != 0)
+            goto invalid;
+
+        avahi_hashmap_replace(cache_files, (void*) filename, (void*) p);
+
+        p += sizeof(f) + f.filename_size + f.data_size;
+    }
+
+    return;
+
+invalid:
+    avahi_log_warn("Ignoring invalid service cache file "AVAHI_SERVICE_CACHE".");
+
+fail:
+    if (cache_files) {
+        avahi_hashmap_free(cache_files);
+        cache_files = NULL;
+    }
+
+    avahi_free(cache_data);
+    cache_data = NULL;
+}
+
+int static_service_cache_setup(void) {
+    assert(cache_fd < 0);
+
+    if ((cache_fd = open(AVAHI_SERVICE_CACHE, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0600)) < 0) {
+        avahi_log_warn("Failed to open service cache file "AVAHI_SERVICE_CACHE": %s", strerror(errno));
+        return -1;
+    }
+
+    cache_load();
+
+    return 0;
+}
+
+void static_service_cache_shutdown(void) {
+
+    if (cache_files) {
+        avahi_hashmap_free(cache_files);
+        cache_files = NULL;
+    }
+
+    avahi_free(cache_data);
+    cache_data = NULL;
+
+    if (cache_fd >= 0) {
+        close(cache_fd);
+        cache_fd = -1;
+    }
+}
+
 static int static_service_group_load(StaticServiceGroup *g) {
     XML_Parser parser = NULL;
     int fd = -1;
@@ -788,11 +1259,19 @@ static int static_service_group_load(StaticServiceGroup *g) {
     g->name = g->chosen_name = NULL;
     g->replace_wildcards = 0;
 
-    if (!(parser = XML_ParserCreate(NULL))) {
-        avahi_log_error("XML_ParserCreate() failed.");
-        goto finish;
+    if (cache_files && stat(g->filename, &st) >= 0) {
+        g->mtime = st.st_mtime;
+        g->size = st.st_size;
+        g->inode = st.st_ino;
+
+        if (cache_restore_group(g) >= 0) {
+            r = 0;
+            goto finish;
+        }
     }
 
+    cache_dirty = 1;
+
     if ((fd = open(g->filename, O_RDONLY)) < 0) {
         avahi_log_error("open(\"%s\", O_RDONLY): %s", g->filename, strerror(errno));
         goto finish;
@@ -804,6 +1283,13 @@ static int static_service_group_load(StaticServiceGroup *g) {
     }
 
     g->mtime = st.st_mtime;
+    g->size = st.st_size;
+    g->inode = st.st_ino;
+
+    if (!(parser = XML_ParserCreate(NULL))) {
+        avahi_log_error("XML_ParserCreate() failed.");
+        goto finish;
+    }
 
     XML_SetUserData(parser, &u);
 
@@ -920,6 +1406,58 @@ void static_service_load(int in_chroot) {
 
         globfree(&globbuf);
     }
+
+    cache_save();
+}
+
+void static_service_load_file(int in_chroot, const char *name) {
+    StaticServiceGroup *g;
+    struct stat st;
+    char *filename;
+    size_t l;
+
+    assert(name);
+
+    l = strlen(name);
+    if (l <= 8 || strcmp(name + l - 8, ".service") != 0 || strchr(name, '/'))
+        return;
+
+    if (!(filename = avahi_strdup_printf("%s/%s", in_chroot ? "/services" : AVAHI_SERVICE_DIR, name))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return;
+    }
+
+    for (g = groups; g; g = g->groups_next)
+        if (strcmp(g->filename, filename) == 0)
+            break;
+
+    if (stat(filename, &st) < 0) {
+
+        if (errno != ENOENT)
+            avahi_log_warn("Failed to stat() file %s, ignoring: %s", filename, strerror(errno));
+        else if (g)
+            avahi_log_info("Service group file %s vanished, removing services.", g->filename);
+
+        if (g)
+            static_service_group_free(g);
+
+    } else if (g) {
+
+        /* We know the file has been written to, so don't rely on the
+         * mtime, which might not have changed within the same second */
+        avahi_log_info("Service group file %s changed, reloading.", g->filename);
+
+        if (static_service_group_load(g) < 0) {
+            avahi_log_warn("Failed to load service group file %s, removing service.", g->filename);
+            static_service_group_free(g);
+        }
+
+    } else
+        load_file(filename);
+
+    avahi_free(filename);
+
+    cache_save();
 }
 
 void static_service_free_all(void) {
@@ -21,7 +21,17 @@
 ***/
 
 void static_service_load(int in_chroot);
+
+/* Like static_service_load(), but only looks at the single file name
+ * in the services directory, which changed or appeared or vanished */
+void static_service_load_file(int in_chroot, const char *name);
 void static_service_free_all(void);
+
+/* Keeps the parsed service files in AVAHI_SERVICE_CACHE, so that
+ * unchanged files don't need to be parsed again when the daemon is
+ * restarted. Needs to be called before chroot() */
+int static_service_cache_setup(void);
+void static_service_cache_shutdown(void);
 void static_service_add_to_server(void);
 void static_service_remove_from_server(void);
 
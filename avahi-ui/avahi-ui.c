@@ -39,9 +39,7 @@
 
 #include "avahi-ui.h"
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
 #include "../avahi-utils/stdb.h"
-#endif
 
 /* todo: i18n, HIGify */
 
@@ -427,13 +425,8 @@ static void browse_callback(
             if (d->priv->service_type_names)
                 pretty_type = g_hash_table_lookup (d->priv->service_type_names, type);
 
-            if (!pretty_type) {
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+            if (!pretty_type)
                 pretty_type = stdb_lookup(type);
-#else
-                pretty_type = type;
-#endif
-            }
 
             gtk_list_store_append(d->priv->service_list_store, &iter);
 
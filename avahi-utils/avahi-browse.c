@@ -40,22 +40,19 @@
 #include <avahi-common/i18n.h>
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
+#include <avahi-client/snapshot.h>
 
 #include "sigint.h"
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
 #include "stdb.h"
-#endif
 
 typedef enum {
     COMMAND_HELP,
     COMMAND_VERSION,
     COMMAND_BROWSE_SERVICES,
     COMMAND_BROWSE_ALL_SERVICES,
-    COMMAND_BROWSE_DOMAINS
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
-    , COMMAND_DUMP_STDB
-#endif
+    COMMAND_BROWSE_DOMAINS,
+    COMMAND_DUMP_STDB
 } Command;
 
 typedef struct Config {
@@ -69,9 +66,7 @@ typedef struct Config {
     int resolve;
     int no_fail;
     int parsable;
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
     int no_db_lookup;
-#endif
 } Config;
 
 typedef struct ServiceInfo ServiceInfo;
@@ -89,6 +84,7 @@ struct ServiceInfo {
 
 static AvahiSimplePoll *simple_poll = NULL;
 static AvahiClient *client = NULL;
+static AvahiCacheSnapshot *snapshot = NULL;
 static int n_all_for_now = 0, n_cache_exhausted = 0, n_resolving = 0;
 static AvahiStringList *browsed_types = NULL;
 static ServiceInfo *services = NULL;
@@ -154,10 +150,8 @@ static char *make_printable(const char *from, char *to) {
 static void print_service_line(Config *config, char c, AvahiIfIndex interface, AvahiProtocol protocol, const char *name, const char *type, const char *domain, int nl) {
     char ifname[IF_NAMESIZE];
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
     if (!config->no_db_lookup)
         type = stdb_lookup(type);
-#endif
 
     if (config->parsable) {
         char sn[AVAHI_DOMAIN_NAME_MAX], *e = sn;
@@ -183,6 +177,45 @@ static void print_service_line(Config *config, char c, AvahiIfIndex interface, A
     fflush(stdout);
 }
 
+static void print_resolved(
+    Config *config,
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    const char *host_name,
+    const AvahiAddress *a,
+    uint16_t port,
+    AvahiStringList *txt) {
+
+    char address[AVAHI_ADDRESS_STR_MAX], *t;
+
+    avahi_address_snprint(address, sizeof(address), a);
+
+    t = avahi_string_list_to_string(txt);
+
+    print_service_line(config, '=', interface, protocol, name, type, domain, 0);
+
+    if (config->parsable)
+        printf(";%s;%s;%u;%s\n",
+               host_name,
+               address,
+               port,
+               t);
+    else
+        printf("   hostname = [%s]\n"
+               "   address = [%s]\n"
+               "   port = [%u]\n"
+               "   txt = [%s]\n",
+               host_name,
+               address,
+               port,
+               t);
+
+    avahi_free(t);
+}
+
 static void service_resolver_callback(
     AvahiServiceResolver *r,
     AvahiIfIndex interface,
@@ -204,35 +237,9 @@ static void service_resolver_callback(
     assert(i);
 
     switch (event) {
-        case AVAHI_RESOLVER_FOUND: {
-            char address[AVAHI_ADDRESS_STR_MAX], *t;
-
-            avahi_address_snprint(address, sizeof(address), a);
-
-            t = avahi_string_list_to_string(txt);
-
-            print_service_line(i->config, '=', interface, protocol, name, type, domain, 0);
-
-            if (i->config->parsable)
-                printf(";%s;%s;%u;%s\n",
-                       host_name,
-                       address,
-                       port,
-                       t);
-            else
-                printf("   hostname = [%s]\n"
-                       "   address = [%s]\n"
-                       "   port = [%u]\n"
-                       "   txt = [%s]\n",
-                       host_name,
-                       address,
-                       port,
-                       t);
-
-            avahi_free(t);
-
+        case AVAHI_RESOLVER_FOUND:
+            print_resolved(i->config, interface, protocol, name, type, domain, host_name, a, port, txt);
             break;
-        }
 
         case AVAHI_RESOLVER_FAILURE:
 
@@ -255,7 +262,8 @@ static ServiceInfo *add_service(Config *c, AvahiIfIndex interface, AvahiProtocol
 
     i = avahi_new(ServiceInfo, 1);
 
-    if (c->resolve) {
+    /* When reading from the cache snapshot we resolve directly */
+    if (c->resolve && client) {
         if (!(i->resolver = avahi_service_resolver_new(client, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, service_resolver_callback, i))) {
             avahi_free(i);
             fprintf(stderr, _("Failed to resolve service '%s' of type '%s' in domain '%s': %s\n"), name, type, domain, avahi_strerror(avahi_client_errno(client)));
@@ -524,6 +532,100 @@ static void browse_domains(Config *c) {
     n_all_for_now++;
 }
 
+static void snapshot_resolve_callback(
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    const char *host_name,
+    const AvahiAddress *a,
+    uint16_t port,
+    AvahiStringList *txt,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    void *userdata) {
+
+    print_resolved(userdata, interface, protocol, name, type, domain, host_name, a, port, txt);
+}
+
+static void snapshot_service_callback(
+    AvahiIfIndex interface,
+    AvahiProtocol protocol,
+    const char *name,
+    const char *type,
+    const char *domain,
+    AvahiLookupResultFlags flags,
+    void *userdata) {
+
+    Config *c = userdata;
+    int r;
+
+    assert(c);
+    assert(snapshot);
+
+    if (c->ignore_local && (flags & AVAHI_LOOKUP_RESULT_LOCAL))
+        return;
+
+    if (find_service(interface, protocol, name, type, domain))
+        return;
+
+    add_service(c, interface, protocol, name, type, domain);
+
+    print_service_line(c, '+', interface, protocol, name, type, domain, 1);
+
+    if (c->resolve)
+        if ((r = avahi_cache_snapshot_resolve_service(snapshot, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, snapshot_resolve_callback, c)) < 0)
+            fprintf(stderr, _("Failed to resolve service '%s' of type '%s' in domain '%s': %s\n"), name, type, domain, avahi_strerror(r));
+}
+
+static void snapshot_browse_service_type(Config *c, const char *stype, const char *domain) {
+    AvahiStringList *i;
+    int r;
+
+    assert(c);
+    assert(snapshot);
+    assert(stype);
+
+    for (i = browsed_types; i; i = i->next)
+        if (avahi_domain_equal(stype, (char*) i->text))
+            return;
+
+    browsed_types = avahi_string_list_add(browsed_types, stype);
+
+    if ((r = avahi_cache_snapshot_foreach_service(snapshot, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, stype, domain, snapshot_service_callback, c)) < 0)
+        fprintf(stderr, _("Failed to browse the cache snapshot: %s\n"), avahi_strerror(r));
+}
+
+static void snapshot_type_callback(
+    AVAHI_GCC_UNUSED AvahiIfIndex interface,
+    AVAHI_GCC_UNUSED AvahiProtocol protocol,
+    AVAHI_GCC_UNUSED const char *name,
+    const char *type,
+    const char *domain,
+    AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
+    void *userdata) {
+
+    snapshot_browse_service_type(userdata, type, domain);
+}
+
+static void browse_snapshot(Config *config) {
+    int r;
+
+    assert(config);
+    assert(snapshot);
+
+    if (config->command == COMMAND_BROWSE_SERVICES)
+        snapshot_browse_service_type(config, config->stype, config->domain);
+    else {
+        assert(config->command == COMMAND_BROWSE_ALL_SERVICES);
+
+        if ((r = avahi_cache_snapshot_foreach_service(snapshot, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, NULL, config->domain, snapshot_type_callback, config)) < 0)
+            fprintf(stderr, _("Failed to browse the cache snapshot: %s\n"), avahi_strerror(r));
+    }
+
+    fflush(stdout);
+}
+
 static int start(Config *config) {
 
     assert(!browsing);
@@ -634,13 +736,9 @@ static void help(FILE *f, const char *argv0) {
                 "%s [options] <service type>\n"
                 "%s [options] -a\n"
                 "%s [options] -D\n"
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
                 "%s [options] -b\n"
-#endif
                 "\n",
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
                 argv0,
-#endif
                 argv0, argv0, argv0);
 
     fprintf(f, "%s%s",
@@ -656,12 +754,8 @@ static void help(FILE *f, const char *argv0) {
               "    -r --resolve         Resolve services found\n"
               "    -f --no-fail         Don't fail if the daemon is not available\n"
               "    -p --parsable        Output in parsable format\n"),
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
             _("    -k --no-db-lookup    Don't lookup service types\n"
               "    -b --dump-db         Dump service type database\n")
-#else
-            ""
-#endif
             );
 }
 
@@ -681,10 +775,8 @@ static int parse_command_line(Config *c, const char *argv0, int argc, char *argv
         { "resolve",        no_argument,       NULL, 'r' },
         { "no-fail",        no_argument,       NULL, 'f' },
         { "parsable",      no_argument,       NULL, 'p' },
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
         { "no-db-lookup",   no_argument,       NULL, 'k' },
         { "dump-db",        no_argument,       NULL, 'b' },
-#endif
         { NULL, 0, NULL, 0 }
     };
 
@@ -700,15 +792,9 @@ static int parse_command_line(Config *c, const char *argv0, int argc, char *argv
         c->parsable = 0;
     c->domain = c->stype = NULL;
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
     c->no_db_lookup = 0;
-#endif
 
-    while ((o = getopt_long(argc, argv, "hVd:avtclrDfp"
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
-                            "kb"
-#endif
-                            , long_options, NULL)) >= 0) {
+    while ((o = getopt_long(argc, argv, "hVd:avtclrDfpkb", long_options, NULL)) >= 0) {
 
         switch(o) {
             case 'h':
@@ -748,14 +834,12 @@ static int parse_command_line(Config *c, const char *argv0, int argc, char *argv
             case 'p':
                 c->parsable = 1;
                 break;
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
             case 'k':
                 c->no_db_lookup = 1;
                 break;
             case 'b':
                 c->command = COMMAND_DUMP_STDB;
                 break;
-#endif
             default:
                 return -1;
         }
@@ -817,6 +901,21 @@ int main(int argc, char *argv[]) {
         case COMMAND_BROWSE_ALL_SERVICES:
         case COMMAND_BROWSE_DOMAINS:
 
+            /* If only the cache contents are requested, read them
+             * directly from the daemon's cache snapshot, if there is
+             * one. The snapshot only covers mDNS, hence not for other
+             * domains than .local */
+            if (config.command != COMMAND_BROWSE_DOMAINS &&
+                config.terminate_on_cache_exhausted &&
+                !config.verbose &&
+                (!config.domain || avahi_domain_equal(config.domain, "local")) &&
+                (snapshot = avahi_cache_snapshot_new(NULL, NULL))) {
+
+                browse_snapshot(&config);
+                ret = 0;
+                break;
+            }
+
             if (!(simple_poll = avahi_simple_poll_new())) {
                 fprintf(stderr, _("Failed to create simple poll object.\n"));
                 goto fail;
@@ -834,7 +933,6 @@ int main(int argc, char *argv[]) {
             ret = 0;
             break;
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
         case COMMAND_DUMP_STDB: {
             char *t;
             stdb_setent();
@@ -849,7 +947,6 @@ int main(int argc, char *argv[]) {
             ret = 0;
             break;
         }
-#endif
     }
 
 
@@ -861,6 +958,9 @@ fail:
     if (client)
         avahi_client_free(client);
 
+    if (snapshot)
+        avahi_cache_snapshot_free(snapshot);
+
     sigint_uninstall();
 
     if (simple_poll)
@@ -871,9 +971,7 @@ fail:
 
     avahi_string_list_free(browsed_types);
 
-#if defined(HAVE_GDBM) || defined(HAVE_DBM)
     stdb_shutdown();
-#endif
 
     return ret;
 }
@@ -0,0 +1,192 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/benchmark.h>
+
+#include "stdb.h"
+
+#define ROUNDS 2000
+#define MAX_LINES 1024
+
+static const char * const test_locales[] = {
+    "C",
+    "de_DE.UTF-8",
+    "de_AT@euro",
+    "it_IT.UTF-8",
+    "it",
+    "fr_FR.UTF-8",
+    NULL
+};
+
+/* The plain text database, for verifying the lookup results */
+static char *keys[MAX_LINES], *values[MAX_LINES];
+static unsigned n_lines = 0;
+
+static void load_source(const char *fn) {
+    char ln[1024];
+    FILE *f;
+
+    if (!(f = fopen(fn, "r"))) {
+        fprintf(stderr, "Failed to open %s\n", fn);
+        exit(1);
+    }
+
+    while (fgets(ln, sizeof(ln), f)) {
+        char *k, *v, *e;
+
+        k = ln + strspn(ln, " \t");
+        k[strcspn(k, "\r\n")] = 0;
+
+        if (!*k || *k == '#' || !(v = strchr(k, ':')))
+            continue;
+
+        *(v++) = 0;
+
+        for (e = k + strlen(k); e > k && (e[-1] == ' ' || e[-1] == '\t'); e--)
+            e[-1] = 0;
+        v += strspn(v, " \t");
+        for (e = v + strlen(v); e > v && (e[-1] == ' ' || e[-1] == '\t'); e--)
+            e[-1] = 0;
+
+        assert(n_lines < MAX_LINES);
+        keys[n_lines] = avahi_strdup(k);
+        values[n_lines] = avahi_strdup(v);
+        n_lines++;
+    }
+
+    fclose(f);
+}
+
+static const char *source_fetch(const char *k) {
+    unsigned i;
+
+    for (i = 0; i < n_lines; i++)
+        if (strcmp(keys[i], k) == 0)
+            return values[i];
+
+    return NULL;
+}
+
+/* The lookup algorithm of the original gdbm backend */
+static const char *source_lookup(const char *name, const char *loc) {
+    char k[256], l[32], *e;
+    const char *v;
+
+    snprintf(k, sizeof(k), "%s[%s]", name, loc);
+    if ((v = source_fetch(k)))
+        return v;
+
+    snprintf(l, sizeof(l), "%s", loc);
+
+    if ((e = strchr(l, '@'))) {
+        *e = 0;
+        snprintf(k, sizeof(k), "%s[%s]", name, l);
+        if ((v = source_fetch(k)))
+            return v;
+    }
+
+    if ((e = strchr(l, '_'))) {
+        *e = 0;
+        snprintf(k, sizeof(k), "%s[%s]", name, l);
+        if ((v = source_fetch(k)))
+            return v;
+    }
+
+    if ((v = source_fetch(name)))
+        return v;
+
+    return name;
+}
+
+int main(int argc, char *argv[]) {
+    const char * const *loc;
+    char **types = NULL, *t;
+    unsigned n_types = 0, n_allocated = 0, i, r;
+
+    load_source(argc > 1 ? argv[1] : SERVICE_TYPES_FILE);
+
+    stdb_setent();
+    while ((t = stdb_getent())) {
+        if (n_types >= n_allocated) {
+            n_allocated = n_allocated ? n_allocated*2 : 64;
+            types = avahi_realloc(types, n_allocated * sizeof(char*));
+        }
+
+        types[n_types++] = avahi_strdup(t);
+    }
+
+    if (n_types == 0) {
+        fprintf(stderr, "Service type database not available.\n");
+        return 1;
+    }
+
+    /* Make sure we enumerate exactly the untranslated types */
+    for (i = 0, r = 0; i < n_lines; i++)
+        if (!strchr(keys[i], '['))
+            r++;
+    assert(r == n_types);
+
+    for (loc = test_locales; *loc; loc++) {
+        struct timeval start;
+        char what[64];
+
+        for (i = 0; i < n_types; i++)
+            assert(strcmp(stdb_lookup_locale(types[i], *loc), source_lookup(types[i], *loc)) == 0);
+
+        assert(strcmp(stdb_lookup_locale("_nonexistent._tcp", *loc), "_nonexistent._tcp") == 0);
+
+        gettimeofday(&start, NULL);
+
+        for (r = 0; r < ROUNDS; r++)
+            for (i = 0; i < n_types; i++)
+                stdb_lookup_locale(types[i], *loc);
+
+        snprintf(what, sizeof(what), "%-12s lookups", *loc);
+        avahi_benchmark_report(&start, what, ROUNDS * n_types);
+    }
+
+    assert(strcmp(stdb_lookup_locale("_http._tcp", "de_DE.UTF-8"), "Web-Angebot") == 0);
+    assert(strcmp(stdb_lookup_locale("_http._tcp", "it_IT@euro"), "Sito Web") == 0);
+    assert(strcmp(stdb_lookup_locale("_smb._tcp", "de_DE"), source_fetch("_smb._tcp")) == 0);
+
+    for (i = 0; i < n_types; i++)
+        avahi_free(types[i]);
+    avahi_free(types);
+
+    for (i = 0; i < n_lines; i++) {
+        avahi_free(keys[i]);
+        avahi_free(values[i]);
+    }
+
+    stdb_shutdown();
+
+    return 0;
+}
@@ -23,8 +23,12 @@
 #endif
 #ifdef HAVE_DBM
 #include <ndbm.h>
-#include <fcntl.h>
 #endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <locale.h>
@@ -34,6 +38,32 @@
 
 #include "stdb.h"
 
+/* The compiled database as written by
+ * service-type-database/build-stdb. All integers are 32 bit little
+ * endian. The header is followed by the locale table, the hash seeds
+ * for each bucket and the entries, each consisting of the offset of
+ * the type name followed by the offset of its resolved description
+ * for every locale in the locale table. The locale fallback chain
+ * has already been followed when the file was generated, hence a
+ * lookup is a single probe into the entry table. */
+
+#define STDB_MAGIC "STDB"
+#define STDB_VERSION 1
+#define STDB_HEADER_SIZE (9*4)
+
+static const uint8_t *stdb_map = NULL;
+static size_t stdb_map_size = 0;
+static uint32_t n_locales = 0, n_entries = 0, n_buckets = 0;
+static const uint8_t *locales = NULL, *buckets = NULL, *entries = NULL;
+
+/* The locale the last lookup was done for and its index in the
+ * locale table */
+static char *cached_locale = NULL;
+static uint32_t cached_locale_index = 0;
+
+static uint32_t enum_index = 0;
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
 #ifdef HAVE_GDBM
 static GDBM_FILE gdbm_file = NULL;
 #endif
@@ -42,8 +72,177 @@ static DBM *dbm_file = NULL;
 #endif
 static char *buffer = NULL;
 static char *enum_key = NULL;
+#endif
 
-static int init(void) {
+static uint32_t read_uint32(const uint8_t *p) {
+    return
+        (uint32_t) p[0] |
+        ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) |
+        ((uint32_t) p[3] << 24);
+}
+
+static uint32_t stdb_hash(uint32_t seed, const char *s) {
+    uint32_t h = 0x811c9dc5U ^ seed;
+
+    for (; *s; s++) {
+        h ^= (uint8_t) *s;
+        h *= 0x01000193U;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static const char *get_string(uint32_t offset) {
+
+    /* The file ends in a NUL byte, which has been verified when
+     * opening it, hence this is always properly terminated */
+    if (offset < STDB_HEADER_SIZE || offset >= stdb_map_size)
+        return NULL;
+
+    return (const char*) stdb_map + offset;
+}
+
+static int table_valid(uint32_t offset, uint32_t n, uint32_t width) {
+    return
+        offset >= STDB_HEADER_SIZE &&
+        offset <= stdb_map_size &&
+        (uint64_t) n * width * 4 <= stdb_map_size - offset;
+}
+
+static int stdb_open(void) {
+    struct stat st;
+    const uint8_t *m;
+    int fd;
+
+    if ((fd = open(STDB_HASH_FILE, O_RDONLY|O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 ||
+        st.st_size < STDB_HEADER_SIZE + 1 ||
+        (m = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    stdb_map = m;
+    stdb_map_size = (size_t) st.st_size;
+
+    if (memcmp(m, STDB_MAGIC, 4) != 0 ||
+        read_uint32(m + 4) != STDB_VERSION ||
+        read_uint32(m + 32) != stdb_map_size ||
+        m[stdb_map_size-1] != 0)
+        goto fail;
+
+    n_locales = read_uint32(m + 8);
+    n_entries = read_uint32(m + 12);
+    n_buckets = read_uint32(m + 16);
+
+    if (n_locales < 1 || n_entries < 1 || n_buckets < 1 ||
+        !table_valid(read_uint32(m + 20), n_locales, 1) ||
+        !table_valid(read_uint32(m + 24), n_buckets, 1) ||
+        !table_valid(read_uint32(m + 28), n_entries, 1 + n_locales))
+        goto fail;
+
+    locales = m + read_uint32(m + 20);
+    buckets = m + read_uint32(m + 24);
+    entries = m + read_uint32(m + 28);
+
+    return 0;
+
+fail:
+    munmap((void*) stdb_map, stdb_map_size);
+    stdb_map = NULL;
+    stdb_map_size = 0;
+    return -1;
+}
+
+static uint32_t find_locale_index(const char *l) {
+    uint32_t i;
+
+    /* Index 0 is the untranslated entry */
+    for (i = 1; i < n_locales; i++) {
+        const char *s;
+
+        if ((s = get_string(read_uint32(locales + i*4))) && strcmp(s, l) == 0)
+            return i;
+    }
+
+    return 0;
+}
+
+static uint32_t get_locale_index(const char *loc) {
+    char l[32], *e;
+    uint32_t i;
+
+    if (!loc)
+        return 0;
+
+    if (cached_locale && strcmp(cached_locale, loc) == 0)
+        return cached_locale_index;
+
+    /* Pick the first locale of the usual fallback chain that the
+     * database knows about. The entries of that locale already
+     * include the fallbacks for the remainder of the chain. */
+    if (!(i = find_locale_index(loc))) {
+        snprintf(l, sizeof(l), "%s", loc);
+
+        if ((e = strchr(l, '@'))) {
+            *e = 0;
+            i = find_locale_index(l);
+        }
+
+        if (!i && (e = strchr(l, '_'))) {
+            *e = 0;
+            i = find_locale_index(l);
+        }
+    }
+
+    avahi_free(cached_locale);
+    cached_locale = avahi_strdup(loc);
+    cached_locale_index = i;
+
+    return i;
+}
+
+static const uint8_t *find_entry(const char *name) {
+    const uint8_t *e;
+    const char *n;
+    uint32_t seed;
+
+    seed = read_uint32(buckets + (stdb_hash(0, name) % n_buckets) * 4);
+    e = entries + (size_t) (stdb_hash(seed, name) % n_entries) * (1 + n_locales) * 4;
+
+    if (!(n = get_string(read_uint32(e))) || strcmp(n, name) != 0)
+        return NULL;
+
+    return e;
+}
+
+static const char *stdb_map_lookup(const char *name, const char *loc) {
+    const uint8_t *e;
+    const char *v;
+
+    if (!(e = find_entry(name)))
+        return name;
+
+    if (!(v = get_string(read_uint32(e + (1 + get_locale_index(loc)) * 4))))
+        return name;
+
+    return v;
+}
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+
+static int dbm_init(void) {
 
 #ifdef HAVE_GDBM
     if (gdbm_file)
@@ -63,17 +262,13 @@ static int init(void) {
     return 0;
 }
 
-const char* stdb_lookup(const char *name) {
+static const char* dbm_lookup(const char *name, const char *loc) {
     datum key, data;
-    const char *loc;
-
-    if (init() < 0)
-        goto fail;
 
     data.dptr = NULL;
     data.dsize = 0;
 
-    if ((loc = setlocale(LC_MESSAGES, NULL))) {
+    if (loc) {
         char k[256];
 
         snprintf(k, sizeof(k), "%s[%s]", name, loc);
@@ -132,45 +327,18 @@ const char* stdb_lookup(const char *name) {
     }
 
     if (!data.dptr)
-        goto fail;
+        return name;
 
     avahi_free(buffer);
     buffer = avahi_strndup(data.dptr, data.dsize);
     free(data.dptr);
 
     return buffer;
-
-fail:
-
-    return name;
-}
-
-void stdb_shutdown(void) {
-#ifdef HAVE_GDBM
-    if (gdbm_file)
-        gdbm_close(gdbm_file);
-
-    gdbm_file = NULL;
-#endif
-#ifdef HAVE_DBM
-    if (dbm_file)
-        dbm_close(dbm_file);
-
-    dbm_file = NULL;
-#endif
-
-    avahi_free(buffer);
-    avahi_free(enum_key);
-
-    buffer = enum_key = NULL;
 }
 
-char *stdb_getent(void) {
+static char *dbm_getent(void) {
     datum key;
 
-    if (init() < 0)
-        return NULL;
-
     for (;;) {
 
         if (!enum_key) {
@@ -206,7 +374,111 @@ char *stdb_getent(void) {
     }
 }
 
+#endif
+
+static int init(void) {
+
+    if (stdb_map)
+        return 0;
+
+    if (stdb_open() >= 0)
+        return 0;
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+    /* Fall back to the old database format */
+    return dbm_init();
+#else
+    return -1;
+#endif
+}
+
+const char* stdb_lookup_locale(const char *name, const char *locale) {
+
+    if (init() < 0)
+        return name;
+
+    if (stdb_map)
+        return stdb_map_lookup(name, locale);
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+    return dbm_lookup(name, locale);
+#else
+    return name;
+#endif
+}
+
+const char* stdb_lookup(const char *name) {
+    return stdb_lookup_locale(name, setlocale(LC_MESSAGES, NULL));
+}
+
+void stdb_shutdown(void) {
+    if (stdb_map)
+        munmap((void*) stdb_map, stdb_map_size);
+
+    stdb_map = NULL;
+    stdb_map_size = 0;
+    locales = buckets = entries = NULL;
+    n_locales = n_entries = n_buckets = 0;
+
+    avahi_free(cached_locale);
+    cached_locale = NULL;
+    enum_index = 0;
+
+#ifdef HAVE_GDBM
+    if (gdbm_file)
+        gdbm_close(gdbm_file);
+
+    gdbm_file = NULL;
+#endif
+#ifdef HAVE_DBM
+    if (dbm_file)
+        dbm_close(dbm_file);
+
+    dbm_file = NULL;
+#endif
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+    avahi_free(buffer);
+    avahi_free(enum_key);
+
+    buffer = enum_key = NULL;
+#endif
+}
+
+char *stdb_getent(void) {
+
+    if (init() < 0)
+        return NULL;
+
+    if (stdb_map) {
+
+        while (enum_index < n_entries) {
+            const uint8_t *e = entries + (size_t) enum_index * (1 + n_locales) * 4;
+            const char *n;
+
+            enum_index++;
+
+            /* Skip types that only have translated descriptions, like
+             * the old database format does */
+            if ((n = get_string(read_uint32(e))) && get_string(read_uint32(e + 4)))
+                return (char*) n;
+        }
+
+        return NULL;
+    }
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
+    return dbm_getent();
+#else
+    return NULL;
+#endif
+}
+
 void stdb_setent(void) {
+    enum_index = 0;
+
+#if defined(HAVE_GDBM) || defined(HAVE_DBM)
     avahi_free(enum_key);
     enum_key = NULL;
+#endif
 }
@@ -23,6 +23,11 @@
 #include <avahi-common/simple-watch.h>
 
 const char* stdb_lookup(const char *name);
+
+/* Like stdb_lookup(), but for the specified LC_MESSAGES locale
+ * instead of the current one */
+const char* stdb_lookup_locale(const char *name, const char *locale);
+
 void stdb_shutdown(void);
 char *stdb_getent(void);
 void stdb_setent(void);